@@ -71,7 +71,7 @@ int main(int argc, char **argv)
 
 	/* Count the number of pages. */
 	fz_try(ctx)
-		page_count = fz_count_pages(ctx, doc);
+		page_count = fz_count_pages_exact(ctx, doc);
 	fz_catch(ctx)
 	{
 		fprintf(stderr, "cannot count number of pages: %s\n", fz_caught_message(ctx));
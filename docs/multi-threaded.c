@@ -176,7 +176,7 @@ int main(int argc, char **argv)
 	// Retrieve the number of pages, which translates to the
 	// number of threads used for rendering pages.
 
-	threads = fz_count_pages(ctx, doc);
+	threads = fz_count_pages_exact(ctx, doc);
 	fprintf(stderr, "spawning %d threads, one per page...\n", threads);
 
 	thread = malloc(threads * sizeof (pthread_t));
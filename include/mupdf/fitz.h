@@ -16,6 +16,7 @@ extern "C" {
 #include "mupdf/fitz/math.h"
 #include "mupdf/fitz/pool.h"
 #include "mupdf/fitz/string.h"
+#include "mupdf/fitz/thread.h"
 #include "mupdf/fitz/tree.h"
 #include "mupdf/fitz/ucdn.h"
 #include "mupdf/fitz/bidi.h"
@@ -62,6 +63,7 @@ extern "C" {
 #include "mupdf/fitz/writer.h"
 #include "mupdf/fitz/output-pnm.h"
 #include "mupdf/fitz/output-png.h"
+#include "mupdf/fitz/output-jpeg.h"
 #include "mupdf/fitz/output-pwg.h"
 #include "mupdf/fitz/output-pcl.h"
 #include "mupdf/fitz/output-ps.h"
@@ -53,6 +53,15 @@ typedef struct fz_halftone_s fz_halftone;
 */
 fz_bitmap *fz_new_bitmap_from_pixmap(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht);
 
+/*
+	fz_new_bitmap_from_pixmap_band: Make a bitmap from one band of
+	a page, given as a pixmap starting band_start rows down the page.
+
+	With an error diffusion halftone the error left over from the
+	bottom of one band is carried into the next, so the bands of a
+	page must be converted in order, starting with band_start 0.
+	Such a halftone must not be used for two pages at once.
+*/
 fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht, int band_start, int bandheight);
 
 struct fz_bitmap_s
@@ -69,15 +78,44 @@ void fz_bitmap_details(fz_bitmap *bitmap, int *w, int *h, int *n, int *stride);
 
 void fz_clear_bitmap(fz_context *ctx, fz_bitmap *bit);
 
+/*
+	Halftoning methods: thresholding against a tile (the default),
+	or Floyd-Steinberg or Stucki error diffusion (serpentine, on each
+	component separately).
+*/
+enum
+{
+	FZ_HALFTONE_THRESHOLD,
+	FZ_HALFTONE_FLOYD_STEINBERG,
+	FZ_HALFTONE_STUCKI
+};
+
 struct fz_halftone_s
 {
 	int refs;
 	int n;
+	int method;
+	int next_row; /* Error diffusion state carried between bands */
+	int error_len;
+	int *errors;
 	fz_pixmap *comp[1];
 };
 
 fz_halftone *fz_new_halftone(fz_context *ctx, int num_comps);
 fz_halftone *fz_default_halftone(fz_context *ctx, int num_comps);
+
+/*
+	fz_new_error_diffusion_halftone: Create a halftone for
+	num_comps components that error diffuses with the given method
+	(FZ_HALFTONE_FLOYD_STEINBERG or FZ_HALFTONE_STUCKI).
+*/
+fz_halftone *fz_new_error_diffusion_halftone(fz_context *ctx, int num_comps, int method);
+
+/*
+	fz_halftone_method_from_name: Look up a halftoning method by
+	name ("threshold", "floyd" or "stucki"). Returns -1 if unknown.
+*/
+int fz_halftone_method_from_name(const char *name);
 void fz_drop_halftone(fz_context *ctx, fz_halftone *half);
 fz_halftone *fz_keep_halftone(fz_context *ctx, fz_halftone *half);
 
@@ -25,6 +25,7 @@ typedef struct fz_glyph_cache_s fz_glyph_cache;
 typedef struct fz_document_handler_context_s fz_document_handler_context;
 typedef struct fz_output_context_s fz_output_context;
 typedef struct fz_context_s fz_context;
+typedef struct fz_alloc_stats_s fz_alloc_stats;
 
 struct fz_alloc_context_s
 {
@@ -34,6 +35,29 @@ struct fz_alloc_context_s
 	void (*free)(void *, void *);
 };
 
+/*
+	Allocation counters, kept separately for each context (and
+	so for each thread), so they are updated without locking.
+
+	allocs, reallocs, frees: Number of calls made through
+	fz_malloc and friends, fz_resize_array and fz_free.
+
+	bytes: Total number of bytes requested.
+
+	locked: Number of allocations that took FZ_LOCK_ALLOC, either
+	because the allocator must be called under the lock or
+	because the first attempt failed and the store had to be
+	scavenged.
+*/
+struct fz_alloc_stats_s
+{
+	size_t allocs;
+	size_t reallocs;
+	size_t frees;
+	size_t bytes;
+	size_t locked;
+};
+
 struct fz_error_stack_slot_s
 {
 	int code;
@@ -125,6 +149,11 @@ struct fz_context_s
 	fz_tuning_context *tuning;
 	fz_document_handler_context *handler;
 	fz_output_context *output;
+	fz_alloc_stats alloc_stats;
+
+	/* Free fz_pool blocks kept for reuse, private to this context */
+	struct fz_pool_node_s *pool_blocks;
+	int pool_blocks_len;
 };
 
 /*
@@ -277,6 +306,23 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 */
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/*
+	fz_tune_worker_threads: Set the number of worker threads that
+	library operations with no explicit thread count of their own
+	(such as repairing a broken PDF file on opening, laying out EPUB
+	chapters, or compressing PCL and PWG output) may use.
+
+	threads: 0 or 1 to do all the work on the calling thread (the
+	default). Threads are only used if the context has locks.
+*/
+void fz_tune_worker_threads(fz_context *ctx, int threads);
+
+/*
+	fz_worker_threads: Get the number of worker threads set by
+	fz_tune_worker_threads.
+*/
+int fz_worker_threads(fz_context *ctx);
+
 /*
 	fz_aa_level: Get the number of bits of antialiasing we are
 	using (for graphics). Between 0 and 8.
@@ -309,7 +355,7 @@ void fz_set_text_aa_level(fz_context *ctx, int bits);
 
 /*
 	fz_graphics_aa_level: Get the number of bits of antialiasing we are
-	using for graphics. Between 0 and 8.
+	using for graphics. Between 0 and 8, or 9 for exact area coverage.
 */
 int fz_graphics_aa_level(fz_context *ctx);
 
@@ -318,7 +364,10 @@ int fz_graphics_aa_level(fz_context *ctx);
 	should use for graphics.
 
 	bits: The number of bits of antialiasing to use (values are clamped
-	to within the 0 to 8 range).
+	to within the 0 to 9 range). 9 selects exact area coverage: rather
+	than sampling each pixel, the area of it covered by the shape is
+	computed. This costs the same per row whatever the quality, so is
+	faster than 8 bits on complex vector art.
 */
 void fz_set_graphics_aa_level(fz_context *ctx, int bits);
 
@@ -365,6 +414,7 @@ enum {
 	FZ_LOCK_FILE, /* Unused now */
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
+	FZ_LOCK_DOCUMENT, /* Serializes object loading in shared documents */
 	FZ_LOCK_MAX
 };
 
@@ -373,8 +423,10 @@ enum {
 
 	All calls to MuPDF's allocator functions pass through to the
 	underlying allocators passed in when the initial context is
-	created, after locks are taken (using the supplied locking function)
-	to ensure that only one thread at a time calls through.
+	created. Custom allocators are called after locks are taken (using
+	the supplied locking function) to ensure that only one thread at a
+	time calls through. The default allocator (the C library's malloc,
+	which is thread safe) is called without locking.
 
 	If the underlying allocator fails, MuPDF attempts to make room for
 	the allocation by evicting elements from the store, then retrying.
@@ -466,6 +518,15 @@ char *fz_strdup(fz_context *ctx, const char *s);
 */
 void fz_free(fz_context *ctx, void *p);
 
+/*
+	fz_get_alloc_stats: Read the allocation counters of this
+	context. Clones of a context have their own counters, starting
+	from zero.
+
+	Does not throw exceptions.
+*/
+void fz_get_alloc_stats(fz_context *ctx, fz_alloc_stats *stats);
+
 /*
 	fz_malloc_no_throw: Allocate a block of memory (with scavenging)
 
@@ -557,6 +618,7 @@ struct fz_tuning_context_s
 	void *image_decode_arg;
 	fz_tune_image_scale_fn *image_scale;
 	void *image_scale_arg;
+	int worker_threads;
 };
 
 fz_tune_image_decode_fn fz_default_image_decode;
@@ -88,6 +88,7 @@ struct fz_document_s
 	fz_document_load_outline_fn *load_outline;
 	fz_document_layout_fn *layout;
 	fz_document_count_pages_fn *count_pages;
+	fz_document_count_pages_fn *count_pages_exact;
 	fz_document_load_page_fn *load_page;
 	fz_document_lookup_metadata_fn *lookup_metadata;
 	int did_layout;
@@ -215,10 +216,23 @@ void fz_layout_document(fz_context *ctx, fz_document *doc, float w, float h, flo
 /*
 	fz_count_pages: Return the number of pages in document
 
-	May return 0 for documents with no pages.
+	May return 0 for documents with no pages. Reflowable documents
+	that are laid out lazily (EPUB) return an estimate until all
+	their content has been laid out, which may change as pages are
+	loaded. Use fz_count_pages_exact to iterate over every page.
 */
 int fz_count_pages(fz_context *ctx, fz_document *doc);
 
+/*
+	fz_count_pages_exact: Return the exact number of pages in
+	document.
+
+	Reflowable documents may have to lay out all their content to
+	count their pages, which can take a while for a large book. For
+	other documents this is the same as fz_count_pages.
+*/
+int fz_count_pages_exact(fz_context *ctx, fz_document *doc);
+
 /*
 	fz_load_page: Load a page.
 
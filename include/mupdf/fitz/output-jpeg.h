@@ -0,0 +1,27 @@
+#ifndef MUPDF_FITZ_OUTPUT_JPEG_H
+#define MUPDF_FITZ_OUTPUT_JPEG_H
+
+#include "mupdf/fitz/system.h"
+#include "mupdf/fitz/context.h"
+#include "mupdf/fitz/output.h"
+#include "mupdf/fitz/pixmap.h"
+#include "mupdf/fitz/buffer.h"
+
+/*
+	fz_write_pixmap_as_jpeg: Write a pixmap to an output stream in
+	baseline JPEG format.
+
+	quality: JPEG quality from 0 to 100.
+
+	Pixmaps that are not gray or RGB are converted to RGB first.
+	JPEG has no alpha channel, so pixmaps with alpha are rejected.
+*/
+void fz_write_pixmap_as_jpeg(fz_context *ctx, fz_output *out, fz_pixmap *pixmap, int quality);
+
+/*
+	fz_new_buffer_from_pixmap_as_jpeg: Create a new buffer containing
+	the pixmap in JPEG format. See fz_write_pixmap_as_jpeg.
+*/
+fz_buffer *fz_new_buffer_from_pixmap_as_jpeg(fz_context *ctx, fz_pixmap *pixmap, int quality);
+
+#endif
@@ -68,6 +68,19 @@ int fz_packed_path_size(const fz_path *path);
 int fz_pack_path(fz_context *ctx, uint8_t *pack, int max, const fz_path *path);
 fz_path *fz_clone_path(fz_context *ctx, fz_path *path);
 
+/*
+	fz_path_coord_count: Return the number of coordinates in a path
+	(packed or not), as a cheap measure of its complexity.
+*/
+int fz_path_coord_count(fz_context *ctx, const fz_path *path);
+
+/*
+	fz_digest_path: Compute an MD5 digest of the commands and
+	coordinates of a path (packed or not), so that identical paths
+	can be recognised without holding on to them.
+*/
+void fz_digest_path(fz_context *ctx, const fz_path *path, unsigned char digest[16]);
+
 fz_point fz_currentpoint(fz_context *ctx, fz_path *path);
 void fz_moveto(fz_context*, fz_path*, float x, float y);
 void fz_lineto(fz_context*, fz_path*, float x, float y);
@@ -4,23 +4,77 @@
 #include "mupdf/fitz/system.h"
 #include "mupdf/fitz/context.h"
 
+/*
+	Simple pool allocator for structures that are built up piece
+	by piece and then freed all at once, such as html box trees and
+	structured text pages.
+
+	Allocations are carved out of blocks that start small and grow
+	to 64k. Allocations too large to share a block get a block of
+	their own. Individual allocations are never freed; dropping or
+	resetting the pool frees them all at once.
+*/
+
 typedef struct fz_pool_s fz_pool;
 typedef struct fz_pool_node_s fz_pool_node;
 
 struct fz_pool_s
 {
 	fz_pool_node *head, *tail;
+	fz_pool_node *large;
 	char *pos, *end;
+	char *last;
+	size_t block_size;
+	size_t size;
 };
 
 struct fz_pool_node_s
 {
 	fz_pool_node *next;
-	char mem[64 << 10]; /* 64k blocks */
+	size_t size;
 };
 
+/*
+	fz_new_pool: Create an empty pool. No blocks are allocated
+	until the first allocation.
+*/
 fz_pool *fz_new_pool(fz_context *ctx);
+
+/*
+	fz_pool_alloc: Allocate 'size' bytes from the pool. The memory
+	is suitably aligned for any basic type, and is cleared to zero.
+	Throws on failure.
+*/
 void *fz_pool_alloc(fz_context *ctx, fz_pool *pool, size_t size);
+
+/*
+	fz_pool_realloc: Grow (or shrink) an allocation from the pool
+	to 'new_size' bytes, returning the new location. The most recent
+	allocation is resized in place if possible; otherwise a new
+	allocation is made and the old contents copied into it. Any
+	space added on the end is cleared to zero. ptr may be NULL.
+*/
+void *fz_pool_realloc(fz_context *ctx, fz_pool *pool, void *ptr, size_t old_size, size_t new_size);
+
+/*
+	fz_pool_size: The number of bytes held by the pool, for the
+	benefit of the store.
+*/
+size_t fz_pool_size(fz_context *ctx, fz_pool *pool);
+
+/*
+	fz_pool_reset: Forget all allocations made from the pool, but
+	keep its blocks for reuse by later allocations. Blocks of large
+	allocations are freed.
+*/
+void fz_pool_reset(fz_context *ctx, fz_pool *pool);
+
 void fz_drop_pool(fz_context *ctx, fz_pool *pool);
 
+/*
+	fz_drop_pool_blocks: Free the blocks of dropped pools that the
+	context keeps for reuse. Called by fz_drop_context.
+*/
+void fz_drop_pool_blocks(fz_context *ctx);
+
 #endif
@@ -81,6 +81,13 @@ struct fz_store_hash_s
 			int id;
 			float m[4];
 		} im;
+		struct
+		{
+			unsigned char digest[16];
+			float m[4];
+			float flatness, linewidth, miterlimit;
+			unsigned char stroked, start_cap, end_cap, linejoin;
+		} fp;
 	} u;
 };
 
@@ -9,6 +9,7 @@
 #include "mupdf/fitz/image.h"
 #include "mupdf/fitz/output.h"
 #include "mupdf/fitz/device.h"
+#include "mupdf/fitz/pool.h"
 
 /*
 	Text extraction device: Used for searching, format conversion etc.
@@ -63,6 +64,7 @@ struct fz_stext_style_s
 */
 struct fz_stext_page_s
 {
+	fz_pool *pool; /* Holds the page and all its blocks, lines and spans */
 	fz_rect mediabox;
 	int len, cap;
 	fz_page_block *blocks;
@@ -214,7 +216,8 @@ void fz_drop_stext_sheet(fz_context *ctx, fz_stext_sheet *sheet);
 	fz_new_stext_page: Create an empty text page.
 
 	The text page is filled out by the text device to contain the blocks,
-	lines and spans of text on the page.
+	lines and spans of text on the page. They are all allocated from
+	page->pool, and freed together when the page is dropped.
 
 	mediabox: optional mediabox information.
 */
@@ -53,6 +53,12 @@
 #endif
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#ifndef ARCH_X86_SSE2
+#define ARCH_X86_SSE2
+#endif
+#endif
+
 /*
 	Some differences in libc can be smoothed over
 */
@@ -241,6 +247,25 @@ typedef int fz_off_t;
 #define restrict
 #endif
 
+/*
+	Publishing a pointer to other threads without a lock: the thread
+	that fills in the data stores the pointer with release ordering,
+	and readers load it with acquire ordering, so that a reader that
+	sees the pointer also sees what it points to. Use these for
+	caches that are checked before taking a lock.
+*/
+#if defined(__GNUC__) || defined(__clang__)
+#define fz_load_acquire_ptr(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define fz_store_release_ptr(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define fz_load_acquire_ptr(p) _InterlockedCompareExchangePointer((void * volatile *)&(p), NULL, NULL)
+#define fz_store_release_ptr(p, v) ((void)_InterlockedExchangePointer((void * volatile *)&(p), (v)))
+#else /* Unknown; plain accesses */
+#define fz_load_acquire_ptr(p) (p)
+#define fz_store_release_ptr(p, v) ((p) = (v))
+#endif
+
 /* noreturn is a GCC extension */
 #ifdef __GNUC__
 #define FZ_NORETURN __attribute__((noreturn))
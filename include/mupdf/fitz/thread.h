@@ -0,0 +1,47 @@
+#ifndef MUPDF_FITZ_THREAD_H
+#define MUPDF_FITZ_THREAD_H
+
+#include "mupdf/fitz/system.h"
+#include "mupdf/fitz/context.h"
+
+/*
+	Simple worker threads for splitting independent jobs across cores.
+
+	The library itself never requires threads. When it is built
+	without thread support (HAVE_PTHREADS or Windows), or when the
+	context was created without locks (so fz_clone_context fails),
+	the jobs are simply run in order on the calling thread.
+*/
+
+/*
+	fz_worker_fn: Run job number 'idx'.
+
+	ctx: A cloned context private to the calling worker thread
+	(or the original context when running serially).
+
+	arg: The opaque pointer passed to fz_run_workers.
+
+	The job may throw; the first error is rethrown (with its
+	original error code) from fz_run_workers once all workers
+	have finished.
+*/
+typedef void (fz_worker_fn)(fz_context *ctx, void *arg, int idx);
+
+/*
+	fz_run_workers: Run jobs 0..count-1, spread over up to 'threads'
+	worker threads. Jobs are handed out in order, but may complete
+	in any order. Returns when all jobs have completed.
+
+	threads: Maximum number of threads to use. 0 or 1 runs the jobs
+	serially on the calling thread.
+*/
+void fz_run_workers(fz_context *ctx, int threads, int count, fz_worker_fn *fn, void *arg);
+
+/*
+	fz_can_run_workers: Returns non-zero if fz_run_workers can
+	actually run jobs concurrently in this build and with this
+	context.
+*/
+int fz_can_run_workers(fz_context *ctx);
+
+#endif
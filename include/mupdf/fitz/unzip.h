@@ -12,8 +12,19 @@ fz_archive *fz_open_directory(fz_context *ctx, const char *dirname);
 fz_archive *fz_open_archive(fz_context *ctx, const char *filename);
 fz_archive *fz_open_archive_with_stream(fz_context *ctx, fz_stream *file);
 int fz_has_archive_entry(fz_context *ctx, fz_archive *zip, const char *name);
+int fz_archive_entry_size(fz_context *ctx, fz_archive *zip, const char *name);
 fz_stream *fz_open_archive_entry(fz_context *ctx, fz_archive *zip, const char *entry);
 fz_buffer *fz_read_archive_entry(fz_context *ctx, fz_archive *zip, const char *entry);
+
+/*
+	fz_read_archive_entries: Read a batch of entries at once.
+
+	The raw entry data is read from the archive in file order, and
+	the entries are then inflated on up to 'threads' worker threads
+	(see fz_run_workers). bufs[i] is set to the contents of entry
+	names[i], or NULL if there is no such entry.
+*/
+void fz_read_archive_entries(fz_context *ctx, fz_archive *zip, int count, const char **names, fz_buffer **bufs, int threads);
 void fz_drop_archive(fz_context *ctx, fz_archive *ar);
 
 int fz_count_archive_entries(fz_context *ctx, fz_archive *zip);
@@ -22,6 +33,12 @@ const char *fz_list_archive_entry(fz_context *ctx, fz_archive *zip, int idx);
 typedef struct fz_zip_writer_s fz_zip_writer;
 
 fz_zip_writer *fz_new_zip_writer(fz_context *ctx, const char *filename);
+
+/*
+	fz_write_zip_entry: Append the contents of 'buf' to the archive
+	as 'name'. Entries are stored uncompressed unless 'compress' is
+	set and deflating actually makes them smaller.
+*/
 void fz_write_zip_entry(fz_context *ctx, fz_zip_writer *zip, const char *name, fz_buffer *buf, int compress);
 void fz_close_zip_writer(fz_context *ctx, fz_zip_writer *zip);
 void fz_drop_zip_writer(fz_context *ctx, fz_zip_writer *zip);
@@ -226,6 +226,7 @@ struct fz_html_flow_s
 	unsigned int markup_lang : 15;
 
 	float x, y, w, h;
+	float em_w; /* shaped width in ems, or negative if not yet measured */
 	fz_html *box; /* for style and em */
 	union {
 		char *text;
@@ -261,4 +262,18 @@ void fz_layout_html(fz_context *ctx, fz_html *box, float w, float h, float em);
 void fz_draw_html(fz_context *ctx, fz_device *dev, const fz_matrix *ctm, fz_html *box, float page_top, float page_bot);
 void fz_drop_html(fz_context *ctx, fz_html *box);
 
+/*
+	fz_layout_epub_chapters: Lay out every chapter of an EPUB document
+	that has not been laid out yet, so that the page count is exact.
+
+	Chapters are parsed in turn, but laid out concurrently on up to
+	'threads' worker threads (see fz_run_workers). Does nothing for
+	documents that are not EPUB.
+
+	EPUB documents already do this, with fz_worker_threads threads,
+	whenever they are laid out or counted; this is only needed to use
+	a different number of threads.
+*/
+void fz_layout_epub_chapters(fz_context *ctx, fz_document *doc, int threads);
+
 #endif
@@ -85,6 +85,87 @@ pdf_document *pdf_open_document(fz_context *ctx, const char *filename);
 */
 pdf_document *pdf_open_document_with_stream(fz_context *ctx, fz_stream *file);
 
+/*
+	pdf_open_document_with_index: Open a PDF document, using a
+	sidecar index file to skip reading the cross reference
+	sections and walking the page tree.
+
+	The index records the resolved xref sections, their trailers
+	and the page object numbers, and is only used if the size,
+	modification time and a hash of the head and tail of the PDF
+	file still match. Otherwise the document is opened as by
+	pdf_open_document, and a new index is written (failure to
+	write it is only a warning). No index is written for
+	documents that needed repairing.
+
+	filename: a path to the PDF file.
+
+	index: a path to the sidecar index file.
+*/
+pdf_document *pdf_open_document_with_index(fz_context *ctx, const char *filename, const char *index);
+
+/*
+	pdf_save_xref_index: Write a sidecar index for a document
+	opened from 'filename', for later use by
+	pdf_open_document_with_index.
+
+	Throws if the document has been edited or repaired since it
+	was opened, as the index must describe the file on disk.
+
+	The index is written to a temporary file in the same directory
+	and renamed into place, so readers see either the old index or
+	the complete new one.
+*/
+void pdf_save_xref_index(fz_context *ctx, pdf_document *doc, const char *filename, const char *index);
+
+/*
+	pdf_enable_concurrent_reads: Prepare a document for being read
+	from several threads at once.
+
+	Afterwards, threads each using their own cloned context may
+	load, run and drop pages (and load the objects, fonts, images
+	and other resources they use) from the same document in
+	parallel. Object loading and reads from the underlying file
+	are serialized with pdf_lock_document; objects that have been
+	loaded once are shared without locking.
+
+	Editing the document, or running JavaScript, is not supported
+	while other threads are using it; anything that would create or
+	update objects throws instead. Annotations are used with the
+	appearance streams they have: none are synthesized for those
+	that lack one. A document that needs
+	repairing cannot be repaired once shared; objects that would
+	trigger a repair throw instead. Progressively loaded
+	documents cannot be shared.
+
+	Requires a context with locking functions.
+*/
+void pdf_enable_concurrent_reads(fz_context *ctx, pdf_document *doc);
+
+/*
+	pdf_enable_object_arena: Allocate the objects subsequently
+	loaded from the file out of large blocks, rather than with
+	a separate malloc for every dictionary, array, number, name
+	and string.
+
+	Such objects behave exactly as others; arrays and dictionaries
+	move their contents to the heap when they first grow. A block
+	is freed when every object in it has been dropped, so memory
+	from objects dropped early (for example by pdf_clear_xref) is
+	only returned when the rest of their block goes too.
+*/
+void pdf_enable_object_arena(fz_context *ctx, pdf_document *doc);
+
+/*
+	pdf_lock_document: Take FZ_LOCK_DOCUMENT on behalf of a
+	document. Unlike fz_lock, the same context may take it again
+	while already holding it; each call must be balanced by a
+	call to pdf_unlock_document.
+*/
+void pdf_lock_document(fz_context *ctx, pdf_document *doc);
+
+void pdf_unlock_document(fz_context *ctx, pdf_document *doc);
+
 /*
 	pdf_drop_document: Closes and frees an opened PDF document.
 
@@ -197,9 +278,21 @@ struct pdf_document_s
 	int has_xref_streams;
 
 	int page_count;
+	int page_refs_len;
+	pdf_obj **page_refs; /* Page objects in page order, if known */
+	int page_lookups; /* Page lookups since the page tree was invalidated */
+	int page_index_len;
+	int *page_index; /* Page number + 1 of each page object, by object number */
 
 	int repair_attempted;
 
+	/* Owner of FZ_LOCK_DOCUMENT, see pdf_lock_document */
+	fz_context *lock_owner;
+	int lock_depth;
+	int concurrent_reads;
+
+	pdf_obj_arena *obj_arena;
+
 	/* State indicating which file parsing method we are using */
 	int file_reading_linearly;
 	fz_off_t file_length;
@@ -267,6 +360,9 @@ struct pdf_document_s
 	fz_font **type3_fonts;
 
 	pdf_resource_tables *resources;
+
+	/* Streams copied in by pdf_graft_object, by pdf_hash_object_num */
+	fz_hash_table *graft_streams;
 };
 
 /*
@@ -401,6 +497,9 @@ struct pdf_write_options_s
 	int do_garbage; /* Garbage collect objects before saving; 1=gc, 2=re-number, 3=de-duplicate. */
 	int do_linear; /* Write linearised. */
 	int do_clean; /* Sanitize content streams. */
+	int do_subset_fonts; /* Subset embedded TrueType fonts to the glyphs used. */
+	int do_downsample_images; /* If non-zero, downsample images drawn at more than 1.5 times this resolution (dpi) to it. */
+	int threads; /* Number of worker threads to use where work can be split up. */
 	int continue_on_error; /* If set, errors are (optionally) counted and writing continues. */
 	int *errors; /* Pointer to a place to store a count of errors */
 };
@@ -414,6 +513,9 @@ struct pdf_write_options_s
 		a: ascii hex encode
 		z: deflate
 		s: sanitize content streams
+		F: subset fonts
+		D: downsample images
+		T: worker threads
 */
 pdf_write_options *pdf_parse_write_options(fz_context *ctx, pdf_write_options *opts, const char *args);
 
@@ -126,4 +126,16 @@ pdf_obj *pdf_add_cid_font(fz_context *ctx, pdf_document *doc, fz_font *font);
 
 int pdf_font_writing_supported(fz_font *font);
 
+/*
+	pdf_subset_fonts: Shrink embedded TrueType font programs to the
+	glyphs actually drawn by the pages and annotations of the
+	document, and share identical font programs between font
+	descriptors. Fonts that may be used by form fields are left
+	untouched. Glyph ids are preserved, so no content streams or
+	encodings need rewriting.
+
+	Failures are reported as warnings and leave the fonts unchanged.
+*/
+void pdf_subset_fonts(fz_context *ctx, pdf_document *doc);
+
 #endif
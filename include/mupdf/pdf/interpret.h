@@ -129,6 +129,10 @@ struct pdf_processor_s
 	/* interpreter state that persists across content streams */
 	const char *event;
 	int hidden;
+
+	/* set when other threads may be using the same document; operators
+	 * that look up resources are then run under pdf_lock_document */
+	int shared_document;
 };
 
 struct pdf_csi_s
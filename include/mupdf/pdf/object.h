@@ -32,6 +32,10 @@ pdf_obj *pdf_new_obj_from_str(fz_context *ctx, pdf_document *doc, const char *sr
 pdf_obj *pdf_keep_obj(fz_context *ctx, pdf_obj *obj);
 void pdf_drop_obj(fz_context *ctx, pdf_obj *obj);
 
+/* Block allocator for parsed objects, see pdf_enable_object_arena */
+typedef struct pdf_obj_arena_s pdf_obj_arena;
+void pdf_drop_object_arena(fz_context *ctx, pdf_obj_arena *arena);
+
 /* type queries */
 int pdf_is_null(fz_context *ctx, pdf_obj *obj);
 int pdf_is_bool(fz_context *ctx, pdf_obj *obj);
@@ -49,6 +53,19 @@ pdf_obj *pdf_resolve_obj(fz_context *ctx, pdf_obj *a);
 int pdf_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b);
 int pdf_objcmp_resolve(fz_context *ctx, pdf_obj *a, pdf_obj *b);
 
+/*
+	pdf_hash_obj: Hash an object such that objects that compare
+	equal with pdf_objcmp hash to the same value. Indirect
+	references are hashed by number and are not followed.
+*/
+unsigned int pdf_hash_obj(fz_context *ctx, pdf_obj *obj);
+
+/*
+	pdf_hash_object_num: Hash the value of an object in the xref,
+	and for streams the raw (still encoded) stream data as well.
+*/
+unsigned int pdf_hash_object_num(fz_context *ctx, pdf_document *doc, int num);
+
 static inline int pdf_name_eq(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 {
 	if (a == b)
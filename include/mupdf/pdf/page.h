@@ -5,6 +5,14 @@ int pdf_lookup_page_number(fz_context *ctx, pdf_document *doc, pdf_obj *pageobj)
 int pdf_count_pages(fz_context *ctx, pdf_document *doc);
 pdf_obj *pdf_lookup_page_obj(fz_context *ctx, pdf_document *doc, int needle);
 
+/*
+	pdf_invalidate_page_tree: Forget the cached page count and
+	page index. Must be called after editing the page tree
+	other than through pdf_insert_page and pdf_delete_page,
+	which keep the index up to date.
+*/
+void pdf_invalidate_page_tree(fz_context *ctx, pdf_document *doc);
+
 /*
 	pdf_lookup_anchor: Find the page number of a named destination.
 
@@ -159,6 +167,19 @@ void pdf_clean_page_contents(fz_context *ctx, pdf_document *doc, pdf_page *page,
 void pdf_clean_annot_contents(fz_context *ctx, pdf_document *doc, pdf_annot *annot, fz_cookie *cookie,
 	pdf_page_contents_process_fn *proc, void *proc_arg, int ascii);
 
+/*
+	pdf_clean_document_contents: Clean the contents of every page
+	and annotation in the document, as pdf_clean_page_contents and
+	pdf_clean_annot_contents.
+
+	threads: The number of threads to use for filtering page contents.
+	Page contents are read and the results written back on the calling
+	thread, in page order, so the output does not depend on the number
+	of threads. The context must have been created with locks for more
+	than one thread to be used.
+*/
+void pdf_clean_document_contents(fz_context *ctx, pdf_document *doc, int threads, int ascii);
+
 /*
 	Presentation interface.
 */
@@ -58,6 +58,21 @@ fz_image *pdf_load_image(fz_context *ctx, pdf_document *doc, pdf_obj *obj);
 
 pdf_obj *pdf_add_image(fz_context *ctx, pdf_document *doc, fz_image *image, int mask);
 
+/*
+	pdf_downsample_images: Scale down image XObjects that are drawn
+	at more than 1.5 times 'dpi' anywhere in the document to 'dpi',
+	and recompress them: JPEG images as JPEG, and everything else with
+	Flate. 1 bit gray images and image masks stay 1 bit. Only 8 bit
+	images in device or ICC based colorspaces, 1 bit gray images and
+	image masks are considered. Images that are never drawn, that
+	also appear as inline images of the same size, or that would not
+	get smaller are left untouched. Decoding and encoding are spread
+	over up to 'threads' worker threads (see fz_run_workers).
+
+	Failures are reported as warnings.
+*/
+void pdf_downsample_images(fz_context *ctx, pdf_document *doc, int dpi, int threads);
+
 /*
  * Pattern
  */
@@ -80,6 +80,23 @@ pdf_obj *pdf_resolve_indirect(fz_context *ctx, pdf_obj *ref);
 pdf_obj *pdf_resolve_indirect_chain(fz_context *ctx, pdf_obj *ref);
 pdf_obj *pdf_load_object(fz_context *ctx, pdf_document *doc, int num);
 
+/*
+	pdf_prefetch_objects: Load a batch of objects into the xref
+	cache ahead of use.
+
+	The objects are read in file order, small neighbouring objects
+	with a single read, and each object stream involved is parsed
+	once. Objects that cannot be loaded this way are skipped, and
+	any error is reported when they are next loaded individually.
+
+	nums: The object numbers to load, or NULL for every object.
+
+	The document must not be used by anything else during the call,
+	but it may be made on a separate thread (with a cloned context)
+	to warm the cache in the background.
+*/
+void pdf_prefetch_objects(fz_context *ctx, pdf_document *doc, const int *nums, int count);
+
 fz_buffer *pdf_load_raw_stream(fz_context *ctx, pdf_document *doc, int num);
 fz_buffer *pdf_load_stream(fz_context *ctx, pdf_document *doc, int num);
 fz_stream *pdf_open_raw_stream(fz_context *ctx, pdf_document *doc, int num);
@@ -111,7 +128,7 @@ void pdf_mark_xref(fz_context *ctx, pdf_document *doc);
 void pdf_clear_xref(fz_context *ctx, pdf_document *doc);
 void pdf_clear_xref_to_mark(fz_context *ctx, pdf_document *doc);
 
-int pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, fz_off_t *tmpofs, pdf_obj **root);
+int pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t *stmofsp, fz_off_t *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, fz_off_t *tmpofs, pdf_obj **root);
 
 pdf_obj *pdf_progressive_advance(fz_context *ctx, pdf_document *doc, int pagenum);
 
@@ -108,7 +108,21 @@ LOCAL_SRC_FILES := \
 	$(MY_ROOT)/thirdparty/openjpeg/src/lib/openjp2/thix_manager.c \
 	$(MY_ROOT)/thirdparty/openjpeg/src/lib/openjp2/tpix_manager.c \
 	$(MY_ROOT)/thirdparty/jpeg/jaricom.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcapimin.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcapistd.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcarith.c \
+	$(MY_ROOT)/thirdparty/jpeg/jccoefct.c \
+	$(MY_ROOT)/thirdparty/jpeg/jccolor.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcdctmgr.c \
+	$(MY_ROOT)/thirdparty/jpeg/jchuff.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcinit.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcmainct.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcmarker.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcmaster.c \
 	$(MY_ROOT)/thirdparty/jpeg/jcomapi.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcparam.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcprepct.c \
+	$(MY_ROOT)/thirdparty/jpeg/jcsample.c \
 	$(MY_ROOT)/thirdparty/jpeg/jdapimin.c \
 	$(MY_ROOT)/thirdparty/jpeg/jdapistd.c \
 	$(MY_ROOT)/thirdparty/jpeg/jdarith.c \
@@ -116,6 +116,16 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+void fz_tune_worker_threads(fz_context *ctx, int threads)
+{
+	ctx->tuning->worker_threads = fz_maxi(threads, 0);
+}
+
+int fz_worker_threads(fz_context *ctx)
+{
+	return ctx->tuning->worker_threads;
+}
+
 void
 fz_drop_context(fz_context *ctx)
 {
@@ -133,6 +143,7 @@ fz_drop_context(fz_context *ctx)
 	fz_drop_font_context(ctx);
 	fz_drop_id_context(ctx);
 	fz_drop_output_context(ctx);
+	fz_drop_pool_blocks(ctx);
 
 	if (ctx->warn)
 	{
@@ -220,6 +220,15 @@ fz_count_pages(fz_context *ctx, fz_document *doc)
 	return 0;
 }
 
+int
+fz_count_pages_exact(fz_context *ctx, fz_document *doc)
+{
+	fz_ensure_layout(ctx, doc);
+	if (doc && doc->count_pages_exact)
+		return doc->count_pages_exact(ctx, doc);
+	return fz_count_pages(ctx, doc);
+}
+
 int
 fz_lookup_metadata(fz_context *ctx, fz_document *doc, const char *key, char *buf, int size)
 {
@@ -165,6 +165,7 @@ struct fz_draw_state_s {
 	fz_matrix ctm;
 	float xstep, ystep;
 	fz_irect area;
+	fz_irect painted;
 };
 
 struct fz_draw_device_s
@@ -279,6 +280,154 @@ static void emergency_pop_stack(fz_context *ctx, fz_draw_device *dev, fz_draw_st
 	fz_rethrow(ctx);
 }
 
+/* Group, knockout and clip buffers that start out transparent are not
+ * cleared when they are created. Instead, 'painted' records the area of
+ * state->dest that has been cleared (and possibly drawn to) so far; the
+ * rest of the buffer is transparent by definition. Each drawing operation
+ * extends the painted area to cover what it is about to touch, and only
+ * the painted area is composited back onto the parent when the buffer is
+ * popped. A page sized group holding a few small objects thus only costs
+ * clearing and blending the parts that were actually used, and the memory
+ * pages behind the rest of the buffer are never touched.
+ *
+ * Buffers that are initialised by copying a backdrop are marked as fully
+ * painted, so they composite exactly as before. */
+
+static void
+clear_rect(fz_pixmap *pix, const fz_irect *r)
+{
+	unsigned char *s;
+	size_t w;
+	int h;
+
+	if (fz_is_empty_irect(r))
+		return;
+	s = pix->samples + (unsigned int)((r->y0 - pix->y) * pix->stride + (r->x0 - pix->x) * pix->n);
+	w = (size_t)(r->x1 - r->x0) * pix->n;
+	h = r->y1 - r->y0;
+	while (h--)
+	{
+		memset(s, 0, w);
+		s += pix->stride;
+	}
+}
+
+static void
+mark_painted(fz_context *ctx, fz_draw_state *state, const fz_irect *area)
+{
+	fz_irect r, u, strip;
+	fz_irect p = state->painted;
+
+	fz_intersect_irect(fz_pixmap_bbox(ctx, state->dest, &r), area);
+	if (fz_is_empty_irect(&r))
+		return;
+
+	if (fz_is_empty_irect(&p))
+	{
+		clear_rect(state->dest, &r);
+		state->painted = r;
+		return;
+	}
+
+	u.x0 = fz_mini(p.x0, r.x0);
+	u.y0 = fz_mini(p.y0, r.y0);
+	u.x1 = fz_maxi(p.x1, r.x1);
+	u.y1 = fz_maxi(p.y1, r.y1);
+	if (u.x0 == p.x0 && u.y0 == p.y0 && u.x1 == p.x1 && u.y1 == p.y1)
+		return;
+
+	/* Clear the (up to) four strips of u that lie outside p. */
+	strip = u;
+	strip.y1 = p.y0;
+	clear_rect(state->dest, &strip);
+	strip = u;
+	strip.y0 = p.y1;
+	clear_rect(state->dest, &strip);
+	strip.x0 = u.x0;
+	strip.x1 = p.x0;
+	strip.y0 = p.y0;
+	strip.y1 = p.y1;
+	clear_rect(state->dest, &strip);
+	strip.x0 = p.x1;
+	strip.x1 = u.x1;
+	clear_rect(state->dest, &strip);
+
+	state->painted = u;
+}
+
+/* Initialise a newly allocated state->dest: either leave it transparent,
+ * or (if 'backdrop' is given) copy the backdrop contents into it. */
+static void
+init_dest(fz_context *ctx, fz_draw_state *state, fz_draw_state *backdrop)
+{
+	fz_irect bbox;
+
+	fz_pixmap_bbox(ctx, state->dest, &bbox);
+	if (backdrop && backdrop->dest)
+	{
+		mark_painted(ctx, backdrop, &bbox);
+		fz_copy_pixmap_rect(ctx, state->dest, backdrop->dest, &bbox);
+		state->painted = bbox;
+	}
+	else
+		state->painted = fz_empty_irect;
+}
+
+/* Make a temporary view onto the part of pix that lies within area.
+ * Returns NULL if there is no overlap. The view shares the samples of
+ * pix and must not be kept or dropped. */
+static fz_pixmap *
+pixmap_window(fz_context *ctx, fz_pixmap *view, fz_pixmap *pix, const fz_irect *area)
+{
+	fz_irect r;
+
+	if (!pix)
+		return NULL;
+	fz_intersect_irect(fz_pixmap_bbox(ctx, pix, &r), area);
+	if (fz_is_empty_irect(&r))
+		return NULL;
+	*view = *pix;
+	view->samples += (unsigned int)((r.y0 - pix->y) * pix->stride + (r.x0 - pix->x) * pix->n);
+	view->x = r.x0;
+	view->y = r.y0;
+	view->w = r.x1 - r.x0;
+	view->h = r.y1 - r.y0;
+	return view;
+}
+
+/* Composite the painted area of a group or knockout buffer (state[1])
+ * onto its parent (state[0]). */
+static void
+composite_group(fz_context *ctx, fz_draw_state *state, int alpha, int blendmode, int isolated)
+{
+	fz_pixmap dest_view, shape_view;
+	fz_pixmap *dest, *shape;
+	fz_irect area = state[1].painted;
+
+	if (state[0].dest == state[1].dest)
+	{
+		state[0].painted = state[1].painted;
+		return;
+	}
+
+	dest = pixmap_window(ctx, &dest_view, state[1].dest, &area);
+	if (!dest)
+		return;
+	mark_painted(ctx, &state[0], &area);
+
+	if ((blendmode == 0) && (state[0].shape == state[1].shape))
+		fz_paint_pixmap(state[0].dest, dest, alpha);
+	else
+		fz_blend_pixmap(state[0].dest, dest, alpha, blendmode, isolated, state[1].shape);
+
+	if (state[0].shape && state[0].shape != state[1].shape)
+	{
+		shape = pixmap_window(ctx, &shape_view, state[1].shape, &area);
+		if (shape)
+			fz_paint_pixmap(state[0].shape, shape, alpha);
+	}
+}
+
 static fz_draw_state *
 fz_knockout_begin(fz_context *ctx, fz_draw_device *dev)
 {
@@ -296,10 +445,11 @@ fz_knockout_begin(fz_context *ctx, fz_draw_device *dev)
 	fz_pixmap_bbox(ctx, state->dest, &bbox);
 	fz_intersect_irect(&bbox, &state->scissor);
 	dest = fz_new_pixmap_with_bbox(ctx, state->dest->colorspace, &bbox, state->dest->alpha || isolated);
+	state[1].dest = dest;
 
 	if (isolated)
 	{
-		fz_clear_pixmap(ctx, dest);
+		init_dest(ctx, &state[1], NULL);
 	}
 	else
 	{
@@ -312,10 +462,10 @@ fz_knockout_begin(fz_context *ctx, fz_draw_device *dev)
 			if (prev != state->dest)
 				break;
 		}
-		if (prev)
-			fz_copy_pixmap_rect(ctx, dest, prev, &bbox);
+		if (!prev)
+			init_dest(ctx, &state[1], NULL);
 		else
-			fz_clear_pixmap(ctx, dest);
+			init_dest(ctx, &state[1], prev == state->dest ? state : &dev->stack[i]);
 	}
 
 	if ((state->blendmode & FZ_BLEND_MODEMASK) == 0 && isolated)
@@ -333,7 +483,6 @@ fz_knockout_begin(fz_context *ctx, fz_draw_device *dev)
 	dump_spaces(dev->top-1, "Knockout begin\n");
 #endif
 	state[1].scissor = bbox;
-	state[1].dest = dest;
 	state[1].shape = shape;
 	state[1].blendmode &= ~FZ_BLEND_MODEMASK;
 
@@ -373,10 +522,7 @@ static void fz_knockout_end(fz_context *ctx, fz_draw_device *dev)
 		printf(" (isolated)");
 	printf(" (knockout)");
 #endif
-	if ((blendmode == 0) && (state[0].shape == state[1].shape))
-		fz_paint_pixmap(state[0].dest, state[1].dest, 255);
-	else
-		fz_blend_pixmap(state[0].dest, state[1].dest, 255, blendmode, isolated, state[1].shape);
+	composite_group(ctx, state, 255, blendmode, isolated);
 
 	/* The following test should not be required, but just occasionally
 	 * errors can cause the stack to get out of sync, and this saves our
@@ -384,11 +530,7 @@ static void fz_knockout_end(fz_context *ctx, fz_draw_device *dev)
 	if (state[0].dest != state[1].dest)
 		fz_drop_pixmap(ctx, state[1].dest);
 	if (state[0].shape != state[1].shape)
-	{
-		if (state[0].shape)
-			fz_paint_pixmap(state[0].shape, state[1].shape, 255);
 		fz_drop_pixmap(ctx, state[1].shape);
-	}
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(ctx, state[0].dest, " to get ");
 	if (state[0].shape)
@@ -442,6 +584,7 @@ fz_draw_fill_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 		colorbv[i] = colorfv[i] * 255;
 	colorbv[i] = alpha * 255;
 
+	mark_painted(ctx, state, &bbox);
 	fz_scan_convert(ctx, gel, even_odd, &bbox, state->dest, colorbv);
 	if (state->shape)
 	{
@@ -509,6 +652,7 @@ fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const
 		fz_dump_blend(ctx, state->shape, "/");
 	printf("\n");
 #endif
+	mark_painted(ctx, state, &bbox);
 	fz_scan_convert(ctx, gel, 0, &bbox, state->dest, colorbv);
 	if (state->shape)
 	{
@@ -586,10 +730,7 @@ fz_draw_clip_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in future. */
 		state[1].dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->alpha);
-		if (state[0].dest->alpha)
-			fz_clear_pixmap(ctx, state[1].dest);
-		else
-			fz_copy_pixmap_rect(ctx, state[1].dest, state[0].dest, &bbox);
+		init_dest(ctx, &state[1], state[0].dest->alpha ? NULL : &state[0]);
 		if (state[1].shape)
 		{
 			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, 1);
@@ -659,10 +800,7 @@ fz_draw_clip_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path,
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in future. */
 		state[1].dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->alpha);
-		if (state[0].dest->alpha)
-			fz_clear_pixmap(ctx, state[1].dest);
-		else
-			fz_copy_pixmap_rect(ctx, state[1].dest, state[0].dest, &bbox);
+		init_dest(ctx, &state[1], state[0].dest->alpha ? NULL : &state[0]);
 		if (state->shape)
 		{
 			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, 1);
@@ -753,6 +891,16 @@ draw_glyph(unsigned char *colorbv, fz_pixmap *dst, fz_glyph *glyph,
 	}
 }
 
+static void
+mark_glyph_painted(fz_context *ctx, fz_draw_state *state, fz_glyph *glyph, int x, int y)
+{
+	fz_irect bbox;
+
+	fz_glyph_bbox(ctx, glyph, &bbox);
+	fz_translate_irect(&bbox, x, y);
+	mark_painted(ctx, state, fz_intersect_irect(&bbox, &state->scissor));
+}
+
 static void
 fz_draw_fill_text(fz_context *ctx, fz_device *devp, const fz_text *text, const fz_matrix *in_ctm,
 	fz_colorspace *colorspace, const float *color, float alpha)
@@ -801,6 +949,7 @@ fz_draw_fill_text(fz_context *ctx, fz_device *devp, const fz_text *text, const f
 				fz_pixmap *pixmap = glyph->pixmap;
 				int x = floorf(trm.e);
 				int y = floorf(trm.f);
+				mark_glyph_painted(ctx, state, glyph, x, y);
 				if (pixmap == NULL || pixmap->n == 1)
 				{
 					draw_glyph(colorbv, state->dest, glyph, x, y, &state->scissor);
@@ -882,6 +1031,7 @@ fz_draw_stroke_text(fz_context *ctx, fz_device *devp, const fz_text *text, const
 			{
 				int x = (int)trm.e;
 				int y = (int)trm.f;
+				mark_glyph_painted(ctx, state, glyph, x, y);
 				draw_glyph(colorbv, state->dest, glyph, x, y, &state->scissor);
 				if (state->shape)
 					draw_glyph(colorbv, state->shape, glyph, x, y, &state->scissor);
@@ -945,11 +1095,8 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, const fz_text *text, const f
 		 * we have a choice. We can either create the new destination WITH alpha, or
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in future. */
-		dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->alpha);
-		if (state[0].dest->alpha)
-			fz_clear_pixmap(ctx, dest);
-		else
-			fz_copy_pixmap_rect(ctx, dest, state[0].dest, &bbox);
+		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->alpha);
+		init_dest(ctx, &state[1], state[0].dest->alpha ? NULL : &state[0]);
 		if (state->shape)
 		{
 			shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, 1);
@@ -999,11 +1146,14 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, const fz_text *text, const f
 						if (path)
 						{
 							fz_pixmap *old_dest;
+							fz_irect old_painted;
 							float white = 1;
 
 							old_dest = state[1].dest;
+							old_painted = state[1].painted;
 							state[1].dest = state[1].mask;
 							state[1].mask = NULL;
+							fz_pixmap_bbox(ctx, state[1].dest, &state[1].painted);
 							fz_try(ctx)
 							{
 								fz_draw_fill_path(ctx, devp, path, 0, &ctm, fz_device_gray(ctx), &white, 1);
@@ -1012,6 +1162,7 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, const fz_text *text, const f
 							{
 								state[1].mask = state[1].dest;
 								state[1].dest = old_dest;
+								state[1].painted = old_painted;
 								fz_drop_path(ctx, path);
 							}
 							fz_catch(ctx)
@@ -1071,10 +1222,7 @@ fz_draw_clip_stroke_text(fz_context *ctx, fz_device *devp, const fz_text *text,
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in future. */
 		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->alpha);
-		if (state[0].dest->alpha)
-			fz_clear_pixmap(ctx, state[1].dest);
-		else
-			fz_copy_pixmap_rect(ctx, state[1].dest, state[0].dest, &bbox);
+		init_dest(ctx, &state[1], state[0].dest->alpha ? NULL : &state[0]);
 		if (state->shape)
 		{
 			state[1].shape = shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, 1);
@@ -1121,12 +1269,15 @@ fz_draw_clip_stroke_text(fz_context *ctx, fz_device *devp, const fz_text *text,
 						if (path)
 						{
 							fz_pixmap *old_dest;
+							fz_irect old_painted;
 							float white = 1;
 
 							state = &dev->stack[dev->top];
 							old_dest = state[0].dest;
+							old_painted = state[0].painted;
 							state[0].dest = state[0].mask;
 							state[0].mask = NULL;
+							fz_pixmap_bbox(ctx, state[0].dest, &state[0].painted);
 							fz_try(ctx)
 							{
 								fz_draw_stroke_path(ctx, devp, path, stroke, &ctm, fz_device_gray(ctx), &white, 1);
@@ -1135,6 +1286,7 @@ fz_draw_clip_stroke_text(fz_context *ctx, fz_device *devp, const fz_text *text,
 							{
 								state[0].mask = state[0].dest;
 								state[0].dest = old_dest;
+								state[0].painted = old_painted;
 								fz_drop_path(ctx, path);
 							}
 							fz_catch(ctx)
@@ -1185,6 +1337,8 @@ fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, const fz_m
 	if (state->blendmode & FZ_BLEND_KNOCKOUT)
 		state = fz_knockout_begin(ctx, dev);
 
+	mark_painted(ctx, state, shade->use_background ? &scissor : &bbox);
+
 	dest = state->dest;
 	shape = state->shape;
 
@@ -1262,6 +1416,21 @@ fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, const fz_m
 		fz_knockout_end(ctx, dev);
 }
 
+static void
+mark_image_painted(fz_context *ctx, fz_draw_state *state, const fz_matrix *ctm)
+{
+	fz_rect rect = fz_unit_rect;
+	fz_irect bbox;
+
+	fz_irect_from_rect(&bbox, fz_transform_rect(&rect, ctm));
+	/* Allow for grid fitting of the image to whole pixels. */
+	bbox.x0 -= 1;
+	bbox.y0 -= 1;
+	bbox.x1 += 1;
+	bbox.y1 += 1;
+	mark_painted(ctx, state, fz_intersect_irect(&bbox, &state->scissor));
+}
+
 static fz_pixmap *
 fz_transform_pixmap(fz_context *ctx, fz_draw_device *dev, const fz_pixmap *image, fz_matrix *ctm, int x, int y, int dx, int dy, int gridfit, const fz_irect *clip)
 {
@@ -1396,6 +1565,7 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 	{
 		if (state->blendmode & FZ_BLEND_KNOCKOUT)
 			state = fz_knockout_begin(ctx, dev);
+		mark_image_painted(ctx, state, &local_ctm);
 
 		after = 0;
 		if (pixmap->colorspace == fz_device_gray(ctx))
@@ -1529,6 +1699,7 @@ fz_draw_fill_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 	{
 		if (state->blendmode & FZ_BLEND_KNOCKOUT)
 			state = fz_knockout_begin(ctx, dev);
+		mark_image_painted(ctx, state, &local_ctm);
 
 		if (ctx->tuning->image_scale(ctx->tuning->image_scale_arg, dx, dy, pixmap->w, pixmap->h))
 		{
@@ -1636,10 +1807,7 @@ fz_draw_clip_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in future. */
 		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->alpha);
-		if (state[0].dest->alpha)
-			fz_clear_pixmap(ctx, state[1].dest);
-		else
-			fz_copy_pixmap_rect(ctx, state[1].dest, state[0].dest, &bbox);
+		init_dest(ctx, &state[1], state[0].dest->alpha ? NULL : &state[0]);
 		if (state->shape)
 		{
 			state[1].shape = shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, 1);
@@ -1720,12 +1888,27 @@ fz_draw_pop_clip(fz_context *ctx, fz_device *devp)
 			fz_dump_blend(ctx, state[0].shape, "/");
 		fz_dump_blend(ctx, state[1].mask, " with ");
 #endif
-		fz_paint_pixmap_with_mask(state[0].dest, state[1].dest, state[1].mask);
-		if (state[0].shape != state[1].shape)
+		if (state[0].dest != state[1].dest)
 		{
-			fz_paint_pixmap_with_mask(state[0].shape, state[1].shape, state[1].mask);
-			fz_drop_pixmap(ctx, state[1].shape);
+			fz_pixmap view;
+			fz_irect area = state[1].painted;
+			fz_pixmap *dest = pixmap_window(ctx, &view, state[1].dest, &area);
+			if (dest)
+			{
+				mark_painted(ctx, &state[0], &area);
+				fz_paint_pixmap_with_mask(state[0].dest, dest, state[1].mask);
+				if (state[0].shape != state[1].shape)
+				{
+					fz_pixmap *shape = pixmap_window(ctx, &view, state[1].shape, &area);
+					if (shape)
+						fz_paint_pixmap_with_mask(state[0].shape, shape, state[1].mask);
+				}
+			}
 		}
+		else
+			state[0].painted = state[1].painted;
+		if (state[0].shape != state[1].shape)
+			fz_drop_pixmap(ctx, state[1].shape);
 		/* The following tests should not be required, but just occasionally
 		 * errors can cause the stack to get out of sync, and this might save
 		 * our bacon. */
@@ -1742,6 +1925,8 @@ fz_draw_pop_clip(fz_context *ctx, fz_device *devp)
 	}
 	else
 	{
+		if (state[0].dest == state[1].dest)
+			state[0].painted = state[1].painted;
 #ifdef DUMP_GROUP_BLENDS
 		dump_spaces(dev->top, "Clip end\n");
 #endif
@@ -1802,6 +1987,7 @@ fz_draw_begin_mask(fz_context *ctx, fz_device *devp, const fz_rect *rect, int lu
 			if (shape)
 				fz_clear_pixmap(ctx, shape);
 		}
+		state[1].painted = bbox;
 
 #ifdef DUMP_GROUP_BLENDS
 		dump_spaces(dev->top-1, "Mask begin");
@@ -1863,13 +2049,10 @@ fz_draw_end_mask(fz_context *ctx, fz_device *devp)
 		/* create new dest scratch buffer */
 		fz_pixmap_bbox(ctx, temp, &bbox);
 		dest = fz_new_pixmap_with_bbox(ctx, state->dest->colorspace, &bbox, state->dest->alpha);
-		if (state->dest->alpha)
-			fz_clear_pixmap(ctx, dest);
-		else
-			fz_copy_pixmap_rect(ctx, dest, state->dest, &bbox);
 
 		/* push soft mask as clip mask */
 		state[1].dest = dest;
+		init_dest(ctx, &state[1], state->dest->alpha ? NULL : &state[0]);
 		state[1].blendmode |= FZ_BLEND_ISOLATED;
 		/* If we have a shape, then it'll need to be masked with the
 		 * clip mask when we pop. So create a new shape now. */
@@ -1913,14 +2096,7 @@ fz_draw_begin_group(fz_context *ctx, fz_device *devp, const fz_rect *rect, int i
 
 		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->alpha || isolated);
 
-		if (isolated)
-		{
-			fz_clear_pixmap(ctx, dest);
-		}
-		else
-		{
-			fz_copy_pixmap_rect(ctx, dest, state[0].dest, &bbox);
-		}
+		init_dest(ctx, &state[1], isolated ? NULL : &state[0]);
 
 		if (blendmode == 0 && alpha == 1.0 && isolated)
 		{
@@ -1985,10 +2161,7 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 	if (state[1].blendmode & FZ_BLEND_KNOCKOUT)
 		printf(" (knockout)");
 #endif
-	if ((blendmode == 0) && (state[0].shape == state[1].shape))
-		fz_paint_pixmap(state[0].dest, state[1].dest, alpha * 255);
-	else
-		fz_blend_pixmap(state[0].dest, state[1].dest, alpha * 255, blendmode, isolated, state[1].shape);
+	composite_group(ctx, state, alpha * 255, blendmode, isolated);
 
 	/* The following test should not be required, but just occasionally
 	 * errors can cause the stack to get out of sync, and this might save
@@ -1996,11 +2169,7 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 	if (state[0].dest != state[1].dest)
 		fz_drop_pixmap(ctx, state[1].dest);
 	if (state[0].shape != state[1].shape)
-	{
-		if (state[0].shape)
-			fz_paint_pixmap(state[0].shape, state[1].shape, alpha * 255);
 		fz_drop_pixmap(ctx, state[1].shape);
-	}
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(ctx, state[0].dest, " to get ");
 	if (state[0].shape)
@@ -2155,6 +2324,7 @@ fz_draw_begin_tile(fz_context *ctx, fz_device *devp, const fz_rect *area, const
 		if (tile)
 		{
 			state[1].dest = fz_keep_pixmap(ctx, tile->dest);
+			fz_pixmap_bbox(ctx, state[1].dest, &state[1].painted);
 			state[1].shape = fz_keep_pixmap(ctx, tile->shape);
 			state[1].blendmode |= FZ_BLEND_ISOLATED;
 			state[1].xstep = xstep;
@@ -2177,6 +2347,7 @@ fz_draw_begin_tile(fz_context *ctx, fz_device *devp, const fz_rect *area, const
 		/* Patterns can be transparent, so we need to have an alpha here. */
 		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, 1);
 		fz_clear_pixmap(ctx, dest);
+		state[1].painted = bbox;
 		shape = state[0].shape;
 		if (shape)
 		{
@@ -2261,6 +2432,8 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 		shapectm.f = state[1].shape->y;
 	}
 
+	mark_painted(ctx, &state[0], &state[0].scissor);
+
 #ifdef DUMP_GROUP_BLENDS
 	dump_spaces(dev->top, "");
 	fz_dump_blend(ctx, state[1].dest, "Tiling ");
@@ -2447,6 +2620,7 @@ fz_new_draw_device(fz_context *ctx, const fz_matrix *transform, fz_pixmap *dest)
 	dev->stack[0].scissor.y0 = dest->y;
 	dev->stack[0].scissor.x1 = dest->x + dest->w;
 	dev->stack[0].scissor.y1 = dest->y + dest->h;
+	dev->stack[0].painted = dev->stack[0].scissor;
 
 	fz_try(ctx)
 	{
@@ -15,7 +15,14 @@ static inline int fz_idiv(int a, int b)
  * antialiasing (to a maximum of 8). If it is defined to be 0 then no
  * antialiasing is done. If it is undefined to we will leave the antialiasing
  * accuracy as a run time choice.
+ *
+ * At run time, a graphics level of 9 (AREA_BITS) selects the exact area
+ * coverage rasterizer instead of sampling. Edges are then held in
+ * 1/AREA_SCALE pixel fixed point.
  */
+#define AREA_BITS 9
+#define AREA_SCALE 256
+
 struct fz_aa_context_s
 {
 	int hscale;
@@ -123,7 +130,13 @@ fz_text_aa_level(fz_context *ctx)
 static void
 set_gfx_level(fz_context *ctx, int level)
 {
-	if (level > 6)
+	if (level >= AREA_BITS)
+	{
+		fz_aa_hscale = AREA_SCALE;
+		fz_aa_vscale = AREA_SCALE;
+		fz_aa_bits = AREA_BITS;
+	}
+	else if (level > 6)
 	{
 		fz_aa_hscale = 17;
 		fz_aa_vscale = 15;
@@ -229,6 +242,9 @@ struct fz_gel_s
 	fz_edge *edges;
 	int acap, alen;
 	fz_edge **active;
+	int recording;
+	int rcap, rlen;
+	fz_gel_segment *record;
 };
 
 #ifdef DUMP_GELS
@@ -306,6 +322,11 @@ fz_reset_gel(fz_context *ctx, fz_gel *gel, const fz_irect *clip)
 
 	gel->len = 0;
 	gel->alen = 0;
+
+	fz_free(ctx, gel->record);
+	gel->record = NULL;
+	gel->rlen = gel->rcap = 0;
+	gel->recording = 0;
 }
 
 void
@@ -313,6 +334,7 @@ fz_drop_gel(fz_context *ctx, fz_gel *gel)
 {
 	if (gel == NULL)
 		return;
+	fz_free(ctx, gel->record);
 	fz_free(ctx, gel->active);
 	fz_free(ctx, gel->edges);
 	fz_free(ctx, gel);
@@ -447,6 +469,66 @@ fz_insert_gel_raw(fz_context *ctx, fz_gel *gel, int x0, int y0, int x1, int y1)
 	}
 }
 
+/*
+ * While recording, segments are kept as given (unclipped and unscaled)
+ * instead of being turned into edges, so that they can be cached and
+ * inserted again later, possibly with a different clip and translation.
+ */
+
+static void
+record_gel_segment(fz_context *ctx, fz_gel *gel, float x0, float y0, float x1, float y1, int rect)
+{
+	fz_gel_segment *seg;
+
+	if (gel->rlen == gel->rcap)
+	{
+		int new_cap = gel->rcap ? gel->rcap * 2 : 64;
+		gel->record = fz_resize_array(ctx, gel->record, new_cap, sizeof(fz_gel_segment));
+		gel->rcap = new_cap;
+	}
+
+	seg = &gel->record[gel->rlen++];
+	seg->x0 = x0;
+	seg->y0 = y0;
+	seg->x1 = x1;
+	seg->y1 = y1;
+	seg->rect = rect;
+}
+
+void
+fz_begin_gel_recording(fz_context *ctx, fz_gel *gel)
+{
+	gel->recording = 1;
+	gel->rlen = 0;
+}
+
+fz_gel_segment *
+fz_end_gel_recording(fz_context *ctx, fz_gel *gel, int *len)
+{
+	fz_gel_segment *record = gel->record;
+
+	*len = gel->rlen;
+	gel->record = NULL;
+	gel->rlen = gel->rcap = 0;
+	gel->recording = 0;
+
+	return record;
+}
+
+void
+fz_insert_gel_segments(fz_context *ctx, fz_gel *gel, const fz_gel_segment *segs, int len, float tx, float ty)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (segs[i].rect)
+			fz_insert_gel_rect(ctx, gel, segs[i].x0 + tx, segs[i].y0 + ty, segs[i].x1 + tx, segs[i].y1 + ty);
+		else
+			fz_insert_gel(ctx, gel, segs[i].x0 + tx, segs[i].y0 + ty, segs[i].x1 + tx, segs[i].y1 + ty);
+	}
+}
+
 void
 fz_insert_gel(fz_context *ctx, fz_gel *gel, float fx0, float fy0, float fx1, float fy1)
 {
@@ -455,6 +537,12 @@ fz_insert_gel(fz_context *ctx, fz_gel *gel, float fx0, float fy0, float fx1, flo
 	const int hscale = fz_aa_hscale;
 	const int vscale = fz_aa_vscale;
 
+	if (gel->recording)
+	{
+		record_gel_segment(ctx, gel, fx0, fy0, fx1, fy1, 0);
+		return;
+	}
+
 	fx0 = floorf(fx0 * hscale);
 	fx1 = floorf(fx1 * hscale);
 	fy0 = floorf(fy0 * vscale);
@@ -519,6 +607,12 @@ fz_insert_gel_rect(fz_context *ctx, fz_gel *gel, float fx0, float fy0, float fx1
 	const int hscale = fz_aa_hscale;
 	const int vscale = fz_aa_vscale;
 
+	if (gel->recording)
+	{
+		record_gel_segment(ctx, gel, fx0, fy0, fx1, fy1, 1);
+		return;
+	}
+
 	if (fx0 <= fx1)
 	{
 		fx0 = floorf(fx0 * hscale);
@@ -1022,6 +1116,188 @@ clip_ended:
 	fz_free(ctx, alphas);
 }
 
+/*
+ * Exact area coverage scan conversion.
+ *
+ * Rather than sampling sub-scanlines, each edge adds the signed area it
+ * covers to the cells of the pixel row it crosses (as in FreeType's
+ * "smooth" rasterizer). A running sum along the row then gives the
+ * winding coverage of each pixel. The cost is one pass per pixel row
+ * regardless of quality, and only the range of cells an edge actually
+ * touched in a row is summed, blitted and cleared.
+ */
+
+typedef struct
+{
+	float x0, y0, y1, dxdy;
+	int dir;
+} fz_area_edge;
+
+static inline void
+add_area_cell(float *cells, int x, float a, int *minx, int *maxx)
+{
+	cells[x] += a;
+	if (x < *minx) *minx = x;
+	if (x > *maxx) *maxx = x;
+}
+
+/* Accumulate the part of an edge between ya and yb (within one pixel row). */
+static void
+add_area_line(float *cells, const fz_area_edge *edge, float ya, float yb, int *minx, int *maxx)
+{
+	float xa = edge->x0 + (ya - edge->y0) * edge->dxdy;
+	float xb = edge->x0 + (yb - edge->y0) * edge->dxdy;
+	float d = (yb - ya) * edge->dir;
+	float x0 = fz_min(xa, xb);
+	float x1 = fz_max(xa, xb);
+	float x0floor = floorf(x0);
+	int x0i = (int)x0floor;
+	int x1i = (int)ceilf(x1);
+
+	if (x1i <= x0i + 1)
+	{
+		/* Within a single cell: the area to the right of the midpoint
+		 * carries over into the next cell. */
+		float xm = 0.5f * (xa + xb) - x0floor;
+		add_area_cell(cells, x0i, d - d * xm, minx, maxx);
+		add_area_cell(cells, x0i + 1, d * xm, minx, maxx);
+	}
+	else
+	{
+		float s = 1 / (x1 - x0);
+		float x0f = x0 - x0floor;
+		float a0 = 0.5f * s * (1 - x0f) * (1 - x0f);
+		float x1f = x1 - x1i + 1;
+		float am = 0.5f * s * x1f * x1f;
+		int x;
+
+		add_area_cell(cells, x0i, d * a0, minx, maxx);
+		if (x1i == x0i + 2)
+			add_area_cell(cells, x0i + 1, d * (1 - a0 - am), minx, maxx);
+		else
+		{
+			float a1 = s * (1.5f - x0f);
+			float a2 = a1 + (x1i - x0i - 3) * s;
+			add_area_cell(cells, x0i + 1, d * (a1 - a0), minx, maxx);
+			for (x = x0i + 2; x < x1i - 1; x++)
+				cells[x] += d * s;
+			add_area_cell(cells, x1i - 1, d * (1 - a2 - am), minx, maxx);
+		}
+		add_area_cell(cells, x1i, d * am, minx, maxx);
+	}
+}
+
+static inline void
+undelta_area(unsigned char * restrict out, float * restrict in, int n, int eofill)
+{
+	float acc = 0;
+	float a;
+
+	while (n--)
+	{
+		acc += *in;
+		*in++ = 0;
+		a = fabsf(acc);
+		if (eofill)
+		{
+			a -= 2 * floorf(a * 0.5f);
+			if (a > 1)
+				a = 2 - a;
+		}
+		else if (a > 1)
+			a = 1;
+		*out++ = (unsigned char)(a * 255 + 0.5f);
+	}
+}
+
+static void
+fz_scan_convert_area(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *clip, fz_pixmap *dst, unsigned char *color, void *painter)
+{
+	fz_area_edge *edges = NULL;
+	fz_area_edge **active = NULL;
+	unsigned char *alphas = NULL;
+	float *cells = NULL;
+	int i, e, n, y, alen;
+	const float hscale = fz_aa_hscale;
+	const float vscale = fz_aa_vscale;
+
+	int xmin = fz_idiv(gel->bbox.x0, fz_aa_hscale);
+	int xmax = fz_idiv(gel->bbox.x1, fz_aa_hscale) + 1;
+
+	if (gel->len == 0)
+		return;
+
+	assert(clip->x0 >= xmin);
+	assert(clip->x1 <= xmax);
+
+	/* Two extra cells, as coverage of the last pixel carries over. */
+	n = xmax - xmin + 2;
+	edges = fz_malloc_no_throw(ctx, gel->len * sizeof *edges);
+	active = fz_malloc_no_throw(ctx, gel->len * sizeof *active);
+	alphas = fz_malloc_no_throw(ctx, n);
+	cells = fz_malloc_no_throw(ctx, n * sizeof *cells);
+	if (edges == NULL || active == NULL || alphas == NULL || cells == NULL)
+	{
+		fz_free(ctx, edges);
+		fz_free(ctx, active);
+		fz_free(ctx, alphas);
+		fz_free(ctx, cells);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "scan conversion failed (malloc failure)");
+	}
+	memset(cells, 0, n * sizeof *cells);
+
+	/* Recover the end points of the (sorted) edges, relative to xmin. */
+	for (i = 0; i < gel->len; i++)
+	{
+		fz_edge *g = &gel->edges[i];
+		int width = fz_absi(g->xmove) * g->h + g->adj_up;
+		edges[i].x0 = g->x / hscale - xmin;
+		edges[i].y0 = g->y / vscale;
+		edges[i].y1 = (g->y + g->h) / vscale;
+		edges[i].dxdy = (g->xdir * width / hscale) / (edges[i].y1 - edges[i].y0);
+		edges[i].dir = g->ydir;
+	}
+
+	e = 0;
+	alen = 0;
+	for (y = clip->y0; y < clip->y1 && (alen > 0 || e < gel->len); y++)
+	{
+		float ya = y, yb = y + 1;
+		int minx = n, maxx = -1;
+
+		/* Add the edges that start above the bottom of this row... */
+		while (e < gel->len && edges[e].y0 < yb)
+			active[alen++] = &edges[e++];
+
+		/* ...and accumulate those crossing it, retiring those ending in it. */
+		for (i = 0; i < alen; )
+		{
+			fz_area_edge *edge = active[i];
+			if (edge->y1 > ya)
+				add_area_line(cells, edge, fz_max(ya, edge->y0), fz_min(yb, edge->y1), &minx, &maxx);
+			if (edge->y1 <= yb)
+				active[i] = active[--alen];
+			else
+				i++;
+		}
+
+		if (maxx < 0)
+			continue;
+
+		/* Only the touched range of cells can have non-zero coverage. */
+		undelta_area(alphas + minx, cells + minx, maxx - minx + 1, eofill);
+		minx = fz_maxi(minx + xmin, clip->x0);
+		maxx = fz_mini(maxx + xmin + 1, clip->x1);
+		if (minx < maxx)
+			blit_aa(dst, minx, y, alphas + minx - xmin, maxx - minx, color, painter);
+	}
+
+	fz_free(ctx, edges);
+	fz_free(ctx, active);
+	fz_free(ctx, alphas);
+	fz_free(ctx, cells);
+}
+
 /*
  * Sharp (not anti-aliased) scan conversion
  */
@@ -1149,7 +1425,10 @@ fz_scan_convert(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *clip,
 		assert(fn);
 		if (fn == NULL)
 			return;
-		fz_scan_convert_aa(ctx, gel, eofill, &local_clip, dst, color, fn);
+		if (fz_aa_bits >= AREA_BITS)
+			fz_scan_convert_area(ctx, gel, eofill, &local_clip, dst, color, fn);
+		else
+			fz_scan_convert_aa(ctx, gel, eofill, &local_clip, dst, color, fn);
 	}
 	else
 	{
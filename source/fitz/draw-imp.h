@@ -19,6 +19,20 @@ fz_rect *fz_gel_scissor(fz_context *ctx, const fz_gel *gel, fz_rect *rect);
 
 void fz_scan_convert(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *clip, fz_pixmap *pix, unsigned char *colorbv);
 
+/*
+ * Recording of the segments inserted into a gel, for reuse.
+ */
+
+typedef struct fz_gel_segment_s
+{
+	float x0, y0, x1, y1;
+	int rect;
+} fz_gel_segment;
+
+void fz_begin_gel_recording(fz_context *ctx, fz_gel *gel);
+fz_gel_segment *fz_end_gel_recording(fz_context *ctx, fz_gel *gel, int *len);
+void fz_insert_gel_segments(fz_context *ctx, fz_gel *gel, const fz_gel_segment *segs, int len, float tx, float ty);
+
 void fz_flatten_fill_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_matrix *ctm, float flatness);
 void fz_flatten_stroke_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
 void fz_flatten_dash_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
@@ -214,8 +214,8 @@ static const fz_path_walker flatten_proc =
 	flatten_rectto
 };
 
-void
-fz_flatten_fill_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_matrix *ctm, float flatness)
+static void
+flatten_fill_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_matrix *ctm, float flatness)
 {
 	flatten_arg arg;
 
@@ -841,8 +841,8 @@ static const fz_path_walker stroke_proc =
 	stroke_quadto
 };
 
-void
-fz_flatten_stroke_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
+static void
+flatten_stroke_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
 {
 	struct sctx s;
 
@@ -873,6 +873,256 @@ fz_flatten_stroke_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const
 	fz_stroke_flush(ctx, &s, stroke->start_cap, stroke->end_cap);
 }
 
+/*
+ * Cache of flattened (and stroked) paths.
+ *
+ * Flattening curves and generating the joins and caps of strokes costs
+ * far more than inserting the resulting segments into the gel, and the
+ * same path is often drawn many times (pattern tiles, type 3 glyphs,
+ * forms, or a display list being redrawn). The segments only depend on
+ * the translation of the ctm by an offset, so we flatten without it,
+ * keep the segments in the store, and translate them as they are
+ * inserted. Paths are identified by a digest of their contents, since
+ * the same fz_path may not live as long as the cached segments.
+ */
+
+/* Paths with fewer coordinates than this, such as rectangles and
+ * simple glyph outlines, are quicker to flatten than to digest and
+ * look up. Of the rest, those producing fewer segments than this are
+ * not worth keeping. */
+#define MIN_CACHED_COORDS 16
+#define MIN_CACHED_SEGMENTS 8
+
+typedef struct fz_flat_path_key_s fz_flat_path_key;
+typedef struct fz_flat_path_s fz_flat_path;
+
+struct fz_flat_path_key_s
+{
+	int refs;
+	unsigned char digest[16];
+	int stroked;
+	float m[4];
+	float flatness;
+	float linewidth;
+	float miterlimit;
+	int start_cap, end_cap, linejoin;
+};
+
+struct fz_flat_path_s
+{
+	fz_storable storable;
+	int len;
+	fz_gel_segment *segs;
+};
+
+static void
+drop_flat_path_imp(fz_context *ctx, fz_storable *flat_)
+{
+	fz_flat_path *flat = (fz_flat_path *)flat_;
+	fz_free(ctx, flat->segs);
+	fz_free(ctx, flat);
+}
+
+static void
+drop_flat_path(fz_context *ctx, fz_flat_path *flat)
+{
+	if (flat)
+		fz_drop_storable(ctx, &flat->storable);
+}
+
+static int
+make_hash_flat_path_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_flat_path_key *key = (fz_flat_path_key *)key_;
+	memcpy(hash->u.fp.digest, key->digest, sizeof hash->u.fp.digest);
+	memcpy(hash->u.fp.m, key->m, sizeof hash->u.fp.m);
+	hash->u.fp.flatness = key->flatness;
+	hash->u.fp.linewidth = key->linewidth;
+	hash->u.fp.miterlimit = key->miterlimit;
+	hash->u.fp.stroked = key->stroked;
+	hash->u.fp.start_cap = key->start_cap;
+	hash->u.fp.end_cap = key->end_cap;
+	hash->u.fp.linejoin = key->linejoin;
+	return 1;
+}
+
+static void *
+keep_flat_path_key(fz_context *ctx, void *key_)
+{
+	fz_flat_path_key *key = (fz_flat_path_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+drop_flat_path_key(fz_context *ctx, void *key_)
+{
+	fz_flat_path_key *key = (fz_flat_path_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+cmp_flat_path_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_flat_path_key *k0 = (fz_flat_path_key *)k0_;
+	fz_flat_path_key *k1 = (fz_flat_path_key *)k1_;
+	/* Zero when equal, as the store expects. */
+	return memcmp(k0->digest, k1->digest, sizeof k0->digest) ||
+		k0->stroked != k1->stroked ||
+		k0->m[0] != k1->m[0] || k0->m[1] != k1->m[1] ||
+		k0->m[2] != k1->m[2] || k0->m[3] != k1->m[3] ||
+		k0->flatness != k1->flatness ||
+		k0->linewidth != k1->linewidth ||
+		k0->miterlimit != k1->miterlimit ||
+		k0->start_cap != k1->start_cap ||
+		k0->end_cap != k1->end_cap ||
+		k0->linejoin != k1->linejoin;
+}
+
+static void
+print_flat_path(fz_context *ctx, fz_output *out, void *key_)
+{
+	fz_flat_path_key *key = (fz_flat_path_key *)key_;
+	fz_printf(ctx, out, "(flattened %s path [%g %g %g %g]) ", key->stroked ? "stroked" : "filled",
+		key->m[0], key->m[1], key->m[2], key->m[3]);
+}
+
+static fz_store_type fz_flat_path_store_type =
+{
+	make_hash_flat_path_key,
+	keep_flat_path_key,
+	drop_flat_path_key,
+	cmp_flat_path_key,
+	print_flat_path
+};
+
+/* Takes ownership of segs. Failing to store just means not caching. */
+static void
+store_flat_path(fz_context *ctx, const fz_flat_path_key *key_, fz_gel_segment *segs, int len)
+{
+	fz_flat_path *flat = NULL;
+	fz_flat_path *existing;
+	fz_flat_path_key *key = NULL;
+
+	fz_var(flat);
+	fz_var(key);
+
+	fz_try(ctx)
+	{
+		flat = fz_malloc_struct(ctx, fz_flat_path);
+		FZ_INIT_STORABLE(flat, 1, drop_flat_path_imp);
+		flat->segs = segs;
+		flat->len = len;
+
+		key = fz_malloc_struct(ctx, fz_flat_path_key);
+		*key = *key_;
+		key->refs = 1;
+
+		existing = fz_store_item(ctx, key, flat, sizeof *flat + len * sizeof *segs, &fz_flat_path_store_type);
+		drop_flat_path(ctx, existing);
+	}
+	fz_always(ctx)
+	{
+		if (key)
+			drop_flat_path_key(ctx, key);
+		drop_flat_path(ctx, flat);
+	}
+	fz_catch(ctx)
+	{
+		if (!flat)
+			fz_free(ctx, segs);
+	}
+}
+
+static void
+flatten_path_cached(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
+{
+	fz_flat_path_key key;
+	fz_flat_path *flat;
+	fz_gel_segment *segs = NULL;
+	fz_matrix local = *ctm;
+	int len;
+
+	if (fz_path_coord_count(ctx, path) < MIN_CACHED_COORDS)
+	{
+		if (stroke)
+			flatten_stroke_path(ctx, gel, path, stroke, ctm, flatness, linewidth);
+		else
+			flatten_fill_path(ctx, gel, path, ctm, flatness);
+		return;
+	}
+
+	memset(&key, 0, sizeof key);
+	fz_digest_path(ctx, path, key.digest);
+	key.m[0] = ctm->a;
+	key.m[1] = ctm->b;
+	key.m[2] = ctm->c;
+	key.m[3] = ctm->d;
+	key.flatness = flatness;
+	if (stroke)
+	{
+		key.stroked = 1;
+		key.linewidth = linewidth;
+		key.miterlimit = stroke->miterlimit;
+		key.start_cap = stroke->start_cap;
+		key.end_cap = stroke->end_cap;
+		key.linejoin = stroke->linejoin;
+	}
+
+	flat = fz_find_item(ctx, drop_flat_path_imp, &key, &fz_flat_path_store_type);
+	if (flat)
+	{
+		fz_try(ctx)
+			fz_insert_gel_segments(ctx, gel, flat->segs, flat->len, ctm->e, ctm->f);
+		fz_always(ctx)
+			drop_flat_path(ctx, flat);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return;
+	}
+
+	local.e = 0;
+	local.f = 0;
+
+	fz_var(segs);
+
+	fz_try(ctx)
+	{
+		fz_begin_gel_recording(ctx, gel);
+		if (stroke)
+			flatten_stroke_path(ctx, gel, path, stroke, &local, flatness, linewidth);
+		else
+			flatten_fill_path(ctx, gel, path, &local, flatness);
+		segs = fz_end_gel_recording(ctx, gel, &len);
+
+		fz_insert_gel_segments(ctx, gel, segs, len, ctm->e, ctm->f);
+		if (len >= MIN_CACHED_SEGMENTS)
+		{
+			store_flat_path(ctx, &key, segs, len);
+			segs = NULL;
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, segs);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, fz_end_gel_recording(ctx, gel, &len));
+		fz_rethrow(ctx);
+	}
+}
+
+void
+fz_flatten_fill_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_matrix *ctm, float flatness)
+{
+	flatten_path_cached(ctx, gel, path, NULL, ctm, flatness, 0);
+}
+
+void
+fz_flatten_stroke_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
+{
+	flatten_path_cached(ctx, gel, path, stroke, ctm, flatness, linewidth);
+}
+
 static void
 fz_dash_moveto(fz_context *ctx, struct sctx *s, float x, float y)
 {
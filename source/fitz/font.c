@@ -296,6 +296,29 @@ fz_font *fz_load_system_cjk_font(fz_context *ctx, const char *name, int ros, int
 	return font;
 }
 
+/*
+	The fallback fonts are shared between all cloned contexts, so load
+	the font first and then install it only if no other thread has
+	installed one in the meantime. Readers check the slot without the
+	lock, so it is published with a release store.
+*/
+static fz_font *publish_fallback_font(fz_context *ctx, fz_font **slot, const char *data, int size)
+{
+	fz_font *font = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+	fz_font *installed;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	installed = *slot;
+	if (!installed)
+	{
+		fz_store_release_ptr(*slot, font);
+		installed = font;
+		font = NULL;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_drop_font(ctx, font);
+	return installed;
+}
+
 fz_font *fz_load_fallback_font(fz_context *ctx, int script, int language, int serif, int bold, int italic)
 {
 	const char *data;
@@ -326,24 +349,22 @@ fz_font *fz_load_fallback_font(fz_context *ctx, int script, int language, int se
 
 	if (serif)
 	{
-		if (ctx->font->fallback[index].serif)
-			return ctx->font->fallback[index].serif;
+		fz_font *font = fz_load_acquire_ptr(ctx->font->fallback[index].serif);
+		if (font)
+			return font;
 		data = fz_lookup_noto_font(ctx, script, language, 1, &size);
 		if (data)
-		{
-			ctx->font->fallback[index].serif = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
-			return ctx->font->fallback[index].serif;
-		}
+			return publish_fallback_font(ctx, &ctx->font->fallback[index].serif, data, size);
 	}
 
-	if (ctx->font->fallback[index].sans)
-		return ctx->font->fallback[index].sans;
-	data = fz_lookup_noto_font(ctx, script, language, 0, &size);
-	if (data)
 	{
-		ctx->font->fallback[index].sans = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
-		return ctx->font->fallback[index].sans;
+		fz_font *font = fz_load_acquire_ptr(ctx->font->fallback[index].sans);
+		if (font)
+			return font;
 	}
+	data = fz_lookup_noto_font(ctx, script, language, 0, &size);
+	if (data)
+		return publish_fallback_font(ctx, &ctx->font->fallback[index].sans, data, size);
 
 	return NULL;
 }
@@ -352,26 +373,28 @@ fz_font *fz_load_fallback_symbol_font(fz_context *ctx)
 {
 	const char *data;
 	int size;
-	if (!ctx->font->symbol)
+	fz_font *font = fz_load_acquire_ptr(ctx->font->symbol);
+	if (!font)
 	{
 		data = fz_lookup_noto_symbol_font(ctx, &size);
 		if (data)
-			ctx->font->symbol = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			return publish_fallback_font(ctx, &ctx->font->symbol, data, size);
 	}
-	return ctx->font->symbol;
+	return font;
 }
 
 fz_font *fz_load_fallback_emoji_font(fz_context *ctx)
 {
 	const char *data;
 	int size;
-	if (!ctx->font->emoji)
+	fz_font *font = fz_load_acquire_ptr(ctx->font->emoji);
+	if (!font)
 	{
 		data = fz_lookup_noto_emoji_font(ctx, &size);
 		if (data)
-			ctx->font->emoji = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			return publish_fallback_font(ctx, &ctx->font->emoji, data, size);
 	}
-	return ctx->font->emoji;
+	return font;
 }
 
 static const struct ft_error ft_errors[] =
@@ -1470,14 +1493,26 @@ fz_advance_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
 			return fz_advance_ft_glyph(ctx, font, gid, 1);
 		if (gid >= 0 && gid < font->glyph_count && gid < MAX_ADVANCE_CACHE)
 		{
-			if (!font->advance_cache)
+			float *cache = fz_load_acquire_ptr(font->advance_cache);
+			if (!cache)
 			{
+				/* As for the encoding cache below. */
+				float *mine = fz_malloc_array(ctx, font->glyph_count, sizeof(float));
 				int i;
-				font->advance_cache = fz_malloc_array(ctx, font->glyph_count, sizeof(float));
 				for (i = 0; i < font->glyph_count; ++i)
-					font->advance_cache[i] = fz_advance_ft_glyph(ctx, font, i, 0);
+					mine[i] = fz_advance_ft_glyph(ctx, font, i, 0);
+				fz_lock(ctx, FZ_LOCK_ALLOC);
+				cache = font->advance_cache;
+				if (!cache)
+				{
+					fz_store_release_ptr(font->advance_cache, mine);
+					cache = mine;
+					mine = NULL;
+				}
+				fz_unlock(ctx, FZ_LOCK_ALLOC);
+				fz_free(ctx, mine);
 			}
-			return font->advance_cache[gid];
+			return cache[gid];
 		}
 
 		return fz_advance_ft_glyph(ctx, font, gid, 0);
@@ -1492,20 +1527,38 @@ fz_encode_character(fz_context *ctx, fz_font *font, int ucs)
 {
 	if (font->ft_face)
 	{
+		int gid;
 		if (ucs >= 0 && ucs < 0x10000)
 		{
 			int pg = ucs >> 8;
 			int ix = ucs & 0xFF;
-			if (!font->encoding_cache[pg])
+			uint16_t *cache = fz_load_acquire_ptr(font->encoding_cache[pg]);
+			if (!cache)
 			{
+				/* Fill in a private page, and only publish it if no other thread beat us to it. */
+				uint16_t *mine = fz_malloc_array(ctx, 256, sizeof(uint16_t));
 				int i;
-				font->encoding_cache[pg] = fz_malloc_array(ctx, 256, sizeof(uint16_t));
+				fz_lock(ctx, FZ_LOCK_FREETYPE);
 				for (i = 0; i < 256; ++i)
-					font->encoding_cache[pg][i] = FT_Get_Char_Index(font->ft_face, (pg << 8) + i);
+					mine[i] = FT_Get_Char_Index(font->ft_face, (pg << 8) + i);
+				fz_unlock(ctx, FZ_LOCK_FREETYPE);
+				fz_lock(ctx, FZ_LOCK_ALLOC);
+				cache = font->encoding_cache[pg];
+				if (!cache)
+				{
+					fz_store_release_ptr(font->encoding_cache[pg], mine);
+					cache = mine;
+					mine = NULL;
+				}
+				fz_unlock(ctx, FZ_LOCK_ALLOC);
+				fz_free(ctx, mine);
 			}
-			return font->encoding_cache[pg][ix];
+			return cache[ix];
 		}
-		return FT_Get_Char_Index(font->ft_face, ucs);
+		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		gid = FT_Get_Char_Index(font->ft_face, ucs);
+		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		return gid;
 	}
 	return ucs;
 }
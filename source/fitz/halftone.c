@@ -1,5 +1,9 @@
 #include "mupdf/fitz.h"
 
+#ifdef ARCH_X86_SSE2
+#include <emmintrin.h>
+#endif
+
 fz_halftone *
 fz_new_halftone(fz_context *ctx, int comps)
 {
@@ -9,12 +13,41 @@ fz_new_halftone(fz_context *ctx, int comps)
 	ht = fz_malloc(ctx, sizeof(fz_halftone) + (comps-1)*sizeof(fz_pixmap *));
 	ht->refs = 1;
 	ht->n = comps;
+	ht->method = FZ_HALFTONE_THRESHOLD;
+	ht->next_row = 0;
+	ht->error_len = 0;
+	ht->errors = NULL;
 	for (i = 0; i < comps; i++)
 		ht->comp[i] = NULL;
 
 	return ht;
 }
 
+fz_halftone *
+fz_new_error_diffusion_halftone(fz_context *ctx, int comps, int method)
+{
+	fz_halftone *ht;
+
+	if (method != FZ_HALFTONE_FLOYD_STEINBERG && method != FZ_HALFTONE_STUCKI)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unknown error diffusion method %d", method);
+
+	ht = fz_new_halftone(ctx, comps);
+	ht->method = method;
+	return ht;
+}
+
+int
+fz_halftone_method_from_name(const char *name)
+{
+	if (!strcmp(name, "threshold"))
+		return FZ_HALFTONE_THRESHOLD;
+	if (!strcmp(name, "floyd"))
+		return FZ_HALFTONE_FLOYD_STEINBERG;
+	if (!strcmp(name, "stucki"))
+		return FZ_HALFTONE_STUCKI;
+	return -1;
+}
+
 fz_halftone *
 fz_keep_halftone(fz_context *ctx, fz_halftone *ht)
 {
@@ -29,6 +62,7 @@ fz_drop_halftone(fz_context *ctx, fz_halftone *ht)
 	{
 		for (i = 0; i < ht->n; i++)
 			fz_drop_pixmap(ctx, ht->comp[i]);
+		fz_free(ctx, ht->errors);
 		fz_free(ctx, ht);
 	}
 }
@@ -271,7 +305,7 @@ do_threshold_1(const unsigned char * restrict ht_line, const unsigned char * res
 	);
 }
 #else
-static void do_threshold_1(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w, int ht_len)
+static void do_threshold_1_c(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w, int ht_len)
 {
 	int h;
 	int l = ht_len;
@@ -327,6 +361,54 @@ static void do_threshold_1(const unsigned char * restrict ht_line, const unsigne
 		*out++ = h;
 	}
 }
+
+#ifdef ARCH_X86_SSE2
+/* Compare 16 samples against 16 thresholds, returning the 16 bits of
+ * pixmap >= ht_line in output order (first sample in the top bit of
+ * the first byte). */
+static inline int
+threshold_16_sse2(const unsigned char *ht_line, const unsigned char *pixmap)
+{
+	__m128i p = _mm_loadu_si128((const __m128i *)pixmap);
+	__m128i t = _mm_loadu_si128((const __m128i *)ht_line);
+	__m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(p, t), p);
+
+	/* movemask puts the first byte in the bottom bit, so reverse
+	 * the bytes within each half first. */
+	ge = _mm_shufflelo_epi16(ge, _MM_SHUFFLE(0, 1, 2, 3));
+	ge = _mm_shufflehi_epi16(ge, _MM_SHUFFLE(0, 1, 2, 3));
+	ge = _mm_or_si128(_mm_slli_epi16(ge, 8), _mm_srli_epi16(ge, 8));
+	return _mm_movemask_epi8(ge);
+}
+
+/* ht_len must be a multiple of 16 here; the C version does the last
+ * (up to 15) pixels. */
+static void do_threshold_1(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w, int ht_len)
+{
+	int l = ht_len;
+
+	while (w >= 16)
+	{
+		int h = ~threshold_16_sse2(ht_line, pixmap);
+		out[0] = h;
+		out[1] = h >> 8;
+		out += 2;
+		pixmap += 16;
+		ht_line += 16;
+		l -= 16;
+		if (l == 0)
+		{
+			l = ht_len;
+			ht_line -= ht_len;
+		}
+		w -= 16;
+	}
+	if (w > 0)
+		do_threshold_1_c(ht_line, pixmap, out, w, l);
+}
+#else
+#define do_threshold_1 do_threshold_1_c
+#endif
 #endif
 
 /*
@@ -437,7 +519,7 @@ do_threshold_4(const unsigned char * restrict ht_line, const unsigned char * res
 	);
 }
 #else
-static void do_threshold_4(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w, int ht_len)
+static void do_threshold_4_c(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w, int ht_len)
 {
 	int l = ht_len;
 
@@ -486,6 +568,35 @@ static void do_threshold_4(const unsigned char * restrict ht_line, const unsigne
 		*out = h;
 	}
 }
+
+#ifdef ARCH_X86_SSE2
+static void do_threshold_4(const unsigned char * restrict ht_line, const unsigned char * restrict pixmap, unsigned char * restrict out, int w, int ht_len)
+{
+	int l = ht_len;
+
+	/* 4 pixels of 4 components at a time. */
+	while (w >= 4)
+	{
+		int h = threshold_16_sse2(ht_line, pixmap);
+		out[0] = h;
+		out[1] = h >> 8;
+		out += 2;
+		pixmap += 16;
+		ht_line += 16;
+		l -= 4;
+		if (l == 0)
+		{
+			l = ht_len;
+			ht_line -= ht_len<<2;
+		}
+		w -= 4;
+	}
+	if (w > 0)
+		do_threshold_4_c(ht_line, pixmap, out, w, l);
+}
+#else
+#define do_threshold_4 do_threshold_4_c
+#endif
 #endif
 
 fz_bitmap *fz_new_bitmap_from_pixmap(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht)
@@ -509,6 +620,125 @@ static int gcd(int u, int v)
 	while (1);
 }
 
+/* Error diffusion. Each tap spreads weight/scale of the error to the
+ * sample dx pixels along (in the direction of travel) and dy rows
+ * down. */
+typedef struct
+{
+	int dx, dy, weight;
+} diffusion_tap;
+
+static const diffusion_tap floyd_steinberg_taps[] =
+{
+	{ 1, 0, 7 },
+	{ -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 }
+};
+
+static const diffusion_tap stucki_taps[] =
+{
+	{ 1, 0, 8 }, { 2, 0, 4 },
+	{ -2, 1, 2 }, { -1, 1, 4 }, { 0, 1, 8 }, { 1, 1, 4 }, { 2, 1, 2 },
+	{ -2, 2, 1 }, { -1, 2, 2 }, { 0, 2, 4 }, { 1, 2, 2 }, { 2, 2, 1 }
+};
+
+/* Diffuse one row. err holds three rows of len ints (the errors for
+ * this row and the next two, in units of 1/scale), each with two
+ * pixels of padding either side. Errors are kept per sample, so each
+ * component is diffused separately. Gray (n == 1) has white = 0xFF,
+ * CMYK has white = 0, and either way a set bit means ink. */
+static inline void
+diffuse_line(const unsigned char *pixmap, unsigned char *out, int *err, int len, int w, int n, int dir, const diffusion_tap *taps, int ntaps, int scale)
+{
+	int step, k, t;
+	int invert = (n == 1 ? 255 : 0);
+
+	memset(out, 0, (w * n + 7) >> 3);
+	err += 2 * n;
+	for (step = 0; step < w; step++)
+	{
+		int x = dir > 0 ? step : w - 1 - step;
+		for (k = 0; k < n; k++)
+		{
+			int i = x * n + k;
+			int v = (pixmap[i] ^ invert) * scale + err[i];
+			int unit, rest;
+
+			if (v >= 128 * scale)
+			{
+				out[i >> 3] |= 0x80 >> (i & 7);
+				v -= 255 * scale;
+			}
+
+			/* The last tap takes what is left, so no error is lost
+			 * to rounding. */
+			unit = v / scale;
+			rest = v;
+			for (t = 0; t < ntaps - 1; t++)
+			{
+				int part = unit * taps[t].weight;
+				err[taps[t].dy * len + i + taps[t].dx * dir * n] += part;
+				rest -= part;
+			}
+			err[taps[t].dy * len + i + taps[t].dx * dir * n] += rest;
+		}
+	}
+
+	/* Move on a row. */
+	memmove(err - 2 * n, err - 2 * n + len, 2 * len * sizeof(int));
+	memset(err - 2 * n + 2 * len, 0, len * sizeof(int));
+}
+
+static fz_bitmap *
+new_bitmap_by_error_diffusion(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht, int band_start)
+{
+	fz_bitmap *out;
+	unsigned char *o, *p;
+	int n = pix->n;
+	int len = (pix->w + 4) * n;
+	int y;
+
+	if (ht->n != n)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "halftone has %d components, pixmap has %d", ht->n, n);
+
+	/* Start afresh at the top of a page, or if the bands are not
+	 * contiguous. */
+	if (band_start == 0 || band_start != ht->next_row || len != ht->error_len)
+	{
+		ht->errors = fz_resize_array(ctx, ht->errors, 3 * len, sizeof(int));
+		ht->error_len = len;
+		memset(ht->errors, 0, 3 * len * sizeof(int));
+	}
+
+	out = fz_new_bitmap(ctx, pix->w, pix->h, n, pix->xres, pix->yres);
+	o = out->samples;
+	p = pix->samples;
+	for (y = 0; y < pix->h; y++)
+	{
+		/* Serpentine: alternate rows run right to left. */
+		int dir = ((band_start + y) & 1) ? -1 : 1;
+		/* Constant n and taps let the compiler unroll diffuse_line. */
+		if (ht->method == FZ_HALFTONE_STUCKI)
+		{
+			if (n == 1)
+				diffuse_line(p, o, ht->errors, len, pix->w, 1, dir, stucki_taps, nelem(stucki_taps), 42);
+			else
+				diffuse_line(p, o, ht->errors, len, pix->w, 4, dir, stucki_taps, nelem(stucki_taps), 42);
+		}
+		else
+		{
+			if (n == 1)
+				diffuse_line(p, o, ht->errors, len, pix->w, 1, dir, floyd_steinberg_taps, nelem(floyd_steinberg_taps), 16);
+			else
+				diffuse_line(p, o, ht->errors, len, pix->w, 4, dir, floyd_steinberg_taps, nelem(floyd_steinberg_taps), 16);
+		}
+		o += out->stride;
+		p += pix->stride;
+	}
+	ht->next_row = band_start + pix->h;
+
+	return out;
+}
+
 fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht, int band_start, int bandheight)
 {
 	fz_bitmap *out = NULL;
@@ -541,6 +771,9 @@ fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_ha
 		return NULL;
 	}
 
+	if (ht && ht->method != FZ_HALFTONE_THRESHOLD)
+		return new_bitmap_by_error_diffusion(ctx, pix, ht, band_start);
+
 	if (ht == NULL)
 	{
 		ht = fz_default_halftone(ctx, n);
@@ -548,12 +781,15 @@ fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_ha
 
 	/* Find the minimum length for the halftone line. This
 	 * is the LCM of the halftone lengths and 8. (We need a
-	 * multiple of 8 for the unrolled threshold routines - if
-	 * we ever use SSE, we may need longer.) We use the fact
-	 * that LCM(a,b) = a * b / GCD(a,b) and use euclids
-	 * algorithm.
+	 * multiple of 8 for the unrolled threshold routines, and
+	 * of 16 for the SSE2 ones.) We use the fact that
+	 * LCM(a,b) = a * b / GCD(a,b) and use euclids algorithm.
 	 */
+#ifdef ARCH_X86_SSE2
+	lcm = 16;
+#else
 	lcm = 8;
+#endif
 	for (i = 0; i < ht->n; i++)
 	{
 		w = ht->comp[i]->w;
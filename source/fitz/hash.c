@@ -8,7 +8,8 @@ exhibiting bad behaviour if entries are inserted
 and removed frequently.
 */
 
-enum { MAX_KEY_LEN = 48 };
+/* Large enough for an fz_store_hash, whose biggest key is a flattened path. */
+enum { MAX_KEY_LEN = 64 };
 typedef struct fz_hash_entry_s fz_hash_entry;
 
 struct fz_hash_entry_s
@@ -6,12 +6,42 @@
 #undef FITZ_DEBUG_LOCKING_TIMES
 #endif
 
+/*
+	The default allocator is the C library's, which is thread safe, so
+	it is called without taking FZ_LOCK_ALLOC. Custom allocators were
+	promised to be called under the lock, so they still are. Memento is
+	not thread safe either.
+
+	The lock is only needed on the slow path, where the store is
+	scavenged to make room after an allocation failure.
+*/
+static inline int
+alloc_needs_lock(fz_context *ctx)
+{
+#ifdef MEMENTO
+	return 1;
+#else
+	return ctx->alloc != &fz_alloc_default;
+#endif
+}
+
 static void *
 do_scavenging_malloc(fz_context *ctx, size_t size)
 {
 	void *p;
 	int phase = 0;
 
+	ctx->alloc_stats.allocs++;
+	ctx->alloc_stats.bytes += size;
+
+	if (!alloc_needs_lock(ctx))
+	{
+		p = ctx->alloc->malloc(ctx->alloc->user, size);
+		if (p != NULL)
+			return p;
+	}
+
+	ctx->alloc_stats.locked++;
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	do {
 		p = ctx->alloc->malloc(ctx->alloc->user, size);
@@ -32,6 +62,17 @@ do_scavenging_realloc(fz_context *ctx, void *p, size_t size)
 	void *q;
 	int phase = 0;
 
+	ctx->alloc_stats.reallocs++;
+	ctx->alloc_stats.bytes += size;
+
+	if (!alloc_needs_lock(ctx))
+	{
+		q = ctx->alloc->realloc(ctx->alloc->user, p, size);
+		if (q != NULL)
+			return q;
+	}
+
+	ctx->alloc_stats.locked++;
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	do {
 		q = ctx->alloc->realloc(ctx->alloc->user, p, size);
@@ -183,11 +224,24 @@ fz_resize_array_no_throw(fz_context *ctx, void *p, size_t count, size_t size)
 void
 fz_free(fz_context *ctx, void *p)
 {
+	if (p)
+		ctx->alloc_stats.frees++;
+	if (!alloc_needs_lock(ctx))
+	{
+		ctx->alloc->free(ctx->alloc->user, p);
+		return;
+	}
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	ctx->alloc->free(ctx->alloc->user, p);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
 
+void
+fz_get_alloc_stats(fz_context *ctx, fz_alloc_stats *stats)
+{
+	*stats = ctx->alloc_stats;
+}
+
 char *
 fz_strdup(fz_context *ctx, const char *s)
 {
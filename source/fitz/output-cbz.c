@@ -4,6 +4,14 @@
 
 typedef struct fz_cbz_writer_s fz_cbz_writer;
 
+enum { CBZ_FORMAT_PNG, CBZ_FORMAT_JPEG };
+
+/*
+	Rendered pages are collected in batches of up to 'batch_max'
+	pixmaps, which are encoded on worker threads and then written
+	to the archive in page order. Without threads the batch holds
+	a single page and each page is written as soon as it ends.
+*/
 struct fz_cbz_writer_s
 {
 	fz_document_writer super;
@@ -11,9 +19,93 @@ struct fz_cbz_writer_s
 	fz_pixmap *pixmap;
 	int count;
 	fz_zip_writer *zip;
+	int format;
+	int quality;
+	int compress;
+	int threads;
+	int batch_max;
+	int batch_len;
+	fz_pixmap **batch;
 };
 
-const char *fz_cbz_write_options_usage = "";
+typedef struct
+{
+	fz_cbz_writer *wri;
+	fz_buffer **bufs;
+} fz_cbz_batch;
+
+const char *fz_cbz_write_options_usage =
+	"CBZ output options:\n"
+	"\tformat=(png|jpeg): encode pages as PNG (default) or JPEG\n"
+	"\tquality=N: JPEG quality from 0 to 100 (default 90)\n"
+	"\tcompress: deflate archive entries (default is to store them)\n"
+	"\tthreads=N: encode pages on N worker threads\n"
+	"\n";
+
+static int opteq(const char *a, const char *b)
+{
+	size_t n = strlen(b);
+	return !strncmp(a, b, n) && (a[n] == ',' || a[n] == 0);
+}
+
+/* JPEG cannot hold transparency, so pages rendered with alpha are always PNG. */
+static int
+cbz_use_jpeg(fz_cbz_writer *wri, fz_pixmap *pix)
+{
+	return wri->format == CBZ_FORMAT_JPEG && !pix->alpha;
+}
+
+static void
+cbz_encode_worker(fz_context *ctx, void *arg, int idx)
+{
+	fz_cbz_batch *batch = (fz_cbz_batch *)arg;
+	fz_pixmap *pix = batch->wri->batch[idx];
+
+	if (cbz_use_jpeg(batch->wri, pix))
+		batch->bufs[idx] = fz_new_buffer_from_pixmap_as_jpeg(ctx, pix, batch->wri->quality);
+	else
+		batch->bufs[idx] = fz_new_buffer_from_pixmap_as_png(ctx, pix);
+}
+
+static void
+cbz_flush_batch(fz_context *ctx, fz_cbz_writer *wri)
+{
+	fz_cbz_batch batch;
+	fz_buffer **bufs;
+	char name[40];
+	int i, n = wri->batch_len;
+	int first = wri->count - n;
+
+	if (n == 0)
+		return;
+
+	bufs = fz_calloc(ctx, n, sizeof *bufs);
+	fz_try(ctx)
+	{
+		batch.wri = wri;
+		batch.bufs = bufs;
+		fz_run_workers(ctx, wri->threads, n, cbz_encode_worker, &batch);
+
+		for (i = 0; i < n; i++)
+		{
+			fz_snprintf(name, sizeof name, "p%04d.%s", first + i + 1, cbz_use_jpeg(wri, wri->batch[i]) ? "jpg" : "png");
+			fz_write_zip_entry(ctx, wri->zip, name, bufs[i], wri->compress);
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < n; i++)
+		{
+			fz_drop_buffer(ctx, bufs[i]);
+			fz_drop_pixmap(ctx, wri->batch[i]);
+			wri->batch[i] = NULL;
+		}
+		fz_free(ctx, bufs);
+		wri->batch_len = 0;
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
 
 static fz_device *
 cbz_begin_page(fz_context *ctx, fz_document_writer *wri_, const fz_rect *mediabox)
@@ -26,32 +118,24 @@ static void
 cbz_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 {
 	fz_cbz_writer *wri = (fz_cbz_writer*)wri_;
-	fz_buffer *buffer;
-	char name[40];
 
 	fz_close_device(ctx, dev);
 	fz_drop_device(ctx, dev);
 
 	wri->count += 1;
 
-	fz_snprintf(name, sizeof name, "p%04d.png", wri->count);
-
-	buffer = fz_new_buffer_from_pixmap_as_png(ctx, wri->pixmap);
-	fz_try(ctx)
-		fz_write_zip_entry(ctx, wri->zip, name, buffer, 0);
-	fz_always(ctx)
-		fz_drop_buffer(ctx, buffer);
-	fz_catch(ctx)
-		fz_rethrow(ctx);
-
-	fz_drop_pixmap(ctx, wri->pixmap);
+	wri->batch[wri->batch_len++] = wri->pixmap;
 	wri->pixmap = NULL;
+
+	if (wri->batch_len == wri->batch_max)
+		cbz_flush_batch(ctx, wri);
 }
 
 static void
 cbz_close_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	fz_cbz_writer *wri = (fz_cbz_writer*)wri_;
+	cbz_flush_batch(ctx, wri);
 	fz_close_zip_writer(ctx, wri->zip);
 }
 
@@ -59,6 +143,11 @@ static void
 cbz_drop_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	fz_cbz_writer *wri = (fz_cbz_writer*)wri_;
+	int i;
+
+	for (i = 0; i < wri->batch_len; i++)
+		fz_drop_pixmap(ctx, wri->batch[i]);
+	fz_free(ctx, wri->batch);
 	fz_drop_zip_writer(ctx, wri->zip);
 	fz_drop_pixmap(ctx, wri->pixmap);
 }
@@ -67,6 +156,7 @@ fz_document_writer *
 fz_new_cbz_writer(fz_context *ctx, const char *path, const char *options)
 {
 	fz_cbz_writer *wri;
+	const char *val;
 
 	wri = fz_malloc_struct(ctx, fz_cbz_writer);
 	wri->super.begin_page = cbz_begin_page;
@@ -77,10 +167,33 @@ fz_new_cbz_writer(fz_context *ctx, const char *path, const char *options)
 	fz_try(ctx)
 	{
 		fz_parse_draw_options(ctx, &wri->options, options);
+
+		wri->quality = 90;
+		wri->threads = fz_worker_threads(ctx);
+		if (fz_has_option(ctx, options, "format", &val))
+		{
+			if (opteq(val, "jpeg") || opteq(val, "jpg"))
+				wri->format = CBZ_FORMAT_JPEG;
+			else if (opteq(val, "png"))
+				wri->format = CBZ_FORMAT_PNG;
+			else
+				fz_throw(ctx, FZ_ERROR_GENERIC, "unknown cbz page format");
+		}
+		if (fz_has_option(ctx, options, "quality", &val))
+			wri->quality = fz_clampi(atoi(val), 0, 100);
+		if (fz_has_option(ctx, options, "compress", &val))
+			wri->compress = opteq(val, "yes");
+		if (fz_has_option(ctx, options, "threads", &val))
+			wri->threads = atoi(val);
+
+		wri->batch_max = (wri->threads > 1 && fz_can_run_workers(ctx)) ? wri->threads : 1;
+		wri->batch = fz_calloc(ctx, wri->batch_max, sizeof *wri->batch);
+
 		wri->zip = fz_new_zip_writer(ctx, path ? path : "out.cbz");
 	}
 	fz_catch(ctx)
 	{
+		fz_free(ctx, wri->batch);
 		fz_free(ctx, wri);
 		fz_rethrow(ctx);
 	}
@@ -0,0 +1,202 @@
+#include "mupdf/fitz.h"
+
+#include <jpeglib.h>
+
+#ifdef SHARE_JPEG
+
+#define JZ_CTX_FROM_CINFO(c) (fz_context *)(c->client_data)
+
+#define fz_jpg_mem_init(ctx, cinfo)
+#define fz_jpg_mem_term(cinfo)
+
+#else /* SHARE_JPEG */
+
+typedef void * backing_store_ptr;
+#include "jmemcust.h"
+
+#define JZ_CTX_FROM_CINFO(c) (fz_context *)(GET_CUST_MEM_DATA(c)->priv)
+
+static void *
+fz_jpg_mem_alloc(j_common_ptr cinfo, size_t size)
+{
+	fz_context *ctx = JZ_CTX_FROM_CINFO(cinfo);
+	return fz_malloc(ctx, size);
+}
+
+static void
+fz_jpg_mem_free(j_common_ptr cinfo, void *object, size_t size)
+{
+	fz_context *ctx = JZ_CTX_FROM_CINFO(cinfo);
+	fz_free(ctx, object);
+}
+
+static void
+fz_jpg_mem_init(fz_context *ctx, struct jpeg_compress_struct *cinfo)
+{
+	jpeg_cust_mem_data *custmptr;
+
+	custmptr = fz_malloc_struct(ctx, jpeg_cust_mem_data);
+
+	if (!jpeg_cust_mem_init(custmptr, (void *) ctx, NULL, NULL, NULL,
+				fz_jpg_mem_alloc, fz_jpg_mem_free,
+				fz_jpg_mem_alloc, fz_jpg_mem_free, NULL))
+	{
+		fz_free(ctx, custmptr);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot initialize custom JPEG memory handler");
+	}
+
+	cinfo->client_data = custmptr;
+}
+
+static void
+fz_jpg_mem_term(struct jpeg_compress_struct *cinfo)
+{
+	if(cinfo->client_data)
+	{
+		fz_context *ctx = JZ_CTX_FROM_CINFO(cinfo);
+		fz_free(ctx, cinfo->client_data);
+		cinfo->client_data = NULL;
+	}
+}
+
+#endif /* SHARE_JPEG */
+
+typedef struct
+{
+	struct jpeg_destination_mgr super;
+	fz_context *ctx;
+	fz_output *out;
+	unsigned char buffer[16384];
+} fz_jpg_dest;
+
+static void error_exit(j_common_ptr cinfo)
+{
+	char msg[JMSG_LENGTH_MAX];
+	fz_context *ctx = JZ_CTX_FROM_CINFO(cinfo);
+
+	cinfo->err->format_message(cinfo, msg);
+	fz_throw(ctx, FZ_ERROR_GENERIC, "jpeg error: %s", msg);
+}
+
+static void init_destination(j_compress_ptr cinfo)
+{
+	fz_jpg_dest *dest = (fz_jpg_dest *)cinfo->dest;
+	dest->super.next_output_byte = dest->buffer;
+	dest->super.free_in_buffer = sizeof dest->buffer;
+}
+
+static boolean empty_output_buffer(j_compress_ptr cinfo)
+{
+	fz_jpg_dest *dest = (fz_jpg_dest *)cinfo->dest;
+	fz_write(dest->ctx, dest->out, dest->buffer, sizeof dest->buffer);
+	dest->super.next_output_byte = dest->buffer;
+	dest->super.free_in_buffer = sizeof dest->buffer;
+	return 1;
+}
+
+static void term_destination(j_compress_ptr cinfo)
+{
+	fz_jpg_dest *dest = (fz_jpg_dest *)cinfo->dest;
+	fz_write(dest->ctx, dest->out, dest->buffer, sizeof dest->buffer - dest->super.free_in_buffer);
+}
+
+void
+fz_write_pixmap_as_jpeg(fz_context *ctx, fz_output *out, fz_pixmap *pix, int quality)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr err;
+	fz_jpg_dest *dest = NULL;
+	fz_pixmap *pix2 = NULL;
+	unsigned char *row[1];
+	int stage = 0;
+
+	fz_var(dest);
+	fz_var(pix2);
+	fz_var(stage);
+
+	if (pix->alpha)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write pixmap with alpha as JPEG");
+
+	fz_try(ctx)
+	{
+		if (pix->colorspace != fz_device_gray(ctx) && pix->colorspace != fz_device_rgb(ctx))
+		{
+			pix2 = fz_new_pixmap(ctx, fz_device_rgb(ctx), pix->w, pix->h, 0);
+			fz_convert_pixmap(ctx, pix2, pix);
+			pix = pix2;
+		}
+
+		dest = fz_malloc_struct(ctx, fz_jpg_dest);
+		dest->ctx = ctx;
+		dest->out = out;
+		dest->super.init_destination = init_destination;
+		dest->super.empty_output_buffer = empty_output_buffer;
+		dest->super.term_destination = term_destination;
+
+		cinfo.client_data = ctx;
+		cinfo.err = jpeg_std_error(&err);
+		err.error_exit = error_exit;
+
+		fz_jpg_mem_init(ctx, &cinfo);
+		stage = 1;
+
+		jpeg_create_compress(&cinfo);
+		stage = 2;
+
+		cinfo.dest = &dest->super;
+		cinfo.image_width = pix->w;
+		cinfo.image_height = pix->h;
+		cinfo.input_components = pix->n;
+		cinfo.in_color_space = pix->n == 1 ? JCS_GRAYSCALE : JCS_RGB;
+
+		jpeg_set_defaults(&cinfo);
+		jpeg_set_quality(&cinfo, fz_clampi(quality, 0, 100), 1);
+		cinfo.density_unit = 1;
+		cinfo.X_density = pix->xres;
+		cinfo.Y_density = pix->yres;
+
+		jpeg_start_compress(&cinfo, 1);
+		while (cinfo.next_scanline < cinfo.image_height)
+		{
+			row[0] = pix->samples + (size_t)cinfo.next_scanline * pix->stride;
+			jpeg_write_scanlines(&cinfo, row, 1);
+		}
+		jpeg_finish_compress(&cinfo);
+	}
+	fz_always(ctx)
+	{
+		if (stage >= 2)
+			jpeg_destroy_compress(&cinfo);
+		if (stage >= 1)
+			fz_jpg_mem_term(&cinfo);
+		fz_free(ctx, dest);
+		fz_drop_pixmap(ctx, pix2);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+fz_buffer *
+fz_new_buffer_from_pixmap_as_jpeg(fz_context *ctx, fz_pixmap *pix, int quality)
+{
+	fz_buffer *buf = NULL;
+	fz_output *out = NULL;
+
+	fz_var(buf);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		buf = fz_new_buffer(ctx, 1024);
+		out = fz_new_output_with_buffer(ctx, buf);
+		fz_write_pixmap_as_jpeg(ctx, out, pix, quality);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
@@ -700,7 +700,6 @@ struct fz_color_pcl_output_context_s
 	unsigned char *linebuf;
 	unsigned char *compbuf;
 	unsigned char *prev;
-	unsigned char *curr;
 	int fill;
 	int seed_valid;
 };
@@ -722,10 +721,9 @@ fz_color_pcl_output_context *fz_write_color_pcl_header(fz_context *ctx, fz_outpu
 
 	fz_try(ctx)
 	{
-		pcoc->linebuf = fz_malloc(ctx, w * 3 * 2);
+		pcoc->linebuf = fz_malloc(ctx, w * 3);
 		pcoc->compbuf = fz_malloc(ctx, 32767);
 		pcoc->prev = pcoc->linebuf;
-		pcoc->curr = pcoc->linebuf + w * 3;
 		pcoc->fill = 0;
 		pcoc->seed_valid = 0;
 	}
@@ -777,137 +775,264 @@ fz_color_pcl_output_context *fz_write_color_pcl_header(fz_context *ctx, fz_outpu
 	return pcoc;
 }
 
+/*
+	The rows of a band are analysed and delta compressed in batches
+	on worker threads (see fz_tune_worker_threads), and the results
+	are then fed in order through the sequential state machine that
+	decides what to send. A row can only be delta compressed against
+	the row immediately above it (any blank row in between resets
+	the seed), so each batch job only needs the row before its first
+	one.
+*/
+enum { PCL_JOB_ROWS = 16 };
+
+enum
+{
+	PCL_ROW_BLANK = 1,
+	PCL_ROW_SAME_AS_SEED = 2,
+	PCL_ROW_DUPLICATE = 4
+};
+
+typedef struct color_pcl_batch_s
+{
+	const unsigned char *sp;
+	const unsigned char *seed;
+	int seed_valid;
+	int w, stride;
+	int first, rows;
+	unsigned char *flags;
+	int *len;
+	unsigned char *data;
+} color_pcl_batch;
+
+static void
+color_pcl_batch_worker(fz_context *ctx, void *arg, int idx)
+{
+	color_pcl_batch *batch = (color_pcl_batch *)arg;
+	int ds = batch->w * 3;
+	int ss = batch->w * 4;
+	int i = idx * PCL_JOB_ROWS;
+	int end = fz_mini(i + PCL_JOB_ROWS, batch->rows);
+	const unsigned char *sp = batch->sp + (size_t)i * batch->stride;
+	unsigned char *linebuf, *prev, *curr, *tmp;
+	int have_seed;
+
+	linebuf = fz_malloc(ctx, ds * 2);
+	prev = linebuf;
+	curr = linebuf + ds;
+
+	if (batch->first + i == 0)
+	{
+		have_seed = batch->seed_valid;
+		memcpy(prev, batch->seed, ds);
+	}
+	else
+		have_seed = !line_is_blank(prev, sp - batch->stride, batch->w);
+
+	for (; i < end; i++, sp += batch->stride)
+	{
+		int flags = 0;
+		int len = 0;
+
+		if (line_is_blank(curr, sp, batch->w))
+			flags = PCL_ROW_BLANK;
+		else if (have_seed)
+		{
+			if (memcmp(curr, prev, ds) == 0)
+			{
+				flags = PCL_ROW_SAME_AS_SEED;
+				if (batch->first + i > 0 && memcmp(sp - batch->stride, sp, ss) == 0)
+					flags |= PCL_ROW_DUPLICATE;
+			}
+			else
+				len = delta_compression(curr, prev, batch->data + (size_t)i * ds, ds, ds);
+		}
+
+		batch->flags[i] = flags;
+		batch->len[i] = len;
+		have_seed = !(flags & PCL_ROW_BLANK);
+		tmp = prev; prev = curr; curr = tmp;
+	}
+
+	fz_free(ctx, linebuf);
+}
+
 void fz_write_color_pcl_band(fz_context *ctx, fz_output *out, fz_color_pcl_output_context *pcoc, int w, int h, int n, int stride, int band_start, int bandheight, unsigned char *sp)
 {
-	int y, ss, ds, seed_valid, fill;
-	unsigned char *prev;
-	unsigned char *curr;
+	color_pcl_batch batch = { 0 };
+	int y, i, ds, seed_valid, fill, blanks, dups, batch_rows;
 	unsigned char *comp;
 
 	if (!out || !pcoc)
 		return;
 
 	ds = w * 3;
-	ss = w * 4;
 
-	prev = pcoc->prev;
-	curr = pcoc->curr;
 	fill = pcoc->fill;
 	comp = pcoc->compbuf;
 	seed_valid = pcoc->seed_valid;
 
 	if (band_start+bandheight >= h)
 		bandheight = h - band_start;
+	if (bandheight <= 0)
+		return;
+
+	batch_rows = fz_mini(bandheight, fz_maxi(fz_worker_threads(ctx), 1) * 2 * PCL_JOB_ROWS);
+
+	batch.seed = pcoc->prev;
+	batch.seed_valid = seed_valid;
+	batch.w = w;
+	batch.stride = stride;
 
-	y = 0;
-	while (y < bandheight)
+	fz_var(batch.flags);
+	fz_var(batch.len);
+	fz_var(batch.data);
+
+	fz_try(ctx)
 	{
-		/* Skip over multiple blank lines */
-		int blanks;
-		do
+		batch.flags = fz_malloc(ctx, batch_rows);
+		batch.len = fz_malloc_array(ctx, batch_rows, sizeof *batch.len);
+		batch.data = fz_malloc_array(ctx, batch_rows, ds);
+
+		blanks = 0;
+		dups = 0;
+		for (y = 0; y < bandheight; y += batch.rows)
 		{
-			blanks = 0;
-			while (blanks < 32767 && y < bandheight)
-			{
-				if (!line_is_blank(curr, sp, w))
-					break;
-				blanks++;
-			}
+			batch.sp = sp + (size_t)y * stride;
+			batch.first = y;
+			batch.rows = fz_mini(batch_rows, bandheight - y);
+			fz_run_workers(ctx, fz_worker_threads(ctx), (batch.rows + PCL_JOB_ROWS - 1) / PCL_JOB_ROWS, color_pcl_batch_worker, &batch);
 
-			if (blanks)
+			for (i = 0; i < batch.rows; i++)
 			{
-				if (fill + 3 >= 32767)
+				int flags = batch.flags[i];
+				int len;
+
+				if (dups)
+				{
+					/* Extend a run of duplicated rows */
+					if ((flags & PCL_ROW_DUPLICATE) && dups < 32767)
+					{
+						dups++;
+						continue;
+					}
+					comp[fill++] = 5; /* Duplicate row */
+					comp[fill++] = dups>>8;
+					comp[fill++] = dups & 0xFF;
+					dups = 0;
+				}
+
+				if (flags & PCL_ROW_BLANK)
+				{
+					/* Skip over multiple blank lines */
+					if (++blanks < 32767)
+						continue;
+				}
+
+				if (blanks)
+				{
+					if (fill + 3 >= 32767)
+					{
+						/* Can't fit into the block, so flush */
+						fz_printf(ctx, out, "\033*b%dW", fill);
+						fz_write(ctx, out, comp, fill);
+						fill = 0;
+					}
+					comp[fill++] = 4; /* Empty row */
+					comp[fill++] = blanks>>8;
+					comp[fill++] = blanks & 0xFF;
+					seed_valid = 0;
+					blanks = 0;
+					if (flags & PCL_ROW_BLANK)
+						continue;
+				}
+
+				/* So, at least 1 more line to copy */
+				if (seed_valid && fill + 5 <= 32767 && (flags & PCL_ROW_SAME_AS_SEED))
+				{
+					dups = 1;
+					continue;
+				}
+
+				len = 0;
+				if (seed_valid && batch.len[i] <= fz_mini(ds, 32767 - fill - 3))
+					len = batch.len[i];
+
+				if (fill + len + 3 > 32767)
 				{
-					/* Can't fit into the block, so flush */
+					/* Can't fit this into the block, so flush and send uncompressed */
 					fz_printf(ctx, out, "\033*b%dW", fill);
 					fz_write(ctx, out, comp, fill);
 					fill = 0;
+					len = 0;
+				}
+
+				if (len)
+				{
+					/* Delta compression */
+					comp[fill++] = 3; /* Delta compression */
+					comp[fill++] = len>>8;
+					comp[fill++] = len & 0xFF;
+					memcpy(&comp[fill], batch.data + (size_t)i * ds, len);
+					fill += len;
+				}
+				else
+				{
+					if (fill + ds + 3 > 32767)
+					{
+						/* Can't fit a line uncompressed, so flush */
+						fz_printf(ctx, out, "\033*b%dW", fill);
+						fz_write(ctx, out, comp, fill);
+						fill = 0;
+					}
+
+					/* Unencoded */
+					/* Transfer Raster Data: ds+3 bytes, 0 = Unencoded, count high, count low */
+					comp[fill++] = 0;
+					comp[fill++] = ds>>8;
+					comp[fill++] = ds & 0xFF;
+					line_is_blank(&comp[fill], batch.sp + (size_t)i * stride, w);
+					fill += ds;
+					seed_valid = 1;
 				}
-				comp[fill++] = 4; /* Empty row */
-				comp[fill++] = blanks>>8;
-				comp[fill++] = blanks & 0xFF;
-				seed_valid = 0;
 			}
 		}
-		while (blanks == 32767);
-
-		if (y == bandheight)
-			break;
 
-		/* So, at least 1 more line to copy, and it's in curr */
-		if (seed_valid && fill + 5 <= 32767 && memcmp(curr, prev, ds) == 0)
+		if (dups)
 		{
-			int count = 1;
-			sp += stride;
-			y++;
-			while (count < 32767 && y < h)
-			{
-				if (memcmp(sp-stride, sp, ss) != 0)
-					break;
-				count++;
-				sp += stride;
-				y++;
-			}
 			comp[fill++] = 5; /* Duplicate row */
-			comp[fill++] = count>>8;
-			comp[fill++] = count & 0xFF;
+			comp[fill++] = dups>>8;
+			comp[fill++] = dups & 0xFF;
 		}
-		else
+		if (blanks)
 		{
-			unsigned char *tmp;
-			int len = 0;
-
-			if (seed_valid)
-				len = delta_compression(curr, prev, &comp[fill+3], ds, fz_mini(ds, 32767 - fill - len - 3));
-
-			if (fill + len + 3 > 32767)
+			if (fill + 3 >= 32767)
 			{
-				/* Can't fit this into the block, so flush and send uncompressed */
+				/* Can't fit into the block, so flush */
 				fz_printf(ctx, out, "\033*b%dW", fill);
 				fz_write(ctx, out, comp, fill);
 				fill = 0;
-				len = 0;
-			}
-
-			if (len)
-			{
-				/* Delta compression - Data already in the buffer. */
-				comp[fill++] = 3; /* Delta compression */
-				comp[fill++] = len>>8;
-				comp[fill++] = len & 0xFF;
-				fill += len;
-			}
-			else
-			{
-				if (fill + ds + 3 > 32767)
-				{
-					/* Can't fit a line uncompressed, so flush */
-					fz_printf(ctx, out, "\033*b%dW", fill);
-					fz_write(ctx, out, comp, fill);
-					fill = 0;
-				}
-
-				/* Unencoded */
-				/* Transfer Raster Data: ds+3 bytes, 0 = Unencoded, count high, count low */
-				comp[fill++] = 0;
-				comp[fill++] = ds>>8;
-				comp[fill++] = ds & 0xFF;
-				memcpy(&comp[fill], curr, ds);
-				fill += ds;
-				seed_valid = 1;
 			}
-
-			/* curr becomes prev */
-			tmp = prev; prev = curr; curr = tmp;
-			sp += stride;
-			y++;
+			comp[fill++] = 4; /* Empty row */
+			comp[fill++] = blanks>>8;
+			comp[fill++] = blanks & 0xFF;
+			seed_valid = 0;
 		}
+
+		/* The last row of the band is the seed for the next band. */
+		if (seed_valid)
+			line_is_blank(pcoc->prev, sp + (size_t)(bandheight - 1) * stride, w);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, batch.flags);
+		fz_free(ctx, batch.len);
+		fz_free(ctx, batch.data);
 	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 
-	pcoc->prev = prev;
-	pcoc->curr = curr;
 	pcoc->fill = fill;
-	pcoc->compbuf = comp;
 	pcoc->seed_valid = seed_valid;
 }
 
@@ -1068,8 +1193,6 @@ struct fz_mono_pcl_output_context_s
 {
 	fz_pcl_options options;
 	unsigned char *prev;
-	unsigned char *mode2buf;
-	unsigned char *mode3buf;
 	int top_of_page;
 	int num_blank_lines;
 };
@@ -1078,8 +1201,6 @@ fz_mono_pcl_output_context *fz_write_mono_pcl_header(fz_context *ctx, fz_output
 {
 	fz_mono_pcl_output_context *pcoc = fz_malloc_struct(ctx, fz_mono_pcl_output_context);
 	int line_size;
-	int max_mode_2_size;
-	int max_mode_3_size;
 
 	if (!out)
 		return NULL;
@@ -1090,22 +1211,16 @@ fz_mono_pcl_output_context *fz_write_mono_pcl_header(fz_context *ctx, fz_output
 		fz_pcl_preset(ctx, &pcoc->options, "generic");
 
 	line_size = (w + 7)/8;
-	max_mode_2_size = line_size + (line_size/127) + 1;
-	max_mode_3_size = line_size + (line_size/8) + 1;
 
 	fz_try(ctx)
 	{
 		pcoc->prev = fz_calloc(ctx, line_size, sizeof(unsigned char));
-		pcoc->mode2buf = fz_calloc(ctx, max_mode_2_size, sizeof(unsigned char));
-		pcoc->mode3buf = fz_calloc(ctx, max_mode_3_size, sizeof(unsigned char));
 		pcoc->num_blank_lines = 0;
 		pcoc->top_of_page = 1;
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, pcoc->prev);
-		fz_free(ctx, pcoc->mode2buf);
-		fz_free(ctx, pcoc->mode3buf);
+		fz_free(ctx, pcoc);
 		fz_rethrow(ctx);
 	}
 
@@ -1121,168 +1236,282 @@ fz_mono_pcl_output_context *fz_write_mono_pcl_header(fz_context *ctx, fz_output
 	return pcoc;
 }
 
+/*
+	As for colour output, rows are compressed in batches on worker
+	threads ahead of the sequential pass that picks the mode for
+	each row and emits it. The mode 3 seed row is the row above, or
+	all zeros after a blank row, so every batch job can reconstruct
+	the seed for its first row.
+*/
+typedef struct mono_pcl_batch_s
+{
+	const unsigned char *sp;
+	const unsigned char *seed;
+	int stride, line_size, rmask;
+	int mode2, mode3;
+	int max_mode_2_size, max_mode_3_size;
+	int first, rows;
+	unsigned char *blank;
+	int *count2, *count3;
+	unsigned char *data;
+} mono_pcl_batch;
+
+static int
+mono_line_is_blank(const unsigned char *data, int line_size, int rmask)
+{
+	const unsigned char *end_data = data + line_size;
+
+	if ((end_data[-1] & rmask) == 0)
+	{
+		end_data--;
+		while (end_data > data && end_data[-1] == 0)
+			end_data--;
+	}
+	return end_data == data;
+}
+
+static void
+mono_pcl_batch_worker(fz_context *ctx, void *arg, int idx)
+{
+	mono_pcl_batch *batch = (mono_pcl_batch *)arg;
+	int slot = batch->max_mode_3_size + batch->max_mode_2_size;
+	int i = idx * PCL_JOB_ROWS;
+	int end = fz_mini(i + PCL_JOB_ROWS, batch->rows);
+	const unsigned char *data = batch->sp + (size_t)i * batch->stride;
+	unsigned char *prev = NULL;
+
+	if (batch->mode3)
+	{
+		prev = fz_malloc(ctx, batch->line_size);
+		if (batch->first + i == 0)
+			memcpy(prev, batch->seed, batch->line_size);
+		else if (mono_line_is_blank(data - batch->stride, batch->line_size, batch->rmask))
+			memset(prev, 0, batch->line_size);
+		else
+			memcpy(prev, data - batch->stride, batch->line_size);
+	}
+
+	for (; i < end; i++, data += batch->stride)
+	{
+		unsigned char *mode3buf = batch->data + (size_t)i * slot;
+		unsigned char *mode2buf = mode3buf + batch->max_mode_3_size;
+
+		batch->blank[i] = mono_line_is_blank(data, batch->line_size, batch->rmask);
+		if (batch->blank[i])
+		{
+			/* The seed row is cleared after skipping blank lines. */
+			if (prev)
+				memset(prev, 0, batch->line_size);
+			continue;
+		}
+
+		if (batch->mode3)
+			batch->count3[i] = mode3compress(mode3buf, data, prev, batch->line_size);
+		if (batch->mode2)
+			batch->count2[i] = mode2compress(mode2buf, (unsigned char *)data, batch->line_size);
+	}
+
+	fz_free(ctx, prev);
+}
+
 void fz_write_mono_pcl_band(fz_context *ctx, fz_output *out, fz_mono_pcl_output_context *poc, const fz_bitmap *bitmap)
 {
+	mono_pcl_batch batch = { 0 };
 	unsigned char *data, *out_data;
-	int y, ss, rmask, line_size;
+	int y, i, ss, line_size, slot, batch_rows;
 	int num_blank_lines;
 	int compression = -1;
-	unsigned char *prev = NULL;
-	unsigned char *mode2buf = NULL;
-	unsigned char *mode3buf = NULL;
 	int out_count;
 	const fz_pcl_options *pcl;
 
-	if (!out || !bitmap)
+	if (!out || !bitmap || bitmap->h <= 0)
 		return;
 
 	num_blank_lines = poc->num_blank_lines;
-	rmask = ~0 << (-bitmap->w & 7);
 	line_size = (bitmap->w + 7)/8;
-	prev = poc->prev;
-	mode2buf = poc->mode2buf;
-	mode3buf = poc->mode3buf;
 	pcl = &poc->options;
-
-	/* Transfer raster graphics. */
-	data = bitmap->samples;
 	ss = bitmap->stride;
-	for (y = 0; y < bitmap->h; y++, data += ss)
+
+	batch.stride = ss;
+	batch.line_size = line_size;
+	batch.rmask = ~0 << (-bitmap->w & 7);
+	batch.mode3 = !!(pcl->features & PCL_MODE_3_COMPRESSION);
+	batch.mode2 = batch.mode3 || (pcl->features & PCL_MODE_2_COMPRESSION);
+	batch.max_mode_2_size = line_size + (line_size/127) + 1;
+	batch.max_mode_3_size = line_size + (line_size/8) + 1;
+	slot = batch.max_mode_2_size + batch.max_mode_3_size;
+	batch_rows = fz_mini(bitmap->h, fz_maxi(fz_worker_threads(ctx), 1) * 2 * PCL_JOB_ROWS);
+
+	/* After blank lines (including at the top of the page) the seed
+	 * row is all zeros. */
+	if (num_blank_lines != 0)
+		memset(poc->prev, 0, line_size);
+	batch.seed = poc->prev;
+
+	fz_var(batch.blank);
+	fz_var(batch.count2);
+	fz_var(batch.count3);
+	fz_var(batch.data);
+
+	fz_try(ctx)
 	{
-		unsigned char *end_data = data + line_size;
+		batch.blank = fz_malloc(ctx, batch_rows);
+		batch.count2 = fz_malloc_array(ctx, batch_rows, sizeof *batch.count2);
+		batch.count3 = fz_malloc_array(ctx, batch_rows, sizeof *batch.count3);
+		batch.data = fz_malloc_array(ctx, batch_rows, slot);
 
-		if ((end_data[-1] & rmask) == 0)
-		{
-			end_data--;
-			while (end_data > data && end_data[-1] == 0)
-				end_data--;
-		}
-		if (end_data == data)
+		/* Transfer raster graphics. */
+		for (y = 0; y < bitmap->h; y += batch.rows)
 		{
-			/* Blank line */
-			num_blank_lines++;
-			continue;
-		}
+			batch.sp = bitmap->samples + (size_t)y * ss;
+			batch.first = y;
+			batch.rows = fz_mini(batch_rows, bitmap->h - y);
+			fz_run_workers(ctx, fz_worker_threads(ctx), (batch.rows + PCL_JOB_ROWS - 1) / PCL_JOB_ROWS, mono_pcl_batch_worker, &batch);
 
-		/* We've reached a non-blank line. */
-		/* Put out a spacing command if necessary. */
-		if (poc->top_of_page)
-		{
-			poc->top_of_page = 0;
-			/* We're at the top of a page. */
-			if (pcl->features & PCL_ANY_SPACING)
+			for (i = 0, data = (unsigned char *)batch.sp; i < batch.rows; i++, data += ss)
 			{
-				if (num_blank_lines > 0)
-					fz_printf(ctx, out, "\033*p+%dY", num_blank_lines);
-				/* Start raster graphics. */
-				fz_puts(ctx, out, "\033*r1A");
-			}
-			else if (pcl->features & PCL_MODE_3_COMPRESSION)
-			{
-				/* Start raster graphics. */
-				fz_puts(ctx, out, "\033*r1A");
-				for (; num_blank_lines; num_blank_lines--)
-					fz_puts(ctx, out, "\033*b0W");
-			}
-			else
-			{
-				/* Start raster graphics. */
-				fz_puts(ctx, out, "\033*r1A");
-				for (; num_blank_lines; num_blank_lines--)
-					fz_puts(ctx, out, "\033*bW");
-			}
-		}
+				unsigned char *mode3buf = batch.data + (size_t)i * slot;
+				unsigned char *mode2buf = mode3buf + batch.max_mode_3_size;
 
-		/* Skip blank lines if any */
-		else if (num_blank_lines != 0)
-		{
-			/* Moving down from current position causes head
-			 * motion on the DeskJet, so if the number of lines
-			 * is small, we're better off printing blanks.
-			 *
-			 * For Canon LBP4i and some others, <ESC>*b<n>Y
-			 * doesn't properly clear the seed row if we are in
-			 * compression mode 3.
-			 */
-			if ((num_blank_lines < MIN_SKIP_LINES && compression != 3) ||
-					!(pcl->features & PCL_ANY_SPACING))
-			{
-				int mode_3ns = ((pcl->features & PCL_MODE_3_COMPRESSION) && !(pcl->features & PCL_ANY_SPACING));
-				if (mode_3ns && compression != 2)
+				if (batch.blank[i])
+				{
+					/* Blank line */
+					num_blank_lines++;
+					continue;
+				}
+
+				/* We've reached a non-blank line. */
+				/* Put out a spacing command if necessary. */
+				if (poc->top_of_page)
 				{
-					/* Switch to mode 2 */
-					fz_puts(ctx, out, from3to2);
-					compression = 2;
+					poc->top_of_page = 0;
+					/* We're at the top of a page. */
+					if (pcl->features & PCL_ANY_SPACING)
+					{
+						if (num_blank_lines > 0)
+							fz_printf(ctx, out, "\033*p+%dY", num_blank_lines);
+						/* Start raster graphics. */
+						fz_puts(ctx, out, "\033*r1A");
+					}
+					else if (pcl->features & PCL_MODE_3_COMPRESSION)
+					{
+						/* Start raster graphics. */
+						fz_puts(ctx, out, "\033*r1A");
+						for (; num_blank_lines; num_blank_lines--)
+							fz_puts(ctx, out, "\033*b0W");
+					}
+					else
+					{
+						/* Start raster graphics. */
+						fz_puts(ctx, out, "\033*r1A");
+						for (; num_blank_lines; num_blank_lines--)
+							fz_puts(ctx, out, "\033*bW");
+					}
+				}
+
+				/* Skip blank lines if any */
+				else if (num_blank_lines != 0)
+				{
+					/* Moving down from current position causes head
+					 * motion on the DeskJet, so if the number of lines
+					 * is small, we're better off printing blanks.
+					 *
+					 * For Canon LBP4i and some others, <ESC>*b<n>Y
+					 * doesn't properly clear the seed row if we are in
+					 * compression mode 3.
+					 */
+					if ((num_blank_lines < MIN_SKIP_LINES && compression != 3) ||
+							!(pcl->features & PCL_ANY_SPACING))
+					{
+						int mode_3ns = ((pcl->features & PCL_MODE_3_COMPRESSION) && !(pcl->features & PCL_ANY_SPACING));
+						if (mode_3ns && compression != 2)
+						{
+							/* Switch to mode 2 */
+							fz_puts(ctx, out, from3to2);
+							compression = 2;
+						}
+						if (pcl->features & PCL_MODE_3_COMPRESSION)
+						{
+							/* Must clear the seed row. */
+							fz_puts(ctx, out, "\033*b1Y");
+							num_blank_lines--;
+						}
+						if (mode_3ns)
+						{
+							for (; num_blank_lines; num_blank_lines--)
+								fz_puts(ctx, out, "\033*b0W");
+						}
+						else
+						{
+							for (; num_blank_lines; num_blank_lines--)
+								fz_puts(ctx, out, "\033*bW");
+						}
+					}
+					else if (pcl->features & PCL3_SPACING)
+						fz_printf(ctx, out, "\033*p+%dY", num_blank_lines * bitmap->yres);
+					else
+						fz_printf(ctx, out, "\033*b%dY", num_blank_lines);
 				}
+				num_blank_lines = 0;
+
+				/* Choose the best compression mode for this particular line. */
 				if (pcl->features & PCL_MODE_3_COMPRESSION)
 				{
-					/* Must clear the seed row. */
-					fz_puts(ctx, out, "\033*b1Y");
-					num_blank_lines--;
+					/* Compression modes 2 and 3 are both available. Try
+					 * both and see which produces the least output data.
+					 */
+					int count3 = batch.count3[i];
+					int count2 = batch.count2[i];
+					int penalty3 = (compression == 3 ? 0 : penalty_from2to3);
+					int penalty2 = (compression == 2 ? 0 : penalty_from3to2);
+
+					if (count3 + penalty3 < count2 + penalty2)
+					{
+						if (compression != 3)
+							fz_puts(ctx, out, from2to3);
+						compression = 3;
+						out_data = mode3buf;
+						out_count = count3;
+					}
+					else
+					{
+						if (compression != 2)
+							fz_puts(ctx, out, from3to2);
+						compression = 2;
+						out_data = mode2buf;
+						out_count = count2;
+					}
 				}
-				if (mode_3ns)
+				else if (pcl->features & PCL_MODE_2_COMPRESSION)
 				{
-					for (; num_blank_lines; num_blank_lines--)
-						fz_puts(ctx, out, "\033*b0W");
+					out_data = mode2buf;
+					out_count = batch.count2[i];
 				}
 				else
 				{
-					for (; num_blank_lines; num_blank_lines--)
-						fz_puts(ctx, out, "\033*bW");
+					out_data = data;
+					out_count = line_size;
 				}
-			}
-			else if (pcl->features & PCL3_SPACING)
-				fz_printf(ctx, out, "\033*p+%dY", num_blank_lines * bitmap->yres);
-			else
-				fz_printf(ctx, out, "\033*b%dY", num_blank_lines);
-			/* Clear the seed row (only matters for mode 3 compression). */
-			memset(prev, 0, line_size);
-		}
-		num_blank_lines = 0;
 
-		/* Choose the best compression mode for this particular line. */
-		if (pcl->features & PCL_MODE_3_COMPRESSION)
-		{
-			/* Compression modes 2 and 3 are both available. Try
-			 * both and see which produces the least output data.
-			 */
-			int count3 = mode3compress(mode3buf, data, prev, line_size);
-			int count2 = mode2compress(mode2buf, data, line_size);
-			int penalty3 = (compression == 3 ? 0 : penalty_from2to3);
-			int penalty2 = (compression == 2 ? 0 : penalty_from3to2);
-
-			if (count3 + penalty3 < count2 + penalty2)
-			{
-				if (compression != 3)
-					fz_puts(ctx, out, from2to3);
-				compression = 3;
-				out_data = (unsigned char *)mode3buf;
-				out_count = count3;
-			}
-			else
-			{
-				if (compression != 2)
-					fz_puts(ctx, out, from3to2);
-				compression = 2;
-				out_data = (unsigned char *)mode2buf;
-				out_count = count2;
+				/* Transfer the data */
+				fz_printf(ctx, out, "\033*b%dW", out_count);
+				fz_write(ctx, out, out_data, out_count);
 			}
 		}
-		else if (pcl->features & PCL_MODE_2_COMPRESSION)
-		{
-			out_data = mode2buf;
-			out_count = mode2compress(mode2buf, data, line_size);
-		}
-		else
-		{
-			out_data = data;
-			out_count = line_size;
-		}
 
-		/* Transfer the data */
-		fz_printf(ctx, out, "\033*b%dW", out_count);
-		fz_write(ctx, out, out_data, out_count);
+		/* The last row of the band is the seed for the next band. */
+		if (num_blank_lines == 0)
+			memcpy(poc->prev, bitmap->samples + (size_t)(bitmap->h - 1) * ss, line_size);
 	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, batch.blank);
+		fz_free(ctx, batch.count2);
+		fz_free(ctx, batch.count3);
+		fz_free(ctx, batch.data);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 
 	poc->num_blank_lines = num_blank_lines;
 }
@@ -1302,8 +1531,6 @@ void fz_write_mono_pcl_trailer(fz_context *ctx, fz_output *out, fz_mono_pcl_outp
 	}
 
 	fz_free(ctx, pcoc->prev);
-	fz_free(ctx, pcoc->mode2buf);
-	fz_free(ctx, pcoc->mode3buf);
 	fz_free(ctx, pcoc);
 }
 
@@ -87,169 +87,203 @@ fz_write_pwg_page_header(fz_context *ctx, fz_output *out, const fz_pwg_options *
 	fz_write(ctx, out, pwg ? pwg->page_size_name : zero, 64);
 }
 
-void
-fz_write_pixmap_as_pwg_page(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, const fz_pwg_options *pwg)
+/*
+	Rows are packbits encoded in batches on worker threads (see
+	fz_tune_worker_threads), each into a slot large enough for the
+	worst case, and then written out in order. Runs of repeated rows
+	are found from a per row flag saying whether the row matches the
+	one above it; only rows that may start a run need encoding.
+*/
+enum { PWG_JOB_ROWS = 16 };
+
+typedef struct pwg_batch_s
 {
-	unsigned char *sp;
-	int y, x, sn, dn, ss, ss2;
-
-	if (!out || !pixmap)
-		return;
-
-	if (pixmap->alpha != 0)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write pwg with alpha");
-	sn = pixmap->n;
-	if (sn != 1 && sn != 3 && sn != 4)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap must be grayscale, rgb or cmyk to write as pwg");
-
-	dn = pixmap->n;
-
-	fz_write_pwg_page_header(ctx, out, pwg, pixmap->xres, pixmap->yres, pixmap->w, pixmap->h, dn*8);
+	const unsigned char *sp;
+	int w, n, stride;
+	int first, rows;
+	size_t slot;
+	unsigned char *same;
+	int *len;
+	unsigned char *data;
+} pwg_batch;
+
+/* Encode one line of w values of n bytes each, using a packbits like
+ * compression. */
+static int
+pwg_encode_line(unsigned char *out, const unsigned char *sp, int w, int n)
+{
+	unsigned char *start = out;
+	int x = 0;
 
-	/* Now output the actual bitmap, using a packbits like compression */
-	sp = pixmap->samples;
-	ss = pixmap->w * sn;
-	ss2 = pixmap->stride;
-	y = 0;
-	while (y < pixmap->h)
+	while (x < w)
 	{
-		int yrep;
+		int d;
 
-		assert(sp == pixmap->samples + y * ss2);
-
-		/* Count the number of times this line is repeated */
-		for (yrep = 1; yrep < 256 && y+yrep < pixmap->h; yrep++)
+		/* How far do we have to look to find a repeated value? */
+		for (d = 1; d < 128 && x+d < w; d++)
 		{
-			if (memcmp(sp, sp + yrep * ss2, ss) != 0)
+			if (memcmp(sp + (d-1)*n, sp + d*n, n) == 0)
 				break;
 		}
-		fz_write_byte(ctx, out, yrep-1);
-
-		/* Encode the line */
-		x = 0;
-		while (x < pixmap->w)
+		if (d == 1)
 		{
-			int d;
+			int xrep;
 
-			assert(sp == pixmap->samples + y * ss2 + x * sn);
-
-			/* How far do we have to look to find a repeated value? */
-			for (d = 1; d < 128 && x+d < pixmap->w; d++)
+			/* We immediately have a repeat (or we've hit
+			 * the end of the line). Count the number of
+			 * times this value is repeated. */
+			for (xrep = 1; xrep < 128 && x+xrep < w; xrep++)
 			{
-				if (memcmp(sp + (d-1)*sn, sp + d*sn, sn) == 0)
+				if (memcmp(sp, sp + xrep*n, n) != 0)
 					break;
 			}
-			if (d == 1)
+			*out++ = xrep-1;
+			memcpy(out, sp, n);
+			out += n;
+			sp += n*xrep;
+			x += xrep;
+		}
+		else
+		{
+			*out++ = 257-d;
+			memcpy(out, sp, d*n);
+			out += d*n;
+			sp += d*n;
+			x += d;
+		}
+	}
+
+	return out - start;
+}
+
+static void
+pwg_batch_worker(fz_context *ctx, void *arg, int idx)
+{
+	pwg_batch *batch = (pwg_batch *)arg;
+	int i = idx * PWG_JOB_ROWS;
+	int end = fz_mini(i + PWG_JOB_ROWS, batch->rows);
+	const unsigned char *sp = batch->sp + (size_t)i * batch->stride;
+
+	for (; i < end; i++, sp += batch->stride)
+	{
+		batch->same[i] = (batch->first + i > 0 && memcmp(sp - batch->stride, sp, batch->w * batch->n) == 0);
+		if (batch->same[i])
+			batch->len[i] = -1;
+		else
+			batch->len[i] = pwg_encode_line(batch->data + i * batch->slot, sp, batch->w, batch->n);
+	}
+}
+
+static void
+pwg_write_rows(fz_context *ctx, fz_output *out, const unsigned char *samples, int w, int h, int n, int stride)
+{
+	pwg_batch batch = { 0 };
+	unsigned char *pending = NULL;
+	int y, i, yrep, pending_len, batch_rows;
+
+	if (h <= 0)
+		return;
+
+	/* Worst case is a literal pair for every two values. */
+	batch.slot = (size_t)w * n + w/2 + n + 2;
+	batch.w = w;
+	batch.n = n;
+	batch.stride = stride;
+	batch_rows = fz_mini(h, fz_maxi(fz_worker_threads(ctx), 1) * 2 * PWG_JOB_ROWS);
+
+	fz_var(batch.same);
+	fz_var(batch.len);
+	fz_var(batch.data);
+	fz_var(pending);
+
+	fz_try(ctx)
+	{
+		batch.same = fz_malloc(ctx, batch_rows);
+		batch.len = fz_malloc_array(ctx, batch_rows, sizeof *batch.len);
+		batch.data = fz_malloc_array(ctx, batch_rows, batch.slot);
+		pending = fz_malloc(ctx, batch.slot);
+
+		yrep = 0;
+		pending_len = 0;
+		for (y = 0; y < h; y += batch.rows)
+		{
+			batch.sp = samples + (size_t)y * stride;
+			batch.first = y;
+			batch.rows = fz_mini(batch_rows, h - y);
+			fz_run_workers(ctx, fz_worker_threads(ctx), (batch.rows + PWG_JOB_ROWS - 1) / PWG_JOB_ROWS, pwg_batch_worker, &batch);
+
+			for (i = 0; i < batch.rows; i++)
 			{
-				int xrep;
+				/* Count the number of times this line is repeated */
+				if (yrep > 0 && batch.same[i] && yrep < 256)
+				{
+					yrep++;
+					continue;
+				}
 
-				/* We immediately have a repeat (or we've hit
-				 * the end of the line). Count the number of
-				 * times this value is repeated. */
-				for (xrep = 1; xrep < 128 && x+xrep < pixmap->w; xrep++)
+				if (yrep > 0)
 				{
-					if (memcmp(sp, sp + xrep*sn, sn) != 0)
-						break;
+					fz_write_byte(ctx, out, yrep-1);
+					fz_write(ctx, out, pending, pending_len);
 				}
-				fz_write_byte(ctx, out, xrep-1);
-				fz_write(ctx, out, sp, dn);
-				sp += sn*xrep;
-				x += xrep;
-			}
-			else
-			{
-				fz_write_byte(ctx, out, 257-d);
-				x += d;
-				while (d > 0)
+
+				/* A run of more than 256 lines restarts on a line
+				 * that was not encoded. */
+				if (batch.len[i] < 0)
+					pending_len = pwg_encode_line(pending, batch.sp + (size_t)i * stride, w, n);
+				else
 				{
-					fz_write(ctx, out, sp, dn);
-					sp += sn;
-					d--;
+					pending_len = batch.len[i];
+					memcpy(pending, batch.data + i * batch.slot, pending_len);
 				}
+				yrep = 1;
 			}
 		}
 
-		/* Move to the next line */
-		sp += ss2*(yrep-1);
-		y += yrep;
+		fz_write_byte(ctx, out, yrep-1);
+		fz_write(ctx, out, pending, pending_len);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, batch.same);
+		fz_free(ctx, batch.len);
+		fz_free(ctx, batch.data);
+		fz_free(ctx, pending);
 	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
 void
-fz_write_bitmap_as_pwg_page(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, const fz_pwg_options *pwg)
+fz_write_pixmap_as_pwg_page(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, const fz_pwg_options *pwg)
 {
-	unsigned char *sp;
-	int y, x, ss;
-	int byte_width;
+	int sn;
 
-	if (!out || !bitmap)
+	if (!out || !pixmap)
 		return;
 
-	fz_write_pwg_page_header(ctx, out, pwg, bitmap->xres, bitmap->yres, bitmap->w, bitmap->h, 1);
-
-	/* Now output the actual bitmap, using a packbits like compression */
-	sp = bitmap->samples;
-	ss = bitmap->stride;
-	byte_width = (bitmap->w+7)/8;
-	y = 0;
-	while (y < bitmap->h)
-	{
-		int yrep;
-
-		assert(sp == bitmap->samples + y * ss);
-
-		/* Count the number of times this line is repeated */
-		for (yrep = 1; yrep < 256 && y+yrep < bitmap->h; yrep++)
-		{
-			if (memcmp(sp, sp + yrep * ss, byte_width) != 0)
-				break;
-		}
-		fz_write_byte(ctx, out, yrep-1);
+	if (pixmap->alpha != 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write pwg with alpha");
+	sn = pixmap->n;
+	if (sn != 1 && sn != 3 && sn != 4)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap must be grayscale, rgb or cmyk to write as pwg");
 
-		/* Encode the line */
-		x = 0;
-		while (x < byte_width)
-		{
-			int d;
+	fz_write_pwg_page_header(ctx, out, pwg, pixmap->xres, pixmap->yres, pixmap->w, pixmap->h, sn*8);
 
-			assert(sp == bitmap->samples + y * ss + x);
+	/* Now output the actual bitmap, using a packbits like compression */
+	pwg_write_rows(ctx, out, pixmap->samples, pixmap->w, pixmap->h, sn, pixmap->stride);
+}
 
-			/* How far do we have to look to find a repeated value? */
-			for (d = 1; d < 128 && x+d < byte_width; d++)
-			{
-				if (sp[d-1] == sp[d])
-					break;
-			}
-			if (d == 1)
-			{
-				int xrep;
+void
+fz_write_bitmap_as_pwg_page(fz_context *ctx, fz_output *out, const fz_bitmap *bitmap, const fz_pwg_options *pwg)
+{
+	if (!out || !bitmap)
+		return;
 
-				/* We immediately have a repeat (or we've hit
-				 * the end of the line). Count the number of
-				 * times this value is repeated. */
-				for (xrep = 1; xrep < 128 && x+xrep < byte_width; xrep++)
-				{
-					if (sp[0] != sp[xrep])
-						break;
-				}
-				fz_write_byte(ctx, out, xrep-1);
-				fz_write(ctx, out, sp, 1);
-				sp += xrep;
-				x += xrep;
-			}
-			else
-			{
-				fz_write_byte(ctx, out, 257-d);
-				fz_write(ctx, out, sp, d);
-				sp += d;
-				x += d;
-			}
-		}
+	fz_write_pwg_page_header(ctx, out, pwg, bitmap->xres, bitmap->yres, bitmap->w, bitmap->h, 1);
 
-		/* Move to the next line */
-		sp += ss*yrep - byte_width;
-		y += yrep;
-	}
+	/* Now output the actual bitmap, using a packbits like compression */
+	pwg_write_rows(ctx, out, bitmap->samples, (bitmap->w+7)/8, bitmap->h, 1, bitmap->stride);
 }
 
 void
@@ -581,6 +581,49 @@ static inline fz_rect *bound_expand(fz_rect *r, const fz_point *p)
 	return r;
 }
 
+int fz_path_coord_count(fz_context *ctx, const fz_path *path)
+{
+	if (path->packed == FZ_PATH_PACKED_FLAT)
+		return ((fz_packed_path *)path)->coord_len;
+	return path->coord_len;
+}
+
+void fz_digest_path(fz_context *ctx, const fz_path *path, unsigned char digest[16])
+{
+	int cmd_len, coord_len;
+	uint8_t *cmds;
+	float *coords;
+	fz_md5 md5;
+
+	switch (path->packed)
+	{
+	case FZ_PATH_UNPACKED:
+	case FZ_PATH_PACKED_OPEN:
+		cmd_len = path->cmd_len;
+		coord_len = path->coord_len;
+		coords = path->coords;
+		cmds = path->cmds;
+		break;
+	case FZ_PATH_PACKED_FLAT:
+		cmd_len = ((fz_packed_path *)path)->cmd_len;
+		coord_len = ((fz_packed_path *)path)->coord_len;
+		coords = (float *)&((fz_packed_path *)path)[1];
+		cmds = (uint8_t *)&coords[coord_len];
+		break;
+	default:
+		assert("This never happens" == NULL);
+		memset(digest, 0, 16);
+		return;
+	}
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (unsigned char *)&cmd_len, sizeof cmd_len);
+	fz_md5_update(&md5, (unsigned char *)&coord_len, sizeof coord_len);
+	fz_md5_update(&md5, cmds, cmd_len);
+	fz_md5_update(&md5, (unsigned char *)coords, coord_len * sizeof(float));
+	fz_md5_final(&md5, digest);
+}
+
 void fz_walk_path(fz_context *ctx, const fz_path *path, const fz_path_walker *proc, void *arg)
 {
 	int i, k, cmd_len;
@@ -1,44 +1,212 @@
 #include "mupdf/fitz.h"
 
+enum
+{
+	POOL_FIRST_BLOCK = 4 << 10,
+	POOL_MAX_BLOCK = 64 << 10,
+	/* Anything bigger than this gets a block of its own */
+	POOL_LARGE = 16 << 10,
+	/* Full size blocks kept by each context when pools are dropped,
+	 * so that building and dropping one page after another does not
+	 * keep growing and trimming the heap. */
+	POOL_CACHED_BLOCKS = 4
+};
+
+typedef union
+{
+	void *p;
+	double d;
+	int64_t i;
+} pool_align;
+
+#define POOL_ALIGN sizeof(pool_align)
+#define POOL_ROUND(n) (((n) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+#define POOL_HEADER POOL_ROUND(sizeof(fz_pool_node))
+#define POOL_MEM(node) ((char *)(node) + POOL_HEADER)
+
 fz_pool *fz_new_pool(fz_context *ctx)
 {
 	fz_pool *pool = fz_malloc_struct(ctx, fz_pool);
-	fz_pool_node *node = fz_malloc_struct(ctx, fz_pool_node);
-	pool->head = pool->tail = node;
-	pool->pos = node->mem;
-	pool->end = node->mem + sizeof node->mem;
+	pool->block_size = POOL_FIRST_BLOCK;
+	pool->size = sizeof *pool;
 	return pool;
 }
 
+static fz_pool_node *
+new_pool_node(fz_context *ctx, size_t size)
+{
+	fz_pool_node *node;
+	if (size == POOL_MAX_BLOCK && ctx->pool_blocks)
+	{
+		node = ctx->pool_blocks;
+		ctx->pool_blocks = node->next;
+		ctx->pool_blocks_len--;
+	}
+	else
+		node = fz_malloc(ctx, POOL_HEADER + size);
+	node->next = NULL;
+	node->size = size;
+	return node;
+}
+
+static void
+drop_pool_node(fz_context *ctx, fz_pool_node *node)
+{
+	if (node->size == POOL_MAX_BLOCK && ctx->pool_blocks_len < POOL_CACHED_BLOCKS)
+	{
+		node->next = ctx->pool_blocks;
+		ctx->pool_blocks = node;
+		ctx->pool_blocks_len++;
+	}
+	else
+		fz_free(ctx, node);
+}
+
+static void *
+pool_alloc_large(fz_context *ctx, fz_pool *pool, size_t size)
+{
+	fz_pool_node *node = new_pool_node(ctx, size);
+	node->next = pool->large;
+	pool->large = node;
+	pool->size += POOL_HEADER + size;
+	memset(POOL_MEM(node), 0, size);
+	return POOL_MEM(node);
+}
+
+/* Move on to the next block, reusing blocks kept by fz_pool_reset when they are big enough. */
+static void
+pool_next_block(fz_context *ctx, fz_pool *pool, size_t size)
+{
+	fz_pool_node *next = pool->tail ? pool->tail->next : pool->head;
+
+	if (!next || next->size < size)
+	{
+		size_t block = pool->block_size;
+		while (block < size)
+			block *= 2;
+		next = new_pool_node(ctx, block);
+		pool->size += POOL_HEADER + block;
+		if (pool->block_size < POOL_MAX_BLOCK)
+			pool->block_size *= 2;
+		if (pool->tail)
+		{
+			next->next = pool->tail->next;
+			pool->tail->next = next;
+		}
+		else
+		{
+			next->next = pool->head;
+			pool->head = next;
+		}
+	}
+
+	pool->tail = next;
+	pool->pos = POOL_MEM(next);
+	pool->end = pool->pos + next->size;
+	pool->last = NULL;
+}
+
 void *fz_pool_alloc(fz_context *ctx, fz_pool *pool, size_t size)
 {
 	char *ptr;
 
-	/* round size to pointer alignment (we don't expect to use doubles) */
-	size = ((size + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+	size = POOL_ROUND(size);
 
-	if (pool->pos + size > pool->end)
+	if (size > (size_t)(pool->end - pool->pos))
 	{
-		fz_pool_node *node = fz_malloc_struct(ctx, fz_pool_node);
-		pool->tail = pool->tail->next = node;
-		pool->pos = node->mem;
-		pool->end = node->mem + sizeof node->mem;
-		if (pool->pos + size > pool->end)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "out of memory: allocation too large to fit in pool");
+		if (size > POOL_LARGE)
+			return pool_alloc_large(ctx, pool, size);
+		pool_next_block(ctx, pool, size);
 	}
+
 	ptr = pool->pos;
 	pool->pos += size;
+	pool->last = ptr;
+	memset(ptr, 0, size);
 	return ptr;
 }
 
+void *fz_pool_realloc(fz_context *ctx, fz_pool *pool, void *ptr_, size_t old_size, size_t new_size)
+{
+	char *ptr = ptr_;
+	char *dst;
+
+	if (!ptr)
+		return fz_pool_alloc(ctx, pool, new_size);
+
+	/* The latest allocation from the current block can grow in place */
+	if (ptr == pool->last && POOL_ROUND(new_size) <= (size_t)(pool->end - ptr))
+	{
+		pool->pos = ptr + POOL_ROUND(new_size);
+		if (new_size > old_size)
+			memset(ptr + old_size, 0, new_size - old_size);
+		return ptr;
+	}
+
+	/* As can the latest large allocation */
+	if (pool->large && ptr == POOL_MEM(pool->large) && new_size > POOL_LARGE)
+	{
+		fz_pool_node *node = pool->large;
+		size_t size = POOL_ROUND(new_size);
+		node = fz_resize_array(ctx, node, 1, POOL_HEADER + size);
+		pool->size += size - node->size;
+		node->size = size;
+		pool->large = node;
+		if (new_size > old_size)
+			memset(POOL_MEM(node) + old_size, 0, new_size - old_size);
+		return POOL_MEM(node);
+	}
+
+	dst = fz_pool_alloc(ctx, pool, new_size);
+	memcpy(dst, ptr, fz_minz(old_size, new_size));
+	return dst;
+}
+
+size_t fz_pool_size(fz_context *ctx, fz_pool *pool)
+{
+	return pool->size;
+}
+
+void fz_pool_reset(fz_context *ctx, fz_pool *pool)
+{
+	fz_pool_node *node = pool->large;
+	while (node)
+	{
+		fz_pool_node *next = node->next;
+		pool->size -= POOL_HEADER + node->size;
+		drop_pool_node(ctx, node);
+		node = next;
+	}
+	pool->large = NULL;
+	pool->tail = NULL;
+	pool->pos = pool->end = pool->last = NULL;
+}
+
 void fz_drop_pool(fz_context *ctx, fz_pool *pool)
 {
-	fz_pool_node *node = pool->head;
+	fz_pool_node *node;
+	if (!pool)
+		return;
+	fz_pool_reset(ctx, pool);
+	node = pool->head;
 	while (node)
 	{
 		fz_pool_node *next = node->next;
-		fz_free(ctx, node);
+		drop_pool_node(ctx, node);
 		node = next;
 	}
 	fz_free(ctx, pool);
 }
+
+void fz_drop_pool_blocks(fz_context *ctx)
+{
+	fz_pool_node *node = ctx->pool_blocks;
+	while (node)
+	{
+		fz_pool_node *next = node->next;
+		fz_free(ctx, node);
+		node = next;
+	}
+	ctx->pool_blocks = NULL;
+	ctx->pool_blocks_len = 0;
+}
@@ -149,14 +149,9 @@ new_span_soup(fz_context *ctx)
 static void
 free_span_soup(fz_context *ctx, span_soup *soup)
 {
-	int i;
-
+	/* The spans themselves belong to the page pool */
 	if (soup == NULL)
 		return;
-	for (i = 0; i < soup->len; i++)
-	{
-		fz_free(ctx, soup->spans[i]);
-	}
 	fz_free(ctx, soup->spans);
 	fz_free(ctx, soup);
 }
@@ -197,10 +192,10 @@ push_span(fz_context *ctx, fz_stext_device *tdev, fz_stext_span *span, int new_l
 			if (page->len == page->cap)
 			{
 				int newcap = (page->cap ? page->cap*2 : 4);
-				page->blocks = fz_resize_array(ctx, page->blocks, newcap, sizeof(*page->blocks));
+				page->blocks = fz_pool_realloc(ctx, page->pool, page->blocks, page->cap * sizeof(*page->blocks), newcap * sizeof(*page->blocks));
 				page->cap = newcap;
 			}
-			block = fz_malloc_struct(ctx, fz_stext_block);
+			block = fz_pool_alloc(ctx, page->pool, sizeof *block);
 			page->blocks[page->len].type = FZ_PAGE_BLOCK_TEXT;
 			page->blocks[page->len].u.text = block;
 			block->cap = 0;
@@ -216,7 +211,7 @@ push_span(fz_context *ctx, fz_stext_device *tdev, fz_stext_span *span, int new_l
 		if (block->len == block->cap)
 		{
 			int newcap = (block->cap ? block->cap*2 : 4);
-			block->lines = fz_resize_array(ctx, block->lines, newcap, sizeof(*block->lines));
+			block->lines = fz_pool_realloc(ctx, page->pool, block->lines, block->cap * sizeof(*block->lines), newcap * sizeof(*block->lines));
 			block->cap = newcap;
 		}
 		block->lines[block->len].first_span = NULL;
@@ -458,7 +453,16 @@ fz_lookup_stext_style(fz_context *ctx, fz_stext_sheet *sheet, fz_text_span *span
 fz_stext_page *
 fz_new_stext_page(fz_context *ctx, const fz_rect *mediabox)
 {
-	fz_stext_page *page = fz_malloc(ctx, sizeof(*page));
+	fz_pool *pool = fz_new_pool(ctx);
+	fz_stext_page *page = NULL;
+	fz_try(ctx)
+		page = fz_pool_alloc(ctx, pool, sizeof(*page));
+	fz_catch(ctx)
+	{
+		fz_drop_pool(ctx, pool);
+		fz_rethrow(ctx);
+	}
+	page->pool = pool;
 	page->mediabox = *mediabox;
 	page->len = 0;
 	page->cap = 0;
@@ -467,66 +471,29 @@ fz_new_stext_page(fz_context *ctx, const fz_rect *mediabox)
 	return page;
 }
 
-static void
-fz_drop_stext_line_contents(fz_context *ctx, fz_stext_line *line)
-{
-	fz_stext_span *span, *next;
-	for (span = line->first_span; span; span=next)
-	{
-		next = span->next;
-		fz_free(ctx, span->text);
-		fz_free(ctx, span);
-	}
-}
-
-static void
-fz_drop_stext_block(fz_context *ctx, fz_stext_block *block)
-{
-	fz_stext_line *line;
-	if (block == NULL)
-		return;
-	for (line = block->lines; line < block->lines + block->len; line++)
-		fz_drop_stext_line_contents(ctx, line);
-	fz_free(ctx, block->lines);
-	fz_free(ctx, block);
-}
-
-static void
-fz_drop_image_block(fz_context *ctx, fz_image_block *block)
-{
-	if (block == NULL)
-		return;
-	fz_drop_image(ctx, block->image);
-	fz_drop_colorspace(ctx, block->cspace);
-	fz_free(ctx, block);
-}
-
 void
 fz_drop_stext_page(fz_context *ctx, fz_stext_page *page)
 {
 	fz_page_block *block;
 	if (page == NULL)
 		return;
+	/* Only image blocks hold references; everything else is in the pool */
 	for (block = page->blocks; block < page->blocks + page->len; block++)
 	{
-		switch (block->type)
+		if (block->type == FZ_PAGE_BLOCK_IMAGE)
 		{
-		case FZ_PAGE_BLOCK_TEXT:
-			fz_drop_stext_block(ctx, block->u.text);
-			break;
-		case FZ_PAGE_BLOCK_IMAGE:
-			fz_drop_image_block(ctx, block->u.image);
-			break;
+			fz_drop_image(ctx, block->u.image->image);
+			fz_drop_colorspace(ctx, block->u.image->cspace);
 		}
 	}
-	fz_free(ctx, page->blocks);
-	fz_free(ctx, page);
+	fz_drop_pool(ctx, page->pool);
 }
 
 static fz_stext_span *
-fz_new_stext_span(fz_context *ctx, const fz_point *p, int wmode, const fz_matrix *trm)
+fz_new_stext_span(fz_context *ctx, fz_pool *pool, const fz_point *p, int wmode, const fz_matrix *trm)
 {
-	fz_stext_span *span = fz_malloc_struct(ctx, fz_stext_span);
+	fz_stext_span *span = fz_pool_alloc(ctx, pool, sizeof *span);
+	memset(span, 0, sizeof *span);
 	span->ascender_max = 0;
 	span->descender_min = 0;
 	span->cap = 0;
@@ -546,12 +513,12 @@ fz_new_stext_span(fz_context *ctx, const fz_point *p, int wmode, const fz_matrix
 }
 
 static void
-add_char_to_span(fz_context *ctx, fz_stext_span *span, int c, fz_point *p, fz_point *max, fz_stext_style *style)
+add_char_to_span(fz_context *ctx, fz_pool *pool, fz_stext_span *span, int c, fz_point *p, fz_point *max, fz_stext_style *style)
 {
 	if (span->len == span->cap)
 	{
 		int newcap = (span->cap ? span->cap * 2 : 16);
-		span->text = fz_resize_array(ctx, span->text, newcap, sizeof(fz_stext_char));
+		span->text = fz_pool_realloc(ctx, pool, span->text, span->cap * sizeof(fz_stext_char), newcap * sizeof(fz_stext_char));
 		span->cap = newcap;
 		span->bbox = fz_empty_rect;
 	}
@@ -698,7 +665,7 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_stext_style *sty
 		/* Start a new span */
 		add_span_to_soup(ctx, dev->spans, dev->cur_span);
 		dev->cur_span = NULL;
-		dev->cur_span = fz_new_stext_span(ctx, &p, wmode, trm);
+		dev->cur_span = fz_new_stext_span(ctx, dev->page->pool, &p, wmode, trm);
 		dev->cur_span->spacing = 0;
 	}
 	if (add_space)
@@ -706,10 +673,10 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_stext_style *sty
 		r.x = - 0.2f;
 		r.y = 0;
 		fz_transform_point(&r, trm);
-		add_char_to_span(ctx, dev->cur_span, ' ', &p, &r, style);
+		add_char_to_span(ctx, dev->page->pool, dev->cur_span, ' ', &p, &r, style);
 	}
 no_glyph:
-	add_char_to_span(ctx, dev->cur_span, c, &p, &q, style);
+	add_char_to_span(ctx, dev->page->pool, dev->cur_span, c, &p, &q, style);
 }
 
 static void
@@ -903,10 +870,11 @@ fz_stext_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *img, const f
 	if (page->len == page->cap)
 	{
 		int newcap = (page->cap ? page->cap*2 : 4);
-		page->blocks = fz_resize_array(ctx, page->blocks, newcap, sizeof(*page->blocks));
+		page->blocks = fz_pool_realloc(ctx, page->pool, page->blocks, page->cap * sizeof(*page->blocks), newcap * sizeof(*page->blocks));
 		page->cap = newcap;
 	}
-	block = fz_malloc_struct(ctx, fz_image_block);
+	block = fz_pool_alloc(ctx, page->pool, sizeof *block);
+	memset(block, 0, sizeof *block);
 	page->blocks[page->len].type = FZ_PAGE_BLOCK_IMAGE;
 	page->blocks[page->len].u.image = block;
 	block->image = fz_keep_image(ctx, img);
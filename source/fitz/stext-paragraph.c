@@ -155,14 +155,14 @@ split_block(fz_context *ctx, fz_stext_page *page, int block_num, int linenum)
 	if (page->len == page->cap)
 	{
 		int new_cap = fz_maxi(16, page->cap * 2);
-		page->blocks = fz_resize_array(ctx, page->blocks, new_cap, sizeof(*page->blocks));
+		page->blocks = fz_pool_realloc(ctx, page->pool, page->blocks, page->cap * sizeof(*page->blocks), new_cap * sizeof(*page->blocks));
 		page->cap = new_cap;
 	}
 
+	block2 = fz_pool_alloc(ctx, page->pool, sizeof *block2);
 	memmove(page->blocks+block_num+1, page->blocks+block_num, (page->len - block_num)*sizeof(*page->blocks));
 	page->len++;
 
-	block2 = fz_malloc_struct(ctx, fz_stext_block);
 	block = page->blocks[block_num].u.text;
 
 	page->blocks[block_num+1].type = FZ_PAGE_BLOCK_TEXT;
@@ -172,7 +172,7 @@ split_block(fz_context *ctx, fz_stext_page *page, int block_num, int linenum)
 	block2->cap = 0;
 	block2->len = 0;
 	block2->lines = NULL;
-	block2->lines = fz_malloc_array(ctx, split_len, sizeof(fz_stext_line));
+	block2->lines = fz_pool_alloc(ctx, page->pool, split_len * sizeof(fz_stext_line));
 	block2->cap = block2->len;
 	block2->len = split_len;
 	block->len = linenum;
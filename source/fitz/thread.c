@@ -0,0 +1,181 @@
+#include "mupdf/fitz.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define FZ_THREADS 1
+#elif defined(HAVE_PTHREADS)
+#include <pthread.h>
+#define FZ_THREADS 2
+#endif
+
+/* Never spawn more than this many extra threads for one batch of jobs. */
+enum { MAX_WORKER_THREADS = 64 };
+
+#if FZ_THREADS == 1
+#define MUTEX CRITICAL_SECTION
+#define MUTEX_INIT(A) InitializeCriticalSection(&A)
+#define MUTEX_FIN(A) DeleteCriticalSection(&A)
+#define MUTEX_LOCK(A) EnterCriticalSection(&A)
+#define MUTEX_UNLOCK(A) LeaveCriticalSection(&A)
+#define THREAD HANDLE
+#define THREAD_INIT(A,B,C) ((A = CreateThread(NULL, 0, B, C, 0, NULL)) != NULL)
+#define THREAD_FIN(A) do { (void)WaitForSingleObject(A, INFINITE); CloseHandle(A); } while (0)
+#define THREAD_RETURN_TYPE DWORD WINAPI
+#define THREAD_RETURN() return 0
+#elif FZ_THREADS == 2
+#define MUTEX pthread_mutex_t
+#define MUTEX_INIT(A) (void)pthread_mutex_init(&A, NULL)
+#define MUTEX_FIN(A) (void)pthread_mutex_destroy(&A)
+#define MUTEX_LOCK(A) (void)pthread_mutex_lock(&A)
+#define MUTEX_UNLOCK(A) (void)pthread_mutex_unlock(&A)
+#define THREAD pthread_t
+#define THREAD_INIT(A,B,C) (pthread_create(&A, NULL, B, C) == 0)
+#define THREAD_FIN(A) do { void *res; (void)pthread_join(A, &res); } while (0)
+#define THREAD_RETURN_TYPE void *
+#define THREAD_RETURN() return NULL
+#endif
+
+#ifdef FZ_THREADS
+
+typedef struct fz_work_queue_s fz_work_queue;
+typedef struct fz_worker_s fz_worker;
+
+struct fz_work_queue_s
+{
+	MUTEX mutex;
+	fz_worker_fn *fn;
+	void *arg;
+	int count;
+	int next;
+	int failed;
+	int code;
+	char message[256];
+};
+
+struct fz_worker_s
+{
+	fz_context *ctx;
+	fz_work_queue *queue;
+	THREAD thread;
+};
+
+static void
+run_queue(fz_context *ctx, fz_work_queue *queue)
+{
+	int idx;
+
+	for (;;)
+	{
+		MUTEX_LOCK(queue->mutex);
+		idx = queue->failed ? queue->count : queue->next++;
+		MUTEX_UNLOCK(queue->mutex);
+		if (idx >= queue->count)
+			break;
+
+		fz_try(ctx)
+			queue->fn(ctx, queue->arg, idx);
+		fz_catch(ctx)
+		{
+			MUTEX_LOCK(queue->mutex);
+			if (!queue->failed)
+			{
+				queue->failed = 1;
+				queue->code = fz_caught(ctx);
+				fz_strlcpy(queue->message, fz_caught_message(ctx), sizeof queue->message);
+			}
+			MUTEX_UNLOCK(queue->mutex);
+		}
+	}
+}
+
+static THREAD_RETURN_TYPE
+worker_thread(void *arg)
+{
+	fz_worker *me = (fz_worker *)arg;
+	run_queue(me->ctx, me->queue);
+	THREAD_RETURN();
+}
+
+int
+fz_can_run_workers(fz_context *ctx)
+{
+	return ctx && ctx->locks != &fz_locks_default;
+}
+
+void
+fz_run_workers(fz_context *ctx, int threads, int count, fz_worker_fn *fn, void *arg)
+{
+	fz_worker *workers = NULL;
+	fz_work_queue queue;
+	int i, started = 0;
+
+	if (count <= 0)
+		return;
+
+	if (threads > count)
+		threads = count;
+	if (threads > MAX_WORKER_THREADS)
+		threads = MAX_WORKER_THREADS;
+
+	if (threads <= 1 || !fz_can_run_workers(ctx))
+	{
+		for (i = 0; i < count; i++)
+			fn(ctx, arg, i);
+		return;
+	}
+
+	/* The calling thread acts as one of the workers. */
+	workers = fz_malloc_array(ctx, threads - 1, sizeof *workers);
+
+	memset(&queue, 0, sizeof queue);
+	MUTEX_INIT(queue.mutex);
+	queue.fn = fn;
+	queue.arg = arg;
+	queue.count = count;
+
+	for (i = 0; i < threads - 1; i++)
+	{
+		workers[started].queue = &queue;
+		workers[started].ctx = fz_clone_context(ctx);
+		if (!workers[started].ctx)
+			break;
+		if (!THREAD_INIT(workers[started].thread, worker_thread, &workers[started]))
+		{
+			fz_drop_context(workers[started].ctx);
+			break;
+		}
+		started++;
+	}
+
+	run_queue(ctx, &queue);
+
+	for (i = 0; i < started; i++)
+	{
+		THREAD_FIN(workers[i].thread);
+		fz_drop_context(workers[i].ctx);
+	}
+
+	fz_free(ctx, workers);
+	MUTEX_FIN(queue.mutex);
+
+	if (queue.failed)
+		fz_throw(ctx, queue.code, "%s", queue.message);
+}
+
+#else
+
+int
+fz_can_run_workers(fz_context *ctx)
+{
+	return 0;
+}
+
+void
+fz_run_workers(fz_context *ctx, int threads, int count, fz_worker_fn *fn, void *arg)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		fn(ctx, arg, i);
+}
+
+#endif
@@ -29,6 +29,8 @@ struct fz_archive_s
 	fz_stream *file;
 	int count;
 	struct zip_entry *table;
+	int index_size; /* power of two */
+	int *index; /* open addressing hash of case folded names into table, -1 for empty slots */
 };
 
 static inline int zip_toupper(int c)
@@ -56,20 +58,54 @@ static int case_compare_entries(const void *a_, const void *b_)
 	return zip_strcasecmp(a->name, b->name);
 }
 
+static unsigned int zip_hash_name(const char *s)
+{
+	unsigned int h = 2166136261u;
+	while (*s)
+	{
+		h ^= (unsigned char)zip_toupper(*s++);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void build_zip_index(fz_context *ctx, fz_archive *zip)
+{
+	int i, size = 16;
+	unsigned int mask, pos;
+
+	while (size < zip->count * 2)
+		size <<= 1;
+
+	zip->index = fz_malloc_array(ctx, size, sizeof *zip->index);
+	zip->index_size = size;
+	memset(zip->index, -1, size * sizeof *zip->index);
+
+	mask = size - 1;
+	for (i = 0; i < zip->count; i++)
+	{
+		pos = zip_hash_name(zip->table[i].name) & mask;
+		while (zip->index[pos] >= 0)
+			pos = (pos + 1) & mask;
+		zip->index[pos] = i;
+	}
+}
+
 static struct zip_entry *lookup_zip_entry(fz_context *ctx, fz_archive *zip, const char *name)
 {
-	int l = 0;
-	int r = zip->count - 1;
-	while (l <= r)
+	unsigned int mask, pos;
+	int i;
+
+	if (!zip->index)
+		return NULL;
+
+	mask = zip->index_size - 1;
+	pos = zip_hash_name(name) & mask;
+	while ((i = zip->index[pos]) >= 0)
 	{
-		int m = (l + r) >> 1;
-		int c = zip_strcasecmp(name, zip->table[m].name);
-		if (c < 0)
-			r = m - 1;
-		else if (c > 0)
-			l = m + 1;
-		else
-			return &zip->table[m];
+		if (!zip_strcasecmp(name, zip->table[i].name))
+			return &zip->table[i];
+		pos = (pos + 1) & mask;
 	}
 	return NULL;
 }
@@ -208,6 +244,8 @@ static void read_zip_dir_imp(fz_context *ctx, fz_archive *zip, int start_offset)
 	}
 
 	qsort(zip->table, count, sizeof *zip->table, case_compare_entries);
+
+	build_zip_index(ctx, zip);
 }
 
 static void read_zip_dir(fz_context *ctx, fz_archive *zip)
@@ -284,80 +322,101 @@ static fz_stream *open_zip_entry(fz_context *ctx, fz_archive *zip, struct zip_en
 	fz_throw(ctx, FZ_ERROR_GENERIC, "unknown zip method: %d", method);
 }
 
-static fz_buffer *read_zip_entry(fz_context *ctx, fz_archive *zip, struct zip_entry *ent)
+static void inflate_zip_entry(fz_context *ctx, fz_buffer *ubuf, unsigned char *cbuf, int csize)
+{
+	z_stream z;
+	int code;
+
+	z.zalloc = (alloc_func) fz_malloc_array;
+	z.zfree = (free_func) fz_free;
+	z.opaque = ctx;
+	z.next_in = cbuf;
+	z.avail_in = csize;
+	z.next_out = ubuf->data;
+	z.avail_out = ubuf->len;
+
+	code = inflateInit2(&z, -15);
+	if (code != Z_OK)
+	{
+		fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflateInit2 error: %s", z.msg);
+	}
+	code = inflate(&z, Z_FINISH);
+	if (code != Z_STREAM_END)
+	{
+		inflateEnd(&z);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflate error: %s", z.msg);
+	}
+	code = inflateEnd(&z);
+	if (code != Z_OK)
+	{
+		fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflateEnd error: %s", z.msg);
+	}
+}
+
+/*
+	Read the raw entry data from the archive file. Stored entries
+	are read straight into the returned buffer; for deflated entries
+	the compressed data is returned in *cbufp and must be inflated
+	into the buffer with inflate_zip_entry.
+*/
+static fz_buffer *read_zip_entry_data(fz_context *ctx, fz_archive *zip, struct zip_entry *ent, unsigned char **cbufp)
 {
 	fz_stream *file = zip->file;
 	fz_buffer *ubuf;
-	unsigned char *cbuf;
+	unsigned char *cbuf = NULL;
 	int method;
-	z_stream z;
-	int code;
 
 	method = read_zip_entry_header(ctx, zip, ent);
+	if (method != 0 && method != 8)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unknown zip method: %d", method);
 
 	ubuf = fz_new_buffer(ctx, ent->usize + 1); /* +1 because many callers will add a terminating zero */
 	ubuf->len = ent->usize;
 
-	if (method == 0)
+	fz_var(cbuf);
+
+	fz_try(ctx)
 	{
-		fz_try(ctx)
+		if (method == 0)
 		{
 			fz_read(ctx, file, ubuf->data, ent->usize);
 		}
-		fz_catch(ctx)
+		else
 		{
-			fz_drop_buffer(ctx, ubuf);
-			fz_rethrow(ctx);
+			cbuf = fz_malloc(ctx, ent->csize);
+			fz_read(ctx, file, cbuf, ent->csize);
 		}
-		return ubuf;
 	}
-
-	if (method == 8)
+	fz_catch(ctx)
 	{
-		cbuf = fz_malloc(ctx, ent->csize);
-		fz_try(ctx)
-		{
-			fz_read(ctx, file, cbuf, ent->csize);
+		fz_free(ctx, cbuf);
+		fz_drop_buffer(ctx, ubuf);
+		fz_rethrow(ctx);
+	}
 
-			z.zalloc = (alloc_func) fz_malloc_array;
-			z.zfree = (free_func) fz_free;
-			z.opaque = ctx;
-			z.next_in = cbuf;
-			z.avail_in = ent->csize;
-			z.next_out = ubuf->data;
-			z.avail_out = ent->usize;
+	*cbufp = cbuf;
+	return ubuf;
+}
 
-			code = inflateInit2(&z, -15);
-			if (code != Z_OK)
-			{
-				fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflateInit2 error: %s", z.msg);
-			}
-			code = inflate(&z, Z_FINISH);
-			if (code != Z_STREAM_END)
-			{
-				inflateEnd(&z);
-				fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflate error: %s", z.msg);
-			}
-			code = inflateEnd(&z);
-			if (code != Z_OK)
-			{
-				fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflateEnd error: %s", z.msg);
-			}
-		}
-		fz_always(ctx)
-		{
-			fz_free(ctx, cbuf);
-		}
-		fz_catch(ctx)
-		{
-			fz_drop_buffer(ctx, ubuf);
-			fz_rethrow(ctx);
-		}
+static fz_buffer *read_zip_entry(fz_context *ctx, fz_archive *zip, struct zip_entry *ent)
+{
+	fz_buffer *ubuf;
+	unsigned char *cbuf;
+
+	ubuf = read_zip_entry_data(ctx, zip, ent, &cbuf);
+	if (!cbuf)
 		return ubuf;
-	}
 
-	fz_drop_buffer(ctx, ubuf);
-	fz_throw(ctx, FZ_ERROR_GENERIC, "unknown zip method: %d", method);
+	fz_try(ctx)
+		inflate_zip_entry(ctx, ubuf, cbuf, ent->csize);
+	fz_always(ctx)
+		fz_free(ctx, cbuf);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, ubuf);
+		fz_rethrow(ctx);
+	}
+	return ubuf;
 }
 
 int
@@ -377,6 +436,38 @@ fz_has_archive_entry(fz_context *ctx, fz_archive *zip, const char *name)
 	}
 }
 
+int
+fz_archive_entry_size(fz_context *ctx, fz_archive *zip, const char *name)
+{
+	if (zip->directory)
+	{
+		char path[2048];
+		fz_stream *file;
+		int size = -1;
+		fz_strlcpy(path, zip->directory, sizeof path);
+		fz_strlcat(path, "/", sizeof path);
+		fz_strlcat(path, name, sizeof path);
+		if (!fz_file_exists(ctx, path))
+			return -1;
+		file = fz_open_file(ctx, path);
+		fz_try(ctx)
+		{
+			fz_seek(ctx, file, 0, SEEK_END);
+			size = (int)fz_tell(ctx, file);
+		}
+		fz_always(ctx)
+			fz_drop_stream(ctx, file);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return size;
+	}
+	else
+	{
+		struct zip_entry *ent = lookup_zip_entry(ctx, zip, name);
+		return ent ? ent->usize : -1;
+	}
+}
+
 fz_stream *
 fz_open_archive_entry(fz_context *ctx, fz_archive *zip, const char *name)
 {
@@ -417,6 +508,113 @@ fz_read_archive_entry(fz_context *ctx, fz_archive *zip, const char *name)
 	}
 }
 
+struct zip_batch
+{
+	fz_archive *zip;
+	const char **names;
+	fz_buffer **bufs;
+	unsigned char **cbufs;
+	struct zip_entry **ents;
+};
+
+static void read_directory_entry_worker(fz_context *ctx, void *arg, int idx)
+{
+	struct zip_batch *batch = arg;
+	char path[2048];
+	fz_strlcpy(path, batch->zip->directory, sizeof path);
+	fz_strlcat(path, "/", sizeof path);
+	fz_strlcat(path, batch->names[idx], sizeof path);
+	if (fz_file_exists(ctx, path))
+		batch->bufs[idx] = fz_read_file(ctx, path);
+}
+
+static void inflate_zip_entry_worker(fz_context *ctx, void *arg, int idx)
+{
+	struct zip_batch *batch = arg;
+	if (batch->cbufs[idx])
+		inflate_zip_entry(ctx, batch->bufs[idx], batch->cbufs[idx], batch->ents[idx]->csize);
+}
+
+struct zip_request
+{
+	struct zip_entry *ent;
+	int idx;
+};
+
+static int compare_request_offsets(const void *a_, const void *b_)
+{
+	const struct zip_request *a = a_;
+	const struct zip_request *b = b_;
+	return a->ent->offset - b->ent->offset;
+}
+
+void
+fz_read_archive_entries(fz_context *ctx, fz_archive *zip, int count, const char **names, fz_buffer **bufs, int threads)
+{
+	struct zip_batch batch;
+	struct zip_request *order = NULL;
+	int i, n;
+
+	memset(bufs, 0, count * sizeof *bufs);
+	memset(&batch, 0, sizeof batch);
+	batch.zip = zip;
+	batch.names = names;
+	batch.bufs = bufs;
+
+	fz_var(order);
+
+	fz_try(ctx)
+	{
+		if (zip->directory)
+		{
+			fz_run_workers(ctx, threads, count, read_directory_entry_worker, &batch);
+		}
+		else
+		{
+			batch.ents = fz_malloc_array(ctx, count, sizeof *batch.ents);
+			batch.cbufs = fz_malloc_array(ctx, count, sizeof *batch.cbufs);
+			memset(batch.cbufs, 0, count * sizeof *batch.cbufs);
+			order = fz_malloc_array(ctx, count, sizeof *order);
+
+			/* The file is shared, so read all the raw data in file order first... */
+			for (i = n = 0; i < count; i++)
+			{
+				batch.ents[i] = lookup_zip_entry(ctx, zip, names[i]);
+				if (batch.ents[i])
+				{
+					order[n].ent = batch.ents[i];
+					order[n].idx = i;
+					n++;
+				}
+			}
+			qsort(order, n, sizeof *order, compare_request_offsets);
+			for (i = 0; i < n; i++)
+				bufs[order[i].idx] = read_zip_entry_data(ctx, zip, order[i].ent, &batch.cbufs[order[i].idx]);
+
+			/* ...then inflate the entries in parallel. */
+			fz_run_workers(ctx, threads, count, inflate_zip_entry_worker, &batch);
+		}
+	}
+	fz_always(ctx)
+	{
+		if (batch.cbufs)
+			for (i = 0; i < count; i++)
+				fz_free(ctx, batch.cbufs[i]);
+		fz_free(ctx, batch.cbufs);
+		fz_free(ctx, batch.ents);
+		fz_free(ctx, order);
+	}
+	fz_catch(ctx)
+	{
+		for (i = 0; i < count; i++)
+		{
+			fz_drop_buffer(ctx, bufs[i]);
+			bufs[i] = NULL;
+		}
+		fz_rethrow(ctx);
+	}
+}
+
 int
 fz_count_archive_entries(fz_context *ctx, fz_archive *zip)
 {
@@ -442,6 +640,7 @@ fz_drop_archive(fz_context *ctx, fz_archive *zip)
 		for (i = 0; i < zip->count; ++i)
 			fz_free(ctx, zip->table[i].name);
 		fz_free(ctx, zip->table);
+		fz_free(ctx, zip->index);
 		fz_free(ctx, zip);
 	}
 }
@@ -463,6 +662,7 @@ fz_open_archive_with_stream(fz_context *ctx, fz_stream *file)
 	zip->file = fz_keep_stream(ctx, file);
 	zip->count = 0;
 	zip->table = NULL;
+	zip->index = NULL;
 
 	fz_try(ctx)
 	{
@@ -18,10 +18,50 @@ struct fz_zip_writer_s
 	int closed;
 };
 
-void
-fz_write_zip_entry(fz_context *ctx, fz_zip_writer *zip, const char *name, fz_buffer *buf, int compress)
+static fz_buffer *
+deflate_entry(fz_context *ctx, fz_buffer *buf)
+{
+	fz_buffer *cbuf = NULL;
+	z_stream z;
+	int err;
+
+	fz_var(cbuf);
+
+	memset(&z, 0, sizeof z);
+	/* Zip entries hold raw deflate data without the zlib header. */
+	err = deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	if (err != Z_OK)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "zlib deflateInit2 error: %d", err);
+
+	fz_try(ctx)
+	{
+		cbuf = fz_new_buffer(ctx, compressBound((uLong)buf->len));
+		z.next_in = buf->data;
+		z.avail_in = (uInt)buf->len;
+		z.next_out = cbuf->data;
+		z.avail_out = (uInt)cbuf->cap;
+		err = deflate(&z, Z_FINISH);
+		if (err != Z_STREAM_END)
+		{
+			fz_drop_buffer(ctx, cbuf);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "zlib deflate error: %d", err);
+		}
+		cbuf->len = z.total_out;
+	}
+	fz_always(ctx)
+		deflateEnd(&z);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return cbuf;
+}
+
+static void
+write_zip_entry(fz_context *ctx, fz_zip_writer *zip, const char *name, fz_buffer *buf, fz_buffer *cbuf)
 {
 	int offset = fz_tell_output(ctx, zip->output);
+	int method = cbuf ? 8 : 0;
+	fz_buffer *data = cbuf ? cbuf : buf;
 	int sum;
 
 	sum = crc32(0, NULL, 0);
@@ -31,11 +71,11 @@ fz_write_zip_entry(fz_context *ctx, fz_zip_writer *zip, const char *name, fz_buf
 	fz_write_buffer_int16_le(ctx, zip->central, 0); /* version made by: MS-DOS */
 	fz_write_buffer_int16_le(ctx, zip->central, 20); /* version to extract: 2.0 */
 	fz_write_buffer_int16_le(ctx, zip->central, 0); /* general purpose bit flag */
-	fz_write_buffer_int16_le(ctx, zip->central, 0); /* compression method: store */
+	fz_write_buffer_int16_le(ctx, zip->central, method); /* compression method: store or deflate */
 	fz_write_buffer_int16_le(ctx, zip->central, 0); /* TODO: last mod file time */
 	fz_write_buffer_int16_le(ctx, zip->central, 0); /* TODO: last mod file date */
 	fz_write_buffer_int32_le(ctx, zip->central, sum); /* crc-32 */
-	fz_write_buffer_int32_le(ctx, zip->central, (int)buf->len); /* csize */
+	fz_write_buffer_int32_le(ctx, zip->central, (int)data->len); /* csize */
 	fz_write_buffer_int32_le(ctx, zip->central, (int)buf->len); /* usize */
 	fz_write_buffer_int16_le(ctx, zip->central, (int)strlen(name)); /* file name length */
 	fz_write_buffer_int16_le(ctx, zip->central, 0); /* extra field length */
@@ -49,20 +89,44 @@ fz_write_zip_entry(fz_context *ctx, fz_zip_writer *zip, const char *name, fz_buf
 	fz_write_int32_le(ctx, zip->output, ZIP_LOCAL_FILE_SIG);
 	fz_write_int16_le(ctx, zip->output, 20); /* version to extract: 2.0 */
 	fz_write_int16_le(ctx, zip->output, 0); /* general purpose bit flag */
-	fz_write_int16_le(ctx, zip->output, 0); /* compression method: store */
+	fz_write_int16_le(ctx, zip->output, method); /* compression method: store or deflate */
 	fz_write_int16_le(ctx, zip->output, 0); /* TODO: last mod file time */
 	fz_write_int16_le(ctx, zip->output, 0); /* TODO: last mod file date */
 	fz_write_int32_le(ctx, zip->output, sum); /* crc-32 */
-	fz_write_int32_le(ctx, zip->output, (int)buf->len); /* csize */
+	fz_write_int32_le(ctx, zip->output, (int)data->len); /* csize */
 	fz_write_int32_le(ctx, zip->output, (int)buf->len); /* usize */
 	fz_write_int16_le(ctx, zip->output, (int)strlen(name)); /* file name length */
 	fz_write_int16_le(ctx, zip->output, 0); /* extra field length */
 	fz_write(ctx, zip->output, name, strlen(name));
-	fz_write(ctx, zip->output, buf->data, buf->len);
+	fz_write(ctx, zip->output, data->data, data->len);
 
 	++zip->count;
 }
 
+void
+fz_write_zip_entry(fz_context *ctx, fz_zip_writer *zip, const char *name, fz_buffer *buf, int compress)
+{
+	fz_buffer *cbuf = NULL;
+
+	if (compress && buf->len > 0)
+	{
+		cbuf = deflate_entry(ctx, buf);
+		/* Already compressed data (PNG, JPEG) rarely shrinks; store it as is. */
+		if (cbuf->len >= buf->len)
+		{
+			fz_drop_buffer(ctx, cbuf);
+			cbuf = NULL;
+		}
+	}
+
+	fz_try(ctx)
+		write_zip_entry(ctx, zip, name, buf, cbuf);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, cbuf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 void
 fz_close_zip_writer(fz_context *ctx, fz_zip_writer *zip)
 {
@@ -5,7 +5,7 @@ fz_save_gproof(fz_context *ctx, const char *pdf_file, fz_document *doc, const ch
 				const char *print_profile, const char *display_profile)
 {
 	int i;
-	int num_pages = fz_count_pages(ctx, doc);
+	int num_pages = fz_count_pages_exact(ctx, doc);
 	fz_output *out;
 	fz_page *page = NULL;
 
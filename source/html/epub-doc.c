@@ -11,19 +11,41 @@ struct epub_document_s
 	fz_document super;
 	fz_archive *zip;
 	fz_html_font_set *set;
+	int id;
 	int count;
 	epub_chapter *spine;
 	fz_outline *outline;
 	char *dc_title, *dc_creator;
+
+	/* Current layout, and what we have learned about it so far. */
+	int layout_id;
+	float layout_w, layout_h, layout_em;
+	int measured_size, measured_pages;
+	epub_chapter *refine;
 };
 
+/*
+	Chapters are parsed and laid out lazily. Until a chapter has been
+	laid out ('measured') its page count is estimated from the size
+	of its source file. Pages are always looked up by measuring the
+	chapters in order, so page numbers never depend on the estimates;
+	only fz_count_pages does, until fz_count_pages_exact measures them
+	all.
+	The box trees live in the store, so trees for chapters that have
+	not been viewed recently get evicted and are rebuilt on demand.
+	A tree outlives changes of layout: it remembers the shaped widths
+	of its words, so only the line breaking needs redoing.
+*/
 struct epub_chapter_s
 {
 	char *path;
+	int number;
+	int size;
 	int start;
+	int count;
+	int measured;
 	float page_w, page_h, em;
 	float page_margin[4];
-	fz_html *box;
 	epub_chapter *next;
 };
 
@@ -31,9 +53,106 @@ struct epub_page_s
 {
 	fz_page super;
 	epub_document *doc;
+	epub_chapter *ch;
 	int number;
 };
 
+typedef struct
+{
+	int refs;
+	int doc_id;
+	int chapter;
+} epub_chapter_key;
+
+typedef struct
+{
+	fz_storable storable;
+	fz_html *box;
+	int layout_id;
+} epub_chapter_tree;
+
+static int
+epub_make_hash_chapter_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	epub_chapter_key *key = (epub_chapter_key *)key_;
+	hash->u.pir.ptr = NULL;
+	hash->u.pir.i = key->doc_id;
+	hash->u.pir.r.x0 = key->chapter;
+	hash->u.pir.r.y0 = 0;
+	hash->u.pir.r.x1 = 0;
+	hash->u.pir.r.y1 = 0;
+	return 1;
+}
+
+static void *
+epub_keep_chapter_key(fz_context *ctx, void *key_)
+{
+	epub_chapter_key *key = (epub_chapter_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+epub_drop_chapter_key(fz_context *ctx, void *key_)
+{
+	epub_chapter_key *key = (epub_chapter_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+epub_cmp_chapter_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	epub_chapter_key *k0 = (epub_chapter_key *)k0_;
+	epub_chapter_key *k1 = (epub_chapter_key *)k1_;
+	return k0->doc_id == k1->doc_id && k0->chapter == k1->chapter;
+}
+
+static void
+epub_print_chapter_key(fz_context *ctx, fz_output *out, void *key_)
+{
+	epub_chapter_key *key = (epub_chapter_key *)key_;
+	fz_printf(ctx, out, "(epub chapter doc=%d ch=%d) ", key->doc_id, key->chapter);
+}
+
+static fz_store_type epub_chapter_store_type =
+{
+	epub_make_hash_chapter_key,
+	epub_keep_chapter_key,
+	epub_drop_chapter_key,
+	epub_cmp_chapter_key,
+	epub_print_chapter_key
+};
+
+static void
+epub_drop_chapter_tree_imp(fz_context *ctx, fz_storable *storable)
+{
+	epub_chapter_tree *tree = (epub_chapter_tree *)storable;
+	fz_drop_html(ctx, tree->box);
+	fz_free(ctx, tree);
+}
+
+static void
+epub_drop_chapter_tree(fz_context *ctx, epub_chapter_tree *tree)
+{
+	if (tree)
+		fz_drop_storable(ctx, &tree->storable);
+}
+
+static void
+epub_remove_chapter_trees(fz_context *ctx, epub_document *doc)
+{
+	epub_chapter_key key;
+	epub_chapter *ch;
+
+	key.refs = 1;
+	key.doc_id = doc->id;
+	for (ch = doc->spine; ch; ch = ch->next)
+	{
+		key.chapter = ch->number;
+		fz_remove_item(ctx, epub_drop_chapter_tree_imp, &key, &epub_chapter_store_type);
+	}
+}
+
 static void
 epub_update_link_dests(fz_context *ctx, epub_document *doc, fz_outline *node)
 {
@@ -58,29 +177,441 @@ epub_update_link_dests(fz_context *ctx, epub_document *doc, fz_outline *node)
 }
 
 static void
-epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
+epub_update_page_numbers(fz_context *ctx, epub_document *doc)
 {
-	epub_document *doc = (epub_document*)doc_;
 	epub_chapter *ch;
 	int count = 0;
 
 	for (ch = doc->spine; ch; ch = ch->next)
 	{
 		ch->start = count;
-		ch->em = em;
-		ch->page_margin[T] = fz_from_css_number(ch->box->style.margin[T], em, em);
-		ch->page_margin[B] = fz_from_css_number(ch->box->style.margin[B], em, em);
-		ch->page_margin[L] = fz_from_css_number(ch->box->style.margin[L], em, em);
-		ch->page_margin[R] = fz_from_css_number(ch->box->style.margin[R], em, em);
-		ch->page_w = w - ch->page_margin[L] - ch->page_margin[R];
-		ch->page_h = h - ch->page_margin[T] - ch->page_margin[B];
-		fz_layout_html(ctx, ch->box, ch->page_w, ch->page_h, ch->em);
-		count += ceilf(ch->box->h / ch->page_h);
+		count += ch->count;
 	}
 
 	epub_update_link_dests(ctx, doc, doc->outline);
 }
 
+static int
+epub_estimate_chapter_pages(fz_context *ctx, epub_document *doc, epub_chapter *ch)
+{
+	float bytes_per_page;
+
+	if (ch->size <= 0)
+		return 0;
+
+	if (doc->measured_pages > 0)
+		bytes_per_page = (float)doc->measured_size / doc->measured_pages;
+	else
+	{
+		/* Assume average glyphs of half an em, 1.2em leading, and as much markup as text. */
+		float em = doc->layout_em;
+		bytes_per_page = 2 * (doc->layout_w / (0.5f * em)) * (doc->layout_h / (1.2f * em));
+	}
+
+	if (bytes_per_page < 1)
+		bytes_per_page = 1;
+	return fz_maxi(1, ceilf(ch->size / bytes_per_page));
+}
+
+static fz_html *
+epub_parse_chapter(fz_context *ctx, epub_document *doc, epub_chapter *ch, fz_buffer *buf)
+{
+	char base_uri[2048];
+
+	fz_dirname(base_uri, ch->path, sizeof base_uri);
+
+	fz_write_buffer_byte(ctx, buf, 0);
+	return fz_parse_html(ctx, doc->set, doc->zip, base_uri, buf, fz_user_css(ctx));
+}
+
+/* Work out the page geometry of a chapter for the current layout. */
+static void
+epub_set_chapter_geometry(fz_context *ctx, epub_document *doc, epub_chapter *ch, fz_html *box)
+{
+	float em = doc->layout_em;
+
+	ch->em = em;
+	ch->page_margin[T] = fz_from_css_number(box->style.margin[T], em, em);
+	ch->page_margin[B] = fz_from_css_number(box->style.margin[B], em, em);
+	ch->page_margin[L] = fz_from_css_number(box->style.margin[L], em, em);
+	ch->page_margin[R] = fz_from_css_number(box->style.margin[R], em, em);
+	ch->page_w = doc->layout_w - ch->page_margin[L] - ch->page_margin[R];
+	ch->page_h = doc->layout_h - ch->page_margin[T] - ch->page_margin[B];
+}
+
+static epub_chapter_tree *
+epub_new_chapter_tree(fz_context *ctx, fz_html *box)
+{
+	epub_chapter_tree *tree;
+
+	fz_try(ctx)
+	{
+		tree = fz_malloc_struct(ctx, epub_chapter_tree);
+		FZ_INIT_STORABLE(tree, 1, epub_drop_chapter_tree_imp);
+		tree->box = box;
+		tree->layout_id = -1;
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_html(ctx, box);
+		fz_rethrow(ctx);
+	}
+
+	return tree;
+}
+
+/*
+	Note that a tree has been laid out for the current layout. The
+	first time a chapter is laid out the estimated page count is
+	replaced by the real one; the caller must then call
+	epub_update_page_numbers.
+*/
+static void
+epub_chapter_laid_out(fz_context *ctx, epub_document *doc, epub_chapter *ch, epub_chapter_tree *tree)
+{
+	tree->layout_id = doc->layout_id;
+	if (!ch->measured)
+	{
+		ch->measured = 1;
+		ch->count = ceilf(tree->box->h / ch->page_h);
+		doc->measured_size += ch->size;
+		doc->measured_pages += ch->count;
+	}
+}
+
+/* Put a freshly parsed and laid out tree in the store. */
+static epub_chapter_tree *
+epub_store_chapter_tree(fz_context *ctx, epub_document *doc, epub_chapter *ch, epub_chapter_tree *tree)
+{
+	epub_chapter_key *key = NULL;
+	epub_chapter_tree *existing;
+
+	epub_chapter_laid_out(ctx, doc, ch, tree);
+
+	/* Now we try to cache the tree. Any failure here will just result
+	 * in us not caching. */
+	fz_var(key);
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, epub_chapter_key);
+		key->refs = 1;
+		key->doc_id = doc->id;
+		key->chapter = ch->number;
+		existing = fz_store_item(ctx, key, tree, sizeof *tree + fz_pool_size(ctx, tree->box->pool), &epub_chapter_store_type);
+		if (existing)
+		{
+			/* A racing thread beat us to it; use its tree. */
+			epub_drop_chapter_tree(ctx, tree);
+			tree = existing;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (key)
+			epub_drop_chapter_key(ctx, key);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return tree;
+}
+
+/*
+	Find the box tree for a chapter in the store, or parse it anew, and
+	make sure it is laid out for the current layout. Laying out a
+	chapter for the first time may renumber the pages in the following
+	chapters.
+*/
+static epub_chapter_tree *
+epub_load_chapter_tree(fz_context *ctx, epub_document *doc, epub_chapter *ch)
+{
+	epub_chapter_key key;
+	epub_chapter_tree *tree;
+	fz_buffer *buf;
+	fz_html *box = NULL;
+	int was_measured = ch->measured;
+
+	key.refs = 1;
+	key.doc_id = doc->id;
+	key.chapter = ch->number;
+
+	tree = fz_find_item(ctx, epub_drop_chapter_tree_imp, &key, &epub_chapter_store_type);
+	if (tree)
+	{
+		if (tree->layout_id != doc->layout_id)
+		{
+			fz_try(ctx)
+			{
+				epub_set_chapter_geometry(ctx, doc, ch, tree->box);
+				fz_layout_html(ctx, tree->box, ch->page_w, ch->page_h, ch->em);
+			}
+			fz_catch(ctx)
+			{
+				epub_drop_chapter_tree(ctx, tree);
+				fz_rethrow(ctx);
+			}
+			epub_chapter_laid_out(ctx, doc, ch, tree);
+			if (!was_measured)
+				epub_update_page_numbers(ctx, doc);
+		}
+		return tree;
+	}
+
+	fz_var(box);
+
+	buf = fz_read_archive_entry(ctx, doc->zip, ch->path);
+	fz_try(ctx)
+	{
+		box = epub_parse_chapter(ctx, doc, ch, buf);
+		epub_set_chapter_geometry(ctx, doc, ch, box);
+		fz_layout_html(ctx, box, ch->page_w, ch->page_h, ch->em);
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+	{
+		if (box)
+			fz_drop_html(ctx, box);
+		fz_rethrow(ctx);
+	}
+
+	tree = epub_store_chapter_tree(ctx, doc, ch, epub_new_chapter_tree(ctx, box));
+	if (!was_measured)
+		epub_update_page_numbers(ctx, doc);
+	return tree;
+}
+
+/* A chapter that cannot be laid out is skipped, and counts as having no pages. */
+static void
+epub_measure_chapter(fz_context *ctx, epub_document *doc, epub_chapter *ch)
+{
+	if (ch->measured)
+		return;
+	fz_try(ctx)
+		epub_drop_chapter_tree(ctx, epub_load_chapter_tree(ctx, doc, ch));
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "cannot lay out chapter '%s'", ch->path);
+		ch->measured = 1;
+		ch->count = 0;
+		epub_update_page_numbers(ctx, doc);
+	}
+}
+
+static void epub_layout_chapters(fz_context *ctx, epub_document *doc, int threads);
+
+static void
+epub_measure_all_chapters(fz_context *ctx, epub_document *doc)
+{
+	epub_chapter *ch;
+	int threads = fz_worker_threads(ctx);
+
+	/* Lay out the chapters concurrently if we may, and fall back to
+	 * doing them one at a time, skipping any that fail, if we can't. */
+	if (threads > 1)
+	{
+		fz_try(ctx)
+			epub_layout_chapters(ctx, doc, threads);
+		fz_catch(ctx)
+			fz_warn(ctx, "cannot lay out chapters concurrently");
+	}
+
+	for (ch = doc->spine; ch; ch = ch->next)
+		epub_measure_chapter(ctx, doc, ch);
+}
+
+/* Lay out one more not yet measured chapter, to refine the page count estimate. */
+static void
+epub_refine_layout(fz_context *ctx, epub_document *doc)
+{
+	while (doc->refine && doc->refine->measured)
+		doc->refine = doc->refine->next;
+	if (doc->refine)
+		epub_measure_chapter(ctx, doc, doc->refine);
+}
+
+/*
+	Measure chapters in order until we reach the one holding page n.
+	Every chapter before it is then measured too, so the page numbers
+	do not depend on any estimates.
+*/
+static epub_chapter *
+epub_lookup_page(fz_context *ctx, epub_document *doc, int n, int *local)
+{
+	epub_chapter *ch;
+
+	for (ch = doc->spine; ch; ch = ch->next)
+	{
+		epub_measure_chapter(ctx, doc, ch);
+		if (n < ch->start + ch->count)
+		{
+			*local = n - ch->start;
+			return ch;
+		}
+	}
+	return NULL;
+}
+
+static void
+epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
+{
+	epub_document *doc = (epub_document*)doc_;
+	epub_chapter *ch;
+
+	/* Keep the chapter trees; they get laid out again as they are needed. */
+	doc->layout_id++;
+	doc->layout_w = w;
+	doc->layout_h = h;
+	doc->layout_em = em;
+	doc->measured_size = 0;
+	doc->measured_pages = 0;
+	doc->refine = doc->spine;
+
+	for (ch = doc->spine; ch; ch = ch->next)
+	{
+		ch->measured = 0;
+		ch->em = em;
+		ch->page_margin[T] = ch->page_margin[B] = ch->page_margin[L] = ch->page_margin[R] = 0;
+		ch->page_w = w;
+		ch->page_h = h;
+		ch->count = epub_estimate_chapter_pages(ctx, doc, ch);
+	}
+	epub_update_page_numbers(ctx, doc);
+
+	/* With worker threads to spare, lay out every chapter now... */
+	if (fz_worker_threads(ctx) > 1)
+	{
+		epub_measure_all_chapters(ctx, doc);
+		return;
+	}
+
+	/* ...otherwise lay out the first chapter, which also calibrates the estimates. */
+	epub_refine_layout(ctx, doc);
+	for (ch = doc->spine; ch; ch = ch->next)
+		if (!ch->measured)
+			ch->count = epub_estimate_chapter_pages(ctx, doc, ch);
+	epub_update_page_numbers(ctx, doc);
+}
+
+struct epub_layout_batch
+{
+	epub_chapter **chapters;
+	epub_chapter_tree **trees;
+};
+
+static void
+epub_layout_chapter_worker(fz_context *ctx, void *arg, int idx)
+{
+	struct epub_layout_batch *batch = arg;
+	epub_chapter *ch = batch->chapters[idx];
+	fz_layout_html(ctx, batch->trees[idx]->box, ch->page_w, ch->page_h, ch->em);
+}
+
+static void
+epub_layout_chapters(fz_context *ctx, epub_document *doc, int threads)
+{
+	struct epub_layout_batch batch = { NULL, NULL };
+	epub_chapter_key key;
+	fz_buffer **bufs = NULL;
+	const char **names = NULL;
+	int *parse = NULL;
+	epub_chapter *ch;
+	int i, n = 0, m = 0;
+
+	fz_var(bufs);
+	fz_var(names);
+	fz_var(parse);
+	fz_var(n);
+	fz_var(m);
+
+	fz_try(ctx)
+	{
+		batch.chapters = fz_malloc_array(ctx, doc->count, sizeof *batch.chapters);
+		for (n = 0, ch = doc->spine; ch; ch = ch->next)
+			if (!ch->measured)
+				batch.chapters[n++] = ch;
+
+		batch.trees = fz_malloc_array(ctx, n, sizeof *batch.trees);
+		memset(batch.trees, 0, n * sizeof *batch.trees);
+		bufs = fz_malloc_array(ctx, n, sizeof *bufs);
+		memset(bufs, 0, n * sizeof *bufs);
+		names = fz_malloc_array(ctx, n, sizeof *names);
+		parse = fz_malloc_array(ctx, n, sizeof *parse);
+
+		/* Chapters whose trees are still in the store only need laying out again. */
+		key.refs = 1;
+		key.doc_id = doc->id;
+		for (i = 0; i < n; i++)
+		{
+			key.chapter = batch.chapters[i]->number;
+			batch.trees[i] = fz_find_item(ctx, epub_drop_chapter_tree_imp, &key, &epub_chapter_store_type);
+			if (!batch.trees[i])
+			{
+				parse[m] = i;
+				names[m++] = batch.chapters[i]->path;
+			}
+		}
+
+		/* Reading and parsing share the archive and font set, so do them in turn... */
+		fz_read_archive_entries(ctx, doc->zip, m, names, bufs, threads);
+		for (i = 0; i < m; i++)
+		{
+			if (!bufs[i])
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find chapter: '%s'", names[i]);
+			batch.trees[parse[i]] = epub_new_chapter_tree(ctx, epub_parse_chapter(ctx, doc, batch.chapters[parse[i]], bufs[i]));
+			fz_drop_buffer(ctx, bufs[i]);
+			bufs[i] = NULL;
+		}
+		for (i = 0; i < n; i++)
+			epub_set_chapter_geometry(ctx, doc, batch.chapters[i], batch.trees[i]->box);
+
+		/* ...but the chapters are independent flows, so lay them out concurrently. */
+		fz_run_workers(ctx, threads, n, epub_layout_chapter_worker, &batch);
+
+		/* Finally, record the page counts and hand any new trees over to the store. */
+		for (i = 0; i < n; i++)
+		{
+			epub_chapter_tree *tree = batch.trees[i];
+			batch.trees[i] = NULL;
+			if (tree->layout_id < 0)
+				tree = epub_store_chapter_tree(ctx, doc, batch.chapters[i], tree);
+			else
+				epub_chapter_laid_out(ctx, doc, batch.chapters[i], tree);
+			epub_drop_chapter_tree(ctx, tree);
+		}
+	}
+	fz_always(ctx)
+	{
+		if (bufs)
+			for (i = 0; i < m; i++)
+				fz_drop_buffer(ctx, bufs[i]);
+		if (batch.trees)
+			for (i = 0; i < n; i++)
+				epub_drop_chapter_tree(ctx, batch.trees[i]);
+		fz_free(ctx, bufs);
+		fz_free(ctx, names);
+		fz_free(ctx, parse);
+		fz_free(ctx, batch.trees);
+		fz_free(ctx, batch.chapters);
+		epub_update_page_numbers(ctx, doc);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+void
+fz_layout_epub_chapters(fz_context *ctx, fz_document *doc_, int threads)
+{
+	if (doc_->layout != epub_layout)
+		return;
+	(void)fz_count_pages(ctx, doc_); /* make sure the document has been laid out */
+	epub_layout_chapters(ctx, (epub_document*)doc_, threads);
+}
+
 static int
 epub_count_pages(fz_context *ctx, fz_document *doc_)
 {
@@ -88,10 +619,17 @@ epub_count_pages(fz_context *ctx, fz_document *doc_)
 	epub_chapter *ch;
 	int count = 0;
 	for (ch = doc->spine; ch; ch = ch->next)
-		count += ceilf(ch->box->h / ch->page_h);
+		count += ch->count;
 	return count;
 }
 
+static int
+epub_count_pages_exact(fz_context *ctx, fz_document *doc_)
+{
+	epub_measure_all_chapters(ctx, (epub_document*)doc_);
+	return epub_count_pages(ctx, doc_);
+}
+
 static void
 epub_drop_page(fz_context *ctx, fz_page *page_)
 {
@@ -101,23 +639,15 @@ static fz_rect *
 epub_bound_page(fz_context *ctx, fz_page *page_, fz_rect *bbox)
 {
 	epub_page *page = (epub_page*)page_;
-	epub_document *doc = page->doc;
-	epub_chapter *ch;
-	int n = page->number;
-	int count = 0;
+	epub_chapter *ch = page->ch;
 
-	for (ch = doc->spine; ch; ch = ch->next)
+	if (ch)
 	{
-		int cn = ceilf(ch->box->h / ch->page_h);
-		if (n < count + cn)
-		{
-			bbox->x0 = 0;
-			bbox->y0 = 0;
-			bbox->x1 = ch->page_w + ch->page_margin[L] + ch->page_margin[R];
-			bbox->y1 = ch->page_h + ch->page_margin[T] + ch->page_margin[B];
-			return bbox;
-		}
-		count += cn;
+		bbox->x0 = 0;
+		bbox->y0 = 0;
+		bbox->x1 = ch->page_w + ch->page_margin[L] + ch->page_margin[R];
+		bbox->y1 = ch->page_h + ch->page_margin[T] + ch->page_margin[B];
+		return bbox;
 	}
 
 	*bbox = fz_unit_rect;
@@ -128,35 +658,46 @@ static void
 epub_run_page(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *ctm, fz_cookie *cookie)
 {
 	epub_page *page = (epub_page*)page_;
-	epub_document *doc = page->doc;
-	epub_chapter *ch;
+	epub_chapter *ch = page->ch;
+	epub_chapter_tree *tree;
 	fz_matrix local_ctm = *ctm;
 	int n = page->number;
-	int count = 0;
 
-	for (ch = doc->spine; ch; ch = ch->next)
+	if (!ch)
+		return;
+
+	tree = epub_load_chapter_tree(ctx, page->doc, ch);
+	fz_try(ctx)
 	{
-		int cn = ceilf(ch->box->h / ch->page_h);
-		if (n < count + cn)
-		{
-			fz_pre_translate(&local_ctm, ch->page_margin[L], ch->page_margin[T]);
-			fz_draw_html(ctx, dev, &local_ctm, ch->box, (n-count) * ch->page_h, (n-count+1) * ch->page_h);
-			break;
-		}
-		count += cn;
+		fz_pre_translate(&local_ctm, ch->page_margin[L], ch->page_margin[T]);
+		fz_draw_html(ctx, dev, &local_ctm, tree->box, n * ch->page_h, (n+1) * ch->page_h);
 	}
+	fz_always(ctx)
+		epub_drop_chapter_tree(ctx, tree);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
 static fz_page *
 epub_load_page(fz_context *ctx, fz_document *doc_, int number)
 {
 	epub_document *doc = (epub_document*)doc_;
-	epub_page *page = fz_new_page(ctx, sizeof *page);
+	epub_page *page;
+	epub_chapter *ch;
+	int local = 0;
+
+	ch = epub_lookup_page(ctx, doc, number, &local);
+
+	/* Use the time between pages to firm up the page count estimate. */
+	epub_refine_layout(ctx, doc);
+
+	page = fz_new_page(ctx, sizeof *page);
 	page->super.bound_page = epub_bound_page;
 	page->super.run_page_contents = epub_run_page;
 	page->super.drop_page = epub_drop_page;
 	page->doc = doc;
-	page->number = number;
+	page->ch = ch;
+	page->number = local;
 	return (fz_page*)page;
 }
 
@@ -165,11 +706,11 @@ epub_drop_document(fz_context *ctx, fz_document *doc_)
 {
 	epub_document *doc = (epub_document*)doc_;
 	epub_chapter *ch, *next;
+	epub_remove_chapter_trees(ctx, doc);
 	ch = doc->spine;
 	while (ch)
 	{
 		next = ch->next;
-		fz_drop_html(ctx, ch->box);
 		fz_free(ctx, ch->path);
 		fz_free(ctx, ch);
 		ch = next;
@@ -215,25 +756,20 @@ path_from_idref(char *path, fz_xml *manifest, const char *base_uri, const char *
 }
 
 static epub_chapter *
-epub_parse_chapter(fz_context *ctx, epub_document *doc, const char *path)
+epub_new_chapter(fz_context *ctx, epub_document *doc, const char *path, int number)
 {
-	fz_archive *zip = doc->zip;
-	fz_buffer *buf;
 	epub_chapter *ch;
-	char base_uri[2048];
+	int size = fz_archive_entry_size(ctx, doc->zip, path);
 
-	fz_dirname(base_uri, path, sizeof base_uri);
-
-	buf = fz_read_archive_entry(ctx, zip, path);
-	fz_write_buffer_byte(ctx, buf, 0);
+	if (size < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find chapter: '%s'", path);
 
 	ch = fz_malloc_struct(ctx, epub_chapter);
 	ch->path = fz_strdup(ctx, path);
-	ch->box = fz_parse_html(ctx, doc->set, zip, base_uri, buf, fz_user_css(ctx));
+	ch->number = number;
+	ch->size = size;
 	ch->next = NULL;
 
-	fz_drop_buffer(ctx, buf);
-
 	return ch;
 }
 
@@ -321,6 +857,7 @@ epub_parse_header(fz_context *ctx, epub_document *doc)
 	const char *version;
 	char ncx[2048], s[2048];
 	epub_chapter *head, *tail;
+	int count = 0;
 
 	if (fz_has_archive_entry(ctx, zip, "META-INF/rights.xml"))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "EPUB is locked by DRM");
@@ -377,14 +914,15 @@ epub_parse_header(fz_context *ctx, epub_document *doc)
 		if (path_from_idref(s, manifest, base_uri, fz_xml_att(itemref, "idref"), sizeof s))
 		{
 			if (!head)
-				head = tail = epub_parse_chapter(ctx, doc, s);
+				head = tail = epub_new_chapter(ctx, doc, s, count++);
 			else
-				tail = tail->next = epub_parse_chapter(ctx, doc, s);
+				tail = tail->next = epub_new_chapter(ctx, doc, s, count++);
 		}
 		itemref = fz_xml_find_next(itemref, "itemref");
 	}
 
 	doc->spine = head;
+	doc->count = count;
 
 	fz_drop_xml(ctx, container_xml);
 	fz_drop_xml(ctx, content_opf);
@@ -418,11 +956,13 @@ epub_init(fz_context *ctx, fz_archive *zip)
 	doc = fz_new_document(ctx, epub_document);
 	doc->zip = zip;
 	doc->set = fz_new_html_font_set(ctx);
+	doc->id = fz_gen_id(ctx);
 
 	doc->super.drop_document = epub_drop_document;
 	doc->super.layout = epub_layout;
 	doc->super.load_outline = epub_load_outline;
 	doc->super.count_pages = epub_count_pages;
+	doc->super.count_pages_exact = epub_count_pages_exact;
 	doc->super.load_page = epub_load_page;
 	doc->super.lookup_metadata = epub_lookup_metadata;
 	doc->super.is_reflowable = 1;
@@ -156,6 +156,7 @@ static fz_html_flow *add_flow(fz_context *ctx, fz_pool *pool, fz_html *top, fz_h
 	flow->bidi_level = 0;
 	flow->markup_lang = 0;
 	flow->breaks_line = 0;
+	flow->em_w = -1;
 	flow->box = inline_box;
 	*top->flow_tail = flow;
 	top->flow_tail = &flow->next;
@@ -758,10 +759,37 @@ static void measure_image(fz_context *ctx, fz_html_flow *node, float max_w, floa
 	node->h = image_h * s;
 }
 
+/*
+	Scratch space for shaping, owned by a single layout or draw call.
+	Runs that need no OpenType shaping are shaped straight into the
+	glyph arrays here without calling HarfBuzz, and so without taking
+	the HarfBuzz lock. The HarfBuzz buffer is only created, under the
+	lock, for runs that do.
+*/
+typedef struct shape_buffer
+{
+	hb_buffer_t *hb_buf;
+	hb_glyph_info_t *glyph_info;
+	hb_glyph_position_t *glyph_pos;
+	unsigned int cap;
+} shape_buffer;
+
+static void drop_shape_buffer(fz_context *ctx, shape_buffer *buf)
+{
+	fz_free(ctx, buf->glyph_info);
+	fz_free(ctx, buf->glyph_pos);
+	if (buf->hb_buf)
+	{
+		hb_lock(ctx);
+		hb_buffer_destroy(buf->hb_buf);
+		hb_unlock(ctx);
+	}
+}
+
 typedef struct string_walker
 {
 	fz_context *ctx;
-	hb_buffer_t *hb_buf;
+	shape_buffer *shape_buf;
 	int rtl;
 	const char *start;
 	const char *end;
@@ -822,10 +850,10 @@ static int quick_ligature(fz_context *ctx, string_walker *walker, unsigned int i
 	return walker->glyph_info[i].codepoint;
 }
 
-static void init_string_walker(fz_context *ctx, string_walker *walker, hb_buffer_t *hb_buf, int rtl, fz_font *font, int script, int language, const char *text)
+static void init_string_walker(fz_context *ctx, string_walker *walker, shape_buffer *shape_buf, int rtl, fz_font *font, int script, int language, const char *text)
 {
 	walker->ctx = ctx;
-	walker->hb_buf = hb_buf;
+	walker->shape_buf = shape_buf;
 	walker->rtl = rtl;
 	walker->start = text;
 	walker->end = text;
@@ -842,6 +870,7 @@ typedef void (fz_hb_font_destructor_t)(void *);
 static int walk_string(string_walker *walker)
 {
 	fz_context *ctx = walker->ctx;
+	hb_buffer_t *hb_buf;
 	FT_Face face;
 	int fterr;
 	int quickshape;
@@ -876,46 +905,91 @@ static int walk_string(string_walker *walker)
 	if (walker->script <= 3 && !walker->rtl && !walker->font->has_opentype)
 		quickshape = 1;
 
+	face = walker->font->ft_face;
+	walker->scale = face->units_per_EM;
+
+	if (quickshape)
+	{
+		shape_buffer *buf = walker->shape_buf;
+		const char *s = walker->start;
+		unsigned int i, n = 0;
+		int c;
+
+		/* One glyph per character, so the run is never longer than its bytes. */
+		if (buf->cap < (unsigned int)(walker->end - walker->start))
+		{
+			unsigned int cap = fz_maxi(64, walker->end - walker->start);
+			buf->glyph_info = fz_resize_array(ctx, buf->glyph_info, cap, sizeof *buf->glyph_info);
+			buf->glyph_pos = fz_resize_array(ctx, buf->glyph_pos, cap, sizeof *buf->glyph_pos);
+			buf->cap = cap;
+		}
+
+		while (s < walker->end)
+		{
+			memset(&buf->glyph_info[n], 0, sizeof buf->glyph_info[n]);
+			buf->glyph_info[n].cluster = s - walker->start;
+			s += fz_chartorune(&c, s);
+			buf->glyph_info[n].codepoint = c;
+			++n;
+		}
+
+		walker->glyph_info = buf->glyph_info;
+		walker->glyph_pos = buf->glyph_pos;
+		walker->glyph_count = n;
+
+		for (i = 0; i < walker->glyph_count; ++i)
+		{
+			int unicode = quick_ligature(ctx, walker, i);
+			int glyph = fz_encode_character(ctx, walker->font, unicode);
+			walker->glyph_info[i].codepoint = glyph;
+			walker->glyph_pos[i].x_offset = 0;
+			walker->glyph_pos[i].y_offset = 0;
+			walker->glyph_pos[i].x_advance = fz_advance_glyph(ctx, walker->font, glyph, 0) * face->units_per_EM;
+			walker->glyph_pos[i].y_advance = 0;
+		}
+
+		return 1;
+	}
+
 	hb_lock(ctx);
 	fz_try(ctx)
 	{
-		face = walker->font->ft_face;
-		walker->scale = face->units_per_EM;
+		if (!walker->shape_buf->hb_buf)
+			walker->shape_buf->hb_buf = hb_buffer_create();
+		hb_buf = walker->shape_buf->hb_buf;
+
 		fterr = FT_Set_Char_Size(face, walker->scale, walker->scale, 72, 72);
 		if (fterr)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "freetype setting character size: %s", ft_error_string(fterr));
 
-		hb_buffer_clear_contents(walker->hb_buf);
-		hb_buffer_set_direction(walker->hb_buf, walker->rtl ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
-		/* hb_buffer_set_script(walker->hb_buf, hb_ucdn_script_translate(walker->script)); */
+		hb_buffer_clear_contents(hb_buf);
+		hb_buffer_set_direction(hb_buf, walker->rtl ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
+		/* hb_buffer_set_script(hb_buf, hb_ucdn_script_translate(walker->script)); */
 		if (walker->language)
 		{
 			fz_string_from_text_language(lang, walker->language);
-			hb_buffer_set_language(walker->hb_buf, hb_language_from_string(lang, strlen(lang)));
+			hb_buffer_set_language(hb_buf, hb_language_from_string(lang, strlen(lang)));
 		}
 		/* hb_buffer_set_cluster_level(hb_buf, HB_BUFFER_CLUSTER_LEVEL_CHARACTERS); */
 
-		hb_buffer_add_utf8(walker->hb_buf, walker->start, walker->end - walker->start, 0, -1);
+		hb_buffer_add_utf8(hb_buf, walker->start, walker->end - walker->start, 0, -1);
 
-		if (!quickshape)
+		if (walker->font->hb_font == NULL)
 		{
-			if (walker->font->hb_font == NULL)
-			{
-				Memento_startLeaking(); /* HarfBuzz leaks harmlessly */
-				walker->font->hb_destroy = (fz_hb_font_destructor_t *)hb_font_destroy;
-				walker->font->hb_font = hb_ft_font_create(face, NULL);
-				Memento_stopLeaking();
-			}
-
 			Memento_startLeaking(); /* HarfBuzz leaks harmlessly */
-			hb_buffer_guess_segment_properties(walker->hb_buf);
+			walker->font->hb_destroy = (fz_hb_font_destructor_t *)hb_font_destroy;
+			walker->font->hb_font = hb_ft_font_create(face, NULL);
 			Memento_stopLeaking();
-
-			hb_shape(walker->font->hb_font, walker->hb_buf, NULL, 0);
 		}
 
-		walker->glyph_pos = hb_buffer_get_glyph_positions(walker->hb_buf, &walker->glyph_count);
-		walker->glyph_info = hb_buffer_get_glyph_infos(walker->hb_buf, NULL);
+		Memento_startLeaking(); /* HarfBuzz leaks harmlessly */
+		hb_buffer_guess_segment_properties(hb_buf);
+		Memento_stopLeaking();
+
+		hb_shape(walker->font->hb_font, hb_buf, NULL, 0);
+
+		walker->glyph_pos = hb_buffer_get_glyph_positions(hb_buf, &walker->glyph_count);
+		walker->glyph_info = hb_buffer_get_glyph_infos(hb_buf, NULL);
 	}
 	fz_always(ctx)
 	{
@@ -926,21 +1000,6 @@ static int walk_string(string_walker *walker)
 		fz_rethrow(ctx);
 	}
 
-	if (quickshape)
-	{
-		unsigned int i;
-		for (i = 0; i < walker->glyph_count; ++i)
-		{
-			int unicode = quick_ligature(ctx, walker, i);
-			int glyph = fz_encode_character(ctx, walker->font, unicode);
-			walker->glyph_info[i].codepoint = glyph;
-			walker->glyph_pos[i].x_offset = 0;
-			walker->glyph_pos[i].y_offset = 0;
-			walker->glyph_pos[i].x_advance = fz_advance_glyph(ctx, walker->font, glyph, 0) * face->units_per_EM;
-			walker->glyph_pos[i].y_advance = 0;
-		}
-	}
-
 	return 1;
 }
 
@@ -956,27 +1015,163 @@ static const char *get_node_text(fz_context *ctx, fz_html_flow *node)
 		return "";
 }
 
-static void measure_string(fz_context *ctx, fz_html_flow *node, hb_buffer_t *hb_buf)
+/*
+	Shaped word widths only depend on the text, font, script, language
+	and direction, and scale linearly with the font size. Each flow node
+	remembers its width in ems, so that relayout at a new page or font
+	size only needs to redo line breaking. Within a single layout pass,
+	repeated words are shaped once and looked up in this cache.
+*/
+
+typedef struct shape_cache_entry_s shape_cache_entry;
+typedef struct shape_cache_s shape_cache;
+
+struct shape_cache_entry_s
+{
+	const char *text;
+	fz_font *font;
+	int script, language, rtl;
+	float em_w;
+};
+
+struct shape_cache_s
+{
+	int size, load;
+	shape_cache_entry *ents;
+};
+
+static shape_cache *new_shape_cache(fz_context *ctx)
+{
+	shape_cache *cache = fz_malloc_struct(ctx, shape_cache);
+	fz_try(ctx)
+	{
+		cache->size = 1024;
+		cache->ents = fz_malloc_array(ctx, cache->size, sizeof *cache->ents);
+		memset(cache->ents, 0, cache->size * sizeof *cache->ents);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
+	return cache;
+}
+
+static void drop_shape_cache(fz_context *ctx, shape_cache *cache)
+{
+	if (cache)
+	{
+		fz_free(ctx, cache->ents);
+		fz_free(ctx, cache);
+	}
+}
+
+static unsigned int hash_shape_key(const char *text, fz_font *font, int script, int language, int rtl)
+{
+	unsigned int h = 2166136261u;
+	while (*text)
+	{
+		h ^= (unsigned char)*text++;
+		h *= 16777619u;
+	}
+	h ^= (unsigned int)(intptr_t)font;
+	h *= 16777619u;
+	h ^= (script << 16) ^ (language << 1) ^ rtl;
+	h *= 16777619u;
+	return h;
+}
+
+static shape_cache_entry *lookup_shape_cache(shape_cache *cache, const char *text, fz_font *font, int script, int language, int rtl)
+{
+	unsigned int mask = cache->size - 1;
+	unsigned int pos = hash_shape_key(text, font, script, language, rtl) & mask;
+	shape_cache_entry *ent;
+
+	for (;;)
+	{
+		ent = &cache->ents[pos];
+		if (!ent->text)
+			return ent;
+		if (ent->font == font && ent->script == script && ent->language == language && ent->rtl == rtl && !strcmp(ent->text, text))
+			return ent;
+		pos = (pos + 1) & mask;
+	}
+}
+
+static void grow_shape_cache(fz_context *ctx, shape_cache *cache)
+{
+	shape_cache_entry *old = cache->ents;
+	int i, old_size = cache->size;
+
+	cache->ents = fz_malloc_array(ctx, old_size * 2, sizeof *cache->ents);
+	memset(cache->ents, 0, old_size * 2 * sizeof *cache->ents);
+	cache->size = old_size * 2;
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].text)
+			*lookup_shape_cache(cache, old[i].text, old[i].font, old[i].script, old[i].language, old[i].rtl) = old[i];
+
+	fz_free(ctx, old);
+}
+
+static void measure_string(fz_context *ctx, fz_html_flow *node, shape_buffer *shape_buf, shape_cache *cache)
 {
 	string_walker walker;
+	shape_cache_entry *ent = NULL;
 	unsigned int i;
 	const char *s;
+	fz_font *font;
+	int rtl;
 	float em;
 
 	em = node->box->em;
 	node->x = 0;
 	node->y = 0;
-	node->w = 0;
 	node->h = fz_from_css_number_scale(node->box->style.line_height, em, em, em);
 
+	if (node->em_w >= 0)
+	{
+		node->w = node->em_w * em;
+		return;
+	}
+
 	s = get_node_text(ctx, node);
-	init_string_walker(ctx, &walker, hb_buf, node->bidi_level & 1, node->box->style.font, node->script, node->markup_lang, s);
+	font = node->box->style.font;
+	rtl = node->bidi_level & 1;
+
+	if (cache)
+	{
+		if (cache->load * 2 >= cache->size)
+			grow_shape_cache(ctx, cache);
+		ent = lookup_shape_cache(cache, s, font, node->script, node->markup_lang, rtl);
+		if (ent->text)
+		{
+			node->em_w = ent->em_w;
+			node->w = node->em_w * em;
+			return;
+		}
+	}
+
+	node->em_w = 0;
+	init_string_walker(ctx, &walker, shape_buf, rtl, font, node->script, node->markup_lang, s);
 	while (walk_string(&walker))
 	{
 		int x = 0;
 		for (i = 0; i < walker.glyph_count; i++)
 			x += walker.glyph_pos[i].x_advance;
-		node->w += x * em / walker.scale;
+		node->em_w += (float)x / walker.scale;
+	}
+	node->w = node->em_w * em;
+
+	if (ent)
+	{
+		ent->text = s;
+		ent->font = font;
+		ent->script = node->script;
+		ent->language = node->markup_lang;
+		ent->rtl = rtl;
+		ent->em_w = node->em_w;
+		cache->load++;
 	}
 }
 
@@ -1171,7 +1366,7 @@ static void layout_flow_inline(fz_context *ctx, fz_html *box, fz_html *top)
 	}
 }
 
-static void layout_flow(fz_context *ctx, fz_html *box, fz_html *top, float page_h, hb_buffer_t *hb_buf)
+static void layout_flow(fz_context *ctx, fz_html *box, fz_html *top, float page_h, shape_buffer *shape_buf, shape_cache *cache)
 {
 	fz_html_flow *node, *line, *candidate;
 	float line_w, candidate_w, indent, break_w, nonbreak_w;
@@ -1210,7 +1405,7 @@ static void layout_flow(fz_context *ctx, fz_html *box, fz_html *top, float page_
 		}
 		else
 		{
-			measure_string(ctx, node, hb_buf);
+			measure_string(ctx, node, shape_buf, cache);
 		}
 	}
 
@@ -1309,7 +1504,7 @@ static int layout_block_page_break(fz_context *ctx, fz_html *box, float page_h,
 	return 0;
 }
 
-static float layout_block(fz_context *ctx, fz_html *box, fz_html *top, float page_h, float vertical, hb_buffer_t *hb_buf)
+static float layout_block(fz_context *ctx, fz_html *box, fz_html *top, float page_h, float vertical, shape_buffer *shape_buf, shape_cache *cache)
 {
 	fz_html *child;
 	int first;
@@ -1362,7 +1557,7 @@ static float layout_block(fz_context *ctx, fz_html *box, fz_html *top, float pag
 	{
 		if (child->type == BOX_BLOCK)
 		{
-			vertical = layout_block(ctx, child, box, page_h, vertical, hb_buf);
+			vertical = layout_block(ctx, child, box, page_h, vertical, shape_buf, cache);
 			if (first)
 			{
 				/* move collapsed parent/child top margins to parent */
@@ -1384,7 +1579,7 @@ static float layout_block(fz_context *ctx, fz_html *box, fz_html *top, float pag
 		}
 		else if (child->type == BOX_FLOW)
 		{
-			layout_flow(ctx, child, box, page_h, hb_buf);
+			layout_flow(ctx, child, box, page_h, shape_buf, cache);
 			if (child->h > 0)
 			{
 				box->h += child->h;
@@ -1424,7 +1619,7 @@ static float layout_block(fz_context *ctx, fz_html *box, fz_html *top, float pag
 	return vertical;
 }
 
-static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm, hb_buffer_t *hb_buf)
+static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm, shape_buffer *shape_buf)
 {
 	fz_html_flow *node;
 	fz_text *text;
@@ -1503,7 +1698,7 @@ static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float p
 			trm.f = y;
 
 			s = get_node_text(ctx, node);
-			init_string_walker(ctx, &walker, hb_buf, node->bidi_level & 1, style->font, node->script, node->markup_lang, s);
+			init_string_walker(ctx, &walker, shape_buf, node->bidi_level & 1, style->font, node->script, node->markup_lang, s);
 			while (walk_string(&walker))
 			{
 				float node_scale = node->box->em / walker.scale;
@@ -1765,7 +1960,7 @@ static void draw_list_mark(fz_context *ctx, fz_html *box, float page_top, float
 	fz_drop_text(ctx, text);
 }
 
-static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm, hb_buffer_t *hb_buf)
+static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm, shape_buffer *shape_buf)
 {
 	float x0, y0, x1, y1;
 
@@ -1801,8 +1996,8 @@ static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float
 	{
 		switch (box->type)
 		{
-		case BOX_BLOCK: draw_block_box(ctx, box, page_top, page_bot, dev, ctm, hb_buf); break;
-		case BOX_FLOW: draw_flow_box(ctx, box, page_top, page_bot, dev, ctm, hb_buf); break;
+		case BOX_BLOCK: draw_block_box(ctx, box, page_top, page_bot, dev, ctm, shape_buf); break;
+		case BOX_FLOW: draw_flow_box(ctx, box, page_top, page_bot, dev, ctm, shape_buf); break;
 		}
 	}
 }
@@ -1811,28 +2006,16 @@ void
 fz_draw_html(fz_context *ctx, fz_device *dev, const fz_matrix *ctm, fz_html *box, float page_top, float page_bot)
 {
 	fz_matrix local_ctm = *ctm;
-	hb_buffer_t *hb_buf = NULL;
-	int unlocked = 0;
-
-	fz_var(hb_buf);
-	fz_var(unlocked);
-
-	hb_lock(ctx);
+	shape_buffer shape_buf = { NULL };
 
 	fz_try(ctx)
 	{
-		hb_buf = hb_buffer_create();
-		hb_unlock(ctx);
-		unlocked = 1;
 		fz_pre_translate(&local_ctm, 0, -page_top);
-		draw_block_box(ctx, box, page_top, page_bot, dev, &local_ctm, hb_buf);
+		draw_block_box(ctx, box, page_top, page_bot, dev, &local_ctm, &shape_buf);
 	}
 	fz_always(ctx)
 	{
-		if (unlocked)
-			hb_lock(ctx);
-		hb_buffer_destroy(hb_buf);
-		hb_unlock(ctx);
+		drop_shape_buffer(ctx, &shape_buf);
 	}
 	fz_catch(ctx)
 	{
@@ -2073,19 +2256,14 @@ fz_print_html(fz_context *ctx, fz_html *box, int pstyle, int level)
 void
 fz_layout_html(fz_context *ctx, fz_html *box, float w, float h, float em)
 {
-	hb_buffer_t *hb_buf = NULL;
-	int unlocked = 0;
+	shape_buffer shape_buf = { NULL };
+	shape_cache *cache = NULL;
 
-	fz_var(hb_buf);
-	fz_var(unlocked);
-
-	hb_lock(ctx);
+	fz_var(cache);
 
 	fz_try(ctx)
 	{
-		hb_buf = hb_buffer_create();
-		unlocked = 1;
-		hb_unlock(ctx);
+		cache = new_shape_cache(ctx);
 
 		box->em = em;
 		box->w = w;
@@ -2093,16 +2271,14 @@ fz_layout_html(fz_context *ctx, fz_html *box, float w, float h, float em)
 
 		if (box->down)
 		{
-			layout_block(ctx, box->down, box, h, 0, hb_buf);
+			layout_block(ctx, box->down, box, h, 0, &shape_buf, cache);
 			box->h = box->down->h;
 		}
 	}
 	fz_always(ctx)
 	{
-		if (unlocked)
-			hb_lock(ctx);
-		hb_buffer_destroy(hb_buf);
-		hb_unlock(ctx);
+		drop_shape_cache(ctx, cache);
+		drop_shape_buffer(ctx, &shape_buf);
 	}
 	fz_catch(ctx)
 	{
@@ -555,7 +555,9 @@ pdf_load_annots(fz_context *ctx, pdf_document *doc, pdf_page *page, pdf_obj *ann
 
 			n = NULL;
 
-			if (doc->update_appearance)
+			/* Synthesizing an appearance creates objects, which
+			 * a document shared between threads cannot do. */
+			if (doc->update_appearance && !doc->concurrent_reads)
 				doc->update_appearance(ctx, doc, annot);
 
 			obj = annot->obj;
@@ -231,7 +231,7 @@ static void retainpages(fz_context *ctx, globals *glo, int argc, char **argv)
 	pdf_drop_obj(ctx, kids);
 
 	/* Force the next call to pdf_count_pages to recount */
-	glo->doc->page_count = 0;
+	pdf_invalidate_page_tree(ctx, glo->doc);
 
 	pagecount = pdf_count_pages(ctx, doc);
 	page_object_nums = fz_calloc(ctx, pagecount, sizeof(*page_object_nums));
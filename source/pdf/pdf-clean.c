@@ -126,40 +126,27 @@ pdf_clean_type3(fz_context *ctx, pdf_document *doc, pdf_obj *obj, pdf_obj *orig_
 	}
 }
 
-void pdf_clean_page_contents(fz_context *ctx, pdf_document *doc, pdf_page *page, fz_cookie *cookie, pdf_page_contents_process_fn *proc_fn, void *proc_arg, int ascii)
+/* Replace the page's contents and resources with the filtered versions,
+ * cleaning any forms, patterns and Type3 fonts they refer to. */
+static void
+pdf_commit_page_contents(fz_context *ctx, pdf_document *doc, pdf_page *page, fz_cookie *cookie, pdf_page_contents_process_fn *proc_fn, void *proc_arg, int ascii, fz_buffer *buffer, pdf_obj *res)
 {
-	pdf_processor *proc_buffer = NULL;
-	pdf_processor *proc_filter = NULL;
 	pdf_obj *new_obj = NULL;
 	pdf_obj *new_ref = NULL;
 	pdf_obj *res_ref = NULL;
-	pdf_obj *res = NULL;
 	pdf_obj *obj;
 	pdf_obj *contents;
 	pdf_obj *resources;
-	fz_buffer *buffer;
 
 	fz_var(new_obj);
 	fz_var(new_ref);
-	fz_var(res);
 	fz_var(res_ref);
-	fz_var(proc_buffer);
-	fz_var(proc_filter);
-
-	buffer = fz_new_buffer(ctx, 1024);
 
 	fz_try(ctx)
 	{
-		res = pdf_new_dict(ctx, doc, 1);
-
 		contents = pdf_page_contents(ctx, page);
 		resources = pdf_page_resources(ctx, page);
 
-		proc_buffer = pdf_new_buffer_processor(ctx, buffer, ascii);
-		proc_filter = pdf_new_filter_processor(ctx, proc_buffer, doc, resources, res);
-
-		pdf_process_contents(ctx, proc_filter, doc, resources, contents, cookie);
-
 		/* Deal with page content stream. */
 
 		if (pdf_is_array(ctx, contents))
@@ -268,12 +255,50 @@ void pdf_clean_page_contents(fz_context *ctx, pdf_document *doc, pdf_page *page,
 	}
 	fz_always(ctx)
 	{
-		pdf_drop_processor(ctx, proc_filter);
-		pdf_drop_processor(ctx, proc_buffer);
-		fz_drop_buffer(ctx, buffer);
 		pdf_drop_obj(ctx, new_obj);
 		pdf_drop_obj(ctx, new_ref);
 		pdf_drop_obj(ctx, res_ref);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+void pdf_clean_page_contents(fz_context *ctx, pdf_document *doc, pdf_page *page, fz_cookie *cookie, pdf_page_contents_process_fn *proc_fn, void *proc_arg, int ascii)
+{
+	pdf_processor *proc_buffer = NULL;
+	pdf_processor *proc_filter = NULL;
+	pdf_obj *res = NULL;
+	pdf_obj *contents;
+	pdf_obj *resources;
+	fz_buffer *buffer;
+
+	fz_var(res);
+	fz_var(proc_buffer);
+	fz_var(proc_filter);
+
+	buffer = fz_new_buffer(ctx, 1024);
+
+	fz_try(ctx)
+	{
+		res = pdf_new_dict(ctx, doc, 1);
+
+		contents = pdf_page_contents(ctx, page);
+		resources = pdf_page_resources(ctx, page);
+
+		proc_buffer = pdf_new_buffer_processor(ctx, buffer, ascii);
+		proc_filter = pdf_new_filter_processor(ctx, proc_buffer, doc, resources, res);
+
+		pdf_process_contents(ctx, proc_filter, doc, resources, contents, cookie);
+
+		pdf_commit_page_contents(ctx, doc, page, cookie, proc_fn, proc_arg, ascii, buffer, res);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_processor(ctx, proc_filter);
+		pdf_drop_processor(ctx, proc_buffer);
+		fz_drop_buffer(ctx, buffer);
 		pdf_drop_obj(ctx, res);
 	}
 	fz_catch(ctx)
@@ -302,3 +327,177 @@ void pdf_clean_annot_contents(fz_context *ctx, pdf_document *doc, pdf_annot *ann
 		pdf_clean_stream_object(ctx, doc, v, NULL, cookie, 1, 1);
 	}
 }
+
+typedef struct
+{
+	pdf_page *page;
+	pdf_obj *resources;
+	fz_buffer *contents;
+	fz_buffer *buffer;
+	pdf_obj *res;
+	int serial;
+} clean_job;
+
+typedef struct
+{
+	pdf_document *doc;
+	clean_job *jobs;
+	int ascii;
+} clean_batch;
+
+static void
+clean_page_worker(fz_context *ctx, void *arg, int idx)
+{
+	clean_batch *batch = (clean_batch *)arg;
+	clean_job *job = &batch->jobs[idx];
+	pdf_processor *proc_buffer = NULL;
+	pdf_processor *proc_filter = NULL;
+
+	if (job->serial)
+		return;
+
+	fz_var(proc_buffer);
+	fz_var(proc_filter);
+
+	fz_try(ctx)
+	{
+		proc_buffer = pdf_new_buffer_processor(ctx, job->buffer, batch->ascii);
+		proc_filter = pdf_new_filter_processor(ctx, proc_buffer, batch->doc, job->resources, job->res);
+		proc_filter->shared_document = 1;
+
+		pdf_process_glyph(ctx, proc_filter, batch->doc, job->resources, job->contents);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_processor(ctx, proc_filter);
+		pdf_drop_processor(ctx, proc_buffer);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+static void
+load_clean_job(fz_context *ctx, pdf_document *doc, clean_job *job, int number)
+{
+	pdf_obj *contents;
+	fz_stream *stm;
+	int truncated = 0;
+
+	job->page = pdf_load_page(ctx, doc, number);
+	job->resources = pdf_page_resources(ctx, job->page);
+	job->buffer = fz_new_buffer(ctx, 1024);
+	job->res = pdf_new_dict(ctx, doc, 1);
+
+	/* Decompress on this thread; the workers only see memory. Pages whose
+	 * contents cannot be read cleanly are left for the serial path, which
+	 * keeps whatever it manages to parse. */
+	contents = pdf_page_contents(ctx, job->page);
+	if (contents)
+	{
+		stm = pdf_open_contents_stream(ctx, doc, contents);
+		fz_try(ctx)
+			job->contents = fz_read_best(ctx, stm, 0, &truncated);
+		fz_always(ctx)
+			fz_drop_stream(ctx, stm);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		if (truncated)
+			job->serial = 1;
+	}
+}
+
+static void
+drop_clean_job(fz_context *ctx, clean_job *job)
+{
+	pdf_drop_obj(ctx, job->res);
+	fz_drop_buffer(ctx, job->buffer);
+	fz_drop_buffer(ctx, job->contents);
+	if (job->page)
+		fz_drop_page(ctx, &job->page->super);
+	memset(job, 0, sizeof *job);
+}
+
+static void
+commit_clean_job(fz_context *ctx, pdf_document *doc, clean_job *job, int ascii)
+{
+	pdf_annot *annot;
+
+	if (job->serial)
+		pdf_clean_page_contents(ctx, doc, job->page, NULL, NULL, NULL, ascii);
+	else
+		pdf_commit_page_contents(ctx, doc, job->page, NULL, NULL, NULL, ascii, job->buffer, job->res);
+
+	for (annot = pdf_first_annot(ctx, job->page); annot != NULL; annot = pdf_next_annot(ctx, annot))
+		pdf_clean_annot_contents(ctx, doc, annot, NULL, NULL, NULL, ascii);
+}
+
+void pdf_clean_document_contents(fz_context *ctx, pdf_document *doc, int threads, int ascii)
+{
+	clean_batch batch = { 0 };
+	int n = pdf_count_pages(ctx, doc);
+	int size, start, count, i;
+
+	if (threads <= 1 || !fz_can_run_workers(ctx))
+	{
+		for (i = 0; i < n; i++)
+		{
+			pdf_annot *annot;
+			pdf_page *page = pdf_load_page(ctx, doc, i);
+
+			fz_try(ctx)
+			{
+				pdf_clean_page_contents(ctx, doc, page, NULL, NULL, NULL, ascii);
+				for (annot = pdf_first_annot(ctx, page); annot != NULL; annot = pdf_next_annot(ctx, annot))
+					pdf_clean_annot_contents(ctx, doc, annot, NULL, NULL, NULL, ascii);
+			}
+			fz_always(ctx)
+				fz_drop_page(ctx, &page->super);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+		}
+		return;
+	}
+
+	/* Enough pages in flight to keep every worker busy, without holding
+	 * the decompressed contents of the whole document at once. */
+	size = fz_mini(threads * 4, n);
+	count = 0;
+
+	batch.doc = doc;
+	batch.ascii = ascii;
+	batch.jobs = fz_calloc(ctx, size, sizeof *batch.jobs);
+
+	fz_var(count);
+
+	fz_try(ctx)
+	{
+		for (start = 0; start < n; start += count)
+		{
+			count = fz_mini(size, n - start);
+			for (i = 0; i < count; i++)
+				load_clean_job(ctx, doc, &batch.jobs[i], start + i);
+
+			fz_run_workers(ctx, threads, count, clean_page_worker, &batch);
+
+			/* Results go back into the document in page order, so the
+			 * output is the same as for a serial clean. */
+			for (i = 0; i < count; i++)
+			{
+				commit_clean_job(ctx, doc, &batch.jobs[i], ascii);
+				drop_clean_job(ctx, &batch.jobs[i]);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < size; i++)
+			drop_clean_job(ctx, &batch.jobs[i]);
+		fz_free(ctx, batch.jobs);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
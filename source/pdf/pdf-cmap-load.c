@@ -14,11 +14,8 @@ pdf_cmap_size(fz_context *ctx, pdf_cmap *cmap)
 		cmap->mcap * sizeof *cmap->mranges;
 }
 
-/*
- * Load CMap stream in PDF file
- */
-pdf_cmap *
-pdf_load_embedded_cmap(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
+static pdf_cmap *
+pdf_load_embedded_cmap_imp(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
 {
 	fz_stream *file = NULL;
 	pdf_cmap *cmap = NULL;
@@ -54,7 +51,7 @@ pdf_load_embedded_cmap(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
 		{
 			pdf_mark_obj(ctx, obj);
 			fz_try(ctx)
-				usecmap = pdf_load_embedded_cmap(ctx, doc, obj);
+				usecmap = pdf_load_embedded_cmap_imp(ctx, doc, obj);
 			fz_always(ctx)
 				pdf_unmark_obj(ctx, obj);
 			fz_catch(ctx)
@@ -78,6 +75,26 @@ pdf_load_embedded_cmap(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
 	return cmap;
 }
 
+/*
+ * Load CMap stream in PDF file
+ */
+pdf_cmap *
+pdf_load_embedded_cmap(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
+{
+	pdf_cmap *cmap = NULL;
+
+	/* Loading marks objects to detect loops */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		cmap = pdf_load_embedded_cmap_imp(ctx, doc, stmobj);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return cmap;
+}
+
 /*
  * Create an Identity-* CMap (for both 1 and 2-byte encodings)
  */
@@ -316,7 +316,14 @@ pdf_load_colorspace(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
 		return cs;
 	}
 
-	cs = pdf_load_colorspace_imp(ctx, doc, obj);
+	/* Loading marks objects to detect loops */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		cs = pdf_load_colorspace_imp(ctx, doc, obj);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 
 	pdf_store_item(ctx, obj, cs, cs->size);
 
@@ -1602,8 +1602,8 @@ pdf_print_function(fz_context *ctx, fz_output *out, fz_function *func)
 	pdf_debug_function_imp(ctx, out, func, 0);
 }
 
-fz_function *
-pdf_load_function(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int out)
+static fz_function *
+pdf_load_function_imp(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int out)
 {
 	pdf_function *func;
 	pdf_obj *obj;
@@ -1690,3 +1690,20 @@ pdf_load_function(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int
 
 	return (fz_function *)func;
 }
+
+fz_function *
+pdf_load_function(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int out)
+{
+	fz_function *func = NULL;
+
+	/* Loading marks objects to detect loops */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		func = pdf_load_function_imp(ctx, doc, dict, in, out);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return func;
+}
@@ -47,6 +47,81 @@ pdf_drop_graft_map(fz_context *ctx, pdf_graft_map *map)
 	}
 }
 
+/* Does the direct object 'obj' contain a reference to object 'num'? */
+static int
+refers_to(fz_context *ctx, pdf_obj *obj, int num)
+{
+	int i, n;
+
+	if (pdf_is_indirect(ctx, obj))
+		return pdf_to_num(ctx, obj) == num;
+
+	if (pdf_is_dict(ctx, obj))
+	{
+		n = pdf_dict_len(ctx, obj);
+		for (i = 0; i < n; i++)
+			if (refers_to(ctx, pdf_dict_get_val(ctx, obj, i), num))
+				return 1;
+	}
+	else if (pdf_is_array(ctx, obj))
+	{
+		n = pdf_array_len(ctx, obj);
+		for (i = 0; i < n; i++)
+			if (refers_to(ctx, pdf_array_get(ctx, obj, i), num))
+				return 1;
+	}
+
+	return 0;
+}
+
+/*
+	Look for an earlier grafted copy of the stream just grafted to
+	'num', whose raw data is 'buf'. Objects from 'first' onwards were
+	created while grafting 'num' and are the only ones that can refer
+	to it, so if none of them do, 'num' is deleted in favour of the
+	earlier copy. Returns the number of the copy, or 0 if none.
+*/
+static int
+share_grafted_stream(fz_context *ctx, pdf_document *dst, int num, int first, fz_buffer *buf)
+{
+	unsigned int hash;
+	fz_buffer *other_buf = NULL;
+	unsigned char *data, *other_data;
+	size_t len, other_len;
+	int other, i, n, differ;
+
+	if (!dst->graft_streams)
+		dst->graft_streams = fz_new_hash_table(ctx, 256, sizeof hash, -1);
+
+	hash = pdf_hash_object_num(ctx, dst, num);
+	other = (int)(intptr_t)fz_hash_find(ctx, dst->graft_streams, &hash);
+
+	/* The earlier copy may since have been changed or deleted. */
+	if (other <= 0 || other >= pdf_xref_len(ctx, dst) || !pdf_obj_num_is_stream(ctx, dst, other) ||
+		pdf_objcmp(ctx, pdf_get_xref_entry(ctx, dst, num)->obj, pdf_get_xref_entry(ctx, dst, other)->obj))
+	{
+		fz_hash_remove(ctx, dst->graft_streams, &hash);
+		fz_hash_insert(ctx, dst->graft_streams, &hash, (void *)(intptr_t)num);
+		return 0;
+	}
+
+	other_buf = pdf_load_raw_stream(ctx, dst, other);
+	len = fz_buffer_storage(ctx, buf, &data);
+	other_len = fz_buffer_storage(ctx, other_buf, &other_data);
+	differ = len != other_len || memcmp(data, other_data, len);
+	fz_drop_buffer(ctx, other_buf);
+	if (differ)
+		return 0;
+
+	n = pdf_xref_len(ctx, dst);
+	for (i = first; i < n; i++)
+		if (i != num && refers_to(ctx, pdf_get_xref_entry(ctx, dst, i)->obj, num))
+			return 0;
+
+	pdf_delete_object(ctx, dst, num);
+	return other;
+}
+
 /* Graft object from dst to source */
 pdf_obj *
 pdf_graft_object(fz_context *ctx, pdf_document *dst, pdf_document *src, pdf_obj *obj_ref, pdf_graft_map *map)
@@ -59,7 +134,7 @@ pdf_graft_object(fz_context *ctx, pdf_document *dst, pdf_document *src, pdf_obj
 	fz_buffer *buffer = NULL;
 	pdf_graft_map *drop_map = NULL;
 	pdf_document *bound;
-	int new_num, src_num, len, i;
+	int new_num, src_num, dup_num, len, i;
 
 	/* Primitive objects are not bound to a document, so can be re-used as is. */
 	if (!pdf_is_indirect(ctx, obj_ref) && !pdf_is_dict(ctx, obj_ref) && !pdf_is_array(ctx, obj_ref))
@@ -112,6 +187,16 @@ pdf_graft_object(fz_context *ctx, pdf_document *dst, pdf_document *src, pdf_obj
 			{
 				buffer = pdf_load_raw_stream(ctx, src, src_num);
 				pdf_update_stream(ctx, dst, ref, buffer, 1);
+
+				/* Store identical images and fonts only once */
+				dup_num = share_grafted_stream(ctx, dst, new_num, new_num + 1, buffer);
+				if (dup_num)
+				{
+					map->dst_from_src[src_num] = dup_num;
+					pdf_drop_obj(ctx, ref);
+					ref = NULL;
+					ref = pdf_new_indirect(ctx, dst, dup_num, 0);
+				}
 			}
 		}
 		fz_always(ctx)
@@ -0,0 +1,641 @@
+#include "mupdf/pdf.h"
+
+#include <zlib.h>
+
+/*
+ * Downsampling of over-resolved images.
+ *
+ * All pages (including hidden optional content and hidden annotations)
+ * are run through a device that records the largest size at which each
+ * image XObject is drawn. Images whose resolution at that size is well
+ * above the requested one are decoded, scaled down with fz_scale_pixmap
+ * and recompressed on worker threads: with JPEG if they were JPEG to
+ * begin with, and with Flate otherwise. Bilevel images (such as
+ * CCITT or JBIG2 scans) are thresholded back to 1 bit. The new data
+ * only replaces the old if it is smaller.
+ */
+
+/* Only downsample images that exceed the target resolution by this much. */
+#define DOWNSAMPLE_THRESHOLD 1.5f
+
+/* Quality for re-encoding images that were JPEG compressed. */
+#define JPEG_QUALITY 85
+
+/* Number of images decoded and encoded at once, per worker thread. */
+#define IMAGES_PER_THREAD 4
+
+typedef struct
+{
+	int num;
+	int w, h;
+	int mask;
+	int bilevel;
+	int dct;
+	float max_w, max_h; /* Largest size drawn, in points */
+	int unsure;
+} image_use;
+
+typedef struct
+{
+	fz_image *image;
+	int idx;
+} page_image;
+
+typedef struct
+{
+	fz_device super;
+	int len;
+	image_use *images;
+	int page_len, page_cap;
+	page_image *page_images;
+} image_use_device;
+
+typedef struct
+{
+	image_use *use;
+	fz_image *image;
+	int w, h;
+	fz_buffer *data;
+	int dct;
+} image_job;
+
+typedef struct
+{
+	int len;
+	image_job *jobs;
+} image_batch;
+
+static int
+is_supported_colorspace(fz_context *ctx, pdf_obj *cs)
+{
+	if (pdf_name_eq(ctx, cs, PDF_NAME_DeviceGray) ||
+		pdf_name_eq(ctx, cs, PDF_NAME_DeviceRGB) ||
+		pdf_name_eq(ctx, cs, PDF_NAME_DeviceCMYK))
+		return 1;
+	if (pdf_is_array(ctx, cs) && pdf_name_eq(ctx, pdf_array_get(ctx, cs, 0), PDF_NAME_ICCBased))
+		return 1;
+	return 0;
+}
+
+/*
+ * Only plain 8 bit images in device (or ICC based) colorspaces, 1 bit
+ * gray images and image masks can be written back from a decoded
+ * pixmap as they are.
+ */
+static int
+is_supported_image(fz_context *ctx, pdf_obj *dict, int *mask, int *bilevel, int *dct)
+{
+	pdf_obj *filter, *cs;
+	int bpc, i, n;
+
+	if (!pdf_name_eq(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Subtype), PDF_NAME_Image))
+		return 0;
+	if (pdf_dict_get(ctx, dict, PDF_NAME_Decode) || pdf_dict_get(ctx, dict, PDF_NAME_SMaskInData))
+		return 0;
+	if (pdf_dict_get(ctx, dict, PDF_NAME_F))
+		return 0; /* External stream data */
+	if (pdf_is_array(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Mask)))
+		return 0;
+
+	*dct = 0;
+	filter = pdf_dict_get(ctx, dict, PDF_NAME_Filter);
+	n = pdf_is_array(ctx, filter) ? pdf_array_len(ctx, filter) : 1;
+	for (i = 0; i < n; i++)
+	{
+		pdf_obj *f = pdf_is_array(ctx, filter) ? pdf_array_get(ctx, filter, i) : filter;
+		if (pdf_name_eq(ctx, f, PDF_NAME_JPXDecode))
+			return 0;
+		if (pdf_name_eq(ctx, f, PDF_NAME_DCTDecode))
+			*dct = 1;
+	}
+
+	*mask = pdf_to_bool(ctx, pdf_dict_get(ctx, dict, PDF_NAME_ImageMask));
+	*bilevel = 0;
+	bpc = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_BitsPerComponent));
+	if (*mask)
+		return bpc == 0 || bpc == 1;
+	cs = pdf_dict_get(ctx, dict, PDF_NAME_ColorSpace);
+	if (bpc == 1)
+		return *bilevel = pdf_name_eq(ctx, cs, PDF_NAME_DeviceGray);
+	return bpc == 8 && is_supported_colorspace(ctx, cs);
+}
+
+static image_use *
+find_images(fz_context *ctx, pdf_document *doc, int *count)
+{
+	image_use *images = NULL;
+	pdf_obj *obj = NULL;
+	int num, len = 0, cap = 0, mask, bilevel, dct;
+	int xref_len = pdf_xref_len(ctx, doc);
+
+	fz_var(images);
+	fz_var(obj);
+
+	fz_try(ctx)
+	{
+		for (num = 1; num < xref_len; num++)
+		{
+			fz_try(ctx)
+			{
+				if (pdf_obj_num_is_stream(ctx, doc, num))
+					obj = pdf_load_object(ctx, doc, num);
+			}
+			fz_catch(ctx)
+			{
+				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+				fz_warn(ctx, "ignoring broken object (%d 0 R)", num);
+			}
+			if (obj && is_supported_image(ctx, obj, &mask, &bilevel, &dct))
+			{
+				if (len == cap)
+				{
+					cap = cap ? cap * 2 : 32;
+					images = fz_resize_array(ctx, images, cap, sizeof *images);
+				}
+				memset(&images[len], 0, sizeof *images);
+				images[len].num = num;
+				images[len].w = pdf_to_int(ctx, pdf_dict_get(ctx, obj, PDF_NAME_Width));
+				images[len].h = pdf_to_int(ctx, pdf_dict_get(ctx, obj, PDF_NAME_Height));
+				images[len].mask = mask;
+				images[len].bilevel = bilevel;
+				images[len].dct = dct;
+				len++;
+			}
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_obj(ctx, obj);
+		fz_free(ctx, images);
+		fz_rethrow(ctx);
+	}
+
+	*count = len;
+	return images;
+}
+
+static int
+lookup_image(image_use *images, int len, int num)
+{
+	int l = 0, r = len - 1;
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		if (images[m].num < num)
+			l = m + 1;
+		else if (images[m].num > num)
+			r = m - 1;
+		else
+			return m;
+	}
+	return -1;
+}
+
+/*
+ * The interpreter loads images through the store, so loading the image
+ * XObjects a page may use before running it lets the device map the
+ * fz_images it is handed back to object numbers.
+ */
+static void
+add_page_image(fz_context *ctx, pdf_document *doc, image_use_device *dev, pdf_obj *ref)
+{
+	int i, idx = lookup_image(dev->images, dev->len, pdf_to_num(ctx, ref));
+	fz_image *image;
+
+	if (idx < 0)
+		return;
+	for (i = 0; i < dev->page_len; i++)
+		if (dev->page_images[i].idx == idx)
+			return;
+
+	image = pdf_load_image(ctx, doc, ref);
+	if (dev->page_len == dev->page_cap)
+	{
+		int cap = dev->page_cap ? dev->page_cap * 2 : 16;
+		fz_try(ctx)
+			dev->page_images = fz_resize_array(ctx, dev->page_images, cap, sizeof *dev->page_images);
+		fz_catch(ctx)
+		{
+			fz_drop_image(ctx, image);
+			fz_rethrow(ctx);
+		}
+		dev->page_cap = cap;
+	}
+	dev->page_images[dev->page_len].image = image;
+	dev->page_images[dev->page_len].idx = idx;
+	dev->page_len++;
+}
+
+static void
+gather_page_images(fz_context *ctx, pdf_document *doc, image_use_device *dev, pdf_obj *res)
+{
+	pdf_obj *dict, *obj, *sub;
+	int i, n;
+
+	if (!pdf_is_dict(ctx, res) || pdf_mark_obj(ctx, res))
+		return;
+
+	fz_try(ctx)
+	{
+		dict = pdf_dict_get(ctx, res, PDF_NAME_XObject);
+		n = pdf_dict_len(ctx, dict);
+		for (i = 0; i < n; i++)
+		{
+			obj = pdf_dict_get_val(ctx, dict, i);
+			sub = pdf_dict_get(ctx, obj, PDF_NAME_Subtype);
+			if (pdf_name_eq(ctx, sub, PDF_NAME_Image))
+				add_page_image(ctx, doc, dev, obj);
+			else if (pdf_name_eq(ctx, sub, PDF_NAME_Form))
+				gather_page_images(ctx, doc, dev, pdf_dict_get(ctx, obj, PDF_NAME_Resources));
+		}
+
+		dict = pdf_dict_get(ctx, res, PDF_NAME_Pattern);
+		n = pdf_dict_len(ctx, dict);
+		for (i = 0; i < n; i++)
+			gather_page_images(ctx, doc, dev, pdf_dict_get(ctx, pdf_dict_get_val(ctx, dict, i), PDF_NAME_Resources));
+
+		dict = pdf_dict_get(ctx, res, PDF_NAME_Font);
+		n = pdf_dict_len(ctx, dict);
+		for (i = 0; i < n; i++)
+			gather_page_images(ctx, doc, dev, pdf_dict_get(ctx, pdf_dict_get_val(ctx, dict, i), PDF_NAME_Resources));
+	}
+	fz_always(ctx)
+		pdf_unmark_obj(ctx, res);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+drop_page_images(fz_context *ctx, image_use_device *dev)
+{
+	int i;
+	for (i = 0; i < dev->page_len; i++)
+		fz_drop_image(ctx, dev->page_images[i].image);
+	dev->page_len = 0;
+}
+
+static void
+record_image(fz_context *ctx, fz_device *dev_, fz_image *image, const fz_matrix *ctm)
+{
+	image_use_device *dev = (image_use_device *)dev_;
+	float w = sqrtf(ctm->a * ctm->a + ctm->b * ctm->b);
+	float h = sqrtf(ctm->c * ctm->c + ctm->d * ctm->d);
+	image_use *use;
+	int i;
+
+	for (i = 0; i < dev->page_len; i++)
+	{
+		if (dev->page_images[i].image == image)
+		{
+			use = &dev->images[dev->page_images[i].idx];
+			use->max_w = fz_max(use->max_w, w);
+			use->max_h = fz_max(use->max_h, h);
+			return;
+		}
+	}
+
+	/* An inline image, or one we failed to track: leave alone any
+	 * image XObject it could be. */
+	for (i = 0; i < dev->len; i++)
+		if (dev->images[i].w == image->w && dev->images[i].h == image->h)
+			dev->images[i].unsure = 1;
+}
+
+static void
+use_fill_image(fz_context *ctx, fz_device *dev, fz_image *image, const fz_matrix *ctm, float alpha)
+{
+	record_image(ctx, dev, image, ctm);
+}
+
+static void
+use_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, const fz_matrix *ctm,
+	fz_colorspace *colorspace, const float *color, float alpha)
+{
+	record_image(ctx, dev, image, ctm);
+}
+
+static void
+use_clip_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, const fz_matrix *ctm, const fz_rect *scissor)
+{
+	record_image(ctx, dev, image, ctm);
+}
+
+static void
+use_drop_device(fz_context *ctx, fz_device *dev_)
+{
+	image_use_device *dev = (image_use_device *)dev_;
+	drop_page_images(ctx, dev);
+	fz_free(ctx, dev->page_images);
+}
+
+static image_use_device *
+new_image_use_device(fz_context *ctx, image_use *images, int len)
+{
+	image_use_device *dev = fz_new_device(ctx, sizeof *dev);
+
+	dev->super.drop_device = use_drop_device;
+	dev->super.fill_image = use_fill_image;
+	dev->super.fill_image_mask = use_fill_image_mask;
+	dev->super.clip_image_mask = use_clip_image_mask;
+
+	dev->images = images;
+	dev->len = len;
+
+	return dev;
+}
+
+static void
+collect_page_images(fz_context *ctx, pdf_document *doc, pdf_page *page, image_use_device *dev)
+{
+	pdf_processor *proc;
+	pdf_annot *annot;
+	fz_matrix page_ctm, annot_ctm;
+	fz_rect mediabox;
+
+	gather_page_images(ctx, doc, dev, pdf_page_resources(ctx, page));
+	for (annot = page->annots; annot; annot = annot->next)
+		if (annot->ap)
+			gather_page_images(ctx, doc, dev, pdf_dict_get(ctx, annot->ap->obj, PDF_NAME_Resources));
+
+	/* With no usage event, all optional content is considered visible. */
+	pdf_run_page_with_usage(ctx, doc, page, &dev->super, &fz_identity, NULL, NULL);
+
+	/* Hidden annotations are skipped by the interpreter, but may be
+	 * shown later on, so their appearance streams count too. */
+	for (annot = page->annots; annot; annot = annot->next)
+	{
+		int flags = pdf_to_int(ctx, pdf_dict_get(ctx, annot->obj, PDF_NAME_F));
+		if (!annot->ap || !(flags & (F_Invisible | F_Hidden)))
+			continue;
+		/* Placed as pdf_run_annot would, so sizes are in points. */
+		pdf_page_transform(ctx, page, &mediabox, &page_ctm);
+		pdf_annot_transform(ctx, annot, &annot_ctm);
+		proc = pdf_new_run_processor(ctx, &dev->super, &page_ctm, NULL, NULL, 0);
+		fz_try(ctx)
+		{
+			proc->op_q(ctx, proc);
+			proc->op_cm(ctx, proc,
+				annot_ctm.a, annot_ctm.b,
+				annot_ctm.c, annot_ctm.d,
+				annot_ctm.e, annot_ctm.f);
+			proc->op_Do_form(ctx, proc, NULL, annot->ap, pdf_page_resources(ctx, page));
+			proc->op_Q(ctx, proc);
+		}
+		fz_always(ctx)
+			pdf_drop_processor(ctx, proc);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+}
+
+/*
+ * Decoding, scaling and encoding; run on worker threads.
+ */
+
+static fz_buffer *
+pack_samples(fz_context *ctx, fz_pixmap *pix, int mask, int bilevel)
+{
+	int x, y, k, n = pix->n - pix->alpha;
+	int stride = mask || bilevel ? (pix->w + 7) >> 3 : pix->w * n;
+	fz_buffer *buf = fz_new_buffer(ctx, stride * pix->h);
+	unsigned char *d = buf->data;
+
+	for (y = 0; y < pix->h; y++)
+	{
+		unsigned char *s = pix->samples + y * pix->stride;
+		if (mask || bilevel)
+		{
+			/* Mask samples are coverage, and a 0 bit paints; gray
+			 * samples are white where the bit is set. */
+			memset(d, 0, stride);
+			for (x = 0; x < pix->w; x++)
+				if ((s[x * pix->n] < 128) == mask)
+					d[x >> 3] |= 0x80 >> (x & 7);
+		}
+		else if (n == pix->n)
+			memcpy(d, s, stride);
+		else
+		{
+			for (x = 0; x < pix->w; x++, s += pix->n)
+				for (k = 0; k < n; k++)
+					d[x * n + k] = s[k];
+		}
+		d += stride;
+	}
+	buf->len = stride * pix->h;
+
+	return buf;
+}
+
+static fz_buffer *
+deflate_samples(fz_context *ctx, fz_buffer *raw)
+{
+	fz_buffer *buf;
+	uLongf csize;
+	uLong len = (uLong)raw->len;
+
+	if (raw->len != (size_t)len)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "image too large to deflate");
+
+	buf = fz_new_buffer(ctx, compressBound(len));
+	csize = (uLongf)buf->cap;
+	if (compress2(buf->data, &csize, raw->data, len, Z_BEST_COMPRESSION) != Z_OK)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot deflate image");
+	}
+	buf->len = csize;
+	return buf;
+}
+
+static void
+downsample_worker(fz_context *ctx, void *arg, int idx)
+{
+	image_job *job = &((image_batch *)arg)->jobs[idx];
+	fz_image *image = job->image;
+	fz_pixmap *pix = NULL;
+	fz_pixmap *scaled = NULL;
+	fz_buffer *raw = NULL;
+	int w = job->w, h = job->h;
+
+	fz_var(pix);
+	fz_var(scaled);
+	fz_var(raw);
+
+	fz_try(ctx)
+	{
+		pix = fz_get_pixmap_from_image(ctx, image, NULL, NULL, &w, &h);
+		if (job->use->mask ? pix->n == 1 : (pix->colorspace == image->colorspace && pix->n - pix->alpha == image->n))
+			scaled = fz_scale_pixmap(ctx, pix, 0, 0, job->w, job->h, NULL);
+		if (scaled && scaled->w == job->w && scaled->h == job->h)
+		{
+			/* Photos stay photos; JPEG output is only gray or RGB though. */
+			if (job->use->dct && !scaled->alpha && (scaled->colorspace == fz_device_gray(ctx) || scaled->colorspace == fz_device_rgb(ctx)))
+			{
+				job->data = fz_new_buffer_from_pixmap_as_jpeg(ctx, scaled, JPEG_QUALITY);
+				job->dct = 1;
+			}
+			else
+			{
+				raw = pack_samples(ctx, scaled, job->use->mask, job->use->bilevel);
+				job->data = deflate_samples(ctx, raw);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, raw);
+		fz_drop_pixmap(ctx, scaled);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+static void
+update_image(fz_context *ctx, pdf_document *doc, image_job *job)
+{
+	pdf_obj *ref;
+	pdf_obj *dict;
+
+	ref = pdf_new_indirect(ctx, doc, job->use->num, 0);
+	fz_try(ctx)
+	{
+		dict = pdf_resolve_indirect(ctx, ref);
+		if (job->data->len < (size_t)pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Length)))
+		{
+			pdf_update_stream(ctx, doc, ref, job->data, 1);
+			pdf_dict_del(ctx, dict, PDF_NAME_DecodeParms);
+			pdf_dict_put_drop(ctx, dict, PDF_NAME_Filter, job->dct ? PDF_NAME_DCTDecode : PDF_NAME_FlateDecode);
+			pdf_dict_put_drop(ctx, dict, PDF_NAME_Width, pdf_new_int(ctx, doc, job->w));
+			pdf_dict_put_drop(ctx, dict, PDF_NAME_Height, pdf_new_int(ctx, doc, job->h));
+			pdf_dict_put_drop(ctx, dict, PDF_NAME_BitsPerComponent, pdf_new_int(ctx, doc, job->use->mask || job->use->bilevel ? 1 : 8));
+		}
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, ref);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+run_batch(fz_context *ctx, pdf_document *doc, image_batch *batch, int threads)
+{
+	int i;
+
+	fz_try(ctx)
+	{
+		fz_run_workers(ctx, threads, batch->len, downsample_worker, batch);
+
+		/* Only the calling thread may change the document. */
+		for (i = 0; i < batch->len; i++)
+			if (batch->jobs[i].data)
+				update_image(ctx, doc, &batch->jobs[i]);
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < batch->len; i++)
+		{
+			fz_drop_image(ctx, batch->jobs[i].image);
+			fz_drop_buffer(ctx, batch->jobs[i].data);
+		}
+		batch->len = 0;
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+void
+pdf_downsample_images(fz_context *ctx, pdf_document *doc, int dpi, int threads)
+{
+	image_use_device *dev = NULL;
+	image_use *images = NULL;
+	image_batch batch = { 0 };
+	pdf_page *page = NULL;
+	pdf_obj *ref = NULL;
+	int i, n, count = 0, batch_size;
+
+	if (dpi <= 0)
+		return;
+	if (doc->crypt)
+	{
+		fz_warn(ctx, "cannot downsample images in encrypted documents");
+		return;
+	}
+
+	batch_size = fz_maxi(threads, 1) * IMAGES_PER_THREAD;
+
+	fz_var(dev);
+	fz_var(images);
+	fz_var(batch);
+	fz_var(page);
+	fz_var(ref);
+
+	fz_try(ctx)
+	{
+		images = find_images(ctx, doc, &count);
+
+		dev = new_image_use_device(ctx, images, count);
+		n = count > 0 ? pdf_count_pages(ctx, doc) : 0;
+		for (i = 0; i < n; i++)
+		{
+			page = pdf_load_page(ctx, doc, i);
+			collect_page_images(ctx, doc, page, dev);
+			drop_page_images(ctx, dev);
+			fz_drop_page(ctx, (fz_page *)page);
+			page = NULL;
+		}
+
+		batch.jobs = fz_malloc_array(ctx, batch_size, sizeof *batch.jobs);
+		for (i = 0; i < count; i++)
+		{
+			image_use *use = &images[i];
+			image_job *job;
+			int w, h;
+
+			/* Images that are never drawn, such as soft masks, are left alone. */
+			if (use->unsure || use->max_w <= 0 || use->max_h <= 0)
+				continue;
+
+			w = (int)ceilf(use->max_w * dpi / 72);
+			h = (int)ceilf(use->max_h * dpi / 72);
+			if (use->w <= w * DOWNSAMPLE_THRESHOLD && use->h <= h * DOWNSAMPLE_THRESHOLD)
+				continue;
+
+			job = &batch.jobs[batch.len];
+			memset(job, 0, sizeof *job);
+			job->use = use;
+			job->w = fz_mini(w, use->w);
+			job->h = fz_mini(h, use->h);
+			ref = pdf_new_indirect(ctx, doc, use->num, 0);
+			job->image = pdf_load_image(ctx, doc, ref);
+			pdf_drop_obj(ctx, ref);
+			ref = NULL;
+
+			if (++batch.len == batch_size)
+				run_batch(ctx, doc, &batch, threads);
+		}
+		run_batch(ctx, doc, &batch, threads);
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < batch.len; i++)
+			fz_drop_image(ctx, batch.jobs[i].image);
+		fz_free(ctx, batch.jobs);
+		pdf_drop_obj(ctx, ref);
+		fz_drop_page(ctx, (fz_page *)page);
+		fz_drop_device(ctx, (fz_device *)dev);
+		fz_free(ctx, images);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "cannot downsample images: %s", fz_caught_message(ctx));
+	}
+}
@@ -116,7 +116,7 @@ ocg_intents_include(fz_context *ctx, pdf_ocg_descriptor *desc, char *name)
 }
 
 static int
-pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const char *event, pdf_obj *ocg)
+pdf_is_hidden_ocg_imp(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const char *event, pdf_obj *ocg)
 {
 	char event_state[16];
 	pdf_obj *obj, *obj2, *type;
@@ -265,7 +265,7 @@ pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const
 				len = pdf_array_len(ctx, obj);
 				for (i = 0; i < len; i++)
 				{
-					int hidden = pdf_is_hidden_ocg(ctx, desc, rdb, event, pdf_array_get(ctx, obj, i));
+					int hidden = pdf_is_hidden_ocg_imp(ctx, desc, rdb, event, pdf_array_get(ctx, obj, i));
 					if ((combine & 1) == 0)
 						hidden = !hidden;
 					if (combine & 2)
@@ -276,7 +276,7 @@ pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const
 			}
 			else
 			{
-				on = pdf_is_hidden_ocg(ctx, desc, rdb, event, obj);
+				on = pdf_is_hidden_ocg_imp(ctx, desc, rdb, event, obj);
 				if ((combine & 1) == 0)
 					on = !on;
 			}
@@ -295,6 +295,26 @@ pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const
 	return 0;
 }
 
+static int
+pdf_is_hidden_ocg(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, const char *event, pdf_obj *ocg)
+{
+	int hidden = 0;
+
+	if (!ocg || !event || !doc->ocg)
+		return 0;
+
+	/* Membership dictionaries are marked to avoid loops */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		hidden = pdf_is_hidden_ocg_imp(ctx, doc->ocg, rdb, event, ocg);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return hidden;
+}
+
 static fz_image *
 parse_inline_image(fz_context *ctx, pdf_csi *csi, fz_stream *stm)
 {
@@ -524,7 +544,7 @@ pdf_process_Do(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 	if (!pdf_is_name(ctx, subtype))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "no XObject subtype specified");
 
-	if (pdf_is_hidden_ocg(ctx, csi->doc->ocg, csi->rdb, proc->event, pdf_dict_get(ctx, xobj, PDF_NAME_OC)))
+	if (pdf_is_hidden_ocg(ctx, csi->doc, csi->rdb, proc->event, pdf_dict_get(ctx, xobj, PDF_NAME_OC)))
 		return;
 
 	if (pdf_name_eq(ctx, subtype, PDF_NAME_Form))
@@ -720,7 +740,7 @@ pdf_process_BDC(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 	if (!pdf_name_eq(ctx, pdf_dict_get(ctx, cooked, PDF_NAME_Type), PDF_NAME_OCG))
 		return;
 
-	if (pdf_is_hidden_ocg(ctx, csi->doc->ocg, csi->rdb, proc->event, cooked))
+	if (pdf_is_hidden_ocg(ctx, csi->doc, csi->rdb, proc->event, cooked))
 		++proc->hidden;
 }
 
@@ -1000,6 +1020,38 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	return 0;
 }
 
+/* Operators that look up (and may load) named resources from the document. */
+static int
+is_resource_keyword(const char *word)
+{
+	static const char *ops[] = { "gs", "Tf", "cs", "CS", "sc", "SC", "scn", "SCN", "sh", "Do", "BI", "BDC", "DP" };
+	int i;
+
+	for (i = 0; i < nelem(ops); i++)
+		if (!strcmp(word, ops[i]))
+			return 1;
+	return 0;
+}
+
+static int
+pdf_process_shared_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, char *word)
+{
+	int ret = 0;
+
+	if (!proc->shared_document || !is_resource_keyword(word))
+		return pdf_process_keyword(ctx, proc, csi, stm, word);
+
+	pdf_lock_document(ctx, csi->doc);
+	fz_try(ctx)
+		ret = pdf_process_keyword(ctx, proc, csi, stm, word);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, csi->doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return ret;
+}
+
 static void
 pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm)
 {
@@ -1161,7 +1213,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					break;
 
 				case PDF_TOK_KEYWORD:
-					if (pdf_process_keyword(ctx, proc, csi, stm, buf->scratch))
+					if (pdf_process_shared_keyword(ctx, proc, csi, stm, buf->scratch))
 					{
 						tok = PDF_TOK_EOF;
 					}
@@ -1266,7 +1318,7 @@ pdf_process_annot(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_p
 	/* TODO: NoZoom and NoRotate */
 
 	/* XXX what resources, if any, to use for this check? */
-	if (pdf_is_hidden_ocg(ctx, doc->ocg, NULL, proc->event, pdf_dict_get(ctx, annot->obj, PDF_NAME_OC)))
+	if (pdf_is_hidden_ocg(ctx, doc, NULL, proc->event, pdf_dict_get(ctx, annot->obj, PDF_NAME_OC)))
 		return;
 
 	if (proc->op_q && proc->op_cm && proc->op_Do_form && proc->op_Q && annot->ap)
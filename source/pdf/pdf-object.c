@@ -25,7 +25,9 @@ enum
 	PDF_FLAGS_SORTED = 2,
 	PDF_FLAGS_MEMO = 4,
 	PDF_FLAGS_MEMO_BOOL = 8,
-	PDF_FLAGS_DIRTY = 16
+	PDF_FLAGS_DIRTY = 16,
+	PDF_FLAGS_ARENA = 32, /* allocated from an object arena */
+	PDF_FLAGS_ARENA_ITEMS = 64 /* array or dict items still in the arena */
 };
 
 struct pdf_obj_s
@@ -93,6 +95,182 @@ typedef struct pdf_obj_ref_s
 #define ARRAY(obj) ((pdf_obj_array *)(obj))
 #define REF(obj) ((pdf_obj_ref *)(obj))
 
+/*
+	Object arenas.
+
+	Objects loaded from the file are carved out of 64k chunks. Chunks
+	are allocated 16 at a time, aligned to their size so that an object
+	can find the block it came from. A block is freed once the arena
+	has moved on from it and every object allocated from it has been
+	dropped, so objects may safely outlive their document.
+
+	Only the thread holding the document lock allocates from the arena;
+	the counts of dropped objects are kept under FZ_LOCK_ALLOC like the
+	reference counts.
+*/
+
+enum
+{
+	ARENA_CHUNK_SIZE = 64 << 10,
+	ARENA_CHUNKS = 16,
+	ARENA_MAX_OBJECT = 2048
+};
+
+typedef struct pdf_arena_block_s pdf_arena_block;
+
+struct pdf_arena_block_s
+{
+	void *base;
+	int closed;
+	size_t allocated;
+	size_t freed;
+};
+
+typedef union
+{
+	pdf_arena_block *block;
+	fz_off_t align;
+} pdf_arena_chunk;
+
+struct pdf_obj_arena_s
+{
+	pdf_arena_block *block;
+	char *next_chunk;
+	int chunks_left;
+	char *pos, *end;
+};
+
+static void
+pdf_close_arena_block(fz_context *ctx, pdf_arena_block *block)
+{
+	int dead;
+
+	if (!block)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	block->closed = 1;
+	dead = (block->freed == block->allocated);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (dead)
+	{
+		fz_free(ctx, block->base);
+		fz_free(ctx, block);
+	}
+}
+
+static void
+pdf_arena_next_chunk(fz_context *ctx, pdf_obj_arena *arena)
+{
+	pdf_arena_chunk *chunk;
+
+	if (arena->chunks_left == 0)
+	{
+		pdf_arena_block *block = fz_malloc_struct(ctx, pdf_arena_block);
+		char *base;
+
+		fz_try(ctx)
+			block->base = Memento_label(fz_malloc(ctx, (ARENA_CHUNKS + 1) * ARENA_CHUNK_SIZE), "pdf_obj_arena");
+		fz_catch(ctx)
+		{
+			fz_free(ctx, block);
+			fz_rethrow(ctx);
+		}
+
+		pdf_close_arena_block(ctx, arena->block);
+		arena->block = block;
+
+		base = block->base;
+		arena->next_chunk = base + (ARENA_CHUNK_SIZE - ((uintptr_t)base & (ARENA_CHUNK_SIZE - 1))) % ARENA_CHUNK_SIZE;
+		arena->chunks_left = ARENA_CHUNKS;
+	}
+
+	chunk = (pdf_arena_chunk *)arena->next_chunk;
+	chunk->block = arena->block;
+	arena->pos = arena->next_chunk + sizeof *chunk;
+	arena->end = arena->next_chunk + ARENA_CHUNK_SIZE;
+	arena->next_chunk += ARENA_CHUNK_SIZE;
+	arena->chunks_left--;
+}
+
+static void *
+pdf_arena_alloc(fz_context *ctx, pdf_document *doc, size_t size)
+{
+	pdf_obj_arena *arena;
+	void *ptr;
+
+	if (!doc || !doc->obj_arena || doc->lock_owner != ctx)
+		return NULL;
+
+	size = (size + sizeof(fz_off_t) - 1) & ~(sizeof(fz_off_t) - 1);
+	if (size > ARENA_MAX_OBJECT)
+		return NULL;
+
+	arena = doc->obj_arena;
+	if (arena->pos + size > arena->end)
+		pdf_arena_next_chunk(ctx, arena);
+	ptr = arena->pos;
+	arena->pos += size;
+	arena->block->allocated++;
+	return ptr;
+}
+
+static void
+pdf_arena_free(fz_context *ctx, void *ptr)
+{
+	pdf_arena_chunk *chunk = (pdf_arena_chunk *)((uintptr_t)ptr & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1));
+	pdf_arena_block *block = chunk->block;
+	int dead;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	block->freed++;
+	dead = (block->closed && block->freed == block->allocated);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (dead)
+	{
+		fz_free(ctx, block->base);
+		fz_free(ctx, block);
+	}
+}
+
+void
+pdf_enable_object_arena(fz_context *ctx, pdf_document *doc)
+{
+	if (!doc->obj_arena)
+		doc->obj_arena = fz_malloc_struct(ctx, pdf_obj_arena);
+}
+
+void
+pdf_drop_object_arena(fz_context *ctx, pdf_obj_arena *arena)
+{
+	if (!arena)
+		return;
+	pdf_close_arena_block(ctx, arena->block);
+	fz_free(ctx, arena);
+}
+
+static void *
+pdf_alloc_obj(fz_context *ctx, pdf_document *doc, size_t size, const char *label)
+{
+	pdf_obj *obj = pdf_arena_alloc(ctx, doc, size);
+	if (obj)
+	{
+		obj->flags = PDF_FLAGS_ARENA;
+		return obj;
+	}
+	obj = Memento_label(fz_malloc(ctx, size), label);
+	obj->flags = 0;
+	return obj;
+}
+
+static void
+pdf_free_obj(fz_context *ctx, pdf_obj *obj)
+{
+	if (obj->flags & PDF_FLAGS_ARENA)
+		pdf_arena_free(ctx, obj);
+	else
+		fz_free(ctx, obj);
+}
+
 pdf_obj *
 pdf_new_null(fz_context *ctx, pdf_document *doc)
 {
@@ -109,10 +287,9 @@ pdf_obj *
 pdf_new_int(fz_context *ctx, pdf_document *doc, int i)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(int)");
+	obj = pdf_alloc_obj(ctx, doc, sizeof(pdf_obj_num), "pdf_obj(int)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INT;
-	obj->super.flags = 0;
 	obj->u.i = i;
 	return &obj->super;
 }
@@ -121,10 +298,9 @@ pdf_obj *
 pdf_new_int_offset(fz_context *ctx, pdf_document *doc, fz_off_t i)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(offset)");
+	obj = pdf_alloc_obj(ctx, doc, sizeof(pdf_obj_num), "pdf_obj(offset)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INT;
-	obj->super.flags = 0;
 	obj->u.i = i;
 	return &obj->super;
 }
@@ -133,10 +309,9 @@ pdf_obj *
 pdf_new_real(fz_context *ctx, pdf_document *doc, float f)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(real)");
+	obj = pdf_alloc_obj(ctx, doc, sizeof(pdf_obj_num), "pdf_obj(real)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_REAL;
-	obj->super.flags = 0;
 	obj->u.f = f;
 	return &obj->super;
 }
@@ -150,10 +325,9 @@ pdf_new_string(fz_context *ctx, pdf_document *doc, const char *str, size_t len)
 	if ((size_t)l != len)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Overflow in pdf string");
 
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_string, buf) + len + 1), "pdf_obj(string)");
+	obj = pdf_alloc_obj(ctx, doc, offsetof(pdf_obj_string, buf) + len + 1, "pdf_obj(string)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_STRING;
-	obj->super.flags = 0;
 	obj->len = l;
 	memcpy(obj->buf, str, len);
 	obj->buf[len] = '\0';
@@ -176,10 +350,9 @@ pdf_new_name(fz_context *ctx, pdf_document *doc, const char *str)
 	if (stdname != NULL)
 		return (pdf_obj *)(intptr_t)(stdname - &PDF_NAMES[0]);
 
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_name, n) + strlen(str) + 1), "pdf_obj(name)");
+	obj = pdf_alloc_obj(ctx, doc, offsetof(pdf_obj_name, n) + strlen(str) + 1, "pdf_obj(name)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_NAME;
-	obj->super.flags = 0;
 	strcpy(obj->n, str);
 	return &obj->super;
 }
@@ -188,10 +361,9 @@ pdf_obj *
 pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
 {
 	pdf_obj_ref *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_ref)), "pdf_obj(indirect)");
+	obj = pdf_alloc_obj(ctx, doc, sizeof(pdf_obj_ref), "pdf_obj(indirect)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INDIRECT;
-	obj->super.flags = 0;
 	obj->doc = doc;
 	obj->num = num;
 	obj->gen = gen;
@@ -512,6 +684,97 @@ pdf_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 	return 1;
 }
 
+static unsigned int
+hash_bytes(unsigned int h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	while (len--)
+		h = (h ^ *p++) * 16777619;
+	return h;
+}
+
+unsigned int
+pdf_hash_obj(fz_context *ctx, pdf_obj *obj)
+{
+	unsigned int h;
+	const char *name;
+	float f;
+	int i;
+
+	if (!obj)
+		return 0;
+
+	/* Name constants and name objects compare equal, so hash their text. */
+	if (obj < PDF_OBJ_NAME__LIMIT)
+	{
+		name = PDF_NAMES[(intptr_t)obj];
+		return hash_bytes(2166136261u ^ PDF_NAME, name, strlen(name));
+	}
+
+	if (obj < PDF_OBJ__LIMIT)
+		return (unsigned int)(intptr_t)obj;
+
+	h = 2166136261u ^ obj->kind;
+	switch (obj->kind)
+	{
+	case PDF_NAME:
+		return hash_bytes(h, NAME(obj)->n, strlen(NAME(obj)->n));
+
+	case PDF_INT:
+		return hash_bytes(h, &NUM(obj)->u.i, sizeof NUM(obj)->u.i);
+
+	case PDF_REAL:
+		/* Fold -0 into 0, as they compare equal. */
+		f = NUM(obj)->u.f + 0.0f;
+		return hash_bytes(h, &f, sizeof f);
+
+	case PDF_STRING:
+		return hash_bytes(h, STRING(obj)->buf, STRING(obj)->len);
+
+	case PDF_INDIRECT:
+		h = hash_bytes(h, &REF(obj)->num, sizeof REF(obj)->num);
+		return hash_bytes(h, &REF(obj)->gen, sizeof REF(obj)->gen);
+
+	case PDF_ARRAY:
+		for (i = 0; i < ARRAY(obj)->len; i++)
+			h = (h ^ pdf_hash_obj(ctx, ARRAY(obj)->items[i])) * 16777619;
+		return h;
+
+	case PDF_DICT:
+		for (i = 0; i < DICT(obj)->len; i++)
+		{
+			h = (h ^ pdf_hash_obj(ctx, DICT(obj)->items[i].k)) * 16777619;
+			h = (h ^ pdf_hash_obj(ctx, DICT(obj)->items[i].v)) * 16777619;
+		}
+		return h;
+	}
+
+	return h;
+}
+
+unsigned int
+pdf_hash_object_num(fz_context *ctx, pdf_document *doc, int num)
+{
+	pdf_xref_entry *entry;
+	unsigned int h;
+	fz_buffer *buf;
+	unsigned char *data;
+	size_t len;
+
+	entry = pdf_cache_object(ctx, doc, num);
+	h = pdf_hash_obj(ctx, entry->obj);
+
+	if (entry->stm_ofs != 0 || entry->stm_buf)
+	{
+		buf = pdf_load_raw_stream(ctx, doc, num);
+		len = fz_buffer_storage(ctx, buf, &data);
+		h = hash_bytes(h, data, len);
+		fz_drop_buffer(ctx, buf);
+	}
+
+	return h;
+}
+
 static char *
 pdf_objkindstr(pdf_obj *obj)
 {
@@ -541,27 +804,37 @@ pdf_obj *
 pdf_new_array(fz_context *ctx, pdf_document *doc, int initialcap)
 {
 	pdf_obj_array *obj;
-	int i;
+	int i, cap = initialcap > 0 ? initialcap : 6;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_array)), "pdf_obj(array)");
+	/* Arena arrays keep their initial items alongside */
+	obj = pdf_arena_alloc(ctx, doc, sizeof(pdf_obj_array) + cap * sizeof(pdf_obj*));
+	if (obj)
+	{
+		obj->super.flags = PDF_FLAGS_ARENA | PDF_FLAGS_ARENA_ITEMS;
+		obj->items = (pdf_obj **)(obj + 1);
+	}
+	else
+	{
+		obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_array)), "pdf_obj(array)");
+		obj->super.flags = 0;
+		fz_try(ctx)
+		{
+			obj->items = Memento_label(fz_malloc_array(ctx, cap, sizeof(pdf_obj*)), "pdf_obj(array items)");
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, obj);
+			fz_rethrow(ctx);
+		}
+	}
 	obj->super.refs = 1;
 	obj->super.kind = PDF_ARRAY;
-	obj->super.flags = 0;
 	obj->doc = doc;
 	obj->parent_num = 0;
 
 	obj->len = 0;
-	obj->cap = initialcap > 1 ? initialcap : 6;
+	obj->cap = cap;
 
-	fz_try(ctx)
-	{
-		obj->items = Memento_label(fz_malloc_array(ctx, obj->cap, sizeof(pdf_obj*)), "pdf_obj(array items)");
-	}
-	fz_catch(ctx)
-	{
-		fz_free(ctx, obj);
-		fz_rethrow(ctx);
-	}
 	for (i = 0; i < obj->cap; i++)
 		obj->items[i] = NULL;
 
@@ -572,9 +845,17 @@ static void
 pdf_array_grow(fz_context *ctx, pdf_obj_array *obj)
 {
 	int i;
-	int new_cap = (obj->cap * 3) / 2;
+	int new_cap = (obj->cap * 3) / 2 + 1;
 
-	obj->items = fz_resize_array(ctx, obj->items, new_cap, sizeof(pdf_obj*));
+	if (obj->super.flags & PDF_FLAGS_ARENA_ITEMS)
+	{
+		pdf_obj **items = fz_malloc_array(ctx, new_cap, sizeof(pdf_obj*));
+		memcpy(items, obj->items, obj->len * sizeof(pdf_obj*));
+		obj->items = items;
+		obj->super.flags &= ~PDF_FLAGS_ARENA_ITEMS;
+	}
+	else
+		obj->items = fz_resize_array(ctx, obj->items, new_cap, sizeof(pdf_obj*));
 	obj->cap = new_cap;
 
 	for (i = obj->len ; i < obj->cap; i++)
@@ -933,27 +1214,36 @@ pdf_obj *
 pdf_new_dict(fz_context *ctx, pdf_document *doc, int initialcap)
 {
 	pdf_obj_dict *obj;
-	int i;
+	int i, cap = initialcap > 0 ? initialcap : 10;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_dict)), "pdf_obj(dict)");
+	obj = pdf_arena_alloc(ctx, doc, sizeof(pdf_obj_dict) + cap * sizeof(struct keyval));
+	if (obj)
+	{
+		obj->super.flags = PDF_FLAGS_ARENA | PDF_FLAGS_ARENA_ITEMS;
+		obj->items = (struct keyval *)(obj + 1);
+	}
+	else
+	{
+		obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_dict)), "pdf_obj(dict)");
+		obj->super.flags = 0;
+		fz_try(ctx)
+		{
+			obj->items = Memento_label(fz_malloc_array(ctx, cap, sizeof(struct keyval)), "pdf_obj(dict items)");
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, obj);
+			fz_rethrow(ctx);
+		}
+	}
 	obj->super.refs = 1;
 	obj->super.kind = PDF_DICT;
-	obj->super.flags = 0;
 	obj->doc = doc;
 	obj->parent_num = 0;
 
 	obj->len = 0;
-	obj->cap = initialcap > 1 ? initialcap : 10;
+	obj->cap = cap;
 
-	fz_try(ctx)
-	{
-		DICT(obj)->items = Memento_label(fz_malloc_array(ctx, DICT(obj)->cap, sizeof(struct keyval)), "pdf_obj(dict items)");
-	}
-	fz_catch(ctx)
-	{
-		fz_free(ctx, obj);
-		fz_rethrow(ctx);
-	}
 	for (i = 0; i < DICT(obj)->cap; i++)
 	{
 		DICT(obj)->items[i].k = NULL;
@@ -967,9 +1257,17 @@ static void
 pdf_dict_grow(fz_context *ctx, pdf_obj *obj)
 {
 	int i;
-	int new_cap = (DICT(obj)->cap * 3) / 2;
+	int new_cap = (DICT(obj)->cap * 3) / 2 + 1;
 
-	DICT(obj)->items = fz_resize_array(ctx, DICT(obj)->items, new_cap, sizeof(struct keyval));
+	if (obj->flags & PDF_FLAGS_ARENA_ITEMS)
+	{
+		struct keyval *items = fz_malloc_array(ctx, new_cap, sizeof(struct keyval));
+		memcpy(items, DICT(obj)->items, DICT(obj)->len * sizeof(struct keyval));
+		DICT(obj)->items = items;
+		obj->flags &= ~PDF_FLAGS_ARENA_ITEMS;
+	}
+	else
+		DICT(obj)->items = fz_resize_array(ctx, DICT(obj)->items, new_cap, sizeof(struct keyval));
 	DICT(obj)->cap = new_cap;
 
 	for (i = DICT(obj)->len; i < DICT(obj)->cap; i++)
@@ -1708,8 +2006,9 @@ pdf_drop_array(fz_context *ctx, pdf_obj *obj)
 	for (i = 0; i < DICT(obj)->len; i++)
 		pdf_drop_obj(ctx, ARRAY(obj)->items[i]);
 
-	fz_free(ctx, DICT(obj)->items);
-	fz_free(ctx, obj);
+	if (!(obj->flags & PDF_FLAGS_ARENA_ITEMS))
+		fz_free(ctx, DICT(obj)->items);
+	pdf_free_obj(ctx, obj);
 }
 
 static void
@@ -1722,8 +2021,9 @@ pdf_drop_dict(fz_context *ctx, pdf_obj *obj)
 		pdf_drop_obj(ctx, DICT(obj)->items[i].v);
 	}
 
-	fz_free(ctx, DICT(obj)->items);
-	fz_free(ctx, obj);
+	if (!(obj->flags & PDF_FLAGS_ARENA_ITEMS))
+		fz_free(ctx, DICT(obj)->items);
+	pdf_free_obj(ctx, obj);
 }
 
 void
@@ -1739,7 +2039,7 @@ pdf_drop_obj(fz_context *ctx, pdf_obj *obj)
 			else if (obj->kind == PDF_DICT)
 				pdf_drop_dict(ctx, obj);
 			else
-				fz_free(ctx, obj);
+				pdf_free_obj(ctx, obj);
 		}
 	}
 }
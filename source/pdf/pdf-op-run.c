@@ -67,6 +67,14 @@ struct pdf_gstate_s
 	int luminosity;
 };
 
+typedef struct xobject_link_s xobject_link;
+
+struct xobject_link_s
+{
+	pdf_obj *obj;
+	xobject_link *up;
+};
+
 struct pdf_run_processor_s
 {
 	pdf_processor super;
@@ -74,6 +82,9 @@ struct pdf_run_processor_s
 
 	int nested_depth;
 
+	/* form xobjects currently being run, innermost first */
+	xobject_link *xobjects;
+
 	/* path object state */
 	fz_path *path;
 	int clip;
@@ -1228,10 +1239,17 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_xobject *xobj, pdf
 	fz_matrix xobj_matrix;
 	int transparency;
 	pdf_document *doc;
+	xobject_link link, *up;
 
-	/* Avoid infinite recursion */
-	if (xobj == NULL || pdf_mark_obj(ctx, xobj->obj))
+	/* Avoid infinite recursion. The chain is kept per processor rather
+	 * than by marking the object, as other threads may be running the
+	 * same xobject. */
+	if (xobj == NULL)
 		return;
+	link.obj = pdf_resolve_indirect(ctx, xobj->obj);
+	for (up = pr->xobjects; up; up = up->up)
+		if (up->obj == link.obj)
+			return;
 
 	pdf_xobject_bbox(ctx, xobj, &xobj_bbox);
 	pdf_xobject_matrix(ctx, xobj, &xobj_matrix);
@@ -1243,6 +1261,8 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_xobject *xobj, pdf
 
 	gparent_save = pr->gparent;
 	pr->gparent = pr->gtop;
+	link.up = pr->xobjects;
+	pr->xobjects = &link;
 
 	fz_try(ctx)
 	{
@@ -1353,7 +1373,7 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_xobject *xobj, pdf
 			pdf_grestore(ctx, pr);
 		}
 
-		pdf_unmark_obj(ctx, xobj->obj);
+		pr->xobjects = link.up;
 	}
 	fz_catch(ctx)
 	{
@@ -2148,6 +2168,7 @@ pdf_new_run_processor(fz_context *ctx, fz_device *dev, const fz_matrix *ctm, con
 	proc->dev = dev;
 
 	proc->nested_depth = nested;
+	proc->xobjects = NULL;
 
 	proc->path = NULL;
 	proc->clip = 0;
@@ -111,6 +111,221 @@ pdf_lookup_page_loc_imp(fz_context *ctx, pdf_document *doc, pdf_obj *node, int *
 	return hit;
 }
 
+typedef struct
+{
+	pdf_obj *node;
+	pdf_obj *kids;
+	int i, n;
+} page_tree_frame;
+
+/* Collect up to 'max' leaf page objects of the tree under 'node', in page order. */
+static int
+pdf_flatten_page_tree_imp(fz_context *ctx, pdf_obj *node, pdf_obj **refs, int max)
+{
+	page_tree_frame local_stack[LOCAL_STACK_SIZE];
+	page_tree_frame *stack = &local_stack[0];
+	int stack_max = LOCAL_STACK_SIZE;
+	int stack_len = 0;
+	int len = 0;
+	int i;
+
+	fz_var(stack);
+	fz_var(stack_len);
+	fz_var(stack_max);
+	fz_var(len);
+
+	fz_try(ctx)
+	{
+		if (pdf_mark_obj(ctx, node))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
+		stack[0].node = node;
+		stack[0].kids = pdf_dict_get(ctx, node, PDF_NAME_Kids);
+		stack[0].i = 0;
+		stack[0].n = pdf_array_len(ctx, stack[0].kids);
+		stack_len = 1;
+
+		while (stack_len > 0)
+		{
+			page_tree_frame *top = &stack[stack_len-1];
+			pdf_obj *kid, *type;
+
+			if (top->i == top->n)
+			{
+				pdf_unmark_obj(ctx, top->node);
+				stack_len--;
+				continue;
+			}
+
+			kid = pdf_array_get(ctx, top->kids, top->i++);
+			type = pdf_dict_get(ctx, kid, PDF_NAME_Type);
+			if (type ? pdf_name_eq(ctx, type, PDF_NAME_Pages) : pdf_dict_get(ctx, kid, PDF_NAME_Kids) && !pdf_dict_get(ctx, kid, PDF_NAME_MediaBox))
+			{
+				if (stack_len == stack_max)
+				{
+					if (stack == &local_stack[0])
+					{
+						stack = fz_malloc_array(ctx, stack_max * 2, sizeof(*stack));
+						memcpy(stack, &local_stack[0], stack_max * sizeof(*stack));
+					}
+					else
+						stack = fz_resize_array(ctx, stack, stack_max * 2, sizeof(*stack));
+					stack_max *= 2;
+				}
+				if (pdf_mark_obj(ctx, kid))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
+				stack[stack_len].node = kid;
+				stack[stack_len].kids = pdf_dict_get(ctx, kid, PDF_NAME_Kids);
+				stack[stack_len].i = 0;
+				stack[stack_len].n = pdf_array_len(ctx, stack[stack_len].kids);
+				stack_len++;
+			}
+			else
+			{
+				if (type ? !pdf_name_eq(ctx, type, PDF_NAME_Page) : !pdf_dict_get(ctx, kid, PDF_NAME_MediaBox))
+					fz_warn(ctx, "non-page object in page tree (%s)", pdf_to_name(ctx, type));
+				if (len == max)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "more pages in page tree than its count");
+				refs[len++] = pdf_keep_obj(ctx, kid);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = stack_len; i > 0; i--)
+			pdf_unmark_obj(ctx, stack[i-1].node);
+		if (stack != &local_stack[0])
+			fz_free(ctx, stack);
+	}
+	fz_catch(ctx)
+	{
+		for (i = 0; i < len; i++)
+			pdf_drop_obj(ctx, refs[i]);
+		fz_rethrow(ctx);
+	}
+
+	return len;
+}
+
+/*
+	Build the flat page index (doc->page_refs) with one walk over the
+	whole page tree. A tree that does not agree with its /Count is
+	left unindexed, and looked up by walking it as before.
+	The caller must hold the document lock.
+*/
+static void
+pdf_load_page_tree(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj *root = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME_Root);
+	pdf_obj *node = pdf_dict_get(ctx, root, PDF_NAME_Pages);
+	int count = pdf_count_pages(ctx, doc);
+	pdf_obj **refs;
+	int i, len = 0;
+
+	if (doc->page_refs || !node || count <= 0)
+		return;
+
+	refs = fz_malloc_array(ctx, count, sizeof(*refs));
+	fz_try(ctx)
+		len = pdf_flatten_page_tree_imp(ctx, node, refs, count);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, refs);
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "cannot index page tree: %s", fz_caught_message(ctx));
+		return;
+	}
+
+	if (len != count)
+	{
+		fz_warn(ctx, "cannot index page tree: found %d of %d pages", len, count);
+		for (i = 0; i < len; i++)
+			pdf_drop_obj(ctx, refs[i]);
+		fz_free(ctx, refs);
+		return;
+	}
+
+	/* pdf_lookup_page_obj reads these unlocked, so publish the array
+	 * only once it and its length are complete. */
+	doc->page_refs_len = len;
+	fz_store_release_ptr(doc->page_refs, refs);
+}
+
+/*
+	Build the reverse of the page index: the page number + 1 of each
+	page object, by object number. The caller must hold the document
+	lock.
+*/
+static void
+pdf_load_page_index(fz_context *ctx, pdf_document *doc)
+{
+	int i, num, max = 0;
+	int *index;
+
+	if (doc->page_index || !doc->page_refs)
+		return;
+
+	for (i = 0; i < doc->page_refs_len; i++)
+	{
+		num = pdf_to_num(ctx, doc->page_refs[i]);
+		if (num > max)
+			max = num;
+	}
+
+	index = fz_calloc(ctx, max + 1, sizeof(*index));
+	/* If a page appears more than once, the first occurrence wins */
+	for (i = doc->page_refs_len; i > 0; i--)
+	{
+		num = pdf_to_num(ctx, doc->page_refs[i-1]);
+		if (num > 0)
+			index[num] = i;
+	}
+
+	doc->page_index_len = max + 1;
+	doc->page_index = index;
+}
+
+/*
+	The first lookup after opening or editing the page tree walks it
+	from the root, so that showing a single page of a large document
+	does not load every page object. Later lookups build the index.
+	The caller must hold the document lock.
+*/
+static void
+pdf_use_page_tree(fz_context *ctx, pdf_document *doc)
+{
+	if (!doc->page_refs && doc->page_lookups++ > 0)
+		pdf_load_page_tree(ctx, doc);
+}
+
+/* Find the parent node and index in its kids of an indexed page. */
+static pdf_obj *
+pdf_lookup_page_loc_indexed(fz_context *ctx, pdf_document *doc, int needle, pdf_obj **parentp, int *indexp)
+{
+	pdf_obj *hit = doc->page_refs[needle];
+	pdf_obj *parent, *kids;
+	int i, len, num;
+
+	if (!parentp && !indexp)
+		return hit;
+
+	num = pdf_to_num(ctx, hit);
+	parent = pdf_dict_get(ctx, hit, PDF_NAME_Parent);
+	kids = pdf_dict_get(ctx, parent, PDF_NAME_Kids);
+	len = pdf_array_len(ctx, kids);
+	for (i = 0; i < len && num > 0; i++)
+	{
+		if (pdf_to_num(ctx, pdf_array_get(ctx, kids, i)) == num)
+		{
+			if (parentp) *parentp = parent;
+			if (indexp) *indexp = i;
+			return hit;
+		}
+	}
+
+	/* The /Parent link is broken; fall back to walking the tree */
+	return NULL;
+}
+
 pdf_obj *
 pdf_lookup_page_loc(fz_context *ctx, pdf_document *doc, int needle, pdf_obj **parentp, int *indexp)
 {
@@ -122,7 +337,21 @@ pdf_lookup_page_loc(fz_context *ctx, pdf_document *doc, int needle, pdf_obj **pa
 	if (!node)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page tree");
 
-	hit = pdf_lookup_page_loc_imp(ctx, doc, node, &skip, parentp, indexp);
+	/* The walk marks nodes to detect cycles */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+	{
+		hit = NULL;
+		pdf_use_page_tree(ctx, doc);
+		if (doc->page_refs && needle >= 0 && needle < doc->page_refs_len)
+			hit = pdf_lookup_page_loc_indexed(ctx, doc, needle, parentp, indexp);
+		if (!hit)
+			hit = pdf_lookup_page_loc_imp(ctx, doc, node, &skip, parentp, indexp);
+	}
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 	if (!hit)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page %d in page tree", needle);
 	return hit;
@@ -131,9 +360,81 @@ pdf_lookup_page_loc(fz_context *ctx, pdf_document *doc, int needle, pdf_obj **pa
 pdf_obj *
 pdf_lookup_page_obj(fz_context *ctx, pdf_document *doc, int needle)
 {
+	pdf_obj **refs = fz_load_acquire_ptr(doc->page_refs);
+	if (refs && needle >= 0 && needle < doc->page_refs_len)
+		return refs[needle];
 	return pdf_lookup_page_loc(ctx, doc, needle, NULL, NULL);
 }
 
+void
+pdf_invalidate_page_tree(fz_context *ctx, pdf_document *doc)
+{
+	int i;
+	doc->page_count = 0;
+	doc->page_lookups = 0;
+	for (i = 0; i < doc->page_refs_len; i++)
+		pdf_drop_obj(ctx, doc->page_refs[i]);
+	fz_free(ctx, doc->page_refs);
+	doc->page_refs = NULL;
+	doc->page_refs_len = 0;
+	fz_free(ctx, doc->page_index);
+	doc->page_index = NULL;
+	doc->page_index_len = 0;
+}
+
+/* Update the page index after inserting 'page_ref' at 'at' into a tree of 'count' pages. */
+static void
+pdf_update_page_tree_insert(fz_context *ctx, pdf_document *doc, int count, int at, pdf_obj *page_ref)
+{
+	if (!doc->page_refs || doc->page_refs_len != count || !pdf_is_indirect(ctx, page_ref))
+	{
+		pdf_invalidate_page_tree(ctx, doc);
+		return;
+	}
+
+	fz_try(ctx)
+		doc->page_refs = fz_resize_array(ctx, doc->page_refs, count + 1, sizeof(*doc->page_refs));
+	fz_catch(ctx)
+	{
+		pdf_invalidate_page_tree(ctx, doc);
+		return;
+	}
+	memmove(&doc->page_refs[at + 1], &doc->page_refs[at], (count - at) * sizeof(*doc->page_refs));
+	doc->page_refs[at] = pdf_keep_obj(ctx, page_ref);
+	doc->page_refs_len = count + 1;
+	doc->page_count = count + 1;
+
+	/* Every later page number has changed; rebuilt from page_refs when needed */
+	fz_free(ctx, doc->page_index);
+	doc->page_index = NULL;
+	doc->page_index_len = 0;
+}
+
+/* Update the page index after deleting page 'at' from a tree of 'count' pages. */
+static void
+pdf_update_page_tree_delete(fz_context *ctx, pdf_document *doc, int count, int at)
+{
+	if (!doc->page_refs || doc->page_refs_len != count)
+	{
+		pdf_invalidate_page_tree(ctx, doc);
+		return;
+	}
+
+	pdf_drop_obj(ctx, doc->page_refs[at]);
+	memmove(&doc->page_refs[at], &doc->page_refs[at + 1], (count - at - 1) * sizeof(*doc->page_refs));
+	doc->page_refs_len = count - 1;
+	doc->page_count = count - 1;
+	if (count == 1)
+	{
+		fz_free(ctx, doc->page_refs);
+		doc->page_refs = NULL;
+	}
+
+	fz_free(ctx, doc->page_index);
+	doc->page_index = NULL;
+	doc->page_index_len = 0;
+}
+
 static int
 pdf_count_pages_before_kid(fz_context *ctx, pdf_document *doc, pdf_obj *parent, int kid_num)
 {
@@ -158,8 +459,8 @@ pdf_count_pages_before_kid(fz_context *ctx, pdf_document *doc, pdf_obj *parent,
 	fz_throw(ctx, FZ_ERROR_GENERIC, "kid not found in parent's kids array");
 }
 
-int
-pdf_lookup_page_number(fz_context *ctx, pdf_document *doc, pdf_obj *node)
+static int
+pdf_lookup_page_number_imp(fz_context *ctx, pdf_document *doc, pdf_obj *node)
 {
 	int needle = pdf_to_num(ctx, node);
 	int total = 0;
@@ -200,6 +501,31 @@ pdf_lookup_page_number(fz_context *ctx, pdf_document *doc, pdf_obj *node)
 	return total;
 }
 
+int
+pdf_lookup_page_number(fz_context *ctx, pdf_document *doc, pdf_obj *node)
+{
+	int total = 0;
+	int num = pdf_to_num(ctx, node);
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+	{
+		pdf_use_page_tree(ctx, doc);
+		pdf_load_page_index(ctx, doc);
+		if (num > 0 && num < doc->page_index_len && doc->page_index[num] > 0 &&
+			pdf_name_eq(ctx, pdf_dict_get(ctx, node, PDF_NAME_Type), PDF_NAME_Page))
+			total = doc->page_index[num] - 1;
+		else
+			total = pdf_lookup_page_number_imp(ctx, doc, node);
+	}
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return total;
+}
+
 int
 pdf_lookup_anchor(fz_context *ctx, pdf_document *doc, const char *name)
 {
@@ -219,7 +545,7 @@ pdf_lookup_anchor(fz_context *ctx, pdf_document *doc, const char *name)
 }
 
 static pdf_obj *
-pdf_lookup_inherited_page_item(fz_context *ctx, pdf_obj *node, pdf_obj *key)
+pdf_lookup_inherited_page_item_imp(fz_context *ctx, pdf_obj *node, pdf_obj *key)
 {
 	pdf_obj *node2 = node;
 	pdf_obj *val;
@@ -258,6 +584,27 @@ pdf_lookup_inherited_page_item(fz_context *ctx, pdf_obj *node, pdf_obj *key)
 	return val;
 }
 
+static pdf_obj *
+pdf_lookup_inherited_page_item(fz_context *ctx, pdf_obj *node, pdf_obj *key)
+{
+	pdf_document *doc = pdf_get_bound_document(ctx, node);
+	pdf_obj *val = NULL;
+
+	if (!doc)
+		return pdf_lookup_inherited_page_item_imp(ctx, node, key);
+
+	/* Walking up the tree marks the parents to detect cycles */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		val = pdf_lookup_inherited_page_item_imp(ctx, node, key);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return val;
+}
+
 static void
 pdf_flatten_inheritable_page_item(fz_context *ctx, pdf_obj *page, pdf_obj *key)
 {
@@ -558,8 +905,8 @@ pdf_new_page(fz_context *ctx, pdf_document *doc)
 	return page;
 }
 
-pdf_page *
-pdf_load_page(fz_context *ctx, pdf_document *doc, int number)
+static pdf_page *
+pdf_load_page_imp(fz_context *ctx, pdf_document *doc, int number)
 {
 	pdf_page *page;
 	pdf_annot *annot;
@@ -624,9 +971,28 @@ pdf_load_page(fz_context *ctx, pdf_document *doc, int number)
 	return page;
 }
 
+pdf_page *
+pdf_load_page(fz_context *ctx, pdf_document *doc, int number)
+{
+	pdf_page *page = NULL;
+
+	/* Annotations and their appearance streams are created and
+	 * marked while loading, so load one page at a time. */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		page = pdf_load_page_imp(ctx, doc, number);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return page;
+}
+
 void
 pdf_delete_page(fz_context *ctx, pdf_document *doc, int at)
 {
+	int count = pdf_count_pages(ctx, doc);
 	pdf_obj *parent, *kids;
 	int i;
 
@@ -641,7 +1007,7 @@ pdf_delete_page(fz_context *ctx, pdf_document *doc, int at)
 		parent = pdf_dict_get(ctx, parent, PDF_NAME_Parent);
 	}
 
-	doc->page_count = 0; /* invalidate cached value */
+	pdf_update_page_tree_delete(ctx, doc, count, at);
 }
 
 void
@@ -730,5 +1096,5 @@ pdf_insert_page(fz_context *ctx, pdf_document *doc, int at, pdf_obj *page_ref)
 		parent = pdf_dict_get(ctx, parent, PDF_NAME_Parent);
 	}
 
-	doc->page_count = 0; /* invalidate cached value */
+	pdf_update_page_tree_insert(ctx, doc, count, at, page_ref);
 }
@@ -274,18 +274,95 @@ pdf_to_utf8_name(fz_context *ctx, pdf_document *doc, pdf_obj *src)
 	return dst;
 }
 
+/*
+ * Items are collected here before the array or dictionary is created,
+ * so that the common short ones are allocated at their final size.
+ * Longer ones spill into a container that grows as before.
+ */
+enum { PARSE_BATCH = 32 };
+
+typedef struct
+{
+	pdf_obj *container;
+	int n;
+	pdf_obj *items[PARSE_BATCH];
+} parse_batch;
+
+static void
+flush_array_batch(fz_context *ctx, pdf_document *doc, parse_batch *b, int cap)
+{
+	int i;
+
+	if (!b->container)
+		b->container = pdf_new_array(ctx, doc, cap);
+	for (i = 0; i < b->n; i++)
+	{
+		pdf_array_push(ctx, b->container, b->items[i]);
+		pdf_drop_obj(ctx, b->items[i]);
+		b->items[i] = NULL;
+	}
+	b->n = 0;
+}
+
+/* Takes ownership of obj, unless it throws. */
+static void
+push_array_batch(fz_context *ctx, pdf_document *doc, parse_batch *b, pdf_obj *obj)
+{
+	if (b->n == PARSE_BATCH)
+		flush_array_batch(ctx, doc, b, PARSE_BATCH * 2);
+	b->items[b->n++] = obj;
+}
+
+static void
+flush_dict_batch(fz_context *ctx, pdf_document *doc, parse_batch *b, int cap)
+{
+	int i;
+
+	if (!b->container)
+		b->container = pdf_new_dict(ctx, doc, cap);
+	for (i = 0; i < b->n; i += 2)
+	{
+		pdf_dict_put(ctx, b->container, b->items[i], b->items[i+1]);
+		pdf_drop_obj(ctx, b->items[i]);
+		pdf_drop_obj(ctx, b->items[i+1]);
+		b->items[i] = b->items[i+1] = NULL;
+	}
+	b->n = 0;
+}
+
+/* Takes ownership of key and val, unless it throws. */
+static void
+push_dict_batch(fz_context *ctx, pdf_document *doc, parse_batch *b, pdf_obj *key, pdf_obj *val)
+{
+	if (b->n == PARSE_BATCH)
+		flush_dict_batch(ctx, doc, b, PARSE_BATCH);
+	b->items[b->n++] = key;
+	b->items[b->n++] = val;
+}
+
+static void
+drop_batch(fz_context *ctx, parse_batch *b)
+{
+	int i;
+	for (i = 0; i < b->n; i++)
+		pdf_drop_obj(ctx, b->items[i]);
+	pdf_drop_obj(ctx, b->container);
+}
+
 pdf_obj *
 pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *buf)
 {
-	pdf_obj *ary = NULL;
+	parse_batch batch;
 	pdf_obj *obj = NULL;
 	fz_off_t a = 0, b = 0, n = 0;
 	pdf_token tok;
 	pdf_obj *op = NULL;
 
 	fz_var(obj);
+	fz_var(batch);
 
-	ary = pdf_new_array(ctx, doc, 4);
+	batch.container = NULL;
+	batch.n = 0;
 
 	fz_try(ctx)
 	{
@@ -298,15 +375,13 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 				if (n > 0)
 				{
 					obj = pdf_new_int_offset(ctx, doc, a);
-					pdf_array_push(ctx, ary, obj);
-					pdf_drop_obj(ctx, obj);
+					push_array_batch(ctx, doc, &batch, obj);
 					obj = NULL;
 				}
 				if (n > 1)
 				{
 					obj = pdf_new_int_offset(ctx, doc, b);
-					pdf_array_push(ctx, ary, obj);
-					pdf_drop_obj(ctx, obj);
+					push_array_batch(ctx, doc, &batch, obj);
 					obj = NULL;
 				}
 				n = 0;
@@ -315,8 +390,7 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 			if (tok == PDF_TOK_INT && n == 2)
 			{
 				obj = pdf_new_int_offset(ctx, doc, a);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
+				push_array_batch(ctx, doc, &batch, obj);
 				obj = NULL;
 				a = b;
 				n --;
@@ -325,7 +399,9 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 			switch (tok)
 			{
 			case PDF_TOK_CLOSE_ARRAY:
-				op = ary;
+				flush_array_batch(ctx, doc, &batch, batch.n);
+				op = batch.container;
+				batch.container = NULL;
 				goto end;
 
 			case PDF_TOK_INT:
@@ -340,61 +416,46 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 				if (n != 2)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot parse indirect reference in array");
 				obj = pdf_new_indirect(ctx, doc, a, b);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
+				push_array_batch(ctx, doc, &batch, obj);
 				obj = NULL;
 				n = 0;
 				break;
 
 			case PDF_TOK_OPEN_ARRAY:
 				obj = pdf_parse_array(ctx, doc, file, buf);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
+				push_array_batch(ctx, doc, &batch, obj);
 				obj = NULL;
 				break;
 
 			case PDF_TOK_OPEN_DICT:
 				obj = pdf_parse_dict(ctx, doc, file, buf);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
+				push_array_batch(ctx, doc, &batch, obj);
 				obj = NULL;
 				break;
 
 			case PDF_TOK_NAME:
 				obj = pdf_new_name(ctx, doc, buf->scratch);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
+				push_array_batch(ctx, doc, &batch, obj);
 				obj = NULL;
 				break;
 			case PDF_TOK_REAL:
 				obj = pdf_new_real(ctx, doc, buf->f);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
+				push_array_batch(ctx, doc, &batch, obj);
 				obj = NULL;
 				break;
 			case PDF_TOK_STRING:
 				obj = pdf_new_string(ctx, doc, buf->scratch, buf->len);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
+				push_array_batch(ctx, doc, &batch, obj);
 				obj = NULL;
 				break;
 			case PDF_TOK_TRUE:
-				obj = pdf_new_bool(ctx, doc, 1);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
-				obj = NULL;
+				push_array_batch(ctx, doc, &batch, PDF_OBJ_TRUE);
 				break;
 			case PDF_TOK_FALSE:
-				obj = pdf_new_bool(ctx, doc, 0);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
-				obj = NULL;
+				push_array_batch(ctx, doc, &batch, PDF_OBJ_FALSE);
 				break;
 			case PDF_TOK_NULL:
-				obj = pdf_new_null(ctx, doc);
-				pdf_array_push(ctx, ary, obj);
-				pdf_drop_obj(ctx, obj);
-				obj = NULL;
+				push_array_batch(ctx, doc, &batch, PDF_OBJ_NULL);
 				break;
 
 			default:
@@ -407,7 +468,7 @@ end:
 	fz_catch(ctx)
 	{
 		pdf_drop_obj(ctx, obj);
-		pdf_drop_obj(ctx, ary);
+		drop_batch(ctx, &batch);
 		fz_rethrow(ctx);
 	}
 	return op;
@@ -416,16 +477,19 @@ end:
 pdf_obj *
 pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *buf)
 {
-	pdf_obj *dict;
+	parse_batch batch;
+	pdf_obj *dict = NULL;
 	pdf_obj *key = NULL;
 	pdf_obj *val = NULL;
 	pdf_token tok;
 	fz_off_t a, b;
 
-	dict = pdf_new_dict(ctx, doc, 8);
-
 	fz_var(key);
 	fz_var(val);
+	fz_var(batch);
+
+	batch.container = NULL;
+	batch.n = 0;
 
 	fz_try(ctx)
 	{
@@ -472,10 +536,8 @@ pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *
 					(tok == PDF_TOK_KEYWORD && !strcmp(buf->scratch, "ID")))
 				{
 					val = pdf_new_int_offset(ctx, doc, a);
-					pdf_dict_put(ctx, dict, key, val);
-					pdf_drop_obj(ctx, val);
+					push_dict_batch(ctx, doc, &batch, key, val);
 					val = NULL;
-					pdf_drop_obj(ctx, key);
 					key = NULL;
 					goto skip;
 				}
@@ -495,16 +557,18 @@ pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *
 				fz_throw(ctx, FZ_ERROR_GENERIC, "unknown token in dict");
 			}
 
-			pdf_dict_put(ctx, dict, key, val);
-			pdf_drop_obj(ctx, val);
+			push_dict_batch(ctx, doc, &batch, key, val);
 			val = NULL;
-			pdf_drop_obj(ctx, key);
 			key = NULL;
 		}
+
+		flush_dict_batch(ctx, doc, &batch, batch.n / 2);
+		dict = batch.container;
+		batch.container = NULL;
 	}
 	fz_catch(ctx)
 	{
-		pdf_drop_obj(ctx, dict);
+		drop_batch(ctx, &batch);
 		pdf_drop_obj(ctx, key);
 		pdf_drop_obj(ctx, val);
 		fz_rethrow(ctx);
@@ -9,9 +9,25 @@ struct entry
 {
 	int num;
 	int gen;
-	int ofs;
-	int stm_ofs;
-	int stm_len;
+	fz_off_t ofs;
+	fz_off_t stm_ofs;
+	fz_off_t stm_len;
+};
+
+/* Everything gathered while scanning the file */
+struct repair_state
+{
+	struct entry *list;
+	int listlen;
+	int listcap;
+	int maxnum;
+
+	pdf_obj *encrypt;
+	pdf_obj *id;
+	pdf_obj *info;
+	pdf_obj **roots;
+	int num_roots;
+	int max_roots;
 };
 
 static void add_root(fz_context *ctx, pdf_obj *obj, pdf_obj ***roots, int *num_roots, int *max_roots)
@@ -27,18 +43,93 @@ static void add_root(fz_context *ctx, pdf_obj *obj, pdf_obj ***roots, int *num_r
 	(*roots)[(*num_roots)++] = pdf_keep_obj(ctx, obj);
 }
 
-int
-pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, fz_off_t *tmpofs, pdf_obj **root)
+static void add_entry(fz_context *ctx, struct repair_state *rs, int num, int gen, fz_off_t ofs, fz_off_t stm_ofs, fz_off_t stm_len)
+{
+	if (rs->listlen + 1 == rs->listcap)
+	{
+		rs->listcap = (rs->listcap * 3) / 2;
+		rs->list = fz_resize_array(ctx, rs->list, rs->listcap, sizeof(struct entry));
+	}
+
+	rs->list[rs->listlen].num = num;
+	rs->list[rs->listlen].gen = gen;
+	rs->list[rs->listlen].ofs = ofs;
+	rs->list[rs->listlen].stm_ofs = stm_ofs;
+	rs->list[rs->listlen].stm_len = stm_len;
+	rs->listlen ++;
+
+	if (num > rs->maxnum)
+		rs->maxnum = num;
+}
+
+/* Pick up what we need from the dictionary of an object found by repair. */
+static fz_off_t
+repair_obj_dict(fz_context *ctx, pdf_document *doc, pdf_obj *dict, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, pdf_obj **root)
+{
+	pdf_obj *obj;
+	fz_off_t stm_len = 0;
+
+	/* We must be careful not to try to resolve any indirections
+	 * here. We have just read dict, so we know it to be a non
+	 * indirected dictionary. Before we look at any values that
+	 * we get back from looking up in it, we need to check they
+	 * aren't indirected. */
+
+	if (encrypt || id || root)
+	{
+		obj = pdf_dict_get(ctx, dict, PDF_NAME_Type);
+		if (!pdf_is_indirect(ctx, obj) && pdf_name_eq(ctx, obj, PDF_NAME_XRef))
+		{
+			if (encrypt)
+			{
+				obj = pdf_dict_get(ctx, dict, PDF_NAME_Encrypt);
+				if (obj)
+				{
+					pdf_drop_obj(ctx, *encrypt);
+					*encrypt = pdf_keep_obj(ctx, obj);
+				}
+			}
+
+			if (id)
+			{
+				obj = pdf_dict_get(ctx, dict, PDF_NAME_ID);
+				if (obj)
+				{
+					pdf_drop_obj(ctx, *id);
+					*id = pdf_keep_obj(ctx, obj);
+				}
+			}
+
+			if (root)
+				*root = pdf_keep_obj(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Root));
+		}
+	}
+
+	obj = pdf_dict_get(ctx, dict, PDF_NAME_Length);
+	if (!pdf_is_indirect(ctx, obj) && pdf_is_int(ctx, obj))
+		stm_len = pdf_to_offset(ctx, obj);
+
+	if (doc->file_reading_linearly && page)
+	{
+		obj = pdf_dict_get(ctx, dict, PDF_NAME_Type);
+		if (!pdf_is_indirect(ctx, obj) && pdf_name_eq(ctx, obj, PDF_NAME_Page))
+		{
+			pdf_drop_obj(ctx, *page);
+			*page = pdf_keep_obj(ctx, dict);
+		}
+	}
+
+	return stm_len;
+}
+
+/* Parse the dictionary that starts an object, if any. Returns the next token. */
+static pdf_token
+repair_obj_start(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t *stm_len, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, fz_off_t *tmpofs, pdf_obj **root)
 {
 	fz_stream *file = doc->file;
 	pdf_token tok;
-	int stm_len;
-
-	*stmofsp = 0;
-	if (stmlenp)
-		*stmlenp = -1;
 
-	stm_len = 0;
+	*stm_len = 0;
 
 	/* On entry to this function, we know that we've just seen
 	 * '<int> <int> obj'. We expect the next thing we see to be a
@@ -48,7 +139,7 @@ pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t *st
 
 	if (tok == PDF_TOK_OPEN_DICT)
 	{
-		pdf_obj *dict, *obj;
+		pdf_obj *dict;
 
 		fz_try(ctx)
 		{
@@ -64,100 +155,116 @@ pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t *st
 			dict = pdf_new_dict(ctx, NULL, 2);
 		}
 
-		/* We must be careful not to try to resolve any indirections
-		 * here. We have just read dict, so we know it to be a non
-		 * indirected dictionary. Before we look at any values that
-		 * we get back from looking up in it, we need to check they
-		 * aren't indirected. */
+		fz_try(ctx)
+			*stm_len = repair_obj_dict(ctx, doc, dict, encrypt, id, page, root);
+		fz_always(ctx)
+			pdf_drop_obj(ctx, dict);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
 
-		if (encrypt || id || root)
-		{
-			obj = pdf_dict_get(ctx, dict, PDF_NAME_Type);
-			if (!pdf_is_indirect(ctx, obj) && pdf_name_eq(ctx, obj, PDF_NAME_XRef))
-			{
-				if (encrypt)
-				{
-					obj = pdf_dict_get(ctx, dict, PDF_NAME_Encrypt);
-					if (obj)
-					{
-						pdf_drop_obj(ctx, *encrypt);
-						*encrypt = pdf_keep_obj(ctx, obj);
-					}
-				}
+	while ( tok != PDF_TOK_STREAM &&
+		tok != PDF_TOK_ENDOBJ &&
+		tok != PDF_TOK_ERROR &&
+		tok != PDF_TOK_EOF &&
+		tok != PDF_TOK_INT )
+	{
+		*tmpofs = fz_tell(ctx, file);
+		if (*tmpofs < 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
+		tok = pdf_lex(ctx, file, buf);
+	}
 
-				if (id)
-				{
-					obj = pdf_dict_get(ctx, dict, PDF_NAME_ID);
-					if (obj)
-					{
-						pdf_drop_obj(ctx, *id);
-						*id = pdf_keep_obj(ctx, obj);
-					}
-				}
+	return tok;
+}
 
-				if (root)
-					*root = pdf_keep_obj(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Root));
-			}
-		}
+/* Having just read a 'stream' token, find where the data starts. */
+static fz_off_t
+repair_stream_start(fz_context *ctx, fz_stream *file)
+{
+	fz_off_t ofs;
+	int c = fz_read_byte(ctx, file);
+	if (c == '\r') {
+		c = fz_peek_byte(ctx, file);
+		if (c == '\n')
+			fz_read_byte(ctx, file);
+	}
 
-		obj = pdf_dict_get(ctx, dict, PDF_NAME_Length);
-		if (!pdf_is_indirect(ctx, obj) && pdf_is_int(ctx, obj))
-			stm_len = pdf_to_int(ctx, obj);
+	ofs = fz_tell(ctx, file);
+	if (ofs < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot seek in file");
+	return ofs;
+}
 
-		if (doc->file_reading_linearly && page)
-		{
-			obj = pdf_dict_get(ctx, dict, PDF_NAME_Type);
-			if (!pdf_is_indirect(ctx, obj) && pdf_name_eq(ctx, obj, PDF_NAME_Page))
-			{
-				pdf_drop_obj(ctx, *page);
-				*page = pdf_keep_obj(ctx, dict);
-			}
-		}
+/* Check whether the stream Length leads to an 'endstream' token. */
+static int
+repair_stream_length_ok(fz_context *ctx, fz_stream *file, pdf_lexbuf *buf, fz_off_t stm_ofs, fz_off_t stm_len)
+{
+	pdf_token tok = PDF_TOK_ERROR;
+
+	if (stm_len <= 0)
+		return 0;
 
-		pdf_drop_obj(ctx, dict);
+	fz_seek(ctx, file, stm_ofs + stm_len, 0);
+	fz_try(ctx)
+	{
+		tok = pdf_lex(ctx, file, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "cannot find endstream token, falling back to scanning");
 	}
+	if (tok == PDF_TOK_ENDSTREAM)
+		return 1;
+	fz_seek(ctx, file, stm_ofs, 0);
+	return 0;
+}
 
-	while ( tok != PDF_TOK_STREAM &&
-		tok != PDF_TOK_ENDOBJ &&
-		tok != PDF_TOK_ERROR &&
-		tok != PDF_TOK_EOF &&
-		tok != PDF_TOK_INT )
+/* Read the 'endobj' token and the one after, as pdf_repair_obj returns it. */
+static pdf_token
+repair_obj_end(fz_context *ctx, fz_stream *file, pdf_lexbuf *buf, fz_off_t *tmpofs)
+{
+	pdf_token tok;
+
+	*tmpofs = fz_tell(ctx, file);
+	if (*tmpofs < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
+	tok = pdf_lex(ctx, file, buf);
+	if (tok != PDF_TOK_ENDOBJ)
+		fz_warn(ctx, "object missing 'endobj' token");
+	else
 	{
+		/* Read another token as we always return the next one */
 		*tmpofs = fz_tell(ctx, file);
 		if (*tmpofs < 0)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
 		tok = pdf_lex(ctx, file, buf);
 	}
+	return tok;
+}
+
+int
+pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t *stmofsp, fz_off_t *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, fz_off_t *tmpofs, pdf_obj **root)
+{
+	fz_stream *file = doc->file;
+	pdf_token tok;
+	fz_off_t stm_len;
+
+	*stmofsp = 0;
+	if (stmlenp)
+		*stmlenp = -1;
+
+	tok = repair_obj_start(ctx, doc, buf, &stm_len, encrypt, id, page, tmpofs, root);
 
 	if (tok == PDF_TOK_STREAM)
 	{
-		int c = fz_read_byte(ctx, file);
-		if (c == '\r') {
-			c = fz_peek_byte(ctx, file);
-			if (c == '\n')
-				fz_read_byte(ctx, file);
-		}
+		int c;
 
-		*stmofsp = fz_tell(ctx, file);
-		if (*stmofsp < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot seek in file");
+		*stmofsp = repair_stream_start(ctx, file);
 
-		if (stm_len > 0)
-		{
-			fz_seek(ctx, file, *stmofsp + stm_len, 0);
-			fz_try(ctx)
-			{
-				tok = pdf_lex(ctx, file, buf);
-			}
-			fz_catch(ctx)
-			{
-				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
-				fz_warn(ctx, "cannot find endstream token, falling back to scanning");
-			}
-			if (tok == PDF_TOK_ENDSTREAM)
-				goto atobjend;
-			fz_seek(ctx, file, *stmofsp, 0);
-		}
+		if (repair_stream_length_ok(ctx, file, buf, *stmofsp, stm_len))
+			return repair_obj_end(ctx, file, buf, tmpofs);
 
 		(void)fz_read(ctx, file, (unsigned char *) buf->scratch, 9);
 
@@ -173,21 +280,7 @@ pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t *st
 		if (stmlenp)
 			*stmlenp = fz_tell(ctx, file) - *stmofsp - 9;
 
-atobjend:
-		*tmpofs = fz_tell(ctx, file);
-		if (*tmpofs < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
-		tok = pdf_lex(ctx, file, buf);
-		if (tok != PDF_TOK_ENDOBJ)
-			fz_warn(ctx, "object missing 'endobj' token");
-		else
-		{
-			/* Read another token as we always return the next one */
-			*tmpofs = fz_tell(ctx, file);
-			if (*tmpofs < 0)
-				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
-			tok = pdf_lex(ctx, file, buf);
-		}
+		tok = repair_obj_end(ctx, file, buf, tmpofs);
 	}
 	return tok;
 }
@@ -260,236 +353,683 @@ pdf_repair_obj_stm(fz_context *ctx, pdf_document *doc, int stm_num)
 	}
 }
 
-void
-pdf_repair_xref(fz_context *ctx, pdf_document *doc)
+/* Pick up what we need from a trailer (or stray) dictionary. */
+static void
+repair_trailer(fz_context *ctx, struct repair_state *rs, pdf_obj *dict)
 {
-	pdf_obj *dict, *obj = NULL;
-	pdf_obj *length;
+	pdf_obj *obj;
 
-	pdf_obj *encrypt = NULL;
-	pdf_obj *id = NULL;
-	pdf_obj **roots = NULL;
-	pdf_obj *info = NULL;
+	obj = pdf_dict_get(ctx, dict, PDF_NAME_Encrypt);
+	if (obj)
+	{
+		pdf_drop_obj(ctx, rs->encrypt);
+		rs->encrypt = pdf_keep_obj(ctx, obj);
+	}
 
-	struct entry *list = NULL;
-	int listlen;
-	int listcap;
-	int maxnum = 0;
+	obj = pdf_dict_get(ctx, dict, PDF_NAME_ID);
+	if (obj && (!rs->id || !rs->encrypt || pdf_dict_get(ctx, dict, PDF_NAME_Encrypt)))
+	{
+		pdf_drop_obj(ctx, rs->id);
+		rs->id = pdf_keep_obj(ctx, obj);
+	}
+
+	obj = pdf_dict_get(ctx, dict, PDF_NAME_Root);
+	if (obj)
+		add_root(ctx, obj, &rs->roots, &rs->num_roots, &rs->max_roots);
 
+	obj = pdf_dict_get(ctx, dict, PDF_NAME_Info);
+	if (obj)
+	{
+		pdf_drop_obj(ctx, rs->info);
+		rs->info = pdf_keep_obj(ctx, obj);
+	}
+}
+
+static void
+repair_scan(fz_context *ctx, pdf_document *doc, struct repair_state *rs)
+{
+	pdf_obj *dict;
 	int num = 0;
 	int gen = 0;
-	fz_off_t tmpofs, stm_ofs, numofs = 0, genofs = 0;
-	int stm_len;
+	fz_off_t tmpofs, stm_ofs, stm_len, numofs = 0, genofs = 0;
 	pdf_token tok;
-	int next;
-	int i;
 	size_t j, n;
 	int c;
 	pdf_lexbuf *buf = &doc->lexbuf.base;
-	int num_roots = 0;
-	int max_roots = 0;
-
-	fz_var(encrypt);
-	fz_var(id);
-	fz_var(roots);
-	fz_var(num_roots);
-	fz_var(max_roots);
-	fz_var(info);
-	fz_var(list);
-	fz_var(obj);
 
-	if (doc->repair_attempted)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "Repair failed already - not trying again");
-	doc->repair_attempted = 1;
-
-	doc->dirty = 1;
-	/* Can't support incremental update after repair */
-	doc->freeze_updates = 1;
+	/* look for '%PDF' version marker within first kilobyte of file */
+	n = fz_read(ctx, doc->file, (unsigned char *)buf->scratch, fz_mini(buf->size, 1024));
 
 	fz_seek(ctx, doc->file, 0, 0);
+	if (n >= 4)
+	{
+		for (j = 0; j < n - 4; j++)
+		{
+			if (memcmp(&buf->scratch[j], "%PDF", 4) == 0)
+			{
+				fz_seek(ctx, doc->file, j + 8, 0); /* skip "%PDF-X.Y" */
+				break;
+			}
+		}
+	}
 
-	fz_try(ctx)
+	/* skip comment line after version marker since some generators
+	 * forget to terminate the comment with a newline */
+	c = fz_read_byte(ctx, doc->file);
+	while (c >= 0 && (c == ' ' || c == '%'))
+		c = fz_read_byte(ctx, doc->file);
+	fz_unread_byte(ctx, doc->file);
+
+	while (1)
 	{
-		pdf_xref_entry *entry;
-		listlen = 0;
-		listcap = 1024;
-		list = fz_malloc_array(ctx, listcap, sizeof(struct entry));
+		tmpofs = fz_tell(ctx, doc->file);
+		if (tmpofs < 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
 
-		/* look for '%PDF' version marker within first kilobyte of file */
-		n = fz_read(ctx, doc->file, (unsigned char *)buf->scratch, fz_mini(buf->size, 1024));
+		fz_try(ctx)
+		{
+			tok = pdf_lex_no_string(ctx, doc->file, buf);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+			fz_warn(ctx, "ignoring the rest of the file");
+			break;
+		}
 
-		fz_seek(ctx, doc->file, 0, 0);
-		if (n >= 4)
+		/* If we have the next token already, then we'll jump
+		 * back here, rather than going through the top of
+		 * the loop. */
+	have_next_token:
+
+		if (tok == PDF_TOK_INT)
 		{
-			for (j = 0; j < n - 4; j++)
+			if (buf->i < 0)
 			{
-				if (memcmp(&buf->scratch[j], "%PDF", 4) == 0)
-				{
-					fz_seek(ctx, doc->file, j + 8, 0); /* skip "%PDF-X.Y" */
-					break;
-				}
+				num = 0;
+				gen = 0;
+				continue;
 			}
+			numofs = genofs;
+			num = gen;
+			genofs = tmpofs;
+			gen = buf->i;
 		}
 
-		/* skip comment line after version marker since some generators
-		 * forget to terminate the comment with a newline */
-		c = fz_read_byte(ctx, doc->file);
-		while (c >= 0 && (c == ' ' || c == '%'))
-			c = fz_read_byte(ctx, doc->file);
-		fz_unread_byte(ctx, doc->file);
-
-		while (1)
+		else if (tok == PDF_TOK_OBJ)
 		{
-			tmpofs = fz_tell(ctx, doc->file);
-			if (tmpofs < 0)
-				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot tell in file");
+			pdf_obj *root = NULL;
 
 			fz_try(ctx)
 			{
-				tok = pdf_lex_no_string(ctx, doc->file, buf);
+				stm_len = 0;
+				stm_ofs = 0;
+				tok = pdf_repair_obj(ctx, doc, buf, &stm_ofs, &stm_len, &rs->encrypt, &rs->id, NULL, &tmpofs, &root);
+				if (root)
+					add_root(ctx, root, &rs->roots, &rs->num_roots, &rs->max_roots);
+			}
+			fz_always(ctx)
+			{
+				pdf_drop_obj(ctx, root);
 			}
 			fz_catch(ctx)
 			{
 				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
-				fz_warn(ctx, "ignoring the rest of the file");
+				/* If we haven't seen a root yet, there is nothing
+				 * we can do, but give up. Otherwise, we'll make
+				 * do. */
+				if (!rs->roots)
+					fz_rethrow(ctx);
+				fz_warn(ctx, "cannot parse object (%d %d R) - ignoring rest of file", num, gen);
 				break;
 			}
 
-			/* If we have the next token already, then we'll jump
-			 * back here, rather than going through the top of
-			 * the loop. */
-		have_next_token:
-
-			if (tok == PDF_TOK_INT)
+			if (num <= 0 || num > MAX_OBJECT_NUMBER)
 			{
-				if (buf->i < 0)
-				{
-					num = 0;
-					gen = 0;
-					continue;
-				}
-				numofs = genofs;
-				num = gen;
-				genofs = tmpofs;
-				gen = buf->i;
+				fz_warn(ctx, "ignoring object with invalid object number (%d %d R)", num, gen);
+				goto have_next_token;
 			}
 
-			else if (tok == PDF_TOK_OBJ)
+			gen = fz_clampi(gen, 0, 65535);
+
+			add_entry(ctx, rs, num, gen, numofs, stm_ofs, stm_len);
+
+			goto have_next_token;
+		}
+
+		/* If we find a dictionary it is probably the trailer,
+		 * but could be a stream (or bogus) dictionary caused
+		 * by a corrupt file. */
+		else if (tok == PDF_TOK_OPEN_DICT)
+		{
+			fz_try(ctx)
+			{
+				dict = pdf_parse_dict(ctx, doc, doc->file, buf);
+			}
+			fz_catch(ctx)
 			{
-				pdf_obj *root = NULL;
+				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+				/* If this was the real trailer dict
+				 * it was broken, in which case we are
+				 * in trouble. Keep going though in
+				 * case this was just a bogus dict. */
+				continue;
+			}
 
-				fz_try(ctx)
-				{
-					stm_len = 0;
-					stm_ofs = 0;
-					tok = pdf_repair_obj(ctx, doc, buf, &stm_ofs, &stm_len, &encrypt, &id, NULL, &tmpofs, &root);
-					if (root)
-						add_root(ctx, root, &roots, &num_roots, &max_roots);
-				}
-				fz_always(ctx)
-				{
-					pdf_drop_obj(ctx, root);
-				}
-				fz_catch(ctx)
-				{
-					fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
-					/* If we haven't seen a root yet, there is nothing
-					 * we can do, but give up. Otherwise, we'll make
-					 * do. */
-					if (!roots)
-						fz_rethrow(ctx);
-					fz_warn(ctx, "cannot parse object (%d %d R) - ignoring rest of file", num, gen);
-					break;
-				}
+			fz_try(ctx)
+				repair_trailer(ctx, rs, dict);
+			fz_always(ctx)
+				pdf_drop_obj(ctx, dict);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+		}
 
-				if (num <= 0 || num > MAX_OBJECT_NUMBER)
-				{
-					fz_warn(ctx, "ignoring object with invalid object number (%d %d R)", num, gen);
-					goto have_next_token;
-				}
+		else if (tok == PDF_TOK_EOF)
+			break;
+		else
+		{
+			if (tok == PDF_TOK_ERROR)
+				fz_read_byte(ctx, doc->file);
+			num = 0;
+			gen = 0;
+		}
+	}
+}
 
-				gen = fz_clampi(gen, 0, 65535);
+/*
+	Scanning with worker threads.
 
-				if (listlen + 1 == listcap)
-				{
-					listcap = (listcap * 3) / 2;
-					list = fz_resize_array(ctx, list, listcap, sizeof(struct entry));
-				}
+	The file is read in large chunks on the calling thread, and the
+	workers search each chunk for the bytes of 'N G obj', 'trailer'
+	and 'endstream'. The candidates are then checked and parsed on
+	the calling thread in file order, skipping any that fall inside
+	an object or stream already read, so later definitions of an
+	object replace earlier ones exactly as in the serial scan. The
+	'endstream' positions stand in for the byte-by-byte search used
+	when a stream Length is wrong.
+*/
 
-				list[listlen].num = num;
-				list[listlen].gen = gen;
-				list[listlen].ofs = numofs;
-				list[listlen].stm_ofs = stm_ofs;
-				list[listlen].stm_len = stm_len;
-				listlen ++;
+enum
+{
+	REPAIR_CHUNK = 4 << 20,
+	REPAIR_OVERLAP = 256,
+	REPAIR_MIN_FILE_LENGTH = 16 << 20
+};
 
-				if (num > maxnum)
-					maxnum = num;
+struct candidate
+{
+	fz_off_t ofs; /* start of the object number, or of 'trailer' */
+	fz_off_t body; /* just after the keyword */
+	int num;
+	int gen;
+	int trailer;
+};
 
-				goto have_next_token;
+struct repair_chunk
+{
+	fz_off_t start, end; /* the keywords this chunk reports on */
+	fz_off_t base; /* file offset of data[0] */
+	unsigned char *data;
+	size_t len;
+
+	struct candidate *cands;
+	int cand_len, cand_cap;
+	fz_off_t *ends;
+	int end_len, end_cap;
+};
+
+static inline int is_white(int c)
+{
+	return c == '\0' || c == '\t' || c == '\n' || c == '\f' || c == '\r' || c == ' ';
+}
+
+static inline int is_delim(int c)
+{
+	return c == '(' || c == ')' || c == '<' || c == '>' || c == '[' || c == ']' || c == '{' || c == '}' || c == '/' || c == '%';
+}
+
+static inline int is_digit(int c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/* Read the integer whose last digit is at p, returning its first digit
+ * in *first, or -1 if there is none (or it is implausibly long). */
+static int
+scan_int_backwards(const unsigned char *data, int p, int *first, int *value)
+{
+	int q = p, v = 0, scale = 1;
+
+	while (q >= 0 && is_digit(data[q]))
+	{
+		if (p - q >= 9)
+			return -1;
+		v += (data[q] - '0') * scale;
+		scale *= 10;
+		q--;
+	}
+	if (q == p)
+		return -1;
+	*first = q + 1;
+	*value = v;
+	return 0;
+}
+
+/* Is position p on a line after a '%'? The lexer would skip it as a comment. */
+static int
+scan_in_comment(const unsigned char *data, int p)
+{
+	int q;
+
+	for (q = p - 1; q >= 0 && p - q <= REPAIR_OVERLAP; q--)
+	{
+		if (data[q] == '\n' || data[q] == '\r')
+			return 0;
+		if (data[q] == '%')
+			return 1;
+	}
+	return 0;
+}
+
+static void
+push_candidate(fz_context *ctx, struct repair_chunk *ch, fz_off_t ofs, fz_off_t body, int num, int gen, int trailer)
+{
+	if (ch->cand_len == ch->cand_cap)
+	{
+		ch->cand_cap = ch->cand_cap ? ch->cand_cap * 2 : 256;
+		ch->cands = fz_resize_array(ctx, ch->cands, ch->cand_cap, sizeof *ch->cands);
+	}
+	ch->cands[ch->cand_len].ofs = ofs;
+	ch->cands[ch->cand_len].body = body;
+	ch->cands[ch->cand_len].num = num;
+	ch->cands[ch->cand_len].gen = gen;
+	ch->cands[ch->cand_len].trailer = trailer;
+	ch->cand_len++;
+}
+
+static void
+push_endstream(fz_context *ctx, struct repair_chunk *ch, fz_off_t ofs)
+{
+	if (ch->end_len == ch->end_cap)
+	{
+		ch->end_cap = ch->end_cap ? ch->end_cap * 2 : 64;
+		ch->ends = fz_resize_array(ctx, ch->ends, ch->end_cap, sizeof *ch->ends);
+	}
+	ch->ends[ch->end_len++] = ofs;
+}
+
+/* Is the keyword of length n at p free standing? */
+static int
+scan_keyword_ends(struct repair_chunk *ch, fz_off_t file_length, int p, int n)
+{
+	if ((size_t)(p + n) < ch->len)
+		return is_white(ch->data[p + n]) || is_delim(ch->data[p + n]);
+	return ch->base + p + n >= file_length;
+}
+
+static void
+scan_chunk(fz_context *ctx, struct repair_chunk *ch, fz_off_t file_length)
+{
+	const unsigned char *data = ch->data;
+	int from = (int)(ch->start - ch->base);
+	int to = (int)(ch->end - ch->base);
+	const unsigned char *s;
+	int p, q, num_first, gen_first, num, gen;
+
+	/* '<num> <gen> obj' */
+	for (p = from; p < to; p = (int)(s - data) + 1)
+	{
+		s = memchr(data + p, 'o', to - p);
+		if (!s)
+			break;
+		q = (int)(s - data);
+		if ((size_t)q + 3 > ch->len || memcmp(s, "obj", 3) || !scan_keyword_ends(ch, file_length, q, 3))
+			continue;
+		q--;
+		while (q >= 0 && is_white(data[q]))
+			q--;
+		if (q < 0 || scan_int_backwards(data, q, &gen_first, &gen) < 0)
+			continue;
+		q = gen_first - 1;
+		if (q < 0 || !is_white(data[q]))
+			continue;
+		while (q >= 0 && is_white(data[q]))
+			q--;
+		if (q < 0 || scan_int_backwards(data, q, &num_first, &num) < 0)
+			continue;
+		q = num_first - 1;
+		if (q < 0 ? ch->base != 0 : !(is_white(data[q]) || is_delim(data[q])))
+			continue;
+		if (scan_in_comment(data, num_first))
+			continue;
+		push_candidate(ctx, ch, ch->base + num_first, ch->base + (s - data) + 3, num, gen, 0);
+	}
+
+	/* 'trailer' */
+	for (p = from; p < to; p = (int)(s - data) + 1)
+	{
+		s = memchr(data + p, 't', to - p);
+		if (!s)
+			break;
+		q = (int)(s - data);
+		if ((size_t)q + 7 > ch->len || memcmp(s, "trailer", 7) || !scan_keyword_ends(ch, file_length, q, 7))
+			continue;
+		if (q > 0 ? !(is_white(data[q - 1]) || is_delim(data[q - 1])) : ch->base != 0)
+			continue;
+		if (scan_in_comment(data, q))
+			continue;
+		push_candidate(ctx, ch, ch->base + q, ch->base + q + 7, 0, 0, 1);
+	}
+
+	/* 'endstream', matched as raw bytes like the serial search */
+	for (p = from; p < to; p = (int)(s - data) + 1)
+	{
+		s = memchr(data + p, 'e', to - p);
+		if (!s)
+			break;
+		q = (int)(s - data);
+		if ((size_t)q + 9 <= ch->len && !memcmp(s, "endstream", 9))
+			push_endstream(ctx, ch, ch->base + q);
+	}
+}
+
+static int
+cmp_candidate(const void *a_, const void *b_)
+{
+	const struct candidate *a = a_;
+	const struct candidate *b = b_;
+	return (a->ofs > b->ofs) - (a->ofs < b->ofs);
+}
+
+typedef struct
+{
+	struct repair_chunk *chunks;
+	fz_off_t file_length;
+} repair_batch;
+
+static void
+scan_chunk_worker(fz_context *ctx, void *arg, int idx)
+{
+	repair_batch *batch = (repair_batch *)arg;
+	struct repair_chunk *ch = &batch->chunks[idx];
+
+	scan_chunk(ctx, ch, batch->file_length);
+
+	/* The obj and trailer passes are separate; put them in file order. */
+	qsort(ch->cands, ch->cand_len, sizeof *ch->cands, cmp_candidate);
+}
+
+/* Find the first 'endstream' at or after ofs. */
+static fz_off_t
+find_endstream(fz_off_t *ends, int len, fz_off_t ofs)
+{
+	int l = 0, r = len;
+
+	while (l < r)
+	{
+		int m = (l + r) >> 1;
+		if (ends[m] < ofs)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l < len ? ends[l] : -1;
+}
+
+/* As pdf_repair_obj, but find the end of the stream from the scan. */
+static void
+repair_scanned_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t length, fz_off_t *ends, int end_len, fz_off_t *stmofsp, fz_off_t *stmlenp, fz_off_t *tmpofs, pdf_obj **root, struct repair_state *rs)
+{
+	fz_stream *file = doc->file;
+	pdf_token tok;
+	fz_off_t stm_len;
+
+	*stmofsp = 0;
+	*stmlenp = -1;
+
+	tok = repair_obj_start(ctx, doc, buf, &stm_len, &rs->encrypt, &rs->id, NULL, tmpofs, root);
+
+	if (tok == PDF_TOK_STREAM)
+	{
+		fz_off_t es;
+
+		*stmofsp = repair_stream_start(ctx, file);
+
+		if (repair_stream_length_ok(ctx, file, buf, *stmofsp, stm_len))
+		{
+			*tmpofs = fz_tell(ctx, file);
+			return;
+		}
+
+		es = find_endstream(ends, end_len, *stmofsp);
+		if (es < 0)
+			es = length - 9;
+		if (es < *stmofsp)
+			es = *stmofsp;
+		*stmlenp = es - *stmofsp;
+		*tmpofs = es + 9;
+	}
+}
+
+static void
+drop_repair_chunks(fz_context *ctx, struct repair_chunk *chunks, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		fz_free(ctx, chunks[i].data);
+		fz_free(ctx, chunks[i].cands);
+		fz_free(ctx, chunks[i].ends);
+	}
+	memset(chunks, 0, count * sizeof *chunks);
+}
+
+static void
+repair_scan_threads(fz_context *ctx, pdf_document *doc, struct repair_state *rs, int threads, fz_off_t length)
+{
+	pdf_lexbuf *buf = &doc->lexbuf.base;
+	struct repair_chunk *chunks = NULL;
+	repair_batch batch;
+	struct candidate *cands = NULL;
+	fz_off_t *ends = NULL;
+	int cand_len = 0, end_len = 0;
+	int nchunks, i, k;
+	fz_off_t start, skip;
+
+	fz_var(chunks);
+	fz_var(cands);
+	fz_var(ends);
+
+	/* Enough chunks per batch to give every worker something to do. */
+	nchunks = threads * 2;
+
+	fz_try(ctx)
+	{
+		chunks = fz_calloc(ctx, nchunks, sizeof *chunks);
+		batch.chunks = chunks;
+		batch.file_length = length;
+
+		for (start = 0; start < length; )
+		{
+			int count = 0;
+
+			for (i = 0; i < nchunks && start < length; i++)
+			{
+				struct repair_chunk *ch = &chunks[i];
+				fz_off_t end = length - start > REPAIR_CHUNK ? start + REPAIR_CHUNK : length;
+				fz_off_t top = length - end > REPAIR_OVERLAP ? end + REPAIR_OVERLAP : length;
+
+				ch->start = start;
+				ch->end = end;
+				ch->base = start > REPAIR_OVERLAP ? start - REPAIR_OVERLAP : 0;
+				ch->data = fz_malloc(ctx, top - ch->base);
+				fz_seek(ctx, doc->file, ch->base, 0);
+				ch->len = fz_read(ctx, doc->file, ch->data, top - ch->base);
+				if (ch->base + (fz_off_t)ch->len < end)
+					ch->end = ch->base + ch->len;
+				count++;
+				start = end;
 			}
 
-			/* If we find a dictionary it is probably the trailer,
-			 * but could be a stream (or bogus) dictionary caused
-			 * by a corrupt file. */
-			else if (tok == PDF_TOK_OPEN_DICT)
+			fz_run_workers(ctx, threads, count, scan_chunk_worker, &batch);
+
+			for (i = 0; i < count; i++)
 			{
-				fz_try(ctx)
+				struct repair_chunk *ch = &chunks[i];
+				if (ch->cand_len)
 				{
-					dict = pdf_parse_dict(ctx, doc, doc->file, buf);
+					cands = fz_resize_array(ctx, cands, cand_len + ch->cand_len, sizeof *cands);
+					memcpy(cands + cand_len, ch->cands, ch->cand_len * sizeof *cands);
+					cand_len += ch->cand_len;
 				}
-				fz_catch(ctx)
+				if (ch->end_len)
 				{
-					fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
-					/* If this was the real trailer dict
-					 * it was broken, in which case we are
-					 * in trouble. Keep going though in
-					 * case this was just a bogus dict. */
-					continue;
+					ends = fz_resize_array(ctx, ends, end_len + ch->end_len, sizeof *ends);
+					memcpy(ends + end_len, ch->ends, ch->end_len * sizeof *ends);
+					end_len += ch->end_len;
 				}
+			}
+			drop_repair_chunks(ctx, chunks, count);
+		}
 
-				obj = pdf_dict_get(ctx, dict, PDF_NAME_Encrypt);
-				if (obj)
+		/* Now walk the candidates in file order. */
+		skip = 0;
+		for (k = 0; k < cand_len; k++)
+		{
+			struct candidate *cand = &cands[k];
+			pdf_obj *root = NULL;
+			fz_off_t tmpofs, stm_ofs, stm_len;
+			int failed = 0;
+
+			if (cand->ofs < skip)
+				continue;
+
+			fz_seek(ctx, doc->file, cand->body, 0);
+			tmpofs = cand->body;
+
+			if (cand->trailer)
+			{
+				pdf_obj *dict = NULL;
+
+				fz_var(dict);
+
+				fz_try(ctx)
 				{
-					pdf_drop_obj(ctx, encrypt);
-					encrypt = pdf_keep_obj(ctx, obj);
+					if (pdf_lex(ctx, doc->file, buf) == PDF_TOK_OPEN_DICT)
+						dict = pdf_parse_dict(ctx, doc, doc->file, buf);
 				}
-
-				obj = pdf_dict_get(ctx, dict, PDF_NAME_ID);
-				if (obj && (!id || !encrypt || pdf_dict_get(ctx, dict, PDF_NAME_Encrypt)))
+				fz_catch(ctx)
 				{
-					pdf_drop_obj(ctx, id);
-					id = pdf_keep_obj(ctx, obj);
+					fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+					/* Keep going, as in the serial scan. */
+					dict = NULL;
 				}
-
-				obj = pdf_dict_get(ctx, dict, PDF_NAME_Root);
-				if (obj)
-					add_root(ctx, obj, &roots, &num_roots, &max_roots);
-
-				obj = pdf_dict_get(ctx, dict, PDF_NAME_Info);
-				if (obj)
+				if (dict)
 				{
-					pdf_drop_obj(ctx, info);
-					info = pdf_keep_obj(ctx, obj);
+					fz_try(ctx)
+						repair_trailer(ctx, rs, dict);
+					fz_always(ctx)
+						pdf_drop_obj(ctx, dict);
+					fz_catch(ctx)
+						fz_rethrow(ctx);
 				}
-
-				pdf_drop_obj(ctx, dict);
-				obj = NULL;
+				skip = fz_tell(ctx, doc->file);
+				continue;
 			}
 
-			else if (tok == PDF_TOK_EOF)
+			fz_try(ctx)
+			{
+				repair_scanned_obj(ctx, doc, buf, length, ends, end_len, &stm_ofs, &stm_len, &tmpofs, &root, rs);
+				if (root)
+					add_root(ctx, root, &rs->roots, &rs->num_roots, &rs->max_roots);
+			}
+			fz_always(ctx)
+			{
+				pdf_drop_obj(ctx, root);
+			}
+			fz_catch(ctx)
+			{
+				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+				if (!rs->roots)
+					fz_rethrow(ctx);
+				fz_warn(ctx, "cannot parse object (%d %d R) - ignoring rest of file", cand->num, cand->gen);
+				failed = 1;
+			}
+			if (failed)
 				break;
-			else
+
+			skip = tmpofs;
+
+			if (cand->num <= 0 || cand->num > MAX_OBJECT_NUMBER)
 			{
-				if (tok == PDF_TOK_ERROR)
-					fz_read_byte(ctx, doc->file);
-				num = 0;
-				gen = 0;
+				fz_warn(ctx, "ignoring object with invalid object number (%d %d R)", cand->num, cand->gen);
+				continue;
 			}
 
+			add_entry(ctx, rs, cand->num, fz_clampi(cand->gen, 0, 65535), cand->ofs, stm_ofs, stm_len);
 		}
+	}
+	fz_always(ctx)
+	{
+		if (chunks)
+			drop_repair_chunks(ctx, chunks, nchunks);
+		fz_free(ctx, chunks);
+		fz_free(ctx, cands);
+		fz_free(ctx, ends);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+void
+pdf_repair_xref(fz_context *ctx, pdf_document *doc)
+{
+	struct repair_state rs = { 0 };
+	pdf_obj *dict, *obj = NULL;
+	pdf_obj *length;
+	int threads = fz_worker_threads(ctx);
+	fz_off_t file_len = 0;
+	int next;
+	int i;
+
+	fz_var(obj);
+
+	if (doc->repair_attempted)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Repair failed already - not trying again");
+	doc->repair_attempted = 1;
+
+	doc->dirty = 1;
+	/* Can't support incremental update after repair */
+	doc->freeze_updates = 1;
+	/* Page objects from an index may no longer be valid */
+	pdf_invalidate_page_tree(ctx, doc);
+
+	fz_seek(ctx, doc->file, 0, 0);
+
+	fz_try(ctx)
+	{
+		pdf_xref_entry *entry;
+		rs.listlen = 0;
+		rs.listcap = 1024;
+		rs.list = fz_malloc_array(ctx, rs.listcap, sizeof(struct entry));
+
+		/* Only worth splitting up the scan of a large file. */
+		if (threads > 1 && fz_can_run_workers(ctx) && !doc->file_reading_linearly)
+		{
+			fz_seek(ctx, doc->file, 0, SEEK_END);
+			file_len = fz_tell(ctx, doc->file);
+			fz_seek(ctx, doc->file, 0, 0);
+		}
+
+		if (file_len >= REPAIR_MIN_FILE_LENGTH)
+			repair_scan_threads(ctx, doc, &rs, threads, file_len);
+		else
+			repair_scan(ctx, doc, &rs);
 
-		if (listlen == 0)
+		if (rs.listlen == 0)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "no objects found");
 
 		/* make xref reasonable */
@@ -500,9 +1040,9 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 		*/
 		/* Ensure that the first xref table is a 'solid' one from
 		 * 0 to maxnum. */
-		pdf_ensure_solid_xref(ctx, doc, maxnum);
+		pdf_ensure_solid_xref(ctx, doc, rs.maxnum);
 
-		for (i = 1; i < maxnum; i++)
+		for (i = 1; i < rs.maxnum; i++)
 		{
 			entry = pdf_get_populating_xref_entry(ctx, doc, i);
 			if (entry->obj != NULL)
@@ -515,22 +1055,22 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 			entry->stm_ofs = 0;
 		}
 
-		for (i = 0; i < listlen; i++)
+		for (i = 0; i < rs.listlen; i++)
 		{
-			entry = pdf_get_populating_xref_entry(ctx, doc, list[i].num);
+			entry = pdf_get_populating_xref_entry(ctx, doc, rs.list[i].num);
 			entry->type = 'n';
-			entry->ofs = list[i].ofs;
-			entry->gen = list[i].gen;
-			entry->num = list[i].num;
+			entry->ofs = rs.list[i].ofs;
+			entry->gen = rs.list[i].gen;
+			entry->num = rs.list[i].num;
 
-			entry->stm_ofs = list[i].stm_ofs;
+			entry->stm_ofs = rs.list[i].stm_ofs;
 
 			/* correct stream length for unencrypted documents */
-			if (!encrypt && list[i].stm_len >= 0)
+			if (!rs.encrypt && rs.list[i].stm_len >= 0)
 			{
-				dict = pdf_load_object(ctx, doc, list[i].num);
+				dict = pdf_load_object(ctx, doc, rs.list[i].num);
 
-				length = pdf_new_int(ctx, doc, list[i].stm_len);
+				length = pdf_new_int_offset(ctx, doc, rs.list[i].stm_len);
 				pdf_dict_put(ctx, dict, PDF_NAME_Length, length);
 				pdf_drop_obj(ctx, length);
 
@@ -566,78 +1106,78 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 		pdf_drop_obj(ctx, obj);
 		obj = NULL;
 
-		obj = pdf_new_int(ctx, doc, maxnum + 1);
+		obj = pdf_new_int(ctx, doc, rs.maxnum + 1);
 		pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_Size, obj);
 		pdf_drop_obj(ctx, obj);
 		obj = NULL;
 
-		if (roots)
+		if (rs.roots)
 		{
 			int i;
-			for (i = num_roots-1; i > 0; i--)
+			for (i = rs.num_roots-1; i > 0; i--)
 			{
-				if (pdf_is_dict(ctx, roots[i]))
+				if (pdf_is_dict(ctx, rs.roots[i]))
 					break;
 			}
 			if (i >= 0)
 			{
-				pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_Root, roots[i]);
+				pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_Root, rs.roots[i]);
 			}
 		}
-		if (info)
+		if (rs.info)
 		{
-			pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_Info, info);
-			pdf_drop_obj(ctx, info);
-			info = NULL;
+			pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_Info, rs.info);
+			pdf_drop_obj(ctx, rs.info);
+			rs.info = NULL;
 		}
 
-		if (encrypt)
+		if (rs.encrypt)
 		{
-			if (pdf_is_indirect(ctx, encrypt))
+			if (pdf_is_indirect(ctx, rs.encrypt))
 			{
 				/* create new reference with non-NULL xref pointer */
-				obj = pdf_new_indirect(ctx, doc, pdf_to_num(ctx, encrypt), pdf_to_gen(ctx, encrypt));
-				pdf_drop_obj(ctx, encrypt);
-				encrypt = obj;
+				obj = pdf_new_indirect(ctx, doc, pdf_to_num(ctx, rs.encrypt), pdf_to_gen(ctx, rs.encrypt));
+				pdf_drop_obj(ctx, rs.encrypt);
+				rs.encrypt = obj;
 				obj = NULL;
 			}
-			pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_Encrypt, encrypt);
-			pdf_drop_obj(ctx, encrypt);
-			encrypt = NULL;
+			pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_Encrypt, rs.encrypt);
+			pdf_drop_obj(ctx, rs.encrypt);
+			rs.encrypt = NULL;
 		}
 
-		if (id)
+		if (rs.id)
 		{
-			if (pdf_is_indirect(ctx, id))
+			if (pdf_is_indirect(ctx, rs.id))
 			{
 				/* create new reference with non-NULL xref pointer */
-				obj = pdf_new_indirect(ctx, doc, pdf_to_num(ctx, id), pdf_to_gen(ctx, id));
-				pdf_drop_obj(ctx, id);
-				id = obj;
+				obj = pdf_new_indirect(ctx, doc, pdf_to_num(ctx, rs.id), pdf_to_gen(ctx, rs.id));
+				pdf_drop_obj(ctx, rs.id);
+				rs.id = obj;
 				obj = NULL;
 			}
-			pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_ID, id);
-			pdf_drop_obj(ctx, id);
-			id = NULL;
+			pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME_ID, rs.id);
+			pdf_drop_obj(ctx, rs.id);
+			rs.id = NULL;
 		}
 
-		fz_free(ctx, list);
+		fz_free(ctx, rs.list);
 	}
 	fz_always(ctx)
 	{
 		int i;
 
-		for (i = 0; i < num_roots; i++)
-			pdf_drop_obj(ctx, roots[i]);
-		fz_free(ctx, roots);
+		for (i = 0; i < rs.num_roots; i++)
+			pdf_drop_obj(ctx, rs.roots[i]);
+		fz_free(ctx, rs.roots);
 	}
 	fz_catch(ctx)
 	{
-		pdf_drop_obj(ctx, encrypt);
-		pdf_drop_obj(ctx, id);
+		pdf_drop_obj(ctx, rs.encrypt);
+		pdf_drop_obj(ctx, rs.id);
 		pdf_drop_obj(ctx, obj);
-		pdf_drop_obj(ctx, info);
-		fz_free(ctx, list);
+		pdf_drop_obj(ctx, rs.info);
+		fz_free(ctx, rs.list);
 		fz_rethrow(ctx);
 	}
 }
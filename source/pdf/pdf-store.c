@@ -55,8 +55,11 @@ pdf_store_item(fz_context *ctx, pdf_obj *key, void *val, size_t itemsize)
 {
 	void *existing;
 	existing = fz_store_item(ctx, key, val, itemsize, &pdf_obj_store_type);
-	assert(existing == NULL);
-	(void)existing; /* Silence warning in release builds */
+	/* Another thread sharing the document may have stored the same
+	 * resource first; keep using ours and drop the reference we were
+	 * given to theirs. */
+	if (existing)
+		fz_drop_storable(ctx, existing);
 }
 
 void *
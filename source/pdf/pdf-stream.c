@@ -242,6 +242,81 @@ build_filter_chain(fz_context *ctx, fz_stream *chain, pdf_document *doc, pdf_obj
 	return chain;
 }
 
+/*
+ * Like fz_open_null, but for reading a stream from the document
+ * file while other threads may be using it too. Each read seeks
+ * and copies under the document lock.
+ */
+struct shared_null_filter
+{
+	pdf_document *doc;
+	fz_stream *chain;
+	size_t remain;
+	fz_off_t offset;
+	unsigned char buffer[4096];
+};
+
+static int
+next_shared_null(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	struct shared_null_filter *state = stm->state;
+	size_t n = 0;
+
+	if (state->remain == 0)
+		return EOF;
+
+	pdf_lock_document(ctx, state->doc);
+	fz_try(ctx)
+	{
+		fz_seek(ctx, state->chain, state->offset, 0);
+		n = fz_available(ctx, state->chain, max);
+		if (n > state->remain)
+			n = state->remain;
+		if (n > sizeof(state->buffer))
+			n = sizeof(state->buffer);
+		memcpy(state->buffer, state->chain->rp, n);
+		state->chain->rp += n;
+	}
+	fz_always(ctx)
+		pdf_unlock_document(ctx, state->doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	stm->rp = state->buffer;
+	stm->wp = stm->rp + n;
+	if (n == 0)
+		return EOF;
+	state->remain -= n;
+	state->offset += n;
+	stm->pos += n;
+	return *stm->rp++;
+}
+
+static void
+close_shared_null(fz_context *ctx, void *state_)
+{
+	struct shared_null_filter *state = (struct shared_null_filter *)state_;
+	fz_stream *chain = state->chain;
+	fz_free(ctx, state);
+	fz_drop_stream(ctx, chain);
+}
+
+static fz_stream *
+pdf_open_shared_null(fz_context *ctx, pdf_document *doc, int len, fz_off_t offset)
+{
+	struct shared_null_filter *state;
+
+	if (len < 0)
+		len = 0;
+	state = fz_malloc_struct(ctx, struct shared_null_filter);
+	state->doc = doc;
+	state->chain = fz_keep_stream(ctx, doc->file);
+	state->remain = len;
+	state->offset = offset;
+
+	return fz_new_stream(ctx, state, next_shared_null, close_shared_null);
+}
+
 /*
  * Build a filter for reading raw stream data.
  * This is a null filter to constrain reading to the stream length (and to
@@ -273,11 +348,15 @@ pdf_open_raw_filter(fz_context *ctx, fz_stream *chain, pdf_document *doc, pdf_ob
 		*orig_gen = 0;
 	}
 
-	/* don't close chain when we close this filter */
-	fz_keep_stream(ctx, chain);
-
 	len = pdf_to_int(ctx, pdf_dict_get(ctx, stmobj, PDF_NAME_Length));
-	chain = fz_open_null(ctx, chain, len, offset);
+	if (doc->concurrent_reads && chain == doc->file)
+		chain = pdf_open_shared_null(ctx, doc, len, offset);
+	else
+	{
+		/* don't close chain when we close this filter */
+		fz_keep_stream(ctx, chain);
+		chain = fz_open_null(ctx, chain, len, offset);
+	}
 
 	hascrypt = pdf_stream_has_crypt(ctx, stmobj);
 	if (doc->crypt && !hascrypt)
@@ -0,0 +1,798 @@
+#include "mupdf/pdf.h"
+
+#include <zlib.h>
+
+/*
+ * Subsetting of embedded TrueType fonts.
+ *
+ * All pages (including hidden optional content and hidden annotations)
+ * are run through a device that records which glyphs of which fonts are
+ * drawn. Embedded font programs are then matched to the loaded fonts by
+ * the digest of their data. Identical font programs are merged into one
+ * stream, and the glyph outlines of every unused glyph are removed from
+ * the 'glyf' table. Glyph ids are preserved, so no other part of the
+ * PDF font needs to change. Tables a PDF renderer never uses, such as
+ * the OpenType layout tables and 'kern', are dropped whatever glyphs
+ * are used, since PDF content positions every glyph itself.
+ */
+
+/* Never render deeper than this into Type3 glyphs that draw text. */
+#define MAX_T3_DEPTH 8
+
+typedef struct
+{
+	fz_font *font;
+	unsigned char digest[16];
+	int len;
+	unsigned char *used;
+} glyph_usage;
+
+typedef struct
+{
+	fz_device super;
+	int t3_depth;
+	int len, cap;
+	glyph_usage *fonts;
+} glyph_usage_device;
+
+static glyph_usage *
+find_usage(fz_context *ctx, glyph_usage_device *dev, fz_font *font)
+{
+	glyph_usage *u;
+	int i;
+
+	for (i = 0; i < dev->len; i++)
+		if (dev->fonts[i].font == font)
+			return &dev->fonts[i];
+
+	if (dev->len == dev->cap)
+	{
+		int cap = dev->cap ? dev->cap * 2 : 16;
+		dev->fonts = fz_resize_array(ctx, dev->fonts, cap, sizeof *dev->fonts);
+		dev->cap = cap;
+	}
+
+	u = &dev->fonts[dev->len];
+	u->len = font->glyph_count > 0 ? font->glyph_count : 256;
+	u->used = fz_calloc(ctx, u->len, 1);
+	u->font = fz_keep_font(ctx, font);
+	dev->len++;
+	return u;
+}
+
+static void
+mark_glyph(fz_context *ctx, glyph_usage *u, int gid)
+{
+	if (gid >= u->len)
+	{
+		int len = fz_maxi(gid + 1, u->len * 2);
+		u->used = fz_resize_array(ctx, u->used, len, 1);
+		memset(u->used + u->len, 0, len - u->len);
+		u->len = len;
+	}
+	u->used[gid] = 1;
+}
+
+static void
+record_text(fz_context *ctx, fz_device *dev_, const fz_text *text, const fz_matrix *ctm)
+{
+	glyph_usage_device *dev = (glyph_usage_device *)dev_;
+	fz_text_span *span;
+	int i;
+
+	for (span = text->head; span; span = span->next)
+	{
+		fz_font *font = span->font;
+
+		if (font->t3procs)
+		{
+			/* Type3 glyphs may draw text of their own. */
+			fz_matrix tm = span->trm, trm;
+
+			if (!font->t3lists || dev->t3_depth >= MAX_T3_DEPTH)
+				continue;
+			dev->t3_depth++;
+			fz_try(ctx)
+			{
+				for (i = 0; i < span->len; i++)
+				{
+					int gid = span->items[i].gid;
+					if (gid < 0 || gid > 255)
+						continue;
+					tm.e = span->items[i].x;
+					tm.f = span->items[i].y;
+					fz_concat(&trm, &tm, ctm);
+					fz_run_t3_glyph(ctx, font, gid, &trm, dev_);
+				}
+			}
+			fz_always(ctx)
+				dev->t3_depth--;
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+		}
+		else if (font->buffer)
+		{
+			glyph_usage *u = find_usage(ctx, dev, font);
+			for (i = 0; i < span->len; i++)
+				if (span->items[i].gid >= 0)
+					mark_glyph(ctx, u, span->items[i].gid);
+		}
+	}
+}
+
+static void
+usage_fill_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_matrix *ctm,
+	fz_colorspace *colorspace, const float *color, float alpha)
+{
+	record_text(ctx, dev, text, ctm);
+}
+
+static void
+usage_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_stroke_state *stroke,
+	const fz_matrix *ctm, fz_colorspace *colorspace, const float *color, float alpha)
+{
+	record_text(ctx, dev, text, ctm);
+}
+
+static void
+usage_clip_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_matrix *ctm, const fz_rect *scissor)
+{
+	record_text(ctx, dev, text, ctm);
+}
+
+static void
+usage_clip_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_stroke_state *stroke,
+	const fz_matrix *ctm, const fz_rect *scissor)
+{
+	record_text(ctx, dev, text, ctm);
+}
+
+static void
+usage_ignore_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_matrix *ctm)
+{
+	record_text(ctx, dev, text, ctm);
+}
+
+static void
+usage_drop_device(fz_context *ctx, fz_device *dev_)
+{
+	glyph_usage_device *dev = (glyph_usage_device *)dev_;
+	int i;
+
+	for (i = 0; i < dev->len; i++)
+	{
+		fz_drop_font(ctx, dev->fonts[i].font);
+		fz_free(ctx, dev->fonts[i].used);
+	}
+	fz_free(ctx, dev->fonts);
+}
+
+static glyph_usage_device *
+new_glyph_usage_device(fz_context *ctx)
+{
+	glyph_usage_device *dev = fz_new_device(ctx, sizeof *dev);
+
+	dev->super.drop_device = usage_drop_device;
+	dev->super.fill_text = usage_fill_text;
+	dev->super.stroke_text = usage_stroke_text;
+	dev->super.clip_text = usage_clip_text;
+	dev->super.clip_stroke_text = usage_clip_stroke_text;
+	dev->super.ignore_text = usage_ignore_text;
+
+	return dev;
+}
+
+static void
+collect_page_usage(fz_context *ctx, pdf_document *doc, pdf_page *page, fz_device *dev)
+{
+	pdf_processor *proc;
+	pdf_annot *annot;
+
+	/* With no usage event, all optional content is considered visible. */
+	pdf_run_page_with_usage(ctx, doc, page, dev, &fz_identity, NULL, NULL);
+
+	/* Hidden annotations are skipped by the interpreter, but may be
+	 * shown later on, so their appearance streams count too. */
+	for (annot = page->annots; annot; annot = annot->next)
+	{
+		int flags = pdf_to_int(ctx, pdf_dict_get(ctx, annot->obj, PDF_NAME_F));
+		if (!annot->ap || !(flags & (F_Invisible | F_Hidden)))
+			continue;
+		proc = pdf_new_run_processor(ctx, dev, &fz_identity, NULL, NULL, 0);
+		fz_try(ctx)
+		{
+			proc->op_q(ctx, proc);
+			proc->op_Do_form(ctx, proc, NULL, annot->ap, pdf_page_resources(ctx, page));
+			proc->op_Q(ctx, proc);
+		}
+		fz_always(ctx)
+			pdf_drop_processor(ctx, proc);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+}
+
+/*
+ * TrueType glyph table rewriting.
+ */
+
+static inline int get16(const unsigned char *p) { return (p[0] << 8) | p[1]; }
+static inline unsigned int get32(const unsigned char *p) { return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static inline void put16(unsigned char *p, int v) { p[0] = v >> 8; p[1] = v; }
+static inline void put32(unsigned char *p, unsigned int v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+
+#define TAG(a,b,c,d) (((unsigned int)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+/* Tables that play no part in rendering the glyphs of a PDF font. These
+ * are dropped whether or not any glyphs are removed. */
+static int
+is_dropped_table(unsigned int tag)
+{
+	switch (tag)
+	{
+	case TAG('B','A','S','E'):
+	case TAG('D','S','I','G'):
+	case TAG('E','B','D','T'):
+	case TAG('E','B','L','C'):
+	case TAG('E','B','S','C'):
+	case TAG('G','D','E','F'):
+	case TAG('G','P','O','S'):
+	case TAG('G','S','U','B'):
+	case TAG('J','S','T','F'):
+	case TAG('L','T','S','H'):
+	case TAG('V','D','M','X'):
+	case TAG('h','d','m','x'):
+	case TAG('k','e','r','n'):
+		return 1;
+	}
+	return 0;
+}
+
+static fz_buffer *
+deflate_font(fz_context *ctx, fz_buffer *raw)
+{
+	fz_buffer *buf;
+	uLongf csize;
+	uLong len = (uLong)raw->len;
+
+	if (raw->len != (size_t)len)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "font too large to deflate");
+
+	buf = fz_new_buffer(ctx, compressBound(len));
+	csize = (uLongf)buf->cap;
+	if (compress2(buf->data, &csize, raw->data, len, Z_BEST_COMPRESSION) != Z_OK)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot deflate font");
+	}
+	buf->len = csize;
+	return buf;
+}
+
+typedef struct
+{
+	unsigned int tag;
+	const unsigned char *data;
+	unsigned int len;
+	unsigned char *out;
+} ttf_table;
+
+static unsigned int
+ttf_checksum(const unsigned char *p, unsigned int len)
+{
+	unsigned int sum = 0;
+	unsigned char pad[4] = { 0 };
+
+	while (len >= 4)
+	{
+		sum += get32(p);
+		p += 4;
+		len -= 4;
+	}
+	if (len)
+	{
+		memcpy(pad, p, len);
+		sum += get32(pad);
+	}
+	return sum;
+}
+
+static unsigned int
+glyph_offset(const unsigned char *loca, int long_loca, int gid)
+{
+	return long_loca ? get32(loca + gid * 4) : get16(loca + gid * 2) * 2u;
+}
+
+/* Add the components of any composite glyphs to the set of kept glyphs. */
+static void
+keep_components(const unsigned char *glyf, const unsigned int *offsets, unsigned char *keep, int num_glyphs)
+{
+	int changed = 1;
+	int gid;
+
+	while (changed)
+	{
+		changed = 0;
+		for (gid = 0; gid < num_glyphs; gid++)
+		{
+			const unsigned char *p = glyf + offsets[gid];
+			const unsigned char *end = glyf + offsets[gid + 1];
+			int flags;
+
+			if (keep[gid] != 1 || end - p < 10)
+				continue;
+			keep[gid] = 2; /* components visited */
+			if ((short)get16(p) >= 0)
+				continue;
+
+			p += 10;
+			do
+			{
+				int comp;
+				if (end - p < 4)
+					break;
+				flags = get16(p);
+				comp = get16(p + 2);
+				p += 4;
+				p += (flags & 1) ? 4 : 2;
+				if (flags & 8)
+					p += 2;
+				else if (flags & 0x40)
+					p += 4;
+				else if (flags & 0x80)
+					p += 8;
+				if (comp < num_glyphs && !keep[comp])
+				{
+					keep[comp] = 1;
+					changed = 1;
+				}
+			}
+			while (flags & 0x20);
+		}
+	}
+}
+
+/*
+	Return a copy of a TrueType font with the outlines of all glyphs not
+	marked in 'used' removed, or NULL if the font cannot be subset or
+	would not get smaller.
+*/
+static fz_buffer *
+subset_truetype(fz_context *ctx, fz_buffer *font, const unsigned char *used, int used_len)
+{
+	const unsigned char *data = font->data;
+	size_t len = font->len;
+	ttf_table *tables = NULL;
+	unsigned int *offsets = NULL;
+	unsigned char *keep = NULL;
+	fz_buffer *out = NULL;
+	const unsigned char *head = NULL, *maxp = NULL, *loca = NULL, *glyf = NULL;
+	unsigned int loca_len = 0, glyf_len = 0;
+	unsigned int version, glyf_size, pos, sum;
+	int num_tables, num_glyphs, long_loca, new_long_loca, count, i, k;
+
+	if (len < 12)
+		return NULL;
+	version = get32(data);
+	if (version != 0x00010000 && version != TAG('t','r','u','e'))
+		return NULL;
+	num_tables = get16(data + 4);
+	if (num_tables == 0 || 12 + 16 * (size_t)num_tables > len)
+		return NULL;
+
+	fz_var(tables);
+	fz_var(offsets);
+	fz_var(keep);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		tables = fz_malloc_array(ctx, num_tables, sizeof *tables);
+		count = 0;
+		for (i = 0; i < num_tables; i++)
+		{
+			const unsigned char *rec = data + 12 + 16 * i;
+			unsigned int tag = get32(rec);
+			unsigned int ofs = get32(rec + 8);
+			unsigned int tlen = get32(rec + 12);
+
+			if (ofs > len || tlen > len - ofs)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "truetype table out of range");
+			if (tag == TAG('h','e','a','d')) head = data + ofs;
+			else if (tag == TAG('m','a','x','p')) maxp = data + ofs;
+			else if (tag == TAG('l','o','c','a')) loca = data + ofs, loca_len = tlen;
+			else if (tag == TAG('g','l','y','f')) glyf = data + ofs, glyf_len = tlen;
+			if ((tag == TAG('h','e','a','d') && tlen < 54) || (tag == TAG('m','a','x','p') && tlen < 6))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "truetype table too short");
+			if (is_dropped_table(tag))
+				continue;
+			tables[count].tag = tag;
+			tables[count].data = data + ofs;
+			tables[count].len = tlen;
+			tables[count].out = NULL;
+			count++;
+		}
+		if (!head || !maxp || !loca || !glyf)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "not a glyf based truetype font");
+
+		num_glyphs = get16(maxp + 4);
+		long_loca = get16(head + 50) != 0;
+		if ((num_glyphs + 1u) * (long_loca ? 4 : 2) > loca_len)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "truetype loca table too short");
+
+		offsets = fz_malloc_array(ctx, num_glyphs + 1, sizeof *offsets);
+		for (i = 0; i <= num_glyphs; i++)
+		{
+			offsets[i] = glyph_offset(loca, long_loca, i);
+			if (offsets[i] > glyf_len || (i > 0 && offsets[i] < offsets[i - 1]))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "truetype loca table is corrupt");
+		}
+
+		keep = fz_calloc(ctx, num_glyphs + 1, 1);
+		keep[0] = 1;
+		for (i = 0; i < num_glyphs && i < used_len; i++)
+			keep[i] = keep[i] || used[i];
+		keep_components(glyf, offsets, keep, num_glyphs);
+
+		glyf_size = 0;
+		for (i = 0; i < num_glyphs; i++)
+			if (keep[i])
+				glyf_size += (offsets[i + 1] - offsets[i] + 3) & ~3u;
+		new_long_loca = long_loca || glyf_size / 2 > 0xffff;
+
+		/* Lay out the new file: directory first, then the tables. */
+		pos = 12 + 16 * count;
+		for (i = 0; i < count; i++)
+		{
+			if (tables[i].tag == TAG('g','l','y','f'))
+				tables[i].len = glyf_size;
+			else if (tables[i].tag == TAG('l','o','c','a'))
+				tables[i].len = (num_glyphs + 1) * (new_long_loca ? 4 : 2);
+			pos += (tables[i].len + 3) & ~3u;
+		}
+		if (pos >= len)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "subset font is not smaller");
+
+		out = fz_new_buffer(ctx, pos);
+		memset(out->data, 0, pos);
+		out->len = pos;
+
+		put32(out->data, version);
+		put16(out->data + 4, count);
+		for (k = 0; (2 << k) <= count; k++)
+			;
+		put16(out->data + 6, 16 << k);
+		put16(out->data + 8, k);
+		put16(out->data + 10, count * 16 - (16 << k));
+
+		pos = 12 + 16 * count;
+		for (i = 0; i < count; i++)
+		{
+			tables[i].out = out->data + pos;
+			pos += (tables[i].len + 3) & ~3u;
+		}
+
+		for (i = 0; i < count; i++)
+		{
+			ttf_table *t = &tables[i];
+			if (t->tag == TAG('g','l','y','f'))
+			{
+				unsigned char *p = t->out;
+				int g;
+				for (g = 0; g < num_glyphs; g++)
+				{
+					unsigned int glen = offsets[g + 1] - offsets[g];
+					if (!keep[g])
+						continue;
+					memcpy(p, glyf + offsets[g], glen);
+					p += (glen + 3) & ~3u;
+				}
+			}
+			else if (t->tag == TAG('l','o','c','a'))
+			{
+				unsigned int ofs = 0;
+				int g;
+				for (g = 0; g <= num_glyphs; g++)
+				{
+					if (new_long_loca)
+						put32(t->out + g * 4, ofs);
+					else
+						put16(t->out + g * 2, ofs / 2);
+					if (g < num_glyphs && keep[g])
+						ofs += (offsets[g + 1] - offsets[g] + 3) & ~3u;
+				}
+			}
+			else
+			{
+				memcpy(t->out, t->data, t->len);
+				if (t->tag == TAG('h','e','a','d'))
+				{
+					put32(t->out + 8, 0); /* checkSumAdjustment */
+					put16(t->out + 50, new_long_loca);
+				}
+			}
+		}
+
+		/* Write the table directory and fix up the file checksum. */
+		for (i = 0; i < count; i++)
+		{
+			unsigned char *rec = out->data + 12 + 16 * i;
+			put32(rec, tables[i].tag);
+			put32(rec + 4, ttf_checksum(tables[i].out, tables[i].len));
+			put32(rec + 8, (unsigned int)(tables[i].out - out->data));
+			put32(rec + 12, tables[i].len);
+		}
+		sum = ttf_checksum(out->data, (unsigned int)out->len);
+		for (i = 0; i < count; i++)
+			if (tables[i].tag == TAG('h','e','a','d'))
+				put32(tables[i].out + 8, 0xB1B0AFBA - sum);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, tables);
+		fz_free(ctx, offsets);
+		fz_free(ctx, keep);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, out);
+		return NULL;
+	}
+
+	return out;
+}
+
+/*
+ * Font program discovery.
+ */
+
+typedef struct
+{
+	int desc; /* FontDescriptor object number */
+	int num; /* FontFile2 stream object number */
+	int exclude; /* used by the interactive form; keep all glyphs */
+	unsigned char digest[16];
+} font_file;
+
+static void
+digest_buffer(fz_buffer *buf, unsigned char digest[16])
+{
+	fz_md5 md5;
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, buf->data, buf->len);
+	fz_md5_final(&md5, digest);
+}
+
+static pdf_obj *
+font_descriptor(fz_context *ctx, pdf_obj *font)
+{
+	pdf_obj *desc = pdf_dict_get(ctx, font, PDF_NAME_FontDescriptor);
+	if (!desc)
+		desc = pdf_dict_get(ctx, pdf_array_get(ctx, pdf_dict_get(ctx, font, PDF_NAME_DescendantFonts), 0), PDF_NAME_FontDescriptor);
+	return desc;
+}
+
+static void
+exclude_form_fonts(fz_context *ctx, pdf_document *doc, font_file *files, int count)
+{
+	pdf_obj *fonts = pdf_dict_getl(ctx, pdf_trailer(ctx, doc), PDF_NAME_Root, PDF_NAME_AcroForm, PDF_NAME_DR, PDF_NAME_Font, NULL);
+	int i, k, n = pdf_dict_len(ctx, fonts);
+
+	for (i = 0; i < n; i++)
+	{
+		pdf_obj *ff = pdf_dict_get(ctx, font_descriptor(ctx, pdf_dict_get_val(ctx, fonts, i)), PDF_NAME_FontFile2);
+		for (k = 0; k < count; k++)
+			if (files[k].num == pdf_to_num(ctx, ff))
+				files[k].exclude = 1;
+	}
+}
+
+static font_file *
+find_font_files(fz_context *ctx, pdf_document *doc, int *countp)
+{
+	font_file *files = NULL;
+	int count = 0, cap = 0;
+	int num, len = pdf_xref_len(ctx, doc);
+
+	fz_var(files);
+
+	fz_try(ctx)
+	{
+		for (num = 1; num < len; num++)
+		{
+			pdf_obj *obj = NULL, *ff;
+
+			fz_try(ctx)
+				obj = pdf_load_object(ctx, doc, num);
+			fz_catch(ctx)
+			{
+				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+				continue;
+			}
+
+			ff = pdf_dict_get(ctx, obj, PDF_NAME_FontFile2);
+			if (pdf_name_eq(ctx, pdf_dict_get(ctx, obj, PDF_NAME_Type), PDF_NAME_FontDescriptor) && pdf_is_indirect(ctx, ff))
+			{
+				if (count == cap)
+				{
+					cap = cap ? cap * 2 : 32;
+					files = fz_resize_array(ctx, files, cap, sizeof *files);
+				}
+				files[count].desc = num;
+				files[count].num = pdf_to_num(ctx, ff);
+				files[count].exclude = 0;
+				count++;
+			}
+			pdf_drop_obj(ctx, obj);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, files);
+		fz_rethrow(ctx);
+	}
+
+	*countp = count;
+	return files;
+}
+
+static void
+subset_font_group(fz_context *ctx, pdf_document *doc, glyph_usage_device *dev, font_file *files, int count, int first)
+{
+	unsigned char *used = NULL;
+	int used_len = 0;
+	fz_buffer *buf = NULL;
+	fz_buffer *subset = NULL;
+	fz_buffer *packed = NULL;
+	pdf_obj *ref = NULL;
+	int i;
+
+	fz_var(used);
+	fz_var(buf);
+	fz_var(subset);
+	fz_var(packed);
+	fz_var(ref);
+
+	fz_try(ctx)
+	{
+		ref = pdf_new_indirect(ctx, doc, files[first].num, 0);
+
+		/* Point every descriptor using a copy of this font program at the
+		 * first one. The copies become unreferenced and are dropped when
+		 * garbage collecting. */
+		for (i = first; i < count; i++)
+		{
+			if (memcmp(files[i].digest, files[first].digest, 16))
+				continue;
+			if (files[i].num != files[first].num)
+			{
+				pdf_obj *desc = pdf_load_object(ctx, doc, files[i].desc);
+				pdf_dict_put(ctx, desc, PDF_NAME_FontFile2, ref);
+				pdf_drop_obj(ctx, desc);
+			}
+			if (files[i].exclude)
+				used_len = -1;
+		}
+
+		/* Gather the glyphs used from every loaded instance of the font. */
+		for (i = 0; i < dev->len && used_len >= 0; i++)
+		{
+			glyph_usage *u = &dev->fonts[i];
+			int g;
+			if (memcmp(u->digest, files[first].digest, 16))
+				continue;
+			if (u->len > used_len)
+			{
+				used = fz_resize_array(ctx, used, u->len, 1);
+				memset(used + used_len, 0, u->len - used_len);
+				used_len = u->len;
+			}
+			for (g = 0; g < u->len; g++)
+				used[g] |= u->used[g];
+		}
+
+		/* Fonts that were never drawn with are left alone. */
+		if (used_len > 0)
+		{
+			buf = pdf_load_stream(ctx, doc, files[first].num);
+			subset = subset_truetype(ctx, buf, used, used_len);
+			if (subset)
+			{
+				/* Store the subset compressed, as the font it replaces most likely was. */
+				packed = deflate_font(ctx, subset);
+				pdf_dict_put_drop(ctx, ref, PDF_NAME_Length1, pdf_new_int(ctx, doc, (int)subset->len));
+				pdf_update_stream(ctx, doc, ref, packed, 1);
+				pdf_dict_put(ctx, ref, PDF_NAME_Filter, PDF_NAME_FlateDecode);
+				pdf_dict_del(ctx, ref, PDF_NAME_DecodeParms);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, used);
+		fz_drop_buffer(ctx, buf);
+		fz_drop_buffer(ctx, subset);
+		fz_drop_buffer(ctx, packed);
+		pdf_drop_obj(ctx, ref);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+void
+pdf_subset_fonts(fz_context *ctx, pdf_document *doc)
+{
+	glyph_usage_device *dev = NULL;
+	font_file *files = NULL;
+	pdf_page *page = NULL;
+	fz_buffer *buf = NULL;
+	int i, k, n, count = 0;
+
+	if (doc->crypt)
+	{
+		fz_warn(ctx, "cannot subset fonts in encrypted documents");
+		return;
+	}
+
+	fz_var(dev);
+	fz_var(files);
+	fz_var(page);
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		files = find_font_files(ctx, doc, &count);
+		exclude_form_fonts(ctx, doc, files, count);
+
+		for (i = 0; i < count; i++)
+		{
+			for (k = 0; k < i; k++)
+				if (files[k].num == files[i].num)
+					break;
+			if (k < i)
+			{
+				memcpy(files[i].digest, files[k].digest, 16);
+				continue;
+			}
+			buf = pdf_load_stream(ctx, doc, files[i].num);
+			digest_buffer(buf, files[i].digest);
+			fz_drop_buffer(ctx, buf);
+			buf = NULL;
+		}
+
+		dev = new_glyph_usage_device(ctx);
+		n = count > 0 ? pdf_count_pages(ctx, doc) : 0;
+		for (i = 0; i < n; i++)
+		{
+			page = pdf_load_page(ctx, doc, i);
+			collect_page_usage(ctx, doc, page, &dev->super);
+			fz_drop_page(ctx, (fz_page *)page);
+			page = NULL;
+		}
+		for (i = 0; i < dev->len; i++)
+			digest_buffer(dev->fonts[i].font->buffer, dev->fonts[i].digest);
+
+		for (i = 0; i < count; i++)
+		{
+			for (k = 0; k < i; k++)
+				if (!memcmp(files[k].digest, files[i].digest, 16))
+					break;
+			if (k == i)
+				subset_font_group(ctx, doc, dev, files, count, i);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_page(ctx, (fz_page *)page);
+		fz_drop_buffer(ctx, buf);
+		fz_drop_device(ctx, (fz_device *)dev);
+		fz_free(ctx, files);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "cannot subset fonts: %s", fz_caught_message(ctx));
+	}
+}
@@ -629,27 +629,82 @@ static int markobj(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pd
 }
 
 /*
- * Scan for and remove duplicate objects (slow)
+ * Scan for and remove duplicate objects
+ *
+ * Objects are sorted into buckets by a hash of their value (and their
+ * raw stream data, when streams are compared), and only objects in the
+ * same bucket are compared with each other.
  */
 
+typedef struct
+{
+	unsigned int hash;
+	int num;
+	int is_stream;
+} dup_entry;
+
+static int
+dup_entry_cmp(const void *a_, const void *b_)
+{
+	const dup_entry *a = a_;
+	const dup_entry *b = b_;
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return a->num - b->num;
+}
+
+static int
+raw_streams_differ(fz_context *ctx, pdf_document *doc, int num, int other)
+{
+	fz_buffer *sa = NULL;
+	fz_buffer *sb = NULL;
+	int differ = 1;
+
+	fz_var(sa);
+	fz_var(sb);
+
+	fz_try(ctx)
+	{
+		unsigned char *dataa, *datab;
+		size_t lena, lenb;
+		sa = pdf_load_raw_stream(ctx, doc, num);
+		sb = pdf_load_raw_stream(ctx, doc, other);
+		lena = fz_buffer_storage(ctx, sa, &dataa);
+		lenb = fz_buffer_storage(ctx, sb, &datab);
+		if (lena == lenb && memcmp(dataa, datab, lena) == 0)
+			differ = 0;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, sa);
+		fz_drop_buffer(ctx, sb);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return differ;
+}
+
 static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
 {
-	int num, other;
+	int num, other, i, j, k, n;
 	int xref_len = pdf_xref_len(ctx, doc);
+	dup_entry *list;
 
-	for (num = 1; num < xref_len; num++)
+	list = fz_malloc_array(ctx, xref_len, sizeof *list);
+
+	fz_try(ctx)
 	{
-		/* Only compare an object to objects preceding it */
-		for (other = 1; other < num; other++)
+		n = 0;
+		for (num = 1; num < xref_len; num++)
 		{
-			pdf_obj *a, *b;
-			int differ, newnum, streama, streamb;
+			int skip = 0;
 
-			if (num == other || !opts->use_list[num] || !opts->use_list[other])
+			if (!opts->use_list[num])
 				continue;
 
-			/* TODO: resolve indirect references to see if we can omit them */
-
 			/*
 			 * Comparing stream objects data contents would take too long.
 			 *
@@ -658,71 +713,71 @@ static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_st
 			 */
 			fz_try(ctx)
 			{
-				streama = pdf_obj_num_is_stream(ctx, doc, num);
-				streamb = pdf_obj_num_is_stream(ctx, doc, other);
-				differ = streama || streamb;
-				if (streama && streamb && opts->do_garbage >= 4)
-					differ = 0;
+				list[n].is_stream = pdf_obj_num_is_stream(ctx, doc, num);
+				if (list[n].is_stream && opts->do_garbage < 4)
+					skip = 1;
+				else
+					list[n].hash = pdf_hash_object_num(ctx, doc, num);
 			}
 			fz_catch(ctx)
 			{
 				/* Assume different */
-				differ = 1;
+				skip = 1;
 			}
-			if (differ)
+			if (skip)
 				continue;
 
-			a = pdf_get_xref_entry(ctx, doc, num)->obj;
-			b = pdf_get_xref_entry(ctx, doc, other)->obj;
+			list[n++].num = num;
+		}
 
-			if (pdf_objcmp(ctx, a, b))
-				continue;
+		qsort(list, n, sizeof *list, dup_entry_cmp);
 
-			if (streama && streamb)
+		for (i = 0; i < n; i = j)
+		{
+			for (j = i + 1; j < n && list[j].hash == list[i].hash; j++)
 			{
-				/* Check to see if streams match too. */
-				fz_buffer *sa = NULL;
-				fz_buffer *sb = NULL;
+				pdf_obj *a, *b;
 
-				fz_var(sa);
-				fz_var(sb);
+				num = list[j].num;
+				a = pdf_get_xref_entry(ctx, doc, num)->obj;
 
-				differ = 1;
-				fz_try(ctx)
-				{
-					unsigned char *dataa, *datab;
-					size_t lena, lenb;
-					sa = pdf_load_raw_stream(ctx, doc, num);
-					sb = pdf_load_raw_stream(ctx, doc, other);
-					lena = fz_buffer_storage(ctx, sa, &dataa);
-					lenb = fz_buffer_storage(ctx, sb, &datab);
-					if (lena == lenb && memcmp(dataa, datab, lena) == 0)
-						differ = 0;
-				}
-				fz_always(ctx)
-				{
-					fz_drop_buffer(ctx, sa);
-					fz_drop_buffer(ctx, sb);
-				}
-				fz_catch(ctx)
+				/* Only compare an object to objects preceding it */
+				for (k = i; k < j; k++)
 				{
-					fz_rethrow(ctx);
-				}
-				if (differ)
-					continue;
-			}
+					other = list[k].num;
+					if (!opts->use_list[other] || list[k].is_stream != list[j].is_stream)
+						continue;
 
-			/* Keep the lowest numbered object */
-			newnum = fz_mini(num, other);
-			opts->renumber_map[num] = newnum;
-			opts->renumber_map[other] = newnum;
-			opts->rev_renumber_map[newnum] = num; /* Either will do */
-			opts->use_list[fz_maxi(num, other)] = 0;
+					/* TODO: resolve indirect references to see if we can omit them */
 
-			/* One duplicate was found, do not look for another */
-			break;
+					b = pdf_get_xref_entry(ctx, doc, other)->obj;
+					if (pdf_objcmp(ctx, a, b))
+						continue;
+
+					/* Check to see if streams match too. */
+					if (list[j].is_stream && raw_streams_differ(ctx, doc, num, other))
+						continue;
+
+					/* Keep the lowest numbered object */
+					opts->renumber_map[num] = other;
+					opts->renumber_map[other] = other;
+					opts->rev_renumber_map[other] = num; /* Either will do */
+					opts->use_list[num] = 0;
+
+					/* One duplicate was found, do not look for another */
+					break;
+				}
+			}
 		}
 	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, list);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 }
 
 /*
@@ -2167,6 +2222,13 @@ dowriteobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num
 		opts->use_list[num] = 0;
 }
 
+static void
+writeheader(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
+{
+	fz_printf(ctx, opts->out, "%%PDF-%d.%d\n", doc->version / 10, doc->version % 10);
+	fz_puts(ctx, opts->out, "%%\316\274\341\277\246\n\n");
+}
+
 static void
 writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass)
 {
@@ -2174,10 +2236,7 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 	int xref_len = pdf_xref_len(ctx, doc);
 
 	if (!opts->do_incremental)
-	{
-		fz_printf(ctx, opts->out, "%%PDF-%d.%d\n", doc->version / 10, doc->version % 10);
-		fz_puts(ctx, opts->out, "%%\316\274\341\277\246\n\n");
-	}
+		writeheader(ctx, doc, opts);
 
 	dowriteobject(ctx, doc, opts, opts->start, pass);
 
@@ -2652,26 +2711,6 @@ static void complete_signatures(fz_context *ctx, pdf_document *doc, pdf_write_st
 	}
 }
 
-static void sanitize(fz_context *ctx, pdf_document *doc, int ascii)
-{
-	int n = pdf_count_pages(ctx, doc);
-	int i;
-
-	for (i = 0; i < n; i++)
-	{
-		pdf_annot *annot;
-		pdf_page *page = pdf_load_page(ctx, doc, i);
-		pdf_clean_page_contents(ctx, doc, page, NULL, NULL, NULL, ascii);
-
-		for (annot = pdf_first_annot(ctx, page); annot != NULL; annot = pdf_next_annot(ctx, annot))
-		{
-			pdf_clean_annot_contents(ctx, doc, annot, NULL, NULL, NULL, ascii);
-		}
-
-		fz_drop_page(ctx, &page->super);
-	}
-}
-
 /* Initialise the pdf_write_state, used dynamically during the write, from the static
  * pdf_write_options, passed into pdf_save_document */
 static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf_write_options *in_opts, pdf_write_state *opts)
@@ -2749,6 +2788,9 @@ const char *fz_pdf_write_options_usage =
 	"\tpretty: pretty-print objects with indentation\n"
 	"\tlinearize: optimize for web browsers\n"
 	"\tsanitize: clean up graphics commands in content streams\n"
+	"\tsubset-fonts: subset embedded fonts to the glyphs used\n"
+	"\tdownsample-images=N: downsample images to N dpi\n"
+	"\tthreads=N: use N worker threads\n"
 	"\tgarbage: garbage collect unused objects\n"
 	"\tor garbage=compact: ... and compact cross reference table\n"
 	"\tor garbage=deduplicate: ... and remove duplicate objects\n"
@@ -2777,6 +2819,12 @@ pdf_parse_write_options(fz_context *ctx, pdf_write_options *opts, const char *ar
 		opts->do_linear = opteq(val, "yes");
 	if (fz_has_option(ctx, args, "sanitize", &val))
 		opts->do_clean = opteq(val, "yes");
+	if (fz_has_option(ctx, args, "subset-fonts", &val))
+		opts->do_subset_fonts = opteq(val, "yes");
+	if (fz_has_option(ctx, args, "downsample-images", &val))
+		opts->do_downsample_images = atoi(val);
+	if (fz_has_option(ctx, args, "threads", &val))
+		opts->threads = atoi(val);
 	if (fz_has_option(ctx, args, "incremental", &val))
 		opts->do_incremental = opteq(val, "yes");
 	if (fz_has_option(ctx, args, "continue-on-error", &val))
@@ -2812,7 +2860,15 @@ prepare_for_save(fz_context *ctx, pdf_document *doc, pdf_write_options *in_opts)
 
 	/* Sanitize the operator streams */
 	if (in_opts->do_clean)
-		sanitize(ctx, doc, in_opts->do_ascii);
+		pdf_clean_document_contents(ctx, doc, in_opts->threads, in_opts->do_ascii);
+
+	/* Drop unused glyphs from embedded fonts */
+	if (in_opts->do_subset_fonts)
+		pdf_subset_fonts(ctx, doc);
+
+	/* Reduce over-resolved images */
+	if (in_opts->do_downsample_images)
+		pdf_downsample_images(ctx, doc, in_opts->do_downsample_images, in_opts->threads);
 
 	pdf_finish_edit(ctx, doc);
 	presize_unsaved_signature_byteranges(ctx, doc);
@@ -3177,6 +3233,15 @@ void pdf_finish_edit(fz_context *ctx, pdf_document *doc)
 
 typedef struct pdf_writer_s pdf_writer;
 
+/*
+	The document writer normally builds the whole output document in
+	memory and saves it at close. When none of the whole-document
+	options (garbage collection, linearisation, cleaning, font subsetting
+	or image downsampling) are asked for, each finished page and the
+	objects it created are written out and dropped at the end of the
+	page instead, and only the catalog, page tree and cross reference
+	table are written at close.
+*/
 struct pdf_writer_s
 {
 	fz_document_writer super;
@@ -3184,11 +3249,85 @@ struct pdf_writer_s
 	pdf_write_options opts;
 	char *filename;
 
+	fz_output *out;
+	pdf_write_state state;
+	int state_len;
+	int next_object;
+
 	fz_rect mediabox;
 	pdf_obj *resources;
 	fz_buffer *contents;
 };
 
+static int
+pdf_writer_can_stream(const pdf_write_options *opts)
+{
+	return !opts->do_incremental && !opts->do_garbage && !opts->do_linear &&
+		!opts->do_clean && !opts->do_subset_fonts && !opts->do_downsample_images;
+}
+
+static void
+pdf_writer_grow_state(fz_context *ctx, pdf_writer *wri, int len)
+{
+	pdf_write_state *opts = &wri->state;
+	int num;
+
+	if (len <= wri->state_len)
+		return;
+	len = fz_maxi(len, wri->state_len * 2);
+
+	opts->use_list = fz_resize_array(ctx, opts->use_list, len, sizeof(int));
+	opts->ofs_list = fz_resize_array(ctx, opts->ofs_list, len, sizeof(fz_off_t));
+	opts->gen_list = fz_resize_array(ctx, opts->gen_list, len, sizeof(int));
+	for (num = wri->state_len; num < len; num++)
+	{
+		opts->use_list[num] = 0;
+		opts->ofs_list[num] = 0;
+		opts->gen_list[num] = 0;
+	}
+	wri->state_len = len;
+}
+
+/* Write out the objects from..to-1 that have not been written yet.
+ * If 'drop', forget them once written. Nothing ever loads them again:
+ * a later page can only reuse them (through the font and image
+ * resource tables) by reference. */
+static void
+pdf_writer_write_objects(fz_context *ctx, pdf_writer *wri, int from, int to, int drop)
+{
+	pdf_write_state *opts = &wri->state;
+	int num;
+
+	pdf_writer_grow_state(ctx, wri, to);
+
+	for (num = from; num < to; num++)
+	{
+		if (opts->use_list[num])
+			continue;
+		opts->use_list[num] = 1;
+		dowriteobject(ctx, wri->pdf, opts, num, 0);
+		if (drop && opts->use_list[num])
+			pdf_delete_object(ctx, wri->pdf, num);
+	}
+}
+
+/* Append a page to the (flat) page tree without looking at the pages
+ * already in it, which may have been written out. */
+static void
+pdf_writer_append_page(fz_context *ctx, pdf_writer *wri, pdf_obj *page_ref)
+{
+	pdf_obj *pages = pdf_dict_getp(ctx, pdf_trailer(ctx, wri->pdf), "Root/Pages");
+	pdf_obj *kids = pdf_dict_get(ctx, pages, PDF_NAME_Kids);
+	int count = pdf_to_int(ctx, pdf_dict_get(ctx, pages, PDF_NAME_Count));
+
+	if (!kids)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "malformed page tree");
+	pdf_array_push(ctx, kids, page_ref);
+	pdf_dict_put(ctx, page_ref, PDF_NAME_Parent, pages);
+	pdf_dict_put_drop(ctx, pages, PDF_NAME_Count, pdf_new_int(ctx, wri->pdf, count + 1));
+	pdf_invalidate_page_tree(ctx, wri->pdf);
+}
+
 static fz_device *
 pdf_writer_begin_page(fz_context *ctx, fz_document_writer *wri_, const fz_rect *mediabox)
 {
@@ -3209,7 +3348,17 @@ pdf_writer_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 	{
 		fz_close_device(ctx, dev);
 		obj = pdf_add_page(ctx, wri->pdf, &wri->mediabox, 0, wri->resources, wri->contents);
-		pdf_insert_page(ctx, wri->pdf, -1, obj);
+		if (wri->out)
+		{
+			int len;
+
+			pdf_writer_append_page(ctx, wri, obj);
+			len = pdf_xref_len(ctx, wri->pdf);
+			pdf_writer_write_objects(ctx, wri, wri->next_object, len, 1);
+			wri->next_object = len;
+		}
+		else
+			pdf_insert_page(ctx, wri->pdf, -1, obj);
 	}
 	fz_always(ctx)
 	{
@@ -3228,13 +3377,44 @@ static void
 pdf_writer_close_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	pdf_writer *wri = (pdf_writer*)wri_;
-	pdf_save_document(ctx, wri->pdf, wri->filename, &wri->opts);
+	pdf_write_state *opts = &wri->state;
+	int num, lastfree, xref_len;
+
+	if (!wri->out)
+	{
+		pdf_save_document(ctx, wri->pdf, wri->filename, &wri->opts);
+		return;
+	}
+
+	/* Whatever is left: the catalog and page tree. */
+	xref_len = pdf_xref_len(ctx, wri->pdf);
+	pdf_writer_write_objects(ctx, wri, 0, xref_len, 0);
+
+	/* Construct linked list of free object slots */
+	lastfree = 0;
+	for (num = 0; num < xref_len; num++)
+	{
+		if (!opts->use_list[num])
+		{
+			opts->gen_list[num]++;
+			opts->ofs_list[lastfree] = num;
+			lastfree = num;
+		}
+	}
+
+	opts->first_xref_offset = fz_tell_output(ctx, wri->out);
+	writexref(ctx, wri->pdf, opts, 0, xref_len, 1, 0, opts->first_xref_offset);
+
+	fz_drop_output(ctx, wri->out);
+	wri->out = NULL;
 }
 
 static void
 pdf_writer_drop_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	pdf_writer *wri = (pdf_writer*)wri_;
+	fz_drop_output(ctx, wri->out);
+	finalise_write_state(ctx, &wri->state);
 	fz_drop_buffer(ctx, wri->contents);
 	pdf_drop_obj(ctx, wri->resources);
 	pdf_drop_document(ctx, wri->pdf);
@@ -3257,9 +3437,21 @@ fz_new_pdf_writer(fz_context *ctx, const char *path, const char *options)
 		pdf_parse_write_options(ctx, &wri->opts, options);
 		wri->filename = fz_strdup(ctx, path ? path : "out.pdf");
 		wri->pdf = pdf_create_document(ctx);
+		if (pdf_writer_can_stream(&wri->opts))
+		{
+			/* The catalog and page tree stay in memory until close. */
+			wri->next_object = pdf_xref_len(ctx, wri->pdf);
+			initialise_write_state(ctx, wri->pdf, &wri->opts, &wri->state);
+			wri->state_len = wri->next_object + 3;
+			wri->out = fz_new_output_with_path(ctx, wri->filename, 0);
+			wri->state.out = wri->out;
+			writeheader(ctx, wri->pdf, &wri->state);
+		}
 	}
 	fz_catch(ctx)
 	{
+		fz_drop_output(ctx, wri->out);
+		finalise_write_state(ctx, &wri->state);
 		pdf_drop_document(ctx, wri->pdf);
 		fz_free(ctx, wri->filename);
 		fz_free(ctx, wri);
@@ -1,6 +1,19 @@
 #include "mupdf/pdf.h"
 #include "mupdf/fitz/document.h"
 
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <process.h>
+#define getpid _getpid
+#endif
+
+/* Objects are published in the xref with a release store, and looked up
+ * without the document lock (see pdf_enable_concurrent_reads) with an
+ * acquire load, so that a thread that sees the pointer also sees the
+ * finished object behind it. */
+#define load_cached_obj(x) ((pdf_obj *)fz_load_acquire_ptr((x)->obj))
+#define store_cached_obj(x, o) fz_store_release_ptr((x)->obj, (o))
+
 #undef DEBUG_PROGESSIVE_ADVANCE
 
 #ifdef DEBUG_PROGESSIVE_ADVANCE
@@ -123,6 +136,7 @@ static void pdf_populate_next_xref_level(fz_context *ctx, pdf_document *doc)
 	xref->pre_repair_trailer = NULL;
 	xref->unsaved_sigs = NULL;
 	xref->unsaved_sigs_end = NULL;
+	xref->end_ofs = 0;
 }
 
 pdf_obj *pdf_trailer(fz_context *ctx, pdf_document *doc)
@@ -315,6 +329,11 @@ pdf_xref_entry *pdf_get_xref_entry(fz_context *ctx, pdf_document *doc, int i)
 */
 static void ensure_incremental_xref(fz_context *ctx, pdf_document *doc)
 {
+	/* Other threads look up entries without the document lock, so the
+	 * xref must not grow or move under them. */
+	if (doc->concurrent_reads)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot edit a document shared for concurrent reads");
+
 	/* If there are as yet no incremental sections, or if the most recent
 	 * one has been used to sign a signature field, then we need a new one.
 	 * After a signing, any further document changes require a new increment */
@@ -1440,9 +1459,10 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 			pdf_load_linear(ctx, doc);
 
 		/* If we aren't in progressive mode (or the linear load failed
-		 * and has set us back to non-progressive mode), load normally.
+		 * and has set us back to non-progressive mode), load normally,
+		 * unless the sections were already restored from an index.
 		 */
-		if (!doc->file_reading_linearly)
+		if (!doc->file_reading_linearly && doc->num_xref_sections == 0)
 			pdf_load_xref(ctx, doc, &doc->lexbuf.base);
 	}
 	fz_catch(ctx)
@@ -1596,6 +1616,7 @@ pdf_drop_document_imp(fz_context *ctx, pdf_document *doc)
 		}
 		fz_free(ctx, doc->linear_page_refs);
 	}
+	pdf_invalidate_page_tree(ctx, doc);
 	fz_free(ctx, doc->hint_page);
 	fz_free(ctx, doc->hint_shared_ref);
 	fz_free(ctx, doc->hint_shared);
@@ -1616,6 +1637,11 @@ pdf_drop_document_imp(fz_context *ctx, pdf_document *doc)
 
 	pdf_drop_resource_tables(ctx, doc);
 
+	pdf_drop_object_arena(ctx, doc->obj_arena);
+
+	if (doc->graft_streams)
+		fz_drop_hash(ctx, doc->graft_streams);
+
 	fz_free(ctx, doc);
 }
 
@@ -1732,7 +1758,7 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 				}
 				else
 				{
-					entry->obj = obj;
+					store_cached_obj(entry, obj);
 					fz_drop_buffer(ctx, entry->stm_buf);
 					entry->stm_buf = NULL;
 				}
@@ -1993,16 +2019,15 @@ read_hinted_object(fz_context *ctx, pdf_document *doc, int num)
 	return 1;
 }
 
-pdf_xref_entry *
-pdf_cache_object(fz_context *ctx, pdf_document *doc, int num)
+static pdf_xref_entry *
+pdf_cache_object_imp(fz_context *ctx, pdf_document *doc, int num)
 {
 	pdf_xref_entry *x;
+	pdf_obj *obj = NULL;
 	int rnum, rgen, try_repair;
 
 	fz_var(try_repair);
-
-	if (num <= 0 || num >= pdf_xref_len(ctx, doc))
-		fz_throw(ctx, FZ_ERROR_GENERIC, "object out of range (%d 0 R); xref size %d", num, pdf_xref_len(ctx, doc));
+	fz_var(obj);
 
 object_updated:
 	try_repair = 0;
@@ -2015,15 +2040,16 @@ object_updated:
 
 	if (x->type == 'f')
 	{
-		x->obj = pdf_new_null(ctx, doc);
+		store_cached_obj(x, pdf_new_null(ctx, doc));
 	}
 	else if (x->type == 'n')
 	{
 		fz_seek(ctx, doc->file, x->ofs, SEEK_SET);
 
+		obj = NULL;
 		fz_try(ctx)
 		{
-			x->obj = pdf_parse_ind_obj(ctx, doc, doc->file, &doc->lexbuf.base,
+			obj = pdf_parse_ind_obj(ctx, doc, doc->file, &doc->lexbuf.base,
 					&rnum, &rgen, &x->stm_ofs, &try_repair);
 		}
 		fz_catch(ctx)
@@ -2034,7 +2060,8 @@ object_updated:
 
 		if (!try_repair && rnum != num)
 		{
-			pdf_drop_obj(ctx, x->obj);
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
 			x->type = 'f';
 			x->ofs = -1;
 			x->gen = 0;
@@ -2046,6 +2073,12 @@ object_updated:
 
 		if (try_repair)
 		{
+			if (doc->concurrent_reads)
+			{
+				pdf_drop_obj(ctx, obj);
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot repair shared document (%d 0 R)", num);
+			}
+			x->obj = obj;
 			fz_try(ctx)
 			{
 				pdf_repair_xref(ctx, doc);
@@ -2061,8 +2094,12 @@ object_updated:
 			goto object_updated;
 		}
 
+		/* Finish the object before storing it; other threads pick up
+		 * cached objects without taking the document lock. */
 		if (doc->crypt)
-			pdf_crypt_obj(ctx, doc->crypt, x->obj, x->num, x->gen);
+			pdf_crypt_obj(ctx, doc->crypt, obj, x->num, x->gen);
+		pdf_set_obj_parent(ctx, obj, num);
+		store_cached_obj(x, obj);
 	}
 	else if (x->type == 'o')
 	{
@@ -2088,10 +2125,73 @@ object_updated:
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find object in xref (%d 0 R)", num);
 	}
 
-	pdf_set_obj_parent(ctx, x->obj, num);
+	/* Every path above sets the parent before publishing the object. */
+	return x;
+}
+
+pdf_xref_entry *
+pdf_cache_object(fz_context *ctx, pdf_document *doc, int num)
+{
+	pdf_xref_entry *x;
+
+	if (num <= 0 || num >= pdf_xref_len(ctx, doc))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "object out of range (%d 0 R); xref size %d", num, pdf_xref_len(ctx, doc));
+
+	x = pdf_get_xref_entry(ctx, doc, num);
+	if (load_cached_obj(x) != NULL)
+		return x;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		x = pdf_cache_object_imp(ctx, doc, num);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
 	return x;
 }
 
+void
+pdf_lock_document(fz_context *ctx, pdf_document *doc)
+{
+	/* Only the owning thread can see its own context here. */
+	if (doc->lock_owner == ctx)
+	{
+		doc->lock_depth++;
+		return;
+	}
+	fz_lock(ctx, FZ_LOCK_DOCUMENT);
+	doc->lock_owner = ctx;
+	doc->lock_depth = 1;
+}
+
+void
+pdf_unlock_document(fz_context *ctx, pdf_document *doc)
+{
+	if (--doc->lock_depth > 0)
+		return;
+	doc->lock_owner = NULL;
+	fz_unlock(ctx, FZ_LOCK_DOCUMENT);
+}
+
+void
+pdf_enable_concurrent_reads(fz_context *ctx, pdf_document *doc)
+{
+	if (doc->concurrent_reads)
+		return;
+	if (doc->file_reading_linearly)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot share a progressively loaded document");
+
+	/* Looking up an object that is missing from the xref solidifies it,
+	 * moving every entry; do that now rather than under another
+	 * thread's feet. */
+	if (doc->max_xref_len > 0)
+		ensure_solid_xref(ctx, doc, doc->max_xref_len, doc->xref_base);
+
+	doc->concurrent_reads = 1;
+}
+
 pdf_obj *
 pdf_load_object(fz_context *ctx, pdf_document *doc, int num)
 {
@@ -2100,6 +2200,255 @@ pdf_load_object(fz_context *ctx, pdf_document *doc, int num)
 	return pdf_keep_obj(ctx, entry->obj);
 }
 
+/*
+ * bulk object loading
+ */
+
+/* Objects larger than this are parsed straight from the file, so that we
+ * never read the bodies of large streams. */
+enum
+{
+	PREFETCH_MAX_OBJECT = 64 << 10,
+	PREFETCH_MAX_GAP = 4 << 10,
+	PREFETCH_MAX_BLOCK = 1 << 20
+};
+
+typedef struct
+{
+	int num;
+	fz_off_t ofs;
+} pdf_prefetch_entry;
+
+static int
+cmp_prefetch_entry(const void *a_, const void *b_)
+{
+	const pdf_prefetch_entry *a = a_;
+	const pdf_prefetch_entry *b = b_;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs ? -1 : 1;
+	return a->num - b->num;
+}
+
+static int
+cmp_offset(const void *a_, const void *b_)
+{
+	fz_off_t a = *(const fz_off_t *)a_;
+	fz_off_t b = *(const fz_off_t *)b_;
+	return (a > b) - (a < b);
+}
+
+/* The offset of the first object that starts after ofs, or -1. */
+static fz_off_t
+next_object_offset(fz_off_t *ofs_list, int len, fz_off_t ofs)
+{
+	int l = 0, r = len;
+
+	while (l < r)
+	{
+		int m = (l + r) >> 1;
+		if (ofs_list[m] <= ofs)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l < len ? ofs_list[l] : -1;
+}
+
+static void
+add_prefetch_entry(fz_context *ctx, pdf_prefetch_entry **list, int *len, int *cap, int num, fz_off_t ofs)
+{
+	if (*len == *cap)
+	{
+		*cap = *cap ? *cap * 2 : 64;
+		*list = fz_resize_array(ctx, *list, *cap, sizeof **list);
+	}
+	(*list)[*len].num = num;
+	(*list)[*len].ofs = ofs;
+	(*len)++;
+}
+
+/* As pdf_cache_object, for an object whose text lies in stm at
+ * (file offset - base). Anything unexpected is left alone, for
+ * pdf_cache_object to report or repair when the object is used. */
+static void
+prefetch_object(fz_context *ctx, pdf_document *doc, fz_stream *stm, fz_off_t base, int num)
+{
+	pdf_xref_entry *x = pdf_get_xref_entry(ctx, doc, num);
+	fz_off_t stm_ofs;
+	pdf_obj *obj;
+	int rnum, rgen;
+
+	if (x->obj || x->type != 'n')
+		return;
+
+	fz_seek(ctx, stm, x->ofs - base, SEEK_SET);
+	obj = pdf_parse_ind_obj(ctx, doc, stm, &doc->lexbuf.base, &rnum, &rgen, &stm_ofs, NULL);
+	if (rnum != num)
+	{
+		pdf_drop_obj(ctx, obj);
+		return;
+	}
+
+	x->stm_ofs = stm_ofs ? stm_ofs + base : 0;
+	if (doc->crypt)
+		pdf_crypt_obj(ctx, doc->crypt, obj, x->num, x->gen);
+	pdf_set_obj_parent(ctx, obj, num);
+	store_cached_obj(x, obj);
+}
+
+/* Read a run of nearby objects from the file in one go, and parse
+ * them from memory. */
+static void
+prefetch_object_run(fz_context *ctx, pdf_document *doc, pdf_prefetch_entry *run, int count, fz_off_t start, fz_off_t end)
+{
+	fz_buffer *buf;
+	fz_stream *stm = NULL;
+	int i;
+
+	fz_var(stm);
+
+	buf = fz_new_buffer(ctx, end - start);
+	fz_try(ctx)
+	{
+		fz_seek(ctx, doc->file, start, SEEK_SET);
+		buf->len = fz_read(ctx, doc->file, buf->data, end - start);
+		stm = fz_open_buffer(ctx, buf);
+		for (i = 0; i < count; i++)
+		{
+			fz_try(ctx)
+				prefetch_object(ctx, doc, stm, start, run[i].num);
+			fz_catch(ctx)
+				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+void
+pdf_prefetch_objects(fz_context *ctx, pdf_document *doc, const int *nums, int count)
+{
+	pdf_prefetch_entry *list = NULL;
+	pdf_prefetch_entry *stms = NULL;
+	fz_off_t *ofs_list = NULL;
+	int len = 0, cap = 0;
+	int stm_len = 0, stm_cap = 0;
+	int ofs_len = 0;
+	int xref_len = pdf_xref_len(ctx, doc);
+	int i, j, k;
+
+	fz_var(list);
+	fz_var(stms);
+	fz_var(ofs_list);
+
+	if (!nums)
+		count = xref_len - 1;
+
+	fz_try(ctx)
+	{
+		/* Sort out what needs loading, and from where. */
+		for (i = 0; i < count; i++)
+		{
+			int num = nums ? nums[i] : i + 1;
+			pdf_xref_entry *x;
+
+			if (num <= 0 || num >= xref_len)
+				continue;
+			x = pdf_get_xref_entry(ctx, doc, num);
+			if (x->obj)
+				continue;
+			if (x->type == 'n' && x->ofs > 0)
+				add_prefetch_entry(ctx, &list, &len, &cap, num, x->ofs);
+			else if (x->type == 'o' && x->ofs > 0 && x->ofs < xref_len)
+			{
+				pdf_xref_entry *s = pdf_get_xref_entry(ctx, doc, x->ofs);
+				if (s->type == 'n')
+				{
+					add_prefetch_entry(ctx, &stms, &stm_len, &stm_cap, x->ofs, s->ofs);
+					if (!s->obj)
+						add_prefetch_entry(ctx, &list, &len, &cap, x->ofs, s->ofs);
+				}
+			}
+		}
+
+		/* Where every object starts, to tell where each one ends. */
+		if (len > 0)
+		{
+			ofs_list = fz_malloc_array(ctx, xref_len, sizeof *ofs_list);
+			for (i = 1; i < xref_len; i++)
+			{
+				pdf_xref_entry *x = pdf_get_xref_entry(ctx, doc, i);
+				if (x->type == 'n' && x->ofs > 0)
+					ofs_list[ofs_len++] = x->ofs;
+			}
+			qsort(ofs_list, ofs_len, sizeof *ofs_list, cmp_offset);
+		}
+
+		/* Plain objects, in file order, reading runs of small
+		 * neighbouring objects with one read. */
+		qsort(list, len, sizeof *list, cmp_prefetch_entry);
+		for (i = 0; i < len; i = j)
+		{
+			fz_off_t start = list[i].ofs;
+			fz_off_t end = next_object_offset(ofs_list, ofs_len, start);
+
+			j = i + 1;
+			if (end < 0 || end - start > PREFETCH_MAX_OBJECT)
+			{
+				fz_try(ctx)
+					prefetch_object(ctx, doc, doc->file, 0, list[i].num);
+				fz_catch(ctx)
+					fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+				continue;
+			}
+
+			while (j < len)
+			{
+				fz_off_t next = next_object_offset(ofs_list, ofs_len, list[j].ofs);
+				if (next < 0 || next - list[j].ofs > PREFETCH_MAX_OBJECT)
+					break;
+				if (list[j].ofs - end > PREFETCH_MAX_GAP || next - start > PREFETCH_MAX_BLOCK)
+					break;
+				if (next > end)
+					end = next;
+				j++;
+			}
+
+			prefetch_object_run(ctx, doc, list + i, j - i, start, end);
+		}
+
+		/* Each object stream is parsed once, which caches everything
+		 * in it. */
+		qsort(stms, stm_len, sizeof *stms, cmp_prefetch_entry);
+		for (k = 0; k < stm_len; k++)
+		{
+			if (k > 0 && stms[k].num == stms[k-1].num)
+				continue;
+			fz_try(ctx)
+				(void)pdf_load_obj_stm(ctx, doc, stms[k].num, &doc->lexbuf.base, 0);
+			fz_catch(ctx)
+				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, list);
+		fz_free(ctx, stms);
+		fz_free(ctx, ofs_list);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 pdf_obj *
 pdf_resolve_indirect(fz_context *ctx, pdf_obj *ref)
 {
@@ -2364,6 +2713,438 @@ pdf_open_document(fz_context *ctx, const char *filename)
 	return doc;
 }
 
+/*
+ * Sidecar xref index.
+ *
+ * A small file of PDF tokens recording the xref sections and page
+ * object numbers of a PDF file on disk, keyed by its size, mtime and
+ * a hash of its head and tail:
+ *
+ *	%MuPDF-xref-index
+ *	version file_size mtime <digest>
+ *	startxref has_xref_streams num_sections
+ *	xref num_objects end_ofs num_entries
+ *	objnum gen num ofs type
+ *	...
+ *	trailer <<...>>
+ *	...
+ *	pages count
+ *	objnum gen
+ *	...
+ *	end
+ */
+
+enum
+{
+	XREF_INDEX_VERSION = 1,
+	XREF_INDEX_HASH_SIZE = 64 << 10
+};
+
+static int64_t
+xref_index_mtime(fz_context *ctx, const char *filename)
+{
+	struct stat info;
+	if (stat(filename, &info) < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot stat file '%s'", filename);
+	return (int64_t)info.st_mtime;
+}
+
+/* Hash the first and last XREF_INDEX_HASH_SIZE bytes of the file, and
+ * return its size. */
+static fz_off_t
+xref_index_digest(fz_context *ctx, fz_stream *file, unsigned char digest[16])
+{
+	unsigned char *data;
+	fz_off_t size;
+	size_t n;
+	fz_md5 md5;
+
+	fz_seek(ctx, file, 0, SEEK_END);
+	size = fz_tell(ctx, file);
+
+	data = fz_malloc(ctx, XREF_INDEX_HASH_SIZE);
+	fz_try(ctx)
+	{
+		fz_md5_init(&md5);
+		fz_seek(ctx, file, 0, SEEK_SET);
+		n = fz_read(ctx, file, data, XREF_INDEX_HASH_SIZE);
+		fz_md5_update(&md5, data, n);
+		if (size > XREF_INDEX_HASH_SIZE)
+		{
+			fz_seek(ctx, file, size - XREF_INDEX_HASH_SIZE, SEEK_SET);
+			n = fz_read(ctx, file, data, XREF_INDEX_HASH_SIZE);
+			fz_md5_update(&md5, data, n);
+		}
+		fz_md5_final(&md5, digest);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, data);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return size;
+}
+
+/* Temporary name for a new index, next to it so that it can be renamed
+ * into place. Unique per process and document. */
+static char *
+xref_index_tempname(fz_context *ctx, pdf_document *doc, const char *index)
+{
+	size_t len = strlen(index) + 48;
+	char *tmp = fz_malloc(ctx, len);
+	fz_snprintf(tmp, len, "%s.%d-%x.tmp", index, (int)getpid(), (unsigned int)(size_t)doc);
+	return tmp;
+}
+
+static void
+xref_index_replace(fz_context *ctx, const char *tmp, const char *index)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	/* rename does not replace an existing file on Windows */
+	remove(index);
+#endif
+	if (rename(tmp, index) < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot rename '%s' to '%s': %s", tmp, index, strerror(errno));
+}
+
+void
+pdf_save_xref_index(fz_context *ctx, pdf_document *doc, const char *filename, const char *index)
+{
+	static const char *hex = "0123456789abcdef";
+	unsigned char digest[16];
+	fz_output *out = NULL;
+	char *tmp = NULL;
+	int *pages = NULL;
+	int64_t mtime;
+	fz_off_t size;
+	int i, e, n, count;
+
+	if (doc->repair_attempted || doc->file_reading_linearly || doc->num_incremental_sections > 0 || doc->num_xref_sections == 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot index an edited, repaired or progressively loaded document");
+
+	mtime = xref_index_mtime(ctx, filename);
+	size = xref_index_digest(ctx, doc->file, digest);
+
+	fz_var(out);
+	fz_var(tmp);
+	fz_var(pages);
+	fz_var(count);
+
+	fz_try(ctx)
+	{
+		/* A page tree we cannot walk is simply not indexed. */
+		count = pdf_count_pages(ctx, doc);
+		pages = fz_malloc_array(ctx, count + 1, 2 * sizeof(int));
+		fz_try(ctx)
+		{
+			for (i = 0; i < count; i++)
+			{
+				pdf_obj *ref = pdf_lookup_page_obj(ctx, doc, i);
+				pages[2*i] = pdf_to_num(ctx, ref);
+				pages[2*i+1] = pdf_to_gen(ctx, ref);
+				if (pages[2*i] <= 0)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "page %d is not an indirect object", i);
+			}
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+			count = 0;
+		}
+
+		/* Write to a temporary file and rename it over the index, so
+		 * that a crash or a concurrent open never sees half of it. */
+		tmp = xref_index_tempname(ctx, doc, index);
+		out = fz_new_output_with_path(ctx, tmp, 0);
+		fz_printf(ctx, out, "%%MuPDF-xref-index\n%d %Zd %lld <", XREF_INDEX_VERSION, size, mtime);
+		for (i = 0; i < 16; i++)
+			fz_printf(ctx, out, "%c%c", hex[digest[i] >> 4], hex[digest[i] & 15]);
+		fz_printf(ctx, out, ">\n%Zd %d %d\n", doc->startxref, doc->has_xref_streams, doc->num_xref_sections);
+
+		for (i = 0; i < doc->num_xref_sections; i++)
+		{
+			pdf_xref *xref = &doc->xref_sections[i];
+			pdf_xref_subsec *sub;
+
+			n = 0;
+			for (sub = xref->subsec; sub != NULL; sub = sub->next)
+				for (e = 0; e < sub->len; e++)
+					if (sub->table[e].type)
+						n++;
+
+			fz_printf(ctx, out, "xref %d %Zd %d\n", xref->num_objects, xref->end_ofs, n);
+			for (sub = xref->subsec; sub != NULL; sub = sub->next)
+			{
+				for (e = 0; e < sub->len; e++)
+				{
+					pdf_xref_entry *entry = &sub->table[e];
+					if (entry->type)
+						fz_printf(ctx, out, "%d %d %d %Zd %c\n", sub->start + e, entry->gen, entry->num, entry->ofs, entry->type);
+				}
+			}
+
+			fz_printf(ctx, out, "trailer\n");
+			if (xref->trailer)
+				pdf_print_obj(ctx, out, xref->trailer, 1);
+			else
+				fz_printf(ctx, out, "null");
+			fz_printf(ctx, out, "\n");
+		}
+
+		fz_printf(ctx, out, "pages %d\n", count);
+		for (i = 0; i < count; i++)
+			fz_printf(ctx, out, "%d %d\n", pages[2*i], pages[2*i+1]);
+		fz_printf(ctx, out, "end\n");
+		fz_drop_output(ctx, out);
+		out = NULL;
+
+		xref_index_replace(ctx, tmp, index);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_free(ctx, pages);
+	}
+	fz_catch(ctx)
+	{
+		if (tmp)
+			remove(tmp);
+		fz_free(ctx, tmp);
+		fz_rethrow(ctx);
+	}
+
+	fz_free(ctx, tmp);
+}
+
+/* The lexer only keeps an int in buf->i, so file sizes, offsets and
+ * times are parsed again from the token text. */
+static int64_t
+xref_index_int(fz_context *ctx, fz_stream *stm, pdf_lexbuf *buf)
+{
+	if (pdf_lex(ctx, stm, buf) != PDF_TOK_INT)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index");
+	return atoll(buf->scratch);
+}
+
+static fz_off_t
+xref_index_offset(fz_context *ctx, fz_stream *stm, pdf_lexbuf *buf)
+{
+	int64_t ofs = xref_index_int(ctx, stm, buf);
+	if (ofs < 0 || ofs > FZ_OFF_MAX)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "xref index offset out of range");
+	return (fz_off_t)ofs;
+}
+
+static void
+xref_index_keyword(fz_context *ctx, fz_stream *stm, pdf_lexbuf *buf, const char *key)
+{
+	if (pdf_lex(ctx, stm, buf) != PDF_TOK_KEYWORD || strcmp(buf->scratch, key))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index (expected '%s')", key);
+}
+
+/* Returns 0 if the index was made for a different version of the file. */
+static int
+xref_index_is_current(fz_context *ctx, pdf_document *doc, fz_stream *stm, pdf_lexbuf *buf, const char *filename)
+{
+	unsigned char digest[16];
+	fz_off_t size;
+	int64_t mtime;
+
+	if (xref_index_int(ctx, stm, buf) != XREF_INDEX_VERSION)
+		return 0;
+	size = xref_index_offset(ctx, stm, buf);
+	mtime = xref_index_int(ctx, stm, buf);
+	if (pdf_lex(ctx, stm, buf) != PDF_TOK_STRING || buf->len != 16)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index");
+
+	if (mtime != xref_index_mtime(ctx, filename))
+		return 0;
+	if (size != xref_index_digest(ctx, doc->file, digest))
+		return 0;
+	if (memcmp(digest, buf->scratch, 16))
+		return 0;
+
+	doc->file_size = size;
+	return 1;
+}
+
+static void
+xref_index_restore(fz_context *ctx, pdf_document *doc, fz_stream *stm, pdf_lexbuf *buf)
+{
+	pdf_obj **refs = NULL;
+	int i, k, n, count, num_sections;
+	pdf_token tok;
+
+	doc->startxref = xref_index_offset(ctx, stm, buf);
+	doc->has_xref_streams = (int)xref_index_int(ctx, stm, buf);
+	num_sections = (int)xref_index_int(ctx, stm, buf);
+	if (num_sections <= 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index");
+
+	for (i = 0; i < num_sections; i++)
+	{
+		pdf_xref *xref;
+		int num_objects;
+
+		if (pdf_lex(ctx, stm, buf) != PDF_TOK_XREF)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index (expected 'xref')");
+
+		pdf_populate_next_xref_level(ctx, doc);
+		num_objects = (int)xref_index_int(ctx, stm, buf);
+		doc->xref_sections[i].end_ofs = xref_index_offset(ctx, stm, buf);
+		n = (int)xref_index_int(ctx, stm, buf);
+		if (num_objects < 0 || n < 0 || n > num_objects)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index");
+		if (num_objects > 0)
+			ensure_solid_xref(ctx, doc, num_objects, i);
+		xref = &doc->xref_sections[i];
+
+		for (k = 0; k < n; k++)
+		{
+			pdf_xref_entry *entry;
+			int num = (int)xref_index_int(ctx, stm, buf);
+			if (num < 0 || num >= num_objects)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "object number out of range in xref index");
+			entry = &xref->subsec->table[num];
+			entry->gen = (unsigned short)xref_index_int(ctx, stm, buf);
+			entry->num = (int)xref_index_int(ctx, stm, buf);
+			entry->ofs = xref_index_offset(ctx, stm, buf);
+			if (pdf_lex(ctx, stm, buf) != PDF_TOK_KEYWORD || buf->scratch[1] != 0 || !strchr("nfo", buf->scratch[0]))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index entry");
+			entry->type = buf->scratch[0];
+			if (entry->type == 'n' && (entry->ofs <= 0 || entry->ofs >= doc->file_size))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "object offset out of range in xref index");
+		}
+
+		if (pdf_lex(ctx, stm, buf) != PDF_TOK_TRAILER)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index (expected 'trailer')");
+		tok = pdf_lex(ctx, stm, buf);
+		if (tok == PDF_TOK_OPEN_DICT)
+			xref->trailer = pdf_parse_dict(ctx, doc, stm, buf);
+		else if (tok != PDF_TOK_NULL)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index trailer");
+	}
+
+	xref_index_keyword(ctx, stm, buf, "pages");
+	count = (int)xref_index_int(ctx, stm, buf);
+	if (count < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "malformed xref index");
+
+	refs = fz_calloc(ctx, count + 1, sizeof(*refs));
+	fz_try(ctx)
+	{
+		for (k = 0; k < count; k++)
+		{
+			int num = (int)xref_index_int(ctx, stm, buf);
+			int gen = (int)xref_index_int(ctx, stm, buf);
+			refs[k] = pdf_new_indirect(ctx, doc, num, gen);
+		}
+		xref_index_keyword(ctx, stm, buf, "end");
+	}
+	fz_catch(ctx)
+	{
+		for (k = 0; k < count; k++)
+			pdf_drop_obj(ctx, refs[k]);
+		fz_free(ctx, refs);
+		fz_rethrow(ctx);
+	}
+
+	pdf_prime_xref_index(ctx, doc);
+	if (count > 0)
+	{
+		doc->page_refs_len = count;
+		fz_store_release_ptr(doc->page_refs, refs);
+	}
+	else
+		fz_free(ctx, refs);
+}
+
+/* Returns non-zero if the xref sections were restored from the index. */
+static int
+pdf_load_xref_index(fz_context *ctx, pdf_document *doc, const char *filename, const char *index)
+{
+	struct stat info;
+	fz_stream *stm;
+	int loaded = 0;
+
+	/* No index yet is the normal case, and not worth an error. */
+	if (stat(index, &info) < 0)
+		return 0;
+
+	fz_try(ctx)
+		stm = fz_open_file(ctx, index);
+	fz_catch(ctx)
+		return 0;
+
+	fz_var(loaded);
+
+	fz_try(ctx)
+	{
+		if (xref_index_is_current(ctx, doc, stm, &doc->lexbuf.base, filename))
+		{
+			xref_index_restore(ctx, doc, stm, &doc->lexbuf.base);
+			loaded = 1;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_xref_sections(ctx, doc);
+		fz_free(ctx, doc->xref_index);
+		doc->xref_index = NULL;
+		doc->max_xref_len = 0;
+		fz_warn(ctx, "ignoring xref index: %s", fz_caught_message(ctx));
+	}
+
+	return loaded;
+}
+
+pdf_document *
+pdf_open_document_with_index(fz_context *ctx, const char *filename, const char *index)
+{
+	fz_stream *file = NULL;
+	pdf_document *doc = NULL;
+	int indexed = 0;
+
+	fz_var(file);
+	fz_var(doc);
+	fz_var(indexed);
+
+	fz_try(ctx)
+	{
+		file = fz_open_file(ctx, filename);
+		doc = pdf_new_document(ctx, file);
+		indexed = pdf_load_xref_index(ctx, doc, filename, index);
+		pdf_init_document(ctx, doc);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, file);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_document_imp(ctx, doc);
+		fz_rethrow(ctx);
+	}
+
+	if (!indexed && !doc->repair_attempted)
+	{
+		fz_try(ctx)
+			pdf_save_xref_index(ctx, doc, filename, index);
+		fz_catch(ctx)
+			fz_warn(ctx, "cannot write xref index: %s", fz_caught_message(ctx));
+	}
+
+	return doc;
+}
+
 static void
 pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum)
 {
@@ -210,7 +210,7 @@ static void processpage(fz_context *ctx, fz_document *doc, int pagenum)
 static void processpages(fz_context *ctx, fz_document *doc)
 {
 	int page, pagecount;
-	pagecount = fz_count_pages(ctx, doc);
+	pagecount = fz_count_pages_exact(ctx, doc);
 	for (page = 1; page <= pagecount; ++page)
 		processpage(ctx, doc, page);
 }
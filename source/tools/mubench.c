@@ -0,0 +1,2252 @@
+/*
+ * mubench -- micro-benchmarks for the core rendering and parsing paths.
+ *
+ * Every input is generated in-process, so the results only depend
+ * on the code being measured and can be compared across commits.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include <zlib.h>
+
+#ifndef _MSC_VER
+#include <sys/time.h>
+#include <utime.h>
+#else
+#include <sys/utime.h>
+#endif
+
+#include "tool-threads.h"
+
+enum { OUT_UNSET, OUT_TEXT, OUT_JSON, OUT_CSV };
+
+typedef struct bench_s bench;
+
+struct bench_s
+{
+	const char *name;
+	const char *desc;
+	void *(*setup)(fz_context *ctx);
+	/* Run one iteration, and return the number of bytes processed (or 0). */
+	size_t (*run)(fz_context *ctx, void *state);
+	void (*drop)(fz_context *ctx, void *state);
+};
+
+typedef struct
+{
+	int iterations;
+	double total;
+	double min;
+	double max;
+	size_t bytes;
+	/* Allocations made by the calling thread, per iteration. */
+	double allocs;
+	double alloc_kb;
+} bench_result;
+
+static double now_ms(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* A cheap, deterministic pseudo-random number generator. */
+static unsigned int seed = 1;
+
+static unsigned int rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+static float frnd(float lo, float hi)
+{
+	return lo + (hi - lo) * rnd() / 32767.0f;
+}
+
+/* --- Drawing --- */
+
+enum { PAGE_W = 1024, PAGE_H = 1024 };
+
+typedef struct
+{
+	fz_pixmap *dest;
+	fz_path *path;
+	fz_stroke_state *stroke;
+	fz_image *image;
+	fz_display_list *list;
+} draw_state;
+
+static draw_state *new_draw_state(fz_context *ctx, fz_colorspace *cs, int alpha)
+{
+	draw_state *st = fz_malloc_struct(ctx, draw_state);
+	fz_try(ctx)
+		st->dest = fz_new_pixmap(ctx, cs, PAGE_W, PAGE_H, alpha);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void drop_draw_state(fz_context *ctx, void *state)
+{
+	draw_state *st = state;
+	fz_drop_pixmap(ctx, st->dest);
+	fz_drop_path(ctx, st->path);
+	fz_drop_stroke_state(ctx, st->stroke);
+	fz_drop_image(ctx, st->image);
+	fz_drop_display_list(ctx, st->list);
+	fz_free(ctx, st);
+}
+
+static fz_path *new_rects_path(fz_context *ctx, int count)
+{
+	fz_path *path = fz_new_path(ctx);
+	int i;
+	seed = 1;
+	fz_try(ctx)
+	{
+		for (i = 0; i < count; i++)
+		{
+			float x = frnd(0, PAGE_W - 256);
+			float y = frnd(0, PAGE_H - 256);
+			fz_rectto(ctx, path, x, y, x + frnd(64, 256), y + frnd(64, 256));
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_rethrow(ctx);
+	}
+	return path;
+}
+
+/* A star polygon with many crossing edges, to stress scan conversion. */
+static fz_path *new_star_path(fz_context *ctx, int points)
+{
+	fz_path *path = fz_new_path(ctx);
+	float r = PAGE_W * 0.45f;
+	int i, k = points / 2 - 1;
+	fz_try(ctx)
+	{
+		for (i = 0; i < points; i++)
+		{
+			float a = (float)(2 * M_PI * ((i * k) % points) / points);
+			float x = PAGE_W / 2 + r * cosf(a);
+			float y = PAGE_H / 2 + r * sinf(a);
+			if (i == 0)
+				fz_moveto(ctx, path, x, y);
+			else
+				fz_lineto(ctx, path, x, y);
+		}
+		fz_closepath(ctx, path);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_rethrow(ctx);
+	}
+	return path;
+}
+
+/* A wavy curve, to stress flattening and stroking. */
+static fz_path *new_curve_path(fz_context *ctx, int segments)
+{
+	fz_path *path = fz_new_path(ctx);
+	int i;
+	seed = 2;
+	fz_try(ctx)
+	{
+		fz_moveto(ctx, path, frnd(0, PAGE_W), frnd(0, PAGE_H));
+		for (i = 0; i < segments; i++)
+			fz_curveto(ctx, path,
+				frnd(0, PAGE_W), frnd(0, PAGE_H),
+				frnd(0, PAGE_W), frnd(0, PAGE_H),
+				frnd(0, PAGE_W), frnd(0, PAGE_H));
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_rethrow(ctx);
+	}
+	return path;
+}
+
+static fz_image *new_test_image(fz_context *ctx, int w, int h)
+{
+	fz_pixmap *pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), w, h, 0);
+	fz_image *image = NULL;
+	unsigned char *s = fz_pixmap_samples(ctx, pix);
+	int stride = fz_pixmap_stride(ctx, pix);
+	int x, y;
+
+	for (y = 0; y < h; y++)
+	{
+		unsigned char *p = s + y * stride;
+		for (x = 0; x < w; x++)
+		{
+			*p++ = x * 255 / w;
+			*p++ = y * 255 / h;
+			*p++ = ((x >> 3) ^ (y >> 3)) & 1 ? 255 : 0;
+		}
+	}
+
+	fz_try(ctx)
+		image = fz_new_image_from_pixmap(ctx, pix, NULL);
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, pix);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return image;
+}
+
+static void fill_path(fz_context *ctx, draw_state *st, int even_odd, float alpha)
+{
+	static const float color[FZ_MAX_COLORS] = { 0.2f, 0.4f, 0.8f, 0.1f };
+	fz_device *dev;
+
+	fz_clear_pixmap_with_value(ctx, st->dest, 255);
+	dev = fz_new_draw_device(ctx, &fz_identity, st->dest);
+	fz_try(ctx)
+	{
+		fz_fill_path(ctx, dev, st->path, even_odd, &fz_identity, fz_device_rgb(ctx), color, alpha);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static size_t pixmap_bytes(fz_context *ctx, fz_pixmap *pix)
+{
+	return (size_t)fz_pixmap_stride(ctx, pix) * fz_pixmap_height(ctx, pix);
+}
+
+static void *setup_paint_solid(fz_context *ctx)
+{
+	draw_state *st = new_draw_state(ctx, fz_device_rgb(ctx), 0);
+	fz_try(ctx)
+		st->path = new_rects_path(ctx, 200);
+	fz_catch(ctx)
+	{
+		drop_draw_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void *setup_paint_alpha(fz_context *ctx)
+{
+	draw_state *st = new_draw_state(ctx, fz_device_rgb(ctx), 1);
+	fz_try(ctx)
+		st->path = new_rects_path(ctx, 200);
+	fz_catch(ctx)
+	{
+		drop_draw_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t run_paint_solid(fz_context *ctx, void *state)
+{
+	draw_state *st = state;
+	fill_path(ctx, st, 0, 1);
+	return pixmap_bytes(ctx, st->dest);
+}
+
+static size_t run_paint_alpha(fz_context *ctx, void *state)
+{
+	draw_state *st = state;
+	fill_path(ctx, st, 0, 0.5f);
+	return pixmap_bytes(ctx, st->dest);
+}
+
+static void *setup_edge_star(fz_context *ctx)
+{
+	draw_state *st = new_draw_state(ctx, fz_device_rgb(ctx), 0);
+	fz_try(ctx)
+		st->path = new_star_path(ctx, 2001);
+	fz_catch(ctx)
+	{
+		drop_draw_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t run_edge_nonzero(fz_context *ctx, void *state)
+{
+	fill_path(ctx, state, 0, 1);
+	return 0;
+}
+
+static size_t run_edge_evenodd(fz_context *ctx, void *state)
+{
+	fill_path(ctx, state, 1, 1);
+	return 0;
+}
+
+static void *setup_edge_stroke(fz_context *ctx)
+{
+	draw_state *st = new_draw_state(ctx, fz_device_rgb(ctx), 0);
+	fz_try(ctx)
+	{
+		st->path = new_curve_path(ctx, 200);
+		st->stroke = fz_new_stroke_state(ctx);
+		st->stroke->linewidth = 3;
+		st->stroke->linejoin = FZ_LINEJOIN_ROUND;
+		st->stroke->start_cap = st->stroke->end_cap = FZ_LINECAP_ROUND;
+	}
+	fz_catch(ctx)
+	{
+		drop_draw_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t run_edge_stroke(fz_context *ctx, void *state)
+{
+	static const float color[FZ_MAX_COLORS] = { 0 };
+	draw_state *st = state;
+	fz_device *dev;
+
+	fz_clear_pixmap_with_value(ctx, st->dest, 255);
+	dev = fz_new_draw_device(ctx, &fz_identity, st->dest);
+	fz_try(ctx)
+	{
+		fz_stroke_path(ctx, dev, st->path, st->stroke, &fz_identity, fz_device_rgb(ctx), color, 1);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return 0;
+}
+
+static void *setup_edge_small(fz_context *ctx)
+{
+	draw_state *st = new_draw_state(ctx, fz_device_rgb(ctx), 0);
+	fz_try(ctx)
+		st->path = new_rects_path(ctx, 1);
+	fz_catch(ctx)
+	{
+		drop_draw_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+/* Many fills of one small path, as for table rules and underlines. */
+static size_t run_edge_small(fz_context *ctx, void *state)
+{
+	static const float color[FZ_MAX_COLORS] = { 0 };
+	draw_state *st = state;
+	fz_device *dev;
+	fz_matrix ctm;
+	int i;
+
+	fz_clear_pixmap_with_value(ctx, st->dest, 255);
+	dev = fz_new_draw_device(ctx, &fz_identity, st->dest);
+	fz_try(ctx)
+	{
+		seed = 5;
+		for (i = 0; i < 5000; i++)
+		{
+			fz_scale(&ctm, 0.05f, 0.05f);
+			fz_pre_translate(&ctm, frnd(0, PAGE_W * 19), frnd(0, PAGE_H * 19));
+			fz_fill_path(ctx, dev, st->path, 0, &ctm, fz_device_rgb(ctx), color, 1);
+		}
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return 0;
+}
+
+enum { PATH_VARIANTS = 5 };
+
+static void *setup_path_cache(fz_context *ctx)
+{
+	draw_state *st = new_draw_state(ctx, fz_device_rgb(ctx), 0);
+	fz_try(ctx)
+		st->path = new_curve_path(ctx, 20);
+	fz_catch(ctx)
+	{
+		drop_draw_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+/* The same path filled, stroked at two widths, with another join, and
+ * filled at half size (so with another matrix and flatness). */
+static void draw_path_variant(fz_context *ctx, draw_state *st, int variant, unsigned char digest[16])
+{
+	static const float color[FZ_MAX_COLORS] = { 0 };
+	fz_stroke_state *stroke = NULL;
+	fz_device *dev;
+	fz_matrix ctm = fz_identity;
+
+	fz_clear_pixmap_with_value(ctx, st->dest, 255);
+	dev = fz_new_draw_device(ctx, &fz_identity, st->dest);
+	fz_var(stroke);
+	fz_try(ctx)
+	{
+		if (variant == 0 || variant == 4)
+		{
+			if (variant == 4)
+				fz_scale(&ctm, 0.5f, 0.5f);
+			fz_fill_path(ctx, dev, st->path, 0, &ctm, fz_device_rgb(ctx), color, 1);
+		}
+		else
+		{
+			stroke = fz_new_stroke_state(ctx);
+			stroke->linewidth = variant == 1 ? 2 : 8;
+			stroke->linejoin = variant == 3 ? FZ_LINEJOIN_MITER : FZ_LINEJOIN_ROUND;
+			fz_stroke_path(ctx, dev, st->path, stroke, &ctm, fz_device_rgb(ctx), color, 1);
+		}
+		fz_close_device(ctx, dev);
+		fz_md5_pixmap(ctx, st->dest, digest);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stroke_state(ctx, stroke);
+		fz_drop_device(ctx, dev);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Draw each variant from an empty store, then all of them in turn so
+ * that each finds the others cached; the two must agree, and the fill
+ * must differ from the strokes. */
+static size_t run_path_cache(fz_context *ctx, void *state)
+{
+	draw_state *st = state;
+	unsigned char fresh[PATH_VARIANTS][16];
+	unsigned char cached[PATH_VARIANTS][16];
+	int i;
+
+	for (i = 0; i < PATH_VARIANTS; i++)
+	{
+		fz_empty_store(ctx);
+		draw_path_variant(ctx, st, i, fresh[i]);
+	}
+	fz_empty_store(ctx);
+	for (i = 0; i < PATH_VARIANTS; i++)
+		draw_path_variant(ctx, st, i, cached[i]);
+
+	for (i = 0; i < PATH_VARIANTS; i++)
+		if (memcmp(fresh[i], cached[i], 16))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "path variant %d drew another variant's cached segments", i);
+	for (i = 1; i < PATH_VARIANTS; i++)
+		if (!memcmp(fresh[0], fresh[i], 16))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "path variant %d rendered the same as the fill", i);
+	return 0;
+}
+
+static void *setup_affine(fz_context *ctx)
+{
+	draw_state *st = new_draw_state(ctx, fz_device_rgb(ctx), 0);
+	fz_try(ctx)
+		st->image = new_test_image(ctx, 300, 200);
+	fz_catch(ctx)
+	{
+		drop_draw_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t draw_image(fz_context *ctx, draw_state *st, float angle)
+{
+	fz_device *dev;
+	fz_matrix ctm;
+
+	fz_translate(&ctm, PAGE_W / 2, PAGE_H / 2);
+	fz_pre_rotate(&ctm, angle);
+	fz_pre_scale(&ctm, PAGE_W * 0.7f, PAGE_H * 0.7f);
+	fz_pre_translate(&ctm, -0.5f, -0.5f);
+
+	fz_clear_pixmap_with_value(ctx, st->dest, 255);
+	dev = fz_new_draw_device(ctx, &fz_identity, st->dest);
+	fz_try(ctx)
+	{
+		fz_fill_image(ctx, dev, st->image, &ctm, 1);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return pixmap_bytes(ctx, st->dest);
+}
+
+static size_t run_affine_upright(fz_context *ctx, void *state)
+{
+	return draw_image(ctx, state, 0);
+}
+
+static size_t run_affine_rotated(fz_context *ctx, void *state)
+{
+	return draw_image(ctx, state, 30);
+}
+
+/* A display list mixing the above, run through a draw device. */
+static void *setup_display_list(fz_context *ctx)
+{
+	static const float color[FZ_MAX_COLORS] = { 0.8f, 0.2f, 0.1f };
+	draw_state *st = new_draw_state(ctx, fz_device_rgb(ctx), 0);
+	fz_device *dev = NULL;
+	fz_path *rects = NULL;
+	fz_rect mediabox = { 0, 0, PAGE_W, PAGE_H };
+	fz_matrix ctm;
+	int i;
+
+	fz_var(dev);
+	fz_var(rects);
+
+	fz_try(ctx)
+	{
+		st->path = new_curve_path(ctx, 8);
+		st->stroke = fz_new_stroke_state(ctx);
+		st->image = new_test_image(ctx, 64, 64);
+		rects = new_rects_path(ctx, 10);
+		st->list = fz_new_display_list(ctx, &mediabox);
+		dev = fz_new_list_device(ctx, st->list);
+		seed = 3;
+		for (i = 0; i < 200; i++)
+		{
+			fz_translate(&ctm, frnd(-PAGE_W / 2, PAGE_W / 2), frnd(-PAGE_H / 2, PAGE_H / 2));
+			switch (i % 3)
+			{
+			case 0:
+				fz_fill_path(ctx, dev, rects, 0, &ctm, fz_device_rgb(ctx), color, frnd(0.3f, 1));
+				break;
+			case 1:
+				fz_pre_scale(&ctm, 0.25f, 0.25f);
+				fz_stroke_path(ctx, dev, st->path, st->stroke, &ctm, fz_device_rgb(ctx), color, 1);
+				break;
+			case 2:
+				fz_pre_scale(fz_translate(&ctm, frnd(0, PAGE_W), frnd(0, PAGE_H)), frnd(20, 200), frnd(20, 200));
+				fz_fill_image(ctx, dev, st->image, &ctm, 1);
+				break;
+			}
+		}
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_path(ctx, rects);
+	}
+	fz_catch(ctx)
+	{
+		drop_draw_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t run_display_list(fz_context *ctx, void *state)
+{
+	draw_state *st = state;
+	fz_device *dev;
+
+	fz_clear_pixmap_with_value(ctx, st->dest, 255);
+	dev = fz_new_draw_device(ctx, &fz_identity, st->dest);
+	fz_try(ctx)
+	{
+		fz_run_display_list(ctx, st->list, dev, &fz_identity, NULL, NULL);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return 0;
+}
+
+/* --- Structured text --- */
+
+enum { TEXT_LINES = 60, TEXT_COLUMNS = 80 };
+
+typedef struct
+{
+	fz_display_list *list;
+	fz_stext_sheet *sheet;
+} stext_state;
+
+static void drop_stext_state(fz_context *ctx, void *state)
+{
+	stext_state *st = state;
+	fz_drop_display_list(ctx, st->list);
+	fz_drop_stext_sheet(ctx, st->sheet);
+	fz_free(ctx, st);
+}
+
+/* A page of words in a font without glyphs, recorded in a display list. */
+static void *setup_stext(fz_context *ctx)
+{
+	static const float color[FZ_MAX_COLORS] = { 0 };
+	stext_state *st = fz_malloc_struct(ctx, stext_state);
+	fz_rect mediabox = { 0, 0, PAGE_W, PAGE_H };
+	fz_device *dev = NULL;
+	fz_font *font = NULL;
+	fz_text *text = NULL;
+	fz_matrix trm;
+	int i, k, c;
+
+	fz_var(dev);
+	fz_var(font);
+	fz_var(text);
+
+	fz_try(ctx)
+	{
+		st->sheet = fz_new_stext_sheet(ctx);
+		st->list = fz_new_display_list(ctx, &mediabox);
+		font = fz_new_type3_font(ctx, "bench", &fz_identity);
+		dev = fz_new_list_device(ctx, st->list);
+		seed = 5;
+		for (i = 0; i < TEXT_LINES; i++)
+		{
+			text = fz_new_text(ctx);
+			fz_scale(&trm, 10, 10);
+			trm.e = 20;
+			trm.f = 20 + i * 12;
+			for (k = 0; k < TEXT_COLUMNS; k++)
+			{
+				c = rnd() % 6 ? 'a' + rnd() % 26 : ' ';
+				if (c != ' ')
+					fz_show_glyph(ctx, text, font, &trm, c, c, 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+				trm.e += 6;
+			}
+			fz_fill_text(ctx, dev, text, &fz_identity, fz_device_gray(ctx), color, 1);
+			fz_drop_text(ctx, text);
+			text = NULL;
+		}
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_text(ctx, text);
+		fz_drop_font(ctx, font);
+	}
+	fz_catch(ctx)
+	{
+		drop_stext_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t run_stext(fz_context *ctx, void *state)
+{
+	stext_state *st = state;
+	fz_stext_page *page = fz_new_stext_page_from_display_list(ctx, st->list, st->sheet);
+	fz_drop_stext_page(ctx, page);
+	return 0;
+}
+
+/* --- Colorspace conversion --- */
+
+typedef struct
+{
+	fz_pixmap *src;
+	fz_pixmap *dst;
+} convert_state;
+
+static void drop_convert_state(fz_context *ctx, void *state)
+{
+	convert_state *st = state;
+	fz_drop_pixmap(ctx, st->src);
+	fz_drop_pixmap(ctx, st->dst);
+	fz_free(ctx, st);
+}
+
+static void *new_convert_state(fz_context *ctx, fz_colorspace *ss, fz_colorspace *ds)
+{
+	convert_state *st = fz_malloc_struct(ctx, convert_state);
+	fz_try(ctx)
+	{
+		unsigned char *s;
+		size_t i, len;
+
+		st->src = fz_new_pixmap(ctx, ss, PAGE_W, PAGE_H, 0);
+		st->dst = fz_new_pixmap(ctx, ds, PAGE_W, PAGE_H, 0);
+
+		/* Smooth gradients with some noise, as in a typical photo. */
+		seed = 4;
+		s = fz_pixmap_samples(ctx, st->src);
+		len = pixmap_bytes(ctx, st->src);
+		for (i = 0; i < len; i++)
+			s[i] = (i / 7 + (rnd() & 15)) & 255;
+	}
+	fz_catch(ctx)
+	{
+		drop_convert_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void *setup_rgb_to_gray(fz_context *ctx)
+{
+	return new_convert_state(ctx, fz_device_rgb(ctx), fz_device_gray(ctx));
+}
+
+static void *setup_rgb_to_cmyk(fz_context *ctx)
+{
+	return new_convert_state(ctx, fz_device_rgb(ctx), fz_device_cmyk(ctx));
+}
+
+static void *setup_cmyk_to_rgb(fz_context *ctx)
+{
+	return new_convert_state(ctx, fz_device_cmyk(ctx), fz_device_rgb(ctx));
+}
+
+static size_t run_convert(fz_context *ctx, void *state)
+{
+	convert_state *st = state;
+	fz_convert_pixmap(ctx, st->dst, st->src);
+	return pixmap_bytes(ctx, st->src);
+}
+
+/* --- Decoding filters and lexing --- */
+
+typedef struct
+{
+	fz_buffer *data;
+	size_t size;
+	unsigned char *scratch;
+} stream_state;
+
+static void drop_stream_state(fz_context *ctx, void *state)
+{
+	stream_state *st = state;
+	fz_drop_buffer(ctx, st->data);
+	fz_free(ctx, st->scratch);
+	fz_free(ctx, st);
+}
+
+static void *setup_flate(fz_context *ctx)
+{
+	stream_state *st = fz_malloc_struct(ctx, stream_state);
+	unsigned char *raw = NULL;
+	uLongf clen;
+	size_t i;
+
+	fz_var(raw);
+
+	fz_try(ctx)
+	{
+		/* Something between text and image data in compressibility. */
+		st->size = 4 << 20;
+		raw = fz_malloc(ctx, st->size);
+		seed = 5;
+		for (i = 0; i < st->size; i++)
+			raw[i] = (rnd() & 7) ? "0123456789 .Tm re f\n"[i % 20] : rnd();
+
+		clen = compressBound(st->size);
+		st->data = fz_new_buffer(ctx, clen);
+		if (compress(st->data->data, &clen, raw, st->size) != Z_OK)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot deflate test data");
+		st->data->len = clen;
+		st->scratch = fz_malloc(ctx, 64 << 10);
+	}
+	fz_always(ctx)
+		fz_free(ctx, raw);
+	fz_catch(ctx)
+	{
+		drop_stream_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t drain(fz_context *ctx, fz_stream *stm, unsigned char *scratch)
+{
+	size_t n, total = 0;
+	fz_try(ctx)
+		while ((n = fz_read(ctx, stm, scratch, 64 << 10)) > 0)
+			total += n;
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return total;
+}
+
+static size_t run_flate(fz_context *ctx, void *state)
+{
+	stream_state *st = state;
+	fz_stream *stm = fz_open_buffer(ctx, st->data);
+	stm = fz_open_flated(ctx, stm, 15);
+	if (drain(ctx, stm, st->scratch) != st->size)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "flate output has wrong size");
+	return st->size;
+}
+
+/*
+	Build a baseline JPEG by hand: there is no JPEG encoder in the
+	library. Every block has a varying DC term and no AC terms, so the
+	huffman decoding is trivial but the IDCT, upsampling and color
+	conversion run as for any real image.
+*/
+
+typedef struct
+{
+	fz_buffer *buf;
+	unsigned int bits;
+	int n;
+} bit_writer;
+
+static void put_bits(fz_context *ctx, bit_writer *bw, unsigned int code, int len)
+{
+	bw->bits = (bw->bits << len) | code;
+	bw->n += len;
+	while (bw->n >= 8)
+	{
+		int c = (bw->bits >> (bw->n - 8)) & 0xff;
+		fz_write_buffer_byte(ctx, bw->buf, c);
+		if (c == 0xff)
+			fz_write_buffer_byte(ctx, bw->buf, 0);
+		bw->n -= 8;
+	}
+}
+
+static void put_marker(fz_context *ctx, fz_buffer *buf, int marker, const unsigned char *data, int len)
+{
+	fz_write_buffer_byte(ctx, buf, 0xff);
+	fz_write_buffer_byte(ctx, buf, marker);
+	fz_write_buffer_byte(ctx, buf, (len + 2) >> 8);
+	fz_write_buffer_byte(ctx, buf, (len + 2) & 0xff);
+	fz_write_buffer(ctx, buf, data, len);
+}
+
+enum { JPEG_W = 2048, JPEG_H = 1024 };
+
+static fz_buffer *new_test_jpeg(fz_context *ctx)
+{
+	/* DC: categories 0, 1, 2 as codes 00, 01, 10. AC: EOB as code 0. */
+	static const unsigned char dht_dc[] = { 0x00, 0,3,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,1,2 };
+	static const unsigned char dht_ac[] = { 0x10, 1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0 };
+	static const unsigned char sof[] = {
+		8, JPEG_H >> 8, JPEG_H & 0xff, JPEG_W >> 8, JPEG_W & 0xff, 3,
+		1, 0x11, 0, 2, 0x11, 0, 3, 0x11, 0 };
+	static const unsigned char sos[] = { 3, 1, 0x00, 2, 0x00, 3, 0x00, 0, 63, 0 };
+	unsigned char dqt[65];
+	fz_buffer *buf = fz_new_buffer(ctx, JPEG_W * JPEG_H / 64);
+	bit_writer bw = { buf, 0, 0 };
+	int i, c, mcus = (JPEG_W / 8) * (JPEG_H / 8);
+
+	fz_try(ctx)
+	{
+		dqt[0] = 0;
+		for (i = 1; i < 65; i++)
+			dqt[i] = 16;
+
+		fz_write_buffer_byte(ctx, buf, 0xff);
+		fz_write_buffer_byte(ctx, buf, 0xd8);
+		put_marker(ctx, buf, 0xdb, dqt, sizeof dqt);
+		put_marker(ctx, buf, 0xc0, sof, sizeof sof);
+		put_marker(ctx, buf, 0xc4, dht_dc, sizeof dht_dc);
+		put_marker(ctx, buf, 0xc4, dht_ac, sizeof dht_ac);
+		put_marker(ctx, buf, 0xda, sos, sizeof sos);
+
+		seed = 6;
+		for (i = 0; i < mcus; i++)
+		{
+			for (c = 0; c < 3; c++)
+			{
+				/* DC difference of -1, 0 or +1; drifts around but stays in range. */
+				switch (rnd() % 3)
+				{
+				case 0: put_bits(ctx, &bw, 0, 2); break;
+				case 1: put_bits(ctx, &bw, (1 << 1) | 1, 3); break;
+				case 2: put_bits(ctx, &bw, (1 << 1) | 0, 3); break;
+				}
+				put_bits(ctx, &bw, 0, 1);
+			}
+		}
+		if (bw.n > 0)
+			put_bits(ctx, &bw, (1 << (8 - bw.n)) - 1, 8 - bw.n);
+
+		fz_write_buffer_byte(ctx, buf, 0xff);
+		fz_write_buffer_byte(ctx, buf, 0xd9);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+static void *setup_dct(fz_context *ctx)
+{
+	stream_state *st = fz_malloc_struct(ctx, stream_state);
+	fz_try(ctx)
+	{
+		st->data = new_test_jpeg(ctx);
+		st->size = JPEG_W * JPEG_H * 3;
+		st->scratch = fz_malloc(ctx, 64 << 10);
+	}
+	fz_catch(ctx)
+	{
+		drop_stream_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t run_dct(fz_context *ctx, void *state)
+{
+	stream_state *st = state;
+	fz_stream *stm = fz_open_buffer(ctx, st->data);
+	stm = fz_open_dctd(ctx, stm, -1, 0, NULL);
+	if (drain(ctx, stm, st->scratch) != st->size)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "dct output has wrong size");
+	return st->size;
+}
+
+static void *setup_lex(fz_context *ctx)
+{
+	static const char *ops[] = { "m", "l", "c", "re", "f", "S", "cm", "Tf", "Td", "TJ", "Do", "gs", "q", "Q" };
+	stream_state *st = fz_malloc_struct(ctx, stream_state);
+	fz_buffer *buf = NULL;
+	int i;
+
+	fz_try(ctx)
+	{
+		buf = st->data = fz_new_buffer(ctx, 4 << 20);
+		seed = 7;
+		while (buf->len < (4 << 20))
+		{
+			switch (rnd() % 6)
+			{
+			case 0: fz_buffer_printf(ctx, buf, "%d ", (int)rnd() - 16384); break;
+			case 1: fz_buffer_printf(ctx, buf, "%g ", frnd(-1000, 1000)); break;
+			case 2: fz_buffer_printf(ctx, buf, "/F%d ", rnd() % 32); break;
+			case 3: fz_buffer_printf(ctx, buf, "(Hello, world \\(%d\\)) ", rnd()); break;
+			case 4: fz_buffer_printf(ctx, buf, "[<%04x%04x> %d (x)] ", rnd(), rnd(), rnd() % 500); break;
+			case 5:
+				for (i = 0; i < 3; i++)
+					fz_buffer_printf(ctx, buf, "%g ", frnd(0, 612));
+				fz_buffer_printf(ctx, buf, "%s\n", ops[rnd() % nelem(ops)]);
+				break;
+			}
+		}
+		st->size = buf->len;
+	}
+	fz_catch(ctx)
+	{
+		drop_stream_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static size_t run_lex(fz_context *ctx, void *state)
+{
+	stream_state *st = state;
+	fz_stream *stm = fz_open_buffer(ctx, st->data);
+	pdf_lexbuf lexbuf;
+	pdf_token tok;
+
+	pdf_lexbuf_init(ctx, &lexbuf, PDF_LEXBUF_SMALL);
+	fz_try(ctx)
+	{
+		do
+			tok = pdf_lex(ctx, stm, &lexbuf);
+		while (tok != PDF_TOK_EOF && tok != PDF_TOK_ERROR);
+		if (tok == PDF_TOK_ERROR)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "lexer error in test data");
+	}
+	fz_always(ctx)
+	{
+		pdf_lexbuf_fin(ctx, &lexbuf);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return st->size;
+}
+
+/* --- Allocator contention --- */
+
+enum { ALLOC_JOBS = 16, ALLOC_ROUNDS = 64, ALLOC_SLOTS = 256 };
+
+static int bench_threads = 4;
+
+typedef struct
+{
+	int threads;
+	size_t bytes[ALLOC_JOBS];
+} alloc_state;
+
+static void *setup_alloc_serial(fz_context *ctx)
+{
+	alloc_state *st = fz_malloc_struct(ctx, alloc_state);
+	st->threads = 1;
+	return st;
+}
+
+static void *setup_alloc_threads(fz_context *ctx)
+{
+	alloc_state *st = fz_malloc_struct(ctx, alloc_state);
+	st->threads = bench_threads;
+	return st;
+}
+
+static void drop_alloc_state(fz_context *ctx, void *state)
+{
+	fz_free(ctx, state);
+}
+
+/* Churn through small blocks of mixed sizes, as parsing and
+ * display list building do. Each job has its own random sequence,
+ * so the work is the same however the jobs are spread. */
+static void alloc_worker(fz_context *ctx, void *arg, int idx)
+{
+	alloc_state *st = arg;
+	void *slots[ALLOC_SLOTS] = { NULL };
+	unsigned int r = idx + 1;
+	size_t bytes = 0;
+	int i, k;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < ALLOC_ROUNDS; i++)
+		{
+			for (k = 0; k < ALLOC_SLOTS; k++)
+			{
+				size_t size;
+				r = r * 1103515245 + 12345;
+				size = 8 + ((r >> 16) & 511);
+				fz_free(ctx, slots[k]);
+				slots[k] = NULL;
+				slots[k] = fz_malloc(ctx, size);
+				bytes += size;
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		for (k = 0; k < ALLOC_SLOTS; k++)
+			fz_free(ctx, slots[k]);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	st->bytes[idx] = bytes;
+}
+
+static size_t run_alloc(fz_context *ctx, void *state)
+{
+	alloc_state *st = state;
+	size_t bytes = 0;
+	int i;
+
+	fz_run_workers(ctx, st->threads, ALLOC_JOBS, alloc_worker, st);
+	for (i = 0; i < ALLOC_JOBS; i++)
+		bytes += st->bytes[i];
+	return bytes;
+}
+
+/* --- Concurrent page rendering from one document --- */
+
+enum { DOC_PAGES = 24, DOC_FORMS = 4, DOC_IMAGE = 64 };
+
+typedef struct
+{
+	int threads;
+	fz_buffer *pdf;
+	fz_document *doc;
+	unsigned char digest[DOC_PAGES][16];
+} doc_state;
+
+static void drop_doc_state(fz_context *ctx, void *state)
+{
+	doc_state *st = state;
+	fz_drop_buffer(ctx, st->pdf);
+	fz_free(ctx, st);
+}
+
+static void put_flate_object(fz_context *ctx, fz_buffer *pdf, int *ofs, int num, const char *dict, fz_buffer *data)
+{
+	fz_buffer *z;
+	uLongf clen = compressBound(data->len);
+
+	z = fz_new_buffer(ctx, clen);
+	fz_try(ctx)
+	{
+		if (compress(z->data, &clen, data->data, data->len) != Z_OK)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot deflate test data");
+		ofs[num] = pdf->len;
+		fz_buffer_printf(ctx, pdf, "%d 0 obj\n<<%s/Length %d/Filter/FlateDecode>>\nstream\n", num, dict, (int)clen);
+		fz_write_buffer(ctx, pdf, z->data, clen);
+		fz_buffer_printf(ctx, pdf, "\nendstream\nendobj\n");
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, z);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void put_shapes(fz_context *ctx, fz_buffer *buf, int count)
+{
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		fz_buffer_printf(ctx, buf, "%g %g %g rg %g %g %g %g re f\n",
+			frnd(0, 1), frnd(0, 1), frnd(0, 1), frnd(0, 600), frnd(0, 780), frnd(5, 100), frnd(5, 100));
+		fz_buffer_printf(ctx, buf, "%g w %g %g m %g %g %g %g %g %g c S\n",
+			frnd(0.5f, 4), frnd(0, 612), frnd(0, 792), frnd(0, 612), frnd(0, 792),
+			frnd(0, 612), frnd(0, 792), frnd(0, 612), frnd(0, 792));
+	}
+}
+
+/* Objects: 1 catalog, 2 page tree, 3 image, 4.. nested forms, then
+ * a page object and its contents for each page. Form n draws form
+ * n-1, and every page draws the outermost form several times, so
+ * the threads keep meeting on the same objects. With annots, each
+ * page also has an ink annotation without an appearance stream and
+ * a square one that uses the innermost form as its appearance. */
+static fz_buffer *new_test_pdf(fz_context *ctx, int annots)
+{
+	int ofs[4 + DOC_FORMS + 4 * DOC_PAGES];
+	int stride = annots ? 4 : 2;
+	int first_page = 4 + DOC_FORMS;
+	int count = first_page + stride * DOC_PAGES;
+	fz_buffer *pdf = NULL, *data = NULL;
+	char dict[256];
+	int i, k, xref;
+
+	fz_var(pdf);
+	fz_var(data);
+
+	fz_try(ctx)
+	{
+		pdf = fz_new_buffer(ctx, 64 << 10);
+		fz_buffer_printf(ctx, pdf, "%%PDF-1.4\n");
+
+		ofs[1] = pdf->len;
+		fz_buffer_printf(ctx, pdf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+		ofs[2] = pdf->len;
+		fz_buffer_printf(ctx, pdf, "2 0 obj\n<</Type/Pages/MediaBox[0 0 612 792]/Count %d/Kids[", DOC_PAGES);
+		for (i = 0; i < DOC_PAGES; i++)
+			fz_buffer_printf(ctx, pdf, "%d 0 R ", first_page + stride * i);
+		fz_buffer_printf(ctx, pdf, "]>>\nendobj\n");
+
+		data = fz_new_buffer(ctx, DOC_IMAGE * DOC_IMAGE * 3);
+		for (i = 0; i < DOC_IMAGE * DOC_IMAGE; i++)
+		{
+			fz_write_buffer_byte(ctx, data, i);
+			fz_write_buffer_byte(ctx, data, i / DOC_IMAGE * 4);
+			fz_write_buffer_byte(ctx, data, rnd());
+		}
+		fz_snprintf(dict, sizeof dict, "/Type/XObject/Subtype/Image/Width %d/Height %d/ColorSpace/DeviceRGB/BitsPerComponent 8", DOC_IMAGE, DOC_IMAGE);
+		put_flate_object(ctx, pdf, ofs, 3, dict, data);
+		fz_drop_buffer(ctx, data);
+		data = NULL;
+
+		for (k = 0; k < DOC_FORMS; k++)
+		{
+			data = fz_new_buffer(ctx, 4096);
+			put_shapes(ctx, data, 20);
+			fz_buffer_printf(ctx, data, "q 100 0 0 100 %g %g cm /Im0 Do Q\n", frnd(0, 500), frnd(0, 700));
+			if (k > 0)
+				fz_buffer_printf(ctx, data, "q 0.5 0 0 0.5 %g %g cm /Fm0 Do Q\n", frnd(0, 300), frnd(0, 400));
+			if (k > 0)
+				fz_snprintf(dict, sizeof dict, "/Type/XObject/Subtype/Form/BBox[0 0 612 792]/Resources<</XObject<</Im0 3 0 R/Fm0 %d 0 R>>>>", 4 + k - 1);
+			else
+				fz_snprintf(dict, sizeof dict, "/Type/XObject/Subtype/Form/BBox[0 0 612 792]/Resources<</XObject<</Im0 3 0 R>>>>");
+			put_flate_object(ctx, pdf, ofs, 4 + k, dict, data);
+			fz_drop_buffer(ctx, data);
+			data = NULL;
+		}
+
+		for (i = 0; i < DOC_PAGES; i++)
+		{
+			int num = first_page + stride * i;
+			ofs[num] = pdf->len;
+			fz_buffer_printf(ctx, pdf, "%d 0 obj\n<</Type/Page/Parent 2 0 R/Contents %d 0 R/Resources<</XObject<</Fm0 %d 0 R>>>>",
+				num, num + 1, 4 + DOC_FORMS - 1);
+			if (annots)
+				fz_buffer_printf(ctx, pdf, "/Annots[%d 0 R %d 0 R]", num + 2, num + 3);
+			fz_buffer_printf(ctx, pdf, ">>\nendobj\n");
+
+			if (annots)
+			{
+				ofs[num + 2] = pdf->len;
+				fz_buffer_printf(ctx, pdf, "%d 0 obj\n<</Type/Annot/Subtype/Ink/Rect[0 0 612 792]/C[0 0 1]/InkList[[%g %g %g %g %g %g]]>>\nendobj\n",
+					num + 2, frnd(0, 612), frnd(0, 792), frnd(0, 612), frnd(0, 792), frnd(0, 612), frnd(0, 792));
+				ofs[num + 3] = pdf->len;
+				fz_buffer_printf(ctx, pdf, "%d 0 obj\n<</Type/Annot/Subtype/Square/Rect[%g %g %g %g]/AP<</N 4 0 R>>>>\nendobj\n",
+					num + 3, frnd(0, 300), frnd(0, 400), frnd(300, 612), frnd(400, 792));
+			}
+
+			data = fz_new_buffer(ctx, 4096);
+			put_shapes(ctx, data, 10);
+			for (k = 0; k < 3; k++)
+				fz_buffer_printf(ctx, data, "q 0.5 0 0 0.5 %g %g cm /Fm0 Do Q\n", frnd(0, 300), frnd(0, 400));
+			put_flate_object(ctx, pdf, ofs, num + 1, "", data);
+			fz_drop_buffer(ctx, data);
+			data = NULL;
+		}
+
+		xref = pdf->len;
+		fz_buffer_printf(ctx, pdf, "xref\n0 %d\n0000000000 65535 f \n", count);
+		for (i = 1; i < count; i++)
+			fz_buffer_printf(ctx, pdf, "%010d 00000 n \n", ofs[i]);
+		fz_buffer_printf(ctx, pdf, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%d\n%%%%EOF\n", count, xref);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, data);
+		fz_drop_buffer(ctx, pdf);
+		fz_rethrow(ctx);
+	}
+	return pdf;
+}
+
+static fz_document *open_test_pdf(fz_context *ctx, fz_buffer *pdf)
+{
+	fz_stream *stm = fz_open_buffer(ctx, pdf);
+	pdf_document *doc = NULL;
+	fz_try(ctx)
+		doc = pdf_open_document_with_stream(ctx, stm);
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return &doc->super;
+}
+
+static void render_page_digest(fz_context *ctx, fz_document *doc, int number, unsigned char digest[16])
+{
+	fz_page *page = fz_load_page(ctx, doc, number);
+	fz_pixmap *pix = NULL;
+	fz_matrix ctm;
+
+	fz_var(pix);
+
+	fz_try(ctx)
+	{
+		fz_scale(&ctm, 0.5f, 0.5f);
+		pix = fz_new_pixmap_from_page(ctx, page, &ctm, fz_device_rgb(ctx), 0);
+		fz_md5_pixmap(ctx, pix, digest);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_page(ctx, page);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void *new_doc_state(fz_context *ctx, int threads, int annots)
+{
+	doc_state *st = fz_malloc_struct(ctx, doc_state);
+	fz_document *doc = NULL;
+	int i;
+
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		st->threads = threads;
+		seed = 9;
+		st->pdf = new_test_pdf(ctx, annots);
+
+		/* Reference renderings, one page at a time. A shared document
+		 * draws annotations without synthesizing appearances, so the
+		 * reference for annotated pages is shared too. */
+		doc = open_test_pdf(ctx, st->pdf);
+		if (annots)
+			pdf_enable_concurrent_reads(ctx, (pdf_document *)doc);
+		for (i = 0; i < DOC_PAGES; i++)
+			render_page_digest(ctx, doc, i, st->digest[i]);
+	}
+	fz_always(ctx)
+		fz_drop_document(ctx, doc);
+	fz_catch(ctx)
+	{
+		drop_doc_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void *setup_doc_serial(fz_context *ctx)
+{
+	return new_doc_state(ctx, 1, 0);
+}
+
+static void *setup_doc_threads(fz_context *ctx)
+{
+	return new_doc_state(ctx, bench_threads, 0);
+}
+
+static void *setup_annot_threads(fz_context *ctx)
+{
+	return new_doc_state(ctx, bench_threads, 1);
+}
+
+static void doc_worker(fz_context *ctx, void *arg, int idx)
+{
+	doc_state *st = arg;
+	unsigned char digest[16];
+
+	render_page_digest(ctx, st->doc, idx, digest);
+	if (memcmp(digest, st->digest[idx], 16))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "page %d rendered differently when shared", idx + 1);
+	if (pdf_has_unsaved_changes(ctx, (pdf_document *)st->doc))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "page %d changed the shared document", idx + 1);
+}
+
+/* Open the document afresh every time, so that the threads race to
+ * load the shared objects rather than finding them cached. */
+static size_t run_doc(fz_context *ctx, void *state)
+{
+	doc_state *st = state;
+
+	st->doc = open_test_pdf(ctx, st->pdf);
+	fz_try(ctx)
+	{
+		pdf_enable_concurrent_reads(ctx, (pdf_document *)st->doc);
+		fz_run_workers(ctx, st->threads, DOC_PAGES, doc_worker, st);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_document(ctx, st->doc);
+		st->doc = NULL;
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return st->pdf->len;
+}
+
+/* --- Object parsing --- */
+
+enum { PARSE_OBJECTS = 20000 };
+
+typedef struct
+{
+	int arena;
+	fz_buffer *pdf;
+} parse_state;
+
+static void drop_parse_state(fz_context *ctx, void *state)
+{
+	parse_state *st = state;
+	fz_drop_buffer(ctx, st->pdf);
+	fz_free(ctx, st);
+}
+
+/* Objects of the sorts that make up most of a large file: link
+ * annotations, width arrays, font descriptors and page lists. */
+static void put_parse_object(fz_context *ctx, fz_buffer *pdf, int num)
+{
+	int i;
+
+	fz_buffer_printf(ctx, pdf, "%d 0 obj\n", num);
+	switch (num % 4)
+	{
+	case 0:
+		fz_buffer_printf(ctx, pdf, "<</Type/Annot/Subtype/Link/Rect[%g %g %g %g]/Border[0 0 0]/F 4"
+			"/A<</S/URI/URI(http://example.com/%u)>>/P %d 0 R>>\n",
+			frnd(0, 600), frnd(0, 800), frnd(0, 600), frnd(0, 800), rnd(), 1 + rnd() % num);
+		break;
+	case 1:
+		fz_buffer_printf(ctx, pdf, "[");
+		for (i = 0; i < 96; i++)
+			fz_buffer_printf(ctx, pdf, "%d ", 250 + rnd() % 750);
+		fz_buffer_printf(ctx, pdf, "]\n");
+		break;
+	case 2:
+		fz_buffer_printf(ctx, pdf, "<</Type/FontDescriptor/FontName/ABCDEF+Font%d/Flags 32/FontBBox[-%d -%d %d %d]"
+			"/ItalicAngle 0/Ascent %d/Descent -%d/CapHeight 700/StemV 80/FontFile2 %d 0 R>>\n",
+			num, rnd() % 200, rnd() % 300, rnd() % 1200, rnd() % 1000, rnd() % 1000, rnd() % 300, 1 + rnd() % num);
+		break;
+	case 3:
+		fz_buffer_printf(ctx, pdf, "[");
+		for (i = 0; i < 8; i++)
+			fz_buffer_printf(ctx, pdf, "%d 0 R ", 1 + rnd() % num);
+		fz_buffer_printf(ctx, pdf, "]\n");
+		break;
+	}
+	fz_buffer_printf(ctx, pdf, "endobj\n");
+}
+
+static void *new_parse_state(fz_context *ctx, int arena)
+{
+	parse_state *st = fz_malloc_struct(ctx, parse_state);
+	int *ofs = NULL;
+	int i, xref;
+
+	fz_var(ofs);
+
+	fz_try(ctx)
+	{
+		st->arena = arena;
+		st->pdf = fz_new_buffer(ctx, 4 << 20);
+		ofs = fz_malloc_array(ctx, PARSE_OBJECTS, sizeof *ofs);
+		seed = 11;
+
+		fz_buffer_printf(ctx, st->pdf, "%%PDF-1.4\n");
+		ofs[1] = st->pdf->len;
+		fz_buffer_printf(ctx, st->pdf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+		ofs[2] = st->pdf->len;
+		fz_buffer_printf(ctx, st->pdf, "2 0 obj\n<</Type/Pages/Count 0/Kids[]>>\nendobj\n");
+		for (i = 3; i < PARSE_OBJECTS; i++)
+		{
+			ofs[i] = st->pdf->len;
+			put_parse_object(ctx, st->pdf, i);
+		}
+
+		xref = st->pdf->len;
+		fz_buffer_printf(ctx, st->pdf, "xref\n0 %d\n0000000000 65535 f \n", PARSE_OBJECTS);
+		for (i = 1; i < PARSE_OBJECTS; i++)
+			fz_buffer_printf(ctx, st->pdf, "%010d 00000 n \n", ofs[i]);
+		fz_buffer_printf(ctx, st->pdf, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%d\n%%%%EOF\n", PARSE_OBJECTS, xref);
+	}
+	fz_always(ctx)
+		fz_free(ctx, ofs);
+	fz_catch(ctx)
+	{
+		drop_parse_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void *setup_parse_heap(fz_context *ctx)
+{
+	return new_parse_state(ctx, 0);
+}
+
+static void *setup_parse_arena(fz_context *ctx)
+{
+	return new_parse_state(ctx, 1);
+}
+
+/* Load every object, then drop the document. */
+static size_t run_parse(fz_context *ctx, void *state)
+{
+	parse_state *st = state;
+	pdf_document *doc = (pdf_document *)open_test_pdf(ctx, st->pdf);
+	int i;
+
+	fz_try(ctx)
+	{
+		if (st->arena)
+			pdf_enable_object_arena(ctx, doc);
+		for (i = 1; i < PARSE_OBJECTS; i++)
+			pdf_drop_obj(ctx, pdf_load_object(ctx, doc, i));
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return st->pdf->len;
+}
+
+/* --- Page lookup --- */
+
+enum { TREE_NODES = 100, TREE_KIDS = 200, TREE_LOOKUPS = 2000 };
+
+typedef struct
+{
+	int walk;
+	fz_buffer *pdf;
+	pdf_document *doc;
+} tree_state;
+
+static void drop_tree_state(fz_context *ctx, void *state)
+{
+	tree_state *st = state;
+	pdf_drop_document(ctx, st->doc);
+	fz_drop_buffer(ctx, st->pdf);
+	fz_free(ctx, st);
+}
+
+/* A two level page tree of TREE_NODES * TREE_KIDS pages. */
+static void *new_tree_state(fz_context *ctx, int walk)
+{
+	tree_state *st = fz_malloc_struct(ctx, tree_state);
+	int count = TREE_NODES * TREE_KIDS;
+	int first_page = 3 + TREE_NODES;
+	int size = first_page + count;
+	int *ofs = NULL;
+	int i, k, xref;
+
+	fz_var(ofs);
+
+	fz_try(ctx)
+	{
+		st->walk = walk;
+		st->pdf = fz_new_buffer(ctx, 4 << 20);
+		ofs = fz_malloc_array(ctx, size, sizeof *ofs);
+
+		fz_buffer_printf(ctx, st->pdf, "%%PDF-1.4\n");
+		ofs[1] = st->pdf->len;
+		fz_buffer_printf(ctx, st->pdf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+		ofs[2] = st->pdf->len;
+		fz_buffer_printf(ctx, st->pdf, "2 0 obj\n<</Type/Pages/Count %d/Kids[", count);
+		for (i = 0; i < TREE_NODES; i++)
+			fz_buffer_printf(ctx, st->pdf, "%d 0 R ", 3 + i);
+		fz_buffer_printf(ctx, st->pdf, "]>>\nendobj\n");
+		for (i = 0; i < TREE_NODES; i++)
+		{
+			ofs[3 + i] = st->pdf->len;
+			fz_buffer_printf(ctx, st->pdf, "%d 0 obj\n<</Type/Pages/Parent 2 0 R/Count %d/Kids[", 3 + i, TREE_KIDS);
+			for (k = 0; k < TREE_KIDS; k++)
+				fz_buffer_printf(ctx, st->pdf, "%d 0 R ", first_page + i * TREE_KIDS + k);
+			fz_buffer_printf(ctx, st->pdf, "]>>\nendobj\n");
+		}
+		for (i = 0; i < count; i++)
+		{
+			ofs[first_page + i] = st->pdf->len;
+			fz_buffer_printf(ctx, st->pdf, "%d 0 obj\n<</Type/Page/Parent %d 0 R/MediaBox[0 0 612 792]>>\nendobj\n",
+				first_page + i, 3 + i / TREE_KIDS);
+		}
+
+		xref = st->pdf->len;
+		fz_buffer_printf(ctx, st->pdf, "xref\n0 %d\n0000000000 65535 f \n", size);
+		for (i = 1; i < size; i++)
+			fz_buffer_printf(ctx, st->pdf, "%010d 00000 n \n", ofs[i]);
+		fz_buffer_printf(ctx, st->pdf, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%d\n%%%%EOF\n", size, xref);
+
+		st->doc = (pdf_document *)open_test_pdf(ctx, st->pdf);
+	}
+	fz_always(ctx)
+		fz_free(ctx, ofs);
+	fz_catch(ctx)
+	{
+		drop_tree_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void *setup_tree_walk(fz_context *ctx)
+{
+	return new_tree_state(ctx, 1);
+}
+
+static void *setup_tree_index(fz_context *ctx)
+{
+	return new_tree_state(ctx, 0);
+}
+
+/* Look up random pages by number, and their numbers back from the objects. */
+static size_t run_tree(fz_context *ctx, void *state)
+{
+	tree_state *st = state;
+	int i, page;
+
+	seed = 13;
+	for (i = 0; i < TREE_LOOKUPS; i++)
+	{
+		pdf_obj *ref;
+
+		page = rnd() % (TREE_NODES * TREE_KIDS);
+		if (st->walk)
+			pdf_invalidate_page_tree(ctx, st->doc);
+		ref = pdf_lookup_page_obj(ctx, st->doc, page);
+		if (st->walk)
+			pdf_invalidate_page_tree(ctx, st->doc);
+		if (pdf_lookup_page_number(ctx, st->doc, ref) != page)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "page %d lookup mismatch", page);
+	}
+	return 0;
+}
+
+/* --- Sidecar xref index --- */
+
+/*
+	A one page file dated beyond INT_MAX seconds, and with large file
+	support also placed beyond INT_MAX bytes into the file. The index
+	written when it is first opened must be reused by every later open,
+	so its 64-bit fields have to survive the round trip.
+*/
+#define INDEX_HOLE ((int64_t)3 << 30)
+#define INDEX_MARK "%mubench\n"
+
+typedef struct
+{
+	char pdf[1024];
+	char idx[1024];
+} index_state;
+
+static void drop_index_state(fz_context *ctx, void *state)
+{
+	index_state *st = state;
+	remove(st->pdf);
+	remove(st->idx);
+	fz_free(ctx, st);
+}
+
+static void write_index_pdf(fz_context *ctx, const char *filename)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 1024);
+	FILE *file = NULL;
+	int64_t base, ofs[4];
+	int64_t xref;
+	int i;
+
+	fz_var(file);
+
+	fz_try(ctx)
+	{
+		file = fz_fopen(filename, "wb");
+		if (!file)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create '%s'", filename);
+		fputs("%PDF-1.4\n", file);
+#ifdef FZ_LARGEFILE
+		/* A hole, so that the file does not take up the space */
+		if (fz_fseek(file, INDEX_HOLE, SEEK_SET) < 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot seek in '%s'", filename);
+#endif
+		base = fz_ftell(file);
+
+		ofs[1] = base + buf->len;
+		fz_buffer_printf(ctx, buf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+		ofs[2] = base + buf->len;
+		fz_buffer_printf(ctx, buf, "2 0 obj\n<</Type/Pages/Count 1/Kids[3 0 R]>>\nendobj\n");
+		ofs[3] = base + buf->len;
+		fz_buffer_printf(ctx, buf, "3 0 obj\n<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]>>\nendobj\n");
+		xref = base + buf->len;
+		fz_buffer_printf(ctx, buf, "xref\n0 4\n0000000000 65535 f \n");
+		for (i = 1; i < 4; i++)
+			fz_buffer_printf(ctx, buf, "%010lld 00000 n \n", (long long)ofs[i]);
+		fz_buffer_printf(ctx, buf, "trailer\n<</Size 4/Root 1 0 R>>\nstartxref\n%lld\n%%%%EOF\n", (long long)xref);
+
+		if (fwrite(buf->data, 1, buf->len, file) != buf->len)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write '%s'", filename);
+	}
+	fz_always(ctx)
+	{
+		if (file)
+			fclose(file);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void *setup_index(fz_context *ctx)
+{
+	index_state *st = fz_malloc_struct(ctx, index_state);
+	const char *dir = getenv("TMPDIR");
+	struct utimbuf times;
+	FILE *file;
+
+	if (!dir)
+		dir = getenv("TEMP");
+	if (!dir)
+		dir = "/tmp";
+	fz_snprintf(st->pdf, sizeof st->pdf, "%s/mubench-index.pdf", dir);
+	fz_snprintf(st->idx, sizeof st->idx, "%s/mubench-index.idx", dir);
+
+	fz_try(ctx)
+	{
+		remove(st->idx);
+		write_index_pdf(ctx, st->pdf);
+		if (sizeof(time_t) > 4)
+		{
+			times.actime = times.modtime = (time_t)3000000000.0;
+			if (utime(st->pdf, &times) < 0)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot date '%s'", st->pdf);
+		}
+
+		/* Writes the index */
+		pdf_drop_document(ctx, pdf_open_document_with_index(ctx, st->pdf, st->idx));
+
+		/* Rewriting the index would lose the mark */
+		file = fopen(st->idx, "ab");
+		if (!file)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "xref index was not written");
+		fputs(INDEX_MARK, file);
+		fclose(file);
+	}
+	fz_catch(ctx)
+	{
+		drop_index_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+/* Reopen the file, and check that the index was used rather than rewritten. */
+static size_t run_index(fz_context *ctx, void *state)
+{
+	index_state *st = state;
+	pdf_document *doc;
+	char tail[sizeof INDEX_MARK];
+	FILE *file;
+	int ok;
+
+	doc = pdf_open_document_with_index(ctx, st->pdf, st->idx);
+	fz_try(ctx)
+	{
+		if (pdf_count_pages(ctx, doc) != 1 || !pdf_lookup_page_obj(ctx, doc, 0))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "wrong page tree from xref index");
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	ok = 0;
+	file = fopen(st->idx, "rb");
+	if (file)
+	{
+		if (fseek(file, -(long)strlen(INDEX_MARK), SEEK_END) == 0)
+		{
+			tail[fread(tail, 1, strlen(INDEX_MARK), file)] = 0;
+			ok = !strcmp(tail, INDEX_MARK);
+		}
+		fclose(file);
+	}
+	if (!ok)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "xref index was rewritten instead of reused");
+	return 0;
+}
+
+/* --- Raster printer output --- */
+
+enum { RASTER_W = 2550, RASTER_H = 3300 };
+
+typedef struct
+{
+	int threads;
+	fz_pixmap *rgba;
+	fz_pixmap *rgb;
+	fz_bitmap *bitmap;
+	fz_buffer *buf;
+	fz_output *out;
+} raster_state;
+
+static void drop_raster_state(fz_context *ctx, void *state)
+{
+	raster_state *st = state;
+	fz_drop_output(ctx, st->out);
+	fz_drop_buffer(ctx, st->buf);
+	fz_drop_bitmap(ctx, st->bitmap);
+	fz_drop_pixmap(ctx, st->rgb);
+	fz_drop_pixmap(ctx, st->rgba);
+	fz_free(ctx, st);
+}
+
+/* A 300dpi letter page of white paper with lines of 'words' in
+ * random colours, which is what printed text pages look like to the
+ * row compressors. */
+static void *new_raster_state(fz_context *ctx, int threads)
+{
+	raster_state *st = fz_malloc_struct(ctx, raster_state);
+	fz_pixmap *gray = NULL;
+	int x, y;
+
+	fz_var(gray);
+
+	fz_try(ctx)
+	{
+		st->threads = threads;
+		st->rgb = fz_new_pixmap(ctx, fz_device_rgb(ctx), RASTER_W, RASTER_H, 0);
+		fz_clear_pixmap_with_value(ctx, st->rgb, 255);
+		seed = 17;
+		for (y = 150; y + 40 < RASTER_H - 150; y += 50)
+		{
+			x = 150;
+			while (x < RASTER_W - 300)
+			{
+				int w = 20 + rnd() % 120;
+				int v = rnd() % 160;
+				int r, i;
+				for (r = 0; r < 32; r++)
+				{
+					unsigned char *p = st->rgb->samples + (y + r) * st->rgb->stride + x * 3;
+					for (i = 0; i < w; i++, p += 3)
+					{
+						if (((i * 7 + r * 3) & 15) < 9)
+						{
+							p[0] = v;
+							p[1] = v / 2;
+							p[2] = v / 3;
+						}
+					}
+				}
+				x += w + 25;
+			}
+		}
+		/* Colour PCL wants rgb with (ignored) alpha. */
+		st->rgba = fz_new_pixmap(ctx, fz_device_rgb(ctx), RASTER_W, RASTER_H, 1);
+		for (y = 0; y < RASTER_H; y++)
+		{
+			unsigned char *s = st->rgb->samples + y * st->rgb->stride;
+			unsigned char *d = st->rgba->samples + y * st->rgba->stride;
+			for (x = 0; x < RASTER_W; x++, s += 3, d += 4)
+			{
+				d[0] = s[0];
+				d[1] = s[1];
+				d[2] = s[2];
+				d[3] = 255;
+			}
+		}
+		gray = fz_new_pixmap(ctx, fz_device_gray(ctx), RASTER_W, RASTER_H, 0);
+		fz_convert_pixmap(ctx, gray, st->rgb);
+		st->bitmap = fz_new_bitmap_from_pixmap(ctx, gray, NULL);
+		st->buf = fz_new_buffer(ctx, 8 << 20);
+		st->out = fz_new_output_with_buffer(ctx, st->buf);
+	}
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, gray);
+	fz_catch(ctx)
+	{
+		drop_raster_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void *setup_raster_serial(fz_context *ctx)
+{
+	return new_raster_state(ctx, 1);
+}
+
+static void *setup_raster_threads(fz_context *ctx)
+{
+	return new_raster_state(ctx, bench_threads);
+}
+
+/* Write the page as colour PCL, mono PCL and colour and mono PWG. */
+static size_t run_raster(fz_context *ctx, void *state)
+{
+	raster_state *st = state;
+	int threads = fz_worker_threads(ctx);
+
+	st->buf->len = 0;
+	fz_tune_worker_threads(ctx, st->threads);
+	fz_try(ctx)
+	{
+		fz_write_pixmap_as_pcl(ctx, st->out, st->rgba, NULL);
+		fz_write_bitmap_as_pcl(ctx, st->out, st->bitmap, NULL);
+		fz_write_pixmap_as_pwg(ctx, st->out, st->rgb, NULL);
+		fz_write_bitmap_as_pwg(ctx, st->out, st->bitmap, NULL);
+	}
+	fz_always(ctx)
+		fz_tune_worker_threads(ctx, threads);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return (size_t)RASTER_W * RASTER_H * 4;
+}
+
+typedef struct
+{
+	fz_pixmap *pix;
+	fz_halftone *ht;
+} halftone_state;
+
+static void drop_halftone_state(fz_context *ctx, void *state)
+{
+	halftone_state *st = state;
+	fz_drop_halftone(ctx, st->ht);
+	fz_drop_pixmap(ctx, st->pix);
+	fz_free(ctx, st);
+}
+
+static void *new_halftone_state(fz_context *ctx, int method)
+{
+	halftone_state *st = fz_malloc_struct(ctx, halftone_state);
+	fz_try(ctx)
+	{
+		unsigned char *s;
+		size_t i, len;
+
+		st->pix = fz_new_pixmap(ctx, fz_device_gray(ctx), PAGE_W, PAGE_H, 0);
+		seed = 4;
+		s = fz_pixmap_samples(ctx, st->pix);
+		len = pixmap_bytes(ctx, st->pix);
+		for (i = 0; i < len; i++)
+			s[i] = (i / 7 + (rnd() & 15)) & 255;
+		if (method != FZ_HALFTONE_THRESHOLD)
+			st->ht = fz_new_error_diffusion_halftone(ctx, 1, method);
+	}
+	fz_catch(ctx)
+	{
+		drop_halftone_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void *setup_halftone_threshold(fz_context *ctx)
+{
+	return new_halftone_state(ctx, FZ_HALFTONE_THRESHOLD);
+}
+
+static void *setup_halftone_floyd(fz_context *ctx)
+{
+	return new_halftone_state(ctx, FZ_HALFTONE_FLOYD_STEINBERG);
+}
+
+static void *setup_halftone_stucki(fz_context *ctx)
+{
+	return new_halftone_state(ctx, FZ_HALFTONE_STUCKI);
+}
+
+static size_t run_halftone(fz_context *ctx, void *state)
+{
+	halftone_state *st = state;
+	fz_drop_bitmap(ctx, fz_new_bitmap_from_pixmap(ctx, st->pix, st->ht));
+	return pixmap_bytes(ctx, st->pix);
+}
+
+enum { ENCODE_PAGES = 4 };
+
+typedef struct
+{
+	fz_pixmap *pages[ENCODE_PAGES];
+	int jpeg;
+	int threads;
+} encode_state;
+
+static void drop_encode_state(fz_context *ctx, void *state)
+{
+	encode_state *st = state;
+	int i;
+	for (i = 0; i < ENCODE_PAGES; i++)
+		fz_drop_pixmap(ctx, st->pages[i]);
+	fz_free(ctx, st);
+}
+
+static void *new_encode_state(fz_context *ctx, int jpeg, int threads)
+{
+	encode_state *st = fz_malloc_struct(ctx, encode_state);
+	fz_try(ctx)
+	{
+		int i, x, y;
+
+		st->jpeg = jpeg;
+		st->threads = threads;
+		seed = 23;
+		for (i = 0; i < ENCODE_PAGES; i++)
+		{
+			st->pages[i] = fz_new_pixmap(ctx, fz_device_rgb(ctx), PAGE_W, PAGE_H, 0);
+			for (y = 0; y < PAGE_H; y++)
+			{
+				unsigned char *p = st->pages[i]->samples + y * st->pages[i]->stride;
+				for (x = 0; x < PAGE_W; x++, p += 3)
+				{
+					/* A smooth backdrop with blocky "text" and a little noise, like a scanned page. */
+					int v = ((x >> 5) + (y >> 4)) & 1 ? 40 : 230;
+					if (y % 48 > 36 || x < 64 || x > PAGE_W - 64)
+						v = 230;
+					v += rnd() % 9;
+					p[0] = v;
+					p[1] = v - (x * 20 / PAGE_W);
+					p[2] = v - (y * 20 / PAGE_H);
+				}
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		drop_encode_state(ctx, st);
+		fz_rethrow(ctx);
+	}
+	return st;
+}
+
+static void *setup_encode_png(fz_context *ctx)
+{
+	return new_encode_state(ctx, 0, 1);
+}
+
+static void *setup_encode_jpeg(fz_context *ctx)
+{
+	return new_encode_state(ctx, 1, 1);
+}
+
+static void *setup_encode_png_threads(fz_context *ctx)
+{
+	return new_encode_state(ctx, 0, bench_threads);
+}
+
+static void encode_worker(fz_context *ctx, void *arg, int idx)
+{
+	encode_state *st = arg;
+	if (st->jpeg)
+		fz_drop_buffer(ctx, fz_new_buffer_from_pixmap_as_jpeg(ctx, st->pages[idx], 90));
+	else
+		fz_drop_buffer(ctx, fz_new_buffer_from_pixmap_as_png(ctx, st->pages[idx]));
+}
+
+/* Encode a batch of pages the way the cbz writer does. */
+static size_t run_encode(fz_context *ctx, void *state)
+{
+	encode_state *st = state;
+	fz_run_workers(ctx, st->threads, ENCODE_PAGES, encode_worker, st);
+	return pixmap_bytes(ctx, st->pages[0]) * ENCODE_PAGES;
+}
+
+static const bench benches[] =
+{
+	{ "paint-solid", "opaque rectangle fills (draw-paint)", setup_paint_solid, run_paint_solid, drop_draw_state },
+	{ "paint-alpha", "translucent rectangle fills onto alpha pixmap (draw-paint)", setup_paint_alpha, run_paint_alpha, drop_draw_state },
+	{ "edge-nonzero", "2001 point star, non-zero winding (draw-edge)", setup_edge_star, run_edge_nonzero, drop_draw_state },
+	{ "edge-evenodd", "2001 point star, even-odd (draw-edge)", setup_edge_star, run_edge_evenodd, drop_draw_state },
+	{ "edge-stroke", "stroked bezier curves with round joins (draw-path, draw-edge)", setup_edge_stroke, run_edge_stroke, drop_draw_state },
+	{ "edge-small", "5000 fills of a small rectangle (draw-path, draw-edge)", setup_edge_small, run_edge_small, drop_draw_state },
+	{ "edge-cache", "one path filled and stroked several ways, cached and not (draw-path)", setup_path_cache, run_path_cache, drop_draw_state },
+	{ "affine-upright", "scaled image (draw-affine)", setup_affine, run_affine_upright, drop_draw_state },
+	{ "affine-rotated", "scaled and rotated image (draw-affine)", setup_affine, run_affine_rotated, drop_draw_state },
+	{ "convert-rgb-gray", "pixmap conversion rgb to gray (colorspace)", setup_rgb_to_gray, run_convert, drop_convert_state },
+	{ "convert-rgb-cmyk", "pixmap conversion rgb to cmyk (colorspace)", setup_rgb_to_cmyk, run_convert, drop_convert_state },
+	{ "convert-cmyk-rgb", "pixmap conversion cmyk to rgb (colorspace)", setup_cmyk_to_rgb, run_convert, drop_convert_state },
+	{ "decode-flate", "inflate 4MB (filter-flate)", setup_flate, run_flate, drop_stream_state },
+	{ "decode-dct", "decode 2048x1024 rgb jpeg (filter-dct)", setup_dct, run_dct, drop_stream_state },
+	{ "pdf-lex", "tokenize 4MB of content stream (pdf-lex)", setup_lex, run_lex, drop_stream_state },
+	{ "display-list", "run a 200 node display list to a draw device", setup_display_list, run_display_list, drop_draw_state },
+	{ "stext-page", "extract structured text from 60 lines of words (stext-device)", setup_stext, run_stext, drop_stext_state },
+	{ "alloc-serial", "small malloc/free churn on one thread (memory)", setup_alloc_serial, run_alloc, drop_alloc_state },
+	{ "alloc-threads", "the same churn spread over -T threads (memory)", setup_alloc_threads, run_alloc, drop_alloc_state },
+	{ "pdf-pages-serial", "open a generated pdf and render its 24 pages", setup_doc_serial, run_doc, drop_doc_state },
+	{ "pdf-pages-threads", "the same pages rendered on -T threads from one document", setup_doc_threads, run_doc, drop_doc_state },
+	{ "pdf-annots-threads", "the same with annotations, some lacking appearances", setup_annot_threads, run_doc, drop_doc_state },
+	{ "pdf-parse-heap", "load 20000 typical objects, each allocated separately (pdf-parse)", setup_parse_heap, run_parse, drop_parse_state },
+	{ "pdf-parse-arena", "the same objects allocated from an object arena (pdf-object)", setup_parse_arena, run_parse, drop_parse_state },
+	{ "pdf-page-walk", "look up random pages of 20000 by walking the page tree (pdf-page)", setup_tree_walk, run_tree, drop_tree_state },
+	{ "pdf-page-index", "the same lookups through the flat page index (pdf-page)", setup_tree_index, run_tree, drop_tree_state },
+	{ "pdf-open-index", "reopen a file with offsets and dates beyond INT_MAX from its xref index (pdf-xref)", setup_index, run_index, drop_index_state },
+	{ "raster-serial", "write a 300dpi page as pcl and pwg (output-pcl, output-pwg)", setup_raster_serial, run_raster, drop_raster_state },
+	{ "raster-threads", "the same with rows compressed on -T threads", setup_raster_threads, run_raster, drop_raster_state },
+	{ "halftone-threshold", "ordered threshold a gray page to 1bpp (halftone)", setup_halftone_threshold, run_halftone, drop_halftone_state },
+	{ "halftone-floyd", "floyd-steinberg error diffusion of the same page (halftone)", setup_halftone_floyd, run_halftone, drop_halftone_state },
+	{ "halftone-stucki", "stucki error diffusion of the same page (halftone)", setup_halftone_stucki, run_halftone, drop_halftone_state },
+	{ "encode-png", "png encode 4 rgb pages, as written to cbz (output-png)", setup_encode_png, run_encode, drop_encode_state },
+	{ "encode-jpeg", "jpeg encode the same pages at quality 90 (output-jpeg)", setup_encode_jpeg, run_encode, drop_encode_state },
+	{ "encode-png-threads", "png encode the same pages on -T threads (output-cbz)", setup_encode_png_threads, run_encode, drop_encode_state },
+};
+
+static int run_bench(fz_context *ctx, const bench *b, double min_time, int min_iterations, bench_result *res)
+{
+	void *state = NULL;
+	fz_alloc_stats before, after;
+	double start, t;
+
+	fz_var(state);
+
+	memset(res, 0, sizeof *res);
+	fz_try(ctx)
+	{
+		state = b->setup(ctx);
+
+		/* Warm up caches before measuring. */
+		b->run(ctx, state);
+
+		fz_get_alloc_stats(ctx, &before);
+		start = now_ms();
+		do
+		{
+			t = now_ms();
+			res->bytes = b->run(ctx, state);
+			t = now_ms() - t;
+			if (res->iterations == 0 || t < res->min)
+				res->min = t;
+			if (t > res->max)
+				res->max = t;
+			res->iterations++;
+		}
+		while (res->iterations < min_iterations || now_ms() - start < min_time);
+		res->total = now_ms() - start;
+		fz_get_alloc_stats(ctx, &after);
+		res->allocs = (double)(after.allocs + after.reallocs - before.allocs - before.reallocs) / res->iterations;
+		res->alloc_kb = (after.bytes - before.bytes) / 1024.0 / res->iterations;
+	}
+	fz_always(ctx)
+	{
+		if (state)
+			b->drop(ctx, state);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "mubench: %s failed: %s\n", b->name, fz_caught_message(ctx));
+		return 0;
+	}
+	return 1;
+}
+
+static double mb_per_second(const bench_result *res)
+{
+	double mean = res->total / res->iterations;
+	if (res->bytes == 0 || mean <= 0)
+		return 0;
+	return res->bytes / (1024.0 * 1024.0) / (mean / 1000.0);
+}
+
+static void print_result(FILE *out, int format, const bench *b, const bench_result *res, int first)
+{
+	double mean = res->total / res->iterations;
+	switch (format)
+	{
+	case OUT_TEXT:
+		fprintf(out, "%-18s %8d %10.3f %10.3f %10.3f %10.0f %10.1f", b->name, res->iterations, mean, res->min, res->max, res->allocs, res->alloc_kb);
+		if (res->bytes)
+			fprintf(out, " %10.1f", mb_per_second(res));
+		fprintf(out, "\n");
+		break;
+	case OUT_CSV:
+		fprintf(out, "%s,%d,%.4f,%.4f,%.4f,%.0f,%.1f,%.2f\n", b->name, res->iterations, mean, res->min, res->max, res->allocs, res->alloc_kb, mb_per_second(res));
+		break;
+	case OUT_JSON:
+		fprintf(out, "%s\n\t\t{ \"name\": \"%s\", \"iterations\": %d, \"mean_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f, \"allocs\": %.0f, \"alloc_kb\": %.1f, \"mb_per_s\": %.2f }",
+			first ? "" : ",", b->name, res->iterations, mean, res->min, res->max, res->allocs, res->alloc_kb, mb_per_second(res));
+		break;
+	}
+}
+
+static void usage(void)
+{
+	int i;
+	fprintf(stderr,
+		"mubench version " FZ_VERSION "\n"
+		"Usage: mubench [options] [benchmark names]\n"
+		"\t-o -\toutput file name (default: stdout)\n"
+		"\t-F -\toutput format: text, json or csv\n\t\t(default: inferred from output file name, or text)\n"
+		"\t-t -\tminimum time to spend per benchmark in ms (default: 500)\n"
+		"\t-n -\tminimum number of iterations per benchmark (default: 5)\n"
+		"\t-A -\tnumber of bits of antialiasing for graphics (0 to 8, or 9 for exact area)\n"
+		"\t-T -\tnumber of threads for the threaded benchmarks (default: 4)\n"
+		"\t-l\tlist the benchmarks and exit\n"
+		"\n"
+		"Benchmarks:\n");
+	for (i = 0; i < nelem(benches); i++)
+		fprintf(stderr, "\t%-18s %s\n", benches[i].name, benches[i].desc);
+	exit(1);
+}
+
+static int selected(const bench *b, int argc, char **argv)
+{
+	int i;
+	if (argc == 0)
+		return 1;
+	for (i = 0; i < argc; i++)
+		if (strstr(b->name, argv[i]))
+			return 1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = NULL;
+	int format = OUT_UNSET;
+	double min_time = 500;
+	int min_iterations = 5;
+	int aa_level = -1;
+	int i, c, first = 1, failed = 0;
+	FILE *out = stdout;
+	fz_context *ctx;
+	bench_result res;
+
+	while ((c = fz_getopt(argc, argv, "o:F:t:n:A:T:l")) != -1)
+	{
+		switch (c)
+		{
+		default: usage(); break;
+		case 'o': output = fz_optarg; break;
+		case 'F':
+			if (!strcmp(fz_optarg, "json")) format = OUT_JSON;
+			else if (!strcmp(fz_optarg, "csv")) format = OUT_CSV;
+			else if (!strcmp(fz_optarg, "text")) format = OUT_TEXT;
+			else usage();
+			break;
+		case 't': min_time = fz_atof(fz_optarg); break;
+		case 'n': min_iterations = fz_atoi(fz_optarg); break;
+		case 'A': aa_level = fz_atoi(fz_optarg); break;
+		case 'T': bench_threads = fz_atoi(fz_optarg); break;
+		case 'l':
+			for (i = 0; i < nelem(benches); i++)
+				printf("%s\n", benches[i].name);
+			return 0;
+		}
+	}
+
+	ctx = fz_new_context(NULL, LOCKS_INIT(), FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "mubench: cannot initialise context\n");
+		LOCKS_FIN();
+		return 1;
+	}
+
+	if (aa_level >= 0)
+		fz_set_graphics_aa_level(ctx, aa_level);
+
+	if (output)
+	{
+		out = fopen(output, "w");
+		if (!out)
+		{
+			fprintf(stderr, "mubench: cannot open output file '%s'\n", output);
+			fz_drop_context(ctx);
+			LOCKS_FIN();
+			return 1;
+		}
+		if (!format && strstr(output, ".json")) format = OUT_JSON;
+		if (!format && strstr(output, ".csv")) format = OUT_CSV;
+	}
+	if (!format)
+		format = OUT_TEXT;
+
+	switch (format)
+	{
+	case OUT_TEXT:
+		fprintf(out, "%-18s %8s %10s %10s %10s %10s %10s %10s\n", "benchmark", "iters", "mean ms", "min ms", "max ms", "allocs", "alloc KB", "MB/s");
+		break;
+	case OUT_CSV:
+		fprintf(out, "name,iterations,mean_ms,min_ms,max_ms,allocs,alloc_kb,mb_per_s\n");
+		break;
+	case OUT_JSON:
+		fprintf(out, "{\n\t\"version\": \"%s\",\n\t\"results\": [", FZ_VERSION);
+		break;
+	}
+
+	for (i = 0; i < nelem(benches); i++)
+	{
+		if (!selected(&benches[i], argc - fz_optind, argv + fz_optind))
+			continue;
+		if (run_bench(ctx, &benches[i], min_time, min_iterations, &res))
+		{
+			print_result(out, format, &benches[i], &res, first);
+			first = 0;
+		}
+		else
+			failed = 1;
+		fflush(out);
+	}
+
+	if (format == OUT_JSON)
+		fprintf(out, "\n\t]\n}\n");
+
+	if (out != stdout)
+		fclose(out);
+	fz_drop_context(ctx);
+	LOCKS_FIN();
+	return failed;
+}
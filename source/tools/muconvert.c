@@ -4,6 +4,8 @@
 
 #include "mupdf/fitz.h"
 
+#include "tool-threads.h"
+
 /* input options */
 static const char *password = "";
 static int alphabits = 8;
@@ -21,6 +23,70 @@ static fz_context *ctx;
 static fz_document *doc;
 static fz_document_writer *out;
 static int count;
+static char **input_args;
+static int current_arg;
+
+/*
+	With -P, the main thread interprets each page into a display
+	list while a background thread plays the previous page's list
+	into the document writer. At most one page is in flight, so
+	memory use stays bounded by two pages.
+*/
+static struct {
+	int active;
+	int started;
+	fz_context *ctx;
+	THREAD thread;
+	SEMAPHORE start;
+	SEMAPHORE stop;
+	fz_display_list *list; /* NULL to shutdown */
+	fz_rect mediabox;
+	int failed;
+	char message[256];
+} bgwrite;
+
+/*
+	With -T, worker threads interpret pages into display lists,
+	each on its own cloned context with its own copy of the input
+	documents. The lists are passed back through a ring of 'depth'
+	slots, and the main thread plays them into the document writer
+	in page order. A worker may only claim a page once its slot has
+	been emptied, so at most 'depth' pages are held in memory.
+*/
+typedef struct
+{
+	int arg; /* index into argv of the input file */
+	int number;
+} convert_job;
+
+typedef struct
+{
+	SEMAPHORE ready;
+	fz_display_list *list;
+	fz_rect mediabox;
+	int failed;
+	char message[256];
+} convert_slot;
+
+typedef struct
+{
+	fz_context *ctx;
+	THREAD thread;
+	fz_document **docs; /* indexed by argv index */
+} convert_worker;
+
+static struct {
+	int num_workers;
+	convert_worker *workers;
+	convert_job *jobs;
+	int job_count;
+	int job_max;
+	MUTEX mutex;
+	int next;
+	SEMAPHORE space;
+	convert_slot *slots;
+	int depth;
+} pool;
 
 static void usage(void)
 {
@@ -39,6 +105,8 @@ static void usage(void)
 		"\t-F -\toutput format (default inferred from output file name)\n"
 		"\t\tcbz, pdf, png\n"
 		"\t-O -\tcomma separated list of options for output format\n"
+		"\t-P\tparallel interpretation/writing\n"
+		"\t-T -\tnumber of threads to interpret pages with\n"
 		"\n"
 		"\tpages\tcomma separated list of page ranges (N=last page)\n"
 		"\n"
@@ -52,18 +120,301 @@ static void usage(void)
 	exit(1);
 }
 
+static fz_document *open_input(fz_context *ctx, const char *filename)
+{
+	fz_document *doc = fz_open_document(ctx, filename);
+	fz_try(ctx)
+	{
+		if (fz_needs_password(ctx, doc))
+			if (!fz_authenticate_password(ctx, doc, password))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", filename);
+		fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
+	return doc;
+}
+
+static fz_display_list *new_page_list(fz_context *ctx, fz_document *doc, int number, fz_rect *mediabox)
+{
+	fz_page *page;
+	fz_device *dev = NULL;
+	fz_display_list *list = NULL;
+
+	fz_var(dev);
+	fz_var(list);
+
+	page = fz_load_page(ctx, doc, number - 1);
+	fz_try(ctx)
+	{
+		fz_bound_page(ctx, page, mediabox);
+		list = fz_new_display_list(ctx, mediabox);
+		dev = fz_new_list_device(ctx, list);
+		fz_run_page(ctx, page, dev, &fz_identity, NULL);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_page(ctx, page);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+	return list;
+}
+
+static void write_page_list(fz_context *ctx, fz_display_list *list, const fz_rect *mediabox)
+{
+	fz_device *dev;
+
+	fz_try(ctx)
+	{
+		dev = fz_begin_page(ctx, out, mediabox);
+		fz_run_display_list(ctx, list, dev, &fz_identity, NULL, NULL);
+		fz_end_page(ctx, out, dev);
+	}
+	fz_always(ctx)
+		fz_drop_display_list(ctx, list);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+#ifdef TOOL_THREADS
+static THREAD_RETURN_TYPE bgwrite_worker(void *arg)
+{
+	fz_display_list *list;
+
+	(void)arg;
+
+	do
+	{
+		SEMAPHORE_WAIT(bgwrite.start);
+		list = bgwrite.list;
+		if (list)
+		{
+			fz_try(bgwrite.ctx)
+				write_page_list(bgwrite.ctx, list, &bgwrite.mediabox);
+			fz_catch(bgwrite.ctx)
+			{
+				bgwrite.failed = 1;
+				fz_strlcpy(bgwrite.message, fz_caught_message(bgwrite.ctx), sizeof bgwrite.message);
+			}
+		}
+		SEMAPHORE_TRIGGER(bgwrite.stop);
+	}
+	while (list);
+	THREAD_RETURN();
+}
+#endif
+
+static void bgwrite_flush(void)
+{
+	if (!bgwrite.active || !bgwrite.started)
+		return;
+
+	SEMAPHORE_WAIT(bgwrite.stop);
+	bgwrite.started = 0;
+	if (bgwrite.failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%s", bgwrite.message);
+}
+
+#ifdef TOOL_THREADS
+static THREAD_RETURN_TYPE pool_worker(void *arg)
+{
+	convert_worker *me = (convert_worker *)arg;
+	convert_job *job;
+	convert_slot *slot;
+	int seq;
+
+	for (;;)
+	{
+		SEMAPHORE_WAIT(pool.space);
+		MUTEX_LOCK(pool.mutex);
+		seq = pool.next++;
+		MUTEX_UNLOCK(pool.mutex);
+		if (seq >= pool.job_count)
+			break;
+
+		job = &pool.jobs[seq];
+		slot = &pool.slots[seq % pool.depth];
+		slot->list = NULL;
+		slot->failed = 0;
+		fz_try(me->ctx)
+		{
+			if (!me->docs[job->arg])
+				me->docs[job->arg] = open_input(me->ctx, input_args[job->arg]);
+			slot->list = new_page_list(me->ctx, me->docs[job->arg], job->number, &slot->mediabox);
+		}
+		fz_catch(me->ctx)
+		{
+			slot->failed = 1;
+			fz_strlcpy(slot->message, fz_caught_message(me->ctx), sizeof slot->message);
+		}
+		SEMAPHORE_TRIGGER(slot->ready);
+	}
+	THREAD_RETURN();
+}
+#endif
+
+static void queue_page(int number)
+{
+	if (pool.job_count == pool.job_max)
+	{
+		int new_max = pool.job_max ? pool.job_max * 2 : 64;
+		pool.jobs = fz_resize_array(ctx, pool.jobs, new_max, sizeof *pool.jobs);
+		pool.job_max = new_max;
+	}
+	pool.jobs[pool.job_count].arg = current_arg;
+	pool.jobs[pool.job_count].number = number;
+	pool.job_count++;
+}
+
+static void run_pool(int argc)
+{
+	convert_slot *slot;
+	fz_display_list *list;
+	fz_rect mediabox;
+	char message[256];
+	int i, k, done, claimed, failed, started = 0;
+
+	pool.depth = pool.num_workers * 2;
+	pool.slots = fz_calloc(ctx, pool.depth, sizeof *pool.slots);
+	pool.workers = fz_calloc(ctx, pool.num_workers, sizeof *pool.workers);
+	MUTEX_INIT(pool.mutex);
+	SEMAPHORE_INIT(pool.space);
+	for (i = 0; i < pool.depth; i++)
+	{
+		SEMAPHORE_INIT(pool.slots[i].ready);
+		SEMAPHORE_TRIGGER(pool.space);
+	}
+
+	/* The cloned contexts share the tuning, and each worker already
+	 * is one of -T threads; do not let every page split again. The
+	 * document writer took its thread count when it was created. */
+	fz_tune_worker_threads(ctx, 1);
+
+	for (i = 0; i < pool.num_workers; i++)
+	{
+		pool.workers[i].ctx = fz_clone_context(ctx);
+		if (!pool.workers[i].ctx)
+			break;
+		pool.workers[i].docs = fz_calloc(ctx, argc, sizeof *pool.workers[i].docs);
+		THREAD_INIT(pool.workers[i].thread, pool_worker, &pool.workers[i]);
+		started++;
+	}
+	failed = (started == 0);
+	if (failed)
+		fz_strlcpy(message, "cannot start interpreter threads", sizeof message);
+
+	done = 0;
+	while (!failed && done < pool.job_count)
+	{
+		slot = &pool.slots[done++ % pool.depth];
+		SEMAPHORE_WAIT(slot->ready);
+		/* Read the slot before giving it back to the workers */
+		failed = slot->failed;
+		if (failed)
+			fz_strlcpy(message, slot->message, sizeof message);
+		list = slot->list;
+		mediabox = slot->mediabox;
+		SEMAPHORE_TRIGGER(pool.space);
+		if (!failed)
+		{
+			fz_try(ctx)
+				write_page_list(ctx, list, &mediabox);
+			fz_catch(ctx)
+			{
+				failed = 1;
+				fz_strlcpy(message, fz_caught_message(ctx), sizeof message);
+			}
+		}
+	}
+
+	if (failed)
+	{
+		/* Hand out no more pages, wake the workers waiting for a
+		 * slot so that they exit, and wait for the pages that are
+		 * already being made before the slots go away. */
+		MUTEX_LOCK(pool.mutex);
+		claimed = fz_mini(pool.next, pool.job_count);
+		pool.next = pool.job_count;
+		MUTEX_UNLOCK(pool.mutex);
+		for (i = 0; i < started; i++)
+			SEMAPHORE_TRIGGER(pool.space);
+		for (; done < claimed; done++)
+		{
+			slot = &pool.slots[done % pool.depth];
+			SEMAPHORE_WAIT(slot->ready);
+			fz_drop_display_list(ctx, slot->list);
+		}
+	}
+
+	for (i = 0; i < started; i++)
+	{
+		THREAD_FIN(pool.workers[i].thread);
+		for (k = 0; k < argc; k++)
+			fz_drop_document(pool.workers[i].ctx, pool.workers[i].docs[k]);
+		fz_free(ctx, pool.workers[i].docs);
+		fz_drop_context(pool.workers[i].ctx);
+	}
+
+	for (i = 0; i < pool.depth; i++)
+		SEMAPHORE_FIN(pool.slots[i].ready);
+	SEMAPHORE_FIN(pool.space);
+	MUTEX_FIN(pool.mutex);
+	fz_free(ctx, pool.slots);
+	fz_free(ctx, pool.workers);
+	fz_free(ctx, pool.jobs);
+
+	if (failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "%s", message);
+}
+
 static void runpage(int number)
 {
 	fz_rect mediabox;
 	fz_page *page;
 	fz_device *dev;
+	fz_display_list *list;
 
-	page = fz_load_page(ctx, doc, number - 1);
-	fz_bound_page(ctx, page, &mediabox);
-	dev = fz_begin_page(ctx, out, &mediabox);
-	fz_run_page(ctx, page, dev, &fz_identity, NULL);
-	fz_end_page(ctx, out, dev);
-	fz_drop_page(ctx, page);
+	if (pool.num_workers > 0)
+	{
+		queue_page(number);
+		return;
+	}
+
+	if (!bgwrite.active)
+	{
+		page = fz_load_page(ctx, doc, number - 1);
+		fz_bound_page(ctx, page, &mediabox);
+		dev = fz_begin_page(ctx, out, &mediabox);
+		fz_run_page(ctx, page, dev, &fz_identity, NULL);
+		fz_end_page(ctx, out, dev);
+		fz_drop_page(ctx, page);
+		return;
+	}
+
+	list = new_page_list(ctx, doc, number, &mediabox);
+
+	/* Wait for the writer to finish the previous page before handing over this one. */
+	fz_try(ctx)
+		bgwrite_flush();
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+
+	bgwrite.list = list;
+	bgwrite.mediabox = mediabox;
+	bgwrite.started = 1;
+	SEMAPHORE_TRIGGER(bgwrite.start);
 }
 
 static void runrange(const char *range)
@@ -85,7 +436,7 @@ int muconvert_main(int argc, char **argv)
 {
 	int i, c;
 
-	while ((c = fz_getopt(argc, argv, "p:A:W:H:S:U:o:F:O:")) != -1)
+	while ((c = fz_getopt(argc, argv, "p:A:W:H:S:U:o:F:O:PT:")) != -1)
 	{
 		switch (c)
 		{
@@ -101,14 +452,29 @@ int muconvert_main(int argc, char **argv)
 		case 'o': output = fz_optarg; break;
 		case 'F': format = fz_optarg; break;
 		case 'O': options = fz_optarg; break;
+		case 'P': bgwrite.active = 1; break;
+		case 'T': pool.num_workers = atoi(fz_optarg); break;
 		}
 	}
 
 	if (fz_optind == argc || (!format && !output))
 		usage();
 
+#ifndef TOOL_THREADS
+	if (bgwrite.active || pool.num_workers > 0)
+	{
+		fprintf(stderr, "warning: parallel conversion not available in this build\n");
+		bgwrite.active = 0;
+		pool.num_workers = 0;
+	}
+#endif
+
+	/* The interpreter threads already keep writing apart from interpretation. */
+	if (pool.num_workers > 0)
+		bgwrite.active = 0;
+
 	/* Create a context to hold the exception stack and various caches. */
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	ctx = fz_new_context(NULL, (bgwrite.active || pool.num_workers > 0) ? LOCKS_INIT() : NULL, FZ_STORE_UNLIMITED);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot create mupdf context\n");
@@ -126,6 +492,7 @@ int muconvert_main(int argc, char **argv)
 	}
 
 	fz_set_aa_level(ctx, alphabits);
+	fz_tune_worker_threads(ctx, pool.num_workers);
 
 	if (layout_css)
 	{
@@ -135,6 +502,14 @@ int muconvert_main(int argc, char **argv)
 		fz_drop_buffer(ctx, buf);
 	}
 
+	if (bgwrite.active)
+	{
+		bgwrite.ctx = fz_clone_context(ctx);
+		SEMAPHORE_INIT(bgwrite.start);
+		SEMAPHORE_INIT(bgwrite.stop);
+		THREAD_INIT(bgwrite.thread, bgwrite_worker, NULL);
+	}
+
 	/* Open the output document. */
 	fz_try(ctx)
 		out = fz_new_document_writer(ctx, output, format, options);
@@ -145,26 +520,43 @@ int muconvert_main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	input_args = argv;
 	for (i = fz_optind; i < argc; ++i)
 	{
-		doc = fz_open_document(ctx, argv[i]);
-		if (fz_needs_password(ctx, doc))
-			if (!fz_authenticate_password(ctx, doc, password))
-				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", argv[i]);
-		fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
-		count = fz_count_pages(ctx, doc);
+		current_arg = i;
+		doc = open_input(ctx, argv[i]);
+		count = fz_count_pages_exact(ctx, doc);
 
 		if (i+1 < argc && fz_is_page_range(ctx, argv[i+1]))
 			runrange(argv[++i]);
 		else
 			runrange("1-N");
 
+		/* The last page may still refer to resources owned by the document. */
+		bgwrite_flush();
+
 		fz_drop_document(ctx, doc);
 	}
 
+	if (pool.num_workers > 0)
+		run_pool(argc);
+
 	fz_close_document_writer(ctx, out);
 
+	if (bgwrite.active)
+	{
+		bgwrite.list = NULL;
+		SEMAPHORE_TRIGGER(bgwrite.start);
+		SEMAPHORE_WAIT(bgwrite.stop);
+		SEMAPHORE_FIN(bgwrite.start);
+		SEMAPHORE_FIN(bgwrite.stop);
+		THREAD_FIN(bgwrite.thread);
+		fz_drop_context(bgwrite.ctx);
+	}
+
 	fz_drop_document_writer(ctx, out);
 	fz_drop_context(ctx);
+	if (bgwrite.active || pool.num_workers > 0)
+		LOCKS_FIN();
 	return EXIT_SUCCESS;
 }
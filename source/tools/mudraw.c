@@ -439,7 +439,7 @@ static void usage(void)
 		"\t-G -\tapply gamma correction\n"
 		"\t-I\tinvert colors\n"
 		"\n"
-		"\t-A -\tnumber of bits of antialiasing (0 to 8)\n"
+		"\t-A -\tnumber of bits of antialiasing (0 to 8, or 9 for exact area)\n"
 		"\t-A -/-\tnumber of bits of antialiasing (0 to 8) (graphics, text)\n"
 		"\t-D\tdisable use of display list\n"
 		"\t-i\tignore errors\n"
@@ -1212,7 +1212,7 @@ static void drawrange(fz_context *ctx, fz_document *doc, const char *range)
 {
 	int page, spage, epage, pagecount;
 
-	pagecount = fz_count_pages(ctx, doc);
+	pagecount = fz_count_pages_exact(ctx, doc);
 
 	while ((range = fz_parse_page_range(ctx, range, &spage, &epage, pagecount)))
 	{
@@ -1458,6 +1458,7 @@ int mudraw_main(int argc, char **argv)
 
 	fz_set_text_aa_level(ctx, alphabits_text);
 	fz_set_graphics_aa_level(ctx, alphabits_graphics);
+	fz_tune_worker_threads(ctx, num_workers);
 
 	if (bgprint.active)
 	{
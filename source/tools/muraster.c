@@ -561,6 +561,9 @@ static int min_band_height;
 static int max_band_memory;
 int band_height;
 
+static int halftone_method = FZ_HALFTONE_THRESHOLD;
+static fz_halftone *halftone = NULL;
+
 static int errored = 0;
 static fz_colorspace *colorspace;
 static char *filename;
@@ -662,6 +665,7 @@ static void usage(void)
 		"\t-f\tfit file to page if too large\n"
 		"\t-B -\tminimum bandheight (e.g. 32)\n"
 		"\t-M -\tmax bandmemory (e.g. 655360)\n"
+		"\t-E -\thalftoning for pbm and pkm: threshold, floyd or stucki\n"
 #if MURASTER_THREADS != 0
 		"\t-T -\tnumber of threads to use for rendering\n"
 		"\t-P\tparallel interpretation/rendering\n"
@@ -672,7 +676,7 @@ static void usage(void)
 		"\t-S -\tfont size for EPUB layout\n"
 		"\t-U -\tfile name of user stylesheet for EPUB layout\n"
 		"\n"
-		"\t-A -\tnumber of bits of antialiasing (0 to 8)\n"
+		"\t-A -\tnumber of bits of antialiasing (0 to 8, or 9 for exact area)\n"
 		"\t-A -/-\tnumber of bits of antialiasing (0 to 8) (graphics, text)\n"
 		"\n"
 		"\tpages\tcomma separated list of page numbers and ranges\n"
@@ -715,7 +719,10 @@ static int drawband(fz_context *ctx, fz_page *page, fz_display_list *list, const
 		fz_drop_device(ctx, dev);
 		dev = NULL;
 
-		if ((output_format == OUT_PBM) || (output_format == OUT_PKM))
+		/* Thresholding is done here, on the worker rendering the band;
+		 * error diffusion has to be done in band order by
+		 * dodrawpage. */
+		if ((output_format == OUT_PBM || output_format == OUT_PKM) && halftone_method == FZ_HALFTONE_THRESHOLD)
 			*bit = fz_new_bitmap_from_pixmap_band(ctx, pix, NULL, band_start, band_height);
 	}
 	fz_catch(ctx)
@@ -726,6 +733,19 @@ static int drawband(fz_context *ctx, fz_page *page, fz_display_list *list, const
 	return RENDER_OK;
 }
 
+/* Error diffuse a band while the workers carry on rendering the
+ * following ones. */
+static fz_bitmap *diffuse_band(fz_context *ctx, fz_pixmap *pix, int band_start)
+{
+	if (!halftone || halftone->n != pix->n)
+	{
+		fz_drop_halftone(ctx, halftone);
+		halftone = NULL;
+		halftone = fz_new_error_diffusion_halftone(ctx, pix->n, halftone_method);
+	}
+	return fz_new_bitmap_from_pixmap_band(ctx, pix, halftone, band_start, band_height);
+}
+
 static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_details *render)
 {
 	fz_pixmap *pix = NULL;
@@ -814,6 +834,9 @@ static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_de
 
 			render->bands_rendered += render->band_height_multiple;
 
+			if (out && !bit && (output_format == OUT_PBM || output_format == OUT_PKM))
+				bit = diffuse_band(ctx, pix, band_start);
+
 			if (out)
 			{
 				/* If we get any errors while outputting the bands, retrying won't help. */
@@ -1400,7 +1423,7 @@ static void drawrange(fz_context *ctx, fz_document *doc, const char *range)
 {
 	int page, spage, epage, pagecount;
 
-	pagecount = fz_count_pages(ctx, doc);
+	pagecount = fz_count_pages_exact(ctx, doc);
 
 	while ((range = fz_parse_page_range(ctx, range, &spage, &epage, pagecount)))
 	{
@@ -1479,19 +1502,21 @@ trace_realloc(void *arg, void *p_, size_t size)
 static THREAD_RETURN_TYPE worker_thread(void *arg)
 {
 	worker_t *me = (worker_t *)arg;
+	int band_start;
 
 	do
 	{
 		DEBUG_THREADS(("Worker %d waiting\n", me->num));
 		SEMAPHORE_WAIT(me->start);
-		DEBUG_THREADS(("Worker %d woken for band_start %d\n", me->num, me->band_start));
+		band_start = me->band_start;
+		DEBUG_THREADS(("Worker %d woken for band_start %d\n", me->num, band_start));
 		me->status = RENDER_OK;
-		if (me->band_start >= 0)
-			me->status = drawband(me->ctx, NULL, me->list, &me->ctm, &me->tbounds, &me->cookie, me->band_start, me->pix, &me->bit);
-		DEBUG_THREADS(("Worker %d completed band_start %d (status=%d)\n", me->num, me->band_start, me->status));
+		if (band_start >= 0)
+			me->status = drawband(me->ctx, NULL, me->list, &me->ctm, &me->tbounds, &me->cookie, band_start, me->pix, &me->bit);
+		DEBUG_THREADS(("Worker %d completed band_start %d (status=%d)\n", me->num, band_start, me->status));
 		SEMAPHORE_TRIGGER(me->stop);
 	}
-	while (me->band_start >= 0);
+	while (band_start >= 0);
 	THREAD_RETURN();
 }
 
@@ -1582,7 +1607,7 @@ int main(int argc, char **argv)
 	x_resolution = X_RESOLUTION;
 	y_resolution = Y_RESOLUTION;
 
-	while ((c = fz_getopt(argc, argv, "p:o:F:R:r:w:h:fB:M:s:A:iW:H:S:T:U:vP")) != -1)
+	while ((c = fz_getopt(argc, argv, "p:o:F:R:r:w:h:fB:M:E:s:A:iW:H:S:T:U:vP")) != -1)
 	{
 		switch (c)
 		{
@@ -1600,6 +1625,14 @@ int main(int argc, char **argv)
 		case 'f': fit = 1; break;
 		case 'B': min_band_height = atoi(fz_optarg); break;
 		case 'M': max_band_memory = atoi(fz_optarg); break;
+		case 'E':
+			halftone_method = fz_halftone_method_from_name(fz_optarg);
+			if (halftone_method < 0)
+			{
+				fprintf(stderr, "Unknown halftoning method '%s'\n", fz_optarg);
+				exit(1);
+			}
+			break;
 
 		case 'W': layout_w = atof(fz_optarg); break;
 		case 'H': layout_h = atof(fz_optarg); break;
@@ -1851,6 +1884,8 @@ int main(int argc, char **argv)
 	fz_drop_output(ctx, out);
 	out = NULL;
 
+	fz_drop_halftone(ctx, halftone);
+
 	fz_drop_context(ctx);
 	LOCKS_FIN();
 
@@ -11,6 +11,8 @@
 
 #include "mupdf/pdf.h"
 
+#include "tool-threads.h"
+
 static void usage(void)
 {
 	fprintf(stderr,
@@ -24,6 +26,9 @@ static void usage(void)
 		"\t-d\tdecompress streams\n"
 		"\t-z\tdeflate uncompressed streams\n"
 		"\t-f\tcompress font streams\n"
+		"\t-F\tsubset embedded fonts\n"
+		"\t-D -\tdownsample images to this resolution (dpi)\n"
+		"\t-T -\tnumber of threads to use for repair, content cleaning and image downsampling\n"
 		"\t-i\tcompress image streams\n"
 		"\t-s\tclean content streams\n"
 		"\tpages\tcomma separated list of page numbers and ranges\n"
@@ -44,7 +49,7 @@ int pdfclean_main(int argc, char **argv)
 	opts.continue_on_error = 1;
 	opts.errors = &errors;
 
-	while ((c = fz_getopt(argc, argv, "adfgilp:sz")) != -1)
+	while ((c = fz_getopt(argc, argv, "adfFgilp:szD:T:")) != -1)
 	{
 		switch (c)
 		{
@@ -53,11 +58,14 @@ int pdfclean_main(int argc, char **argv)
 		case 'd': opts.do_decompress += 1; break;
 		case 'z': opts.do_compress += 1; break;
 		case 'f': opts.do_compress_fonts += 1; break;
+		case 'F': opts.do_subset_fonts += 1; break;
 		case 'i': opts.do_compress_images += 1; break;
 		case 'a': opts.do_ascii += 1; break;
 		case 'g': opts.do_garbage += 1; break;
 		case 'l': opts.do_linear += 1; break;
 		case 's': opts.do_clean += 1; break;
+		case 'D': opts.do_downsample_images = fz_atoi(fz_optarg); break;
+		case 'T': opts.threads = fz_atoi(fz_optarg); break;
 		default: usage(); break;
 		}
 	}
@@ -76,13 +84,16 @@ int pdfclean_main(int argc, char **argv)
 		outfile = argv[fz_optind++];
 	}
 
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	ctx = fz_new_context(NULL, opts.threads > 1 ? LOCKS_INIT() : NULL, FZ_STORE_UNLIMITED);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot initialise context\n");
 		exit(1);
 	}
 
+	/* Also used when repairing a broken input file */
+	fz_tune_worker_threads(ctx, opts.threads);
+
 	fz_try(ctx)
 	{
 		pdf_clean_file(ctx, infile, outfile, password, &opts, &argv[fz_optind], argc - fz_optind);
@@ -92,6 +103,8 @@ int pdfclean_main(int argc, char **argv)
 		errors++;
 	}
 	fz_drop_context(ctx);
+	if (opts.threads > 1)
+		LOCKS_FIN();
 
 	return errors != 0;
 }
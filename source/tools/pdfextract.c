@@ -226,6 +226,7 @@ int pdfextract_main(int argc, char **argv)
 	if (fz_optind == argc)
 	{
 		int len = pdf_count_objects(ctx, doc);
+		pdf_prefetch_objects(ctx, doc, NULL, 0);
 		for (o = 1; o < len; o++)
 			showobject(o);
 	}
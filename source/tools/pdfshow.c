@@ -161,6 +161,7 @@ static void showgrep(char *filename)
 	int i, len;
 
 	len = pdf_count_objects(ctx, doc);
+	pdf_prefetch_objects(ctx, doc, NULL, 0);
 	for (i = 0; i < len; i++)
 	{
 		pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, i);
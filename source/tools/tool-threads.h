@@ -0,0 +1,166 @@
+#ifndef MUPDF_TOOLS_TOOL_THREADS_H
+#define MUPDF_TOOLS_TOOL_THREADS_H
+
+/*
+ * Threads, mutexes, semaphores and a locking context for the tools
+ * that run work on threads of their own.
+ *
+ * TOOL_THREADS is defined when threads are available. Without it the
+ * macros do nothing and LOCKS_INIT() returns NULL, so the work is
+ * done on the main thread.
+ *
+ * Semaphores count: each SEMAPHORE_TRIGGER lets one SEMAPHORE_WAIT
+ * through, however many triggers are outstanding.
+ */
+
+#include "mupdf/fitz.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define TOOL_THREADS 1
+#elif defined(HAVE_PTHREADS)
+#include <pthread.h>
+#define TOOL_THREADS 2
+#endif
+
+#ifdef TOOL_THREADS
+#if TOOL_THREADS == 1
+
+/* Windows threads */
+#define SEMAPHORE HANDLE
+#define SEMAPHORE_INIT(A) do { A = CreateSemaphore(NULL, 0, 0x7fffffff, NULL); } while (0)
+#define SEMAPHORE_FIN(A) do { CloseHandle(A); } while (0)
+#define SEMAPHORE_TRIGGER(A) do { (void)ReleaseSemaphore(A, 1, NULL); } while (0)
+#define SEMAPHORE_WAIT(A) do { (void)WaitForSingleObject(A, INFINITE); } while (0)
+#define THREAD HANDLE
+#define THREAD_INIT(A,B,C) do { A = CreateThread(NULL, 0, B, C, 0, NULL); } while (0)
+#define THREAD_FIN(A) do { (void)WaitForSingleObject(A, INFINITE); CloseHandle(A); } while (0)
+#define THREAD_RETURN_TYPE DWORD WINAPI
+#define THREAD_RETURN() return 0
+#define MUTEX CRITICAL_SECTION
+#define MUTEX_INIT(A) do { InitializeCriticalSection(&A); } while (0)
+#define MUTEX_FIN(A) do { DeleteCriticalSection(&A); } while (0)
+#define MUTEX_LOCK(A) do { EnterCriticalSection(&A); } while (0)
+#define MUTEX_UNLOCK(A) do { LeaveCriticalSection(&A); } while (0)
+
+#else
+
+/* PThreads, with semaphores built from a mutex and condition variable as in mudraw. */
+
+typedef struct
+{
+	int count;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} tool_semaphore_t;
+
+static inline void
+tool_semaphore_open(tool_semaphore_t *sem)
+{
+	sem->count = 0;
+	(void)pthread_mutex_init(&sem->mutex, NULL);
+	(void)pthread_cond_init(&sem->cond, NULL);
+}
+
+static inline void
+tool_semaphore_close(tool_semaphore_t *sem)
+{
+	(void)pthread_cond_destroy(&sem->cond);
+	(void)pthread_mutex_destroy(&sem->mutex);
+}
+
+static inline void
+tool_semaphore_wait(tool_semaphore_t *sem)
+{
+	(void)pthread_mutex_lock(&sem->mutex);
+	while (sem->count == 0)
+		(void)pthread_cond_wait(&sem->cond, &sem->mutex);
+	--sem->count;
+	(void)pthread_mutex_unlock(&sem->mutex);
+}
+
+static inline void
+tool_semaphore_signal(tool_semaphore_t *sem)
+{
+	(void)pthread_mutex_lock(&sem->mutex);
+	sem->count++;
+	(void)pthread_cond_signal(&sem->cond);
+	(void)pthread_mutex_unlock(&sem->mutex);
+}
+
+#define SEMAPHORE tool_semaphore_t
+#define SEMAPHORE_INIT(A) tool_semaphore_open(&A)
+#define SEMAPHORE_FIN(A) tool_semaphore_close(&A)
+#define SEMAPHORE_TRIGGER(A) tool_semaphore_signal(&A)
+#define SEMAPHORE_WAIT(A) tool_semaphore_wait(&A)
+#define THREAD pthread_t
+#define THREAD_INIT(A,B,C) do { (void)pthread_create(&A, NULL, B, C); } while (0)
+#define THREAD_FIN(A) do { void *res; (void)pthread_join(A, &res); } while (0)
+#define THREAD_RETURN_TYPE void *
+#define THREAD_RETURN() return NULL
+#define MUTEX pthread_mutex_t
+#define MUTEX_INIT(A) do { (void)pthread_mutex_init(&A, NULL); } while (0)
+#define MUTEX_FIN(A) do { (void)pthread_mutex_destroy(&A); } while (0)
+#define MUTEX_LOCK(A) do { (void)pthread_mutex_lock(&A); } while (0)
+#define MUTEX_UNLOCK(A) do { (void)pthread_mutex_unlock(&A); } while (0)
+
+#endif
+
+static MUTEX tool_mutexes[FZ_LOCK_MAX];
+
+static inline void tool_lock(void *user, int lock)
+{
+	MUTEX_LOCK(tool_mutexes[lock]);
+}
+
+static inline void tool_unlock(void *user, int lock)
+{
+	MUTEX_UNLOCK(tool_mutexes[lock]);
+}
+
+static inline fz_locks_context *tool_locks_init(void)
+{
+	static fz_locks_context locks = { NULL, tool_lock, tool_unlock };
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		MUTEX_INIT(tool_mutexes[i]);
+
+	return &locks;
+}
+
+static inline void tool_locks_fin(void)
+{
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		MUTEX_FIN(tool_mutexes[i]);
+}
+
+#define LOCKS_INIT() tool_locks_init()
+#define LOCKS_FIN() tool_locks_fin()
+
+#else
+
+/* Null Threads implementation */
+#define SEMAPHORE int
+#define THREAD int
+#define MUTEX int
+#define SEMAPHORE_INIT(A) do { A = 0; } while (0)
+#define SEMAPHORE_FIN(A) do { A = 0; } while (0)
+#define SEMAPHORE_TRIGGER(A) do { A = 0; } while (0)
+#define SEMAPHORE_WAIT(A) do { A = 0; } while (0)
+#define THREAD_INIT(A,B,C) do { A = 0; (void)C; } while (0)
+#define THREAD_FIN(A) do { A = 0; } while (0)
+#define MUTEX_INIT(A) do { A = 0; } while (0)
+#define MUTEX_FIN(A) do { A = 0; } while (0)
+#define MUTEX_LOCK(A) do { A = 0; } while (0)
+#define MUTEX_UNLOCK(A) do { A = 0; } while (0)
+#define THREAD_RETURN_TYPE int
+#define THREAD_RETURN() return 0
+#define LOCKS_INIT() NULL
+#define LOCKS_FIN() do { } while (0)
+
+#endif
+
+#endif